@@ -0,0 +1,208 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  B-Tree page size benchmark: builds the same table B-Tree in databases
+ *  created with different page sizes (chidb_Btree_openWithPageSize), and
+ *  times insertions and lookups on each.
+ *
+ *  - insert: keys inserted in random order, in a single transaction.
+ *  - bulk: the same keys loaded in order into another B-Tree with
+ *    chidb_Btree_bulkLoad (pages added by it shown in parentheses, next to
+ *    the pages of the whole file).
+ *  - lookup: random lookups of inserted keys, after reopening the file
+ *    with the OS page cache dropped (POSIX_FADV_DONTNEED), so that the
+ *    inner nodes have to be read from the device.
+ *
+ *  Larger pages make for fewer, shallower nodes (fewer reads per lookup),
+ *  at the cost of more bytes read and moved around per node.
+ *
+ *  Usage: bench_btree [file] [nkeys] [record size]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <chidb/chidb.h>
+#include "libchidb/chidbInt.h"
+#include "libchidb/btree.h"
+
+static const uint32_t page_sizes[] = {1024, 4096, 16384, 65536};
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void drop_cache(Pager *pager)
+{
+    fsync(pager->fd);
+    posix_fadvise(pager->fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+static int btree_depth(BTree *bt, npage_t npage)
+{
+    BTreeNode *btn;
+    int depth = 1;
+
+    chidb_Btree_getNodeByPage(bt, npage, &btn);
+    while (btn->type == PGTYPE_TABLE_INTERNAL)
+    {
+        npage = btn->right_page;
+        chidb_Btree_freeMemNode(bt, btn);
+        chidb_Btree_getNodeByPage(bt, npage, &btn);
+        depth++;
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return depth;
+}
+
+static void shuffle(chidb_key_t *keys, uint32_t nkeys)
+{
+    for (uint32_t i = nkeys - 1; i > 0; i--)
+    {
+        uint32_t j = rand() % (i + 1);
+        chidb_key_t tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+}
+
+/* Entries of the bulk load: keys 1 to nkeys, with the same records as the
+ * insertions */
+typedef struct bulk_entries
+{
+    uint32_t next;
+    uint32_t nkeys;
+    uint8_t *record;
+    uint16_t record_size;
+} bulk_entries;
+
+static int bulk_next(void *arg, BTreeCell *cell)
+{
+    bulk_entries *e = arg;
+
+    if (e->next == e->nkeys)
+        return CHIDB_DONE;
+    cell->key = ++e->next;
+    memcpy(e->record, &cell->key, sizeof(chidb_key_t));
+    cell->fields.tableLeaf.data = e->record;
+    cell->fields.tableLeaf.data_size = e->record_size;
+    return CHIDB_OK;
+}
+
+static int bench(const char *fname, uint32_t page_size, chidb_key_t *keys, uint32_t nkeys, uint16_t record_size)
+{
+    chidb db;
+    npage_t nroot, nbulk, n_pages;
+    uint8_t *record, *data;
+    uint32_t size;
+    double start, insert_secs, bulk_secs, lookup_secs;
+
+    unlink(fname);
+    if (chidb_Btree_openWithPageSize(fname, &db, &db.bt, CHIDB_OPEN_DEFAULT, page_size) != CHIDB_OK)
+    {
+        fprintf(stderr, "Could not open %s\n", fname);
+        return 1;
+    }
+
+    record = calloc(record_size, 1);
+    srand(page_size);
+    shuffle(keys, nkeys);
+
+    start = now();
+    chidb_Pager_begin(db.bt->pager);
+    chidb_Btree_newNode(db.bt, &nroot, PGTYPE_TABLE_LEAF);
+    for (uint32_t i = 0; i < nkeys; i++)
+    {
+        memcpy(record, &keys[i], sizeof(chidb_key_t));
+        if (chidb_Btree_insertInTable(db.bt, nroot, keys[i], record, record_size) != CHIDB_OK)
+        {
+            fprintf(stderr, "Could not insert key %u\n", keys[i]);
+            chidb_Pager_rollback(db.bt->pager);
+            chidb_Btree_close(db.bt);
+            free(record);
+            return 1;
+        }
+    }
+    chidb_Pager_commit(db.bt->pager);
+    drop_cache(db.bt->pager);
+    insert_secs = now() - start;
+
+    bulk_entries entries = {0, nkeys, record, record_size};
+    chidb_Btree_newNode(db.bt, &nbulk, PGTYPE_TABLE_LEAF);
+    n_pages = db.bt->pager->n_pages;
+    start = now();
+    if (chidb_Btree_bulkLoad(db.bt, nbulk, 100, bulk_next, &entries) != CHIDB_OK)
+    {
+        fprintf(stderr, "Could not bulk load %u keys\n", nkeys);
+        chidb_Btree_close(db.bt);
+        free(record);
+        return 1;
+    }
+    drop_cache(db.bt->pager);
+    bulk_secs = now() - start;
+    n_pages = db.bt->pager->n_pages - n_pages;
+    chidb_Btree_close(db.bt);
+
+    chidb_Btree_open(fname, &db, &db.bt);
+    drop_cache(db.bt->pager);
+    shuffle(keys, nkeys);
+
+    start = now();
+    for (uint32_t i = 0; i < nkeys; i++)
+    {
+        if (chidb_Btree_find(db.bt, nroot, keys[i], &data, &size) != CHIDB_OK)
+        {
+            fprintf(stderr, "Could not find key %u\n", keys[i]);
+            chidb_Btree_close(db.bt);
+            free(record);
+            return 1;
+        }
+        free(data);
+    }
+    lookup_secs = now() - start;
+
+    printf("%6u B pages  depth %i  %7u pages (%7u)  insert %8.3f s (%9.0f/s)  bulk %8.3f s (%9.0f/s)  lookup %8.3f s (%9.0f/s)\n",
+           page_size, btree_depth(db.bt, nroot), db.bt->pager->n_pages, n_pages,
+           insert_secs, nkeys / insert_secs, bulk_secs, nkeys / bulk_secs, lookup_secs, nkeys / lookup_secs);
+
+    chidb_Btree_close(db.bt);
+    free(record);
+    unlink(fname);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *fname = argc > 1 ? argv[1] : "bench-btree.dat";
+    uint32_t nkeys = argc > 2 ? atoi(argv[2]) : 100000;
+    int record_size = argc > 3 ? atoi(argv[3]) : 64;
+    chidb_key_t *keys;
+
+    if (nkeys == 0 || record_size < (int) sizeof(chidb_key_t) || record_size > 200)
+    {
+        fprintf(stderr, "usage: %s [file] [nkeys > 0] [record size (%zu-200)]\n", argv[0], sizeof(chidb_key_t));
+        return 1;
+    }
+
+    keys = malloc(nkeys * sizeof(chidb_key_t));
+    for (uint32_t i = 0; i < nkeys; i++)
+        keys[i] = i + 1;
+
+    for (int i = 0; i < sizeof(page_sizes) / sizeof(page_sizes[0]); i++)
+        if (bench(fname, page_sizes[i], keys, nkeys, record_size))
+        {
+            free(keys);
+            return 1;
+        }
+
+    free(keys);
+    return 0;
+}
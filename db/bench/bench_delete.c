@@ -0,0 +1,208 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  B-Tree deletion benchmark: runs the same churn workload on a table
+ *  B-Tree with different fill thresholds (chidb_Btree_setMinFill), and
+ *  measures how dense the leaves are left, and what that costs scans.
+ *
+ *  - build: keys 1 to nkeys appended (as rowids would be).
+ *  - churn: each round deletes a random fraction of the rows, and appends
+ *    as many new ones, in a single transaction.
+ *  - scan: after each round, the file is reopened with the OS page cache
+ *    dropped (POSIX_FADV_DONTNEED), and every row is read by following
+ *    the links between leaves.
+ *
+ *  With a threshold of 0, only the leaves that are emptied are merged, so
+ *  the table keeps as many leaves as it ever had, and scans read them all.
+ *  Higher thresholds keep the leaves (and scans) denser, at the cost of
+ *  more pages written by deletions.
+ *
+ *  Usage: bench_delete [file] [nkeys] [rounds] [percent deleted per round]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <chidb/chidb.h>
+#include "libchidb/chidbInt.h"
+#include "libchidb/btree.h"
+
+#define BENCH_RECORD_SIZE (64)
+
+static const uint8_t min_fills[] = {0, 25, BTREE_MIN_FILL, 50};
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void drop_cache(Pager *pager)
+{
+    fsync(pager->fd);
+    posix_fadvise(pager->fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+static void shuffle(chidb_key_t *keys, uint32_t nkeys)
+{
+    for (uint32_t i = nkeys - 1; i > 0; i--)
+    {
+        uint32_t j = rand() % (i + 1);
+        chidb_key_t tmp = keys[i];
+        keys[i] = keys[j];
+        keys[j] = tmp;
+    }
+}
+
+/* Reads every row of a table B-Tree, from its leftmost leaf along the
+ * links between leaves, adding up the bytes used in the leaves */
+static int scan(BTree *bt, npage_t nroot, uint32_t *nleaves, uint32_t *nrows, double *fill)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    npage_t npage = nroot;
+    size_t used = 0, total = 0;
+    uint32_t sum = 0;
+
+    *nleaves = *nrows = 0;
+    for (;;)
+    {
+        if (chidb_Btree_getNodeByPage(bt, npage, &btn) != CHIDB_OK)
+            return 1;
+        if (btn->type == PGTYPE_TABLE_LEAF)
+            break;
+        npage = chidb_Btree_getChildPage(btn, 0);
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+    for (;;)
+    {
+        for (ncell_t i = 0; i < btn->n_cells; i++)
+        {
+            chidb_Btree_getCell(btn, i, &cell);
+            sum += cell.fields.tableLeaf.data[0];
+        }
+        used += bt->usable_size - btn->cells_offset + 2 * btn->n_cells;
+        total += bt->usable_size - LEAFPG_CELLSOFFSET_OFFSET;
+        (*nleaves)++;
+        *nrows += btn->n_cells;
+        npage = btn->next_leaf;
+        chidb_Btree_freeMemNode(bt, btn);
+        if (npage == 0)
+            break;
+        if (chidb_Btree_getNodeByPage(bt, npage, &btn) != CHIDB_OK)
+            return 1;
+    }
+    *fill = 100.0 * used / total;
+
+    return sum == 0xFFFFFFFF; /* So that the reads are not optimized away */
+}
+
+static int bench(const char *fname, uint8_t min_fill, uint32_t nkeys, int rounds, int percent)
+{
+    chidb db;
+    uint8_t record[BENCH_RECORD_SIZE] = {0};
+    chidb_key_t *keys, next_key = nkeys + 1;
+    uint32_t ndelete = (uint64_t) nkeys * percent / 100, nleaves, nrows, nfree;
+    double start, churn_secs, scan_secs, fill;
+    uint64_t writes, merges;
+
+    unlink(fname);
+    if (chidb_Btree_open(fname, &db, &db.bt) != CHIDB_OK || !db.bt->linked)
+    {
+        fprintf(stderr, "Could not open %s\n", fname);
+        return 1;
+    }
+
+    /* The live keys, in random order: the first ndelete are deleted next */
+    keys = malloc(nkeys * sizeof(chidb_key_t));
+    chidb_Btree_begin(db.bt);
+    for (uint32_t i = 0; i < nkeys; i++)
+    {
+        keys[i] = i + 1;
+        chidb_Btree_insertInTable(db.bt, 1, keys[i], record, sizeof(record));
+    }
+    chidb_Btree_commit(db.bt);
+    srand(min_fill);
+
+    printf("min fill %2u%%\n", min_fill);
+    for (int r = 0; r <= rounds; r++)
+    {
+        churn_secs = 0;
+        writes = db.bt->pager->stats.page_writes;
+        merges = db.bt->pager->stats.node_merges;
+        if (r > 0)
+        {
+            shuffle(keys, nkeys);
+            start = now();
+            chidb_Btree_begin(db.bt);
+            for (uint32_t i = 0; i < ndelete; i++)
+            {
+                if (chidb_Btree_delete(db.bt, 1, keys[i]) != CHIDB_OK)
+                {
+                    fprintf(stderr, "Could not delete key %u\n", keys[i]);
+                    chidb_Btree_rollback(db.bt);
+                    chidb_Btree_close(db.bt);
+                    free(keys);
+                    return 1;
+                }
+                keys[i] = next_key++;
+                memcpy(record, &keys[i], sizeof(chidb_key_t));
+                chidb_Btree_insertInTable(db.bt, 1, keys[i], record, sizeof(record));
+            }
+            chidb_Btree_commit(db.bt);
+            churn_secs = now() - start;
+        }
+        writes = db.bt->pager->stats.page_writes - writes;
+        merges = db.bt->pager->stats.node_merges - merges;
+
+        chidb_Btree_close(db.bt);
+        chidb_Btree_open(fname, &db, &db.bt);
+        chidb_Btree_setMinFill(db.bt, min_fill);
+        drop_cache(db.bt->pager);
+        start = now();
+        if (scan(db.bt, 1, &nleaves, &nrows, &fill) != 0 || nrows != nkeys)
+        {
+            fprintf(stderr, "Scan found %u rows instead of %u\n", nrows, nkeys);
+            chidb_Btree_close(db.bt);
+            free(keys);
+            return 1;
+        }
+        scan_secs = now() - start;
+        chidb_Btree_getFreelistCount(db.bt, &nfree);
+
+        printf("  round %3i  churn %8.3f s (%7llu pages written, %6llu merges)  "
+               "%7u leaves  fill %5.1f%%  %7u pages (%7u free)  scan %8.3f s\n",
+               r, churn_secs, (unsigned long long) writes, (unsigned long long) merges,
+               nleaves, fill, db.bt->pager->n_pages, nfree, scan_secs);
+    }
+
+    chidb_Btree_close(db.bt);
+    free(keys);
+    unlink(fname);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *fname = argc > 1 ? argv[1] : "bench-delete.dat";
+    uint32_t nkeys = argc > 2 ? atoi(argv[2]) : 100000;
+    int rounds = argc > 3 ? atoi(argv[3]) : 10;
+    int percent = argc > 4 ? atoi(argv[4]) : 20;
+
+    if (nkeys == 0 || rounds < 0 || percent < 1 || percent > 100)
+    {
+        fprintf(stderr, "usage: %s [file] [nkeys > 0] [rounds >= 0] [percent deleted per round (1-100)]\n", argv[0]);
+        return 1;
+    }
+
+    for (int i = 0; i < sizeof(min_fills) / sizeof(min_fills[0]); i++)
+        if (bench(fname, min_fills[i], nkeys, rounds, percent))
+            return 1;
+
+    return 0;
+}
@@ -0,0 +1,144 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Pager I/O benchmark: compares the synchronous I/O path with the
+ *  io_uring backend (CHIDB_OPEN_URING) on the two operations that
+ *  submit several pages at once.
+ *
+ *  - commit: transactions that each modify pages scattered over the
+ *    file (as a B-Tree insertion that splits nodes would), so that the
+ *    commit has to write many runs of pages.
+ *  - readPages: reads of runs of pages where every few pages are already
+ *    cached, so that each call has to read several runs of pages.
+ *
+ *  The OS page cache is dropped (POSIX_FADV_DONTNEED) before each phase,
+ *  so reads go to the device.
+ *
+ *  Usage: bench_pager [file] [npages] [pages per transaction]
+ *
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <time.h>
+#include <chidb/chidb.h>
+#include "libchidb/pager.h"
+
+#define BENCH_PAGE_SIZE (4096)
+#define BENCH_READ_BATCH (64)
+#define BENCH_CACHED_EVERY (4)
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static void drop_cache(Pager *pager)
+{
+    fsync(pager->fd);
+    posix_fadvise(pager->fd, 0, 0, POSIX_FADV_DONTNEED);
+}
+
+static void report(const char *mode, const char *phase, uint32_t npages, double secs)
+{
+    printf("%-8s %-10s %8u pages %9.3f s %9.1f MB/s\n", mode, phase, npages, secs,
+           (double) npages * BENCH_PAGE_SIZE / secs / (1 << 20));
+}
+
+static int bench(const char *fname, int flags, uint32_t npages, uint32_t txn_pages)
+{
+    const char *mode = flags & CHIDB_OPEN_URING ? "io_uring" : "sync";
+    Pager *pager;
+    MemPage *page, **pages;
+    npage_t npage;
+    double start;
+
+    unlink(fname);
+    if (chidb_Pager_openWithFlags(&pager, fname, flags) != CHIDB_OK)
+    {
+        fprintf(stderr, "Could not open %s\n", fname);
+        return 1;
+    }
+    chidb_Pager_setPageSize(pager, BENCH_PAGE_SIZE);
+    chidb_Pager_setCacheSize(pager, npages);
+
+    /* Initial load, not timed */
+    chidb_Pager_begin(pager);
+    for (uint32_t i = 0; i < npages; i++)
+    {
+        chidb_Pager_allocatePage(pager, &npage);
+        chidb_Pager_readPage(pager, npage, &page);
+        memset(page->data, npage & 0xff, BENCH_PAGE_SIZE);
+        chidb_Pager_writePage(pager, page);
+        chidb_Pager_releaseMemPage(pager, page);
+    }
+    chidb_Pager_commit(pager);
+    drop_cache(pager);
+
+    /* Scattered commits: page i of a transaction is txn_pages/npages of
+     * the file away from page i-1 */
+    uint32_t stride = npages / txn_pages > 1 ? npages / txn_pages : 2;
+    start = now();
+    for (uint32_t t = 0; t < npages / txn_pages; t++)
+    {
+        chidb_Pager_begin(pager);
+        for (uint32_t i = 0; i < txn_pages; i++)
+        {
+            chidb_Pager_readPage(pager, 1 + (t + i * stride) % npages, &page);
+            page->data[t % BENCH_PAGE_SIZE]++;
+            chidb_Pager_writePage(pager, page);
+            chidb_Pager_releaseMemPage(pager, page);
+        }
+        chidb_Pager_commit(pager);
+    }
+    fsync(pager->fd);
+    report(mode, "commit", npages / txn_pages * txn_pages, now() - start);
+    chidb_Pager_close(pager);
+
+    /* readPages over a file where every few pages are cached */
+    chidb_Pager_openWithFlags(&pager, fname, flags);
+    chidb_Pager_setPageSize(pager, BENCH_PAGE_SIZE);
+    chidb_Pager_setCacheSize(pager, npages);
+    for (npage = 1; npage <= npages; npage += BENCH_CACHED_EVERY)
+    {
+        chidb_Pager_readPage(pager, npage, &page);
+        chidb_Pager_releaseMemPage(pager, page);
+    }
+    drop_cache(pager);
+
+    pages = malloc(BENCH_READ_BATCH * sizeof(MemPage *));
+    start = now();
+    for (npage = 1; npage + BENCH_READ_BATCH - 1 <= npages; npage += BENCH_READ_BATCH)
+    {
+        chidb_Pager_readPages(pager, npage, BENCH_READ_BATCH, pages);
+        for (uint32_t i = 0; i < BENCH_READ_BATCH; i++)
+            chidb_Pager_releaseMemPage(pager, pages[i]);
+    }
+    report(mode, "readPages", npages / BENCH_READ_BATCH * BENCH_READ_BATCH, now() - start);
+    free(pages);
+    chidb_Pager_close(pager);
+
+    unlink(fname);
+    return 0;
+}
+
+int main(int argc, char *argv[])
+{
+    const char *fname = argc > 1 ? argv[1] : "bench-pager.dat";
+    uint32_t npages = argc > 2 ? atoi(argv[2]) : 16384;
+    uint32_t txn_pages = argc > 3 ? atoi(argv[3]) : 16;
+
+    if (npages < BENCH_READ_BATCH || txn_pages == 0 || txn_pages > npages)
+    {
+        fprintf(stderr, "usage: %s [file] [npages >= %i] [pages per transaction]\n", argv[0], BENCH_READ_BATCH);
+        return 1;
+    }
+
+    return bench(fname, CHIDB_OPEN_DEFAULT, npages, txn_pages) ||
+           bench(fname, CHIDB_OPEN_URING, npages, txn_pages);
+}
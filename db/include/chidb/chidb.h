@@ -0,0 +1,319 @@
+/*****************************************************************************
+ *
+ *																 chidb
+ *
+ * This is the header for the chidb API.
+ *
+ * The chidb API comprises a set of functions that allows client software
+ * to access and manipulate chidb files, including executing SQL statements
+ * on them. See the chidb Architecture document for more details.
+ *
+ * 2009, 2010 Borja Sotomayor - http://people.cs.uchicago.edu/~borja/
+ * Some modifications by CMSC 23500 class of Spring 2009
+\*****************************************************************************/
+
+#ifndef CHIDB_H_
+#define CHIDB_H_
+
+#include <chisql/chisql.h>
+
+/* Forward declarations.
+ * From the API's perspective's, these are opaque data types. */
+typedef struct chidb_stmt chidb_stmt;
+typedef struct chidb chidb;
+
+/* API return codes */
+#define CHIDB_OK (0)
+#define CHIDB_EINVALIDSQL (1)
+#define CHIDB_ENOMEM (2)
+#define CHIDB_ECANTOPEN (3)
+#define CHIDB_ECORRUPT (4)
+#define CHIDB_ECONSTRAINT (5)
+#define CHIDB_EMISMATCH (6)
+#define CHIDB_EIO (7)
+#define CHIDB_EMISUSE (8)
+
+#define CHIDB_ROW (100)
+#define CHIDB_DONE (101)
+
+/* Flags for chidb_open_v2 */
+#define CHIDB_OPEN_DEFAULT (0x00)
+#define CHIDB_OPEN_MMAP    (0x01)  /* Read pages through a memory mapping of the file */
+#define CHIDB_OPEN_WAL     (0x02)  /* Write modified pages to a write-ahead log */
+#define CHIDB_OPEN_URING   (0x04)  /* Batch multi-page I/O with io_uring (Linux only) */
+#define CHIDB_OPEN_COMPRESS (0x08) /* Create the database with compressed pages */
+#define CHIDB_OPEN_DIRECT  (0x10)  /* Bypass the OS page cache (O_DIRECT) */
+#define CHIDB_OPEN_PREWARM (0x20)  /* Reload the cached pages of the last session */
+#define CHIDB_OPEN_PACKED  (0x40)  /* Create the database with prefix-compressed indexes */
+
+/* I/O statistics of a database (see chidb_stats).
+ *
+ * Bucket i of a latency histogram counts the operations that took less
+ * than 2^i microseconds (and more than the previous bucket). The last
+ * bucket counts every operation that took longer. */
+#define CHIDB_STATS_BUCKETS (16)
+
+typedef struct chidb_stats
+{
+    uint64_t page_reads;        /* Pages requested from the pager */
+    uint64_t cache_hits;        /* ... that were already in memory */
+    uint64_t cache_misses;      /* ... that had to be read (or zeroed) */
+    uint64_t page_writes;       /* Pages written to the file or to the WAL */
+    uint64_t bytes_read;        /* Bytes read from the file and the WAL */
+    uint64_t bytes_written;     /* Bytes written to the file and the WAL */
+    uint64_t pages_allocated;   /* Pages added to the end of the database */
+    uint64_t node_splits;       /* B-Tree nodes split by insertions */
+    uint64_t node_merges;       /* B-Tree nodes merged by deletions */
+    uint64_t overflow_reads;    /* Overflow pages read to get at large rows */
+    uint64_t read_latency[CHIDB_STATS_BUCKETS];
+    uint64_t write_latency[CHIDB_STATS_BUCKETS];
+} chidb_stats_t;
+
+/* Opens a chidb file.
+ *
+ * If the file does not exist, it will be created
+ *
+ * If the filename is ":memory:", a new, empty database is created in
+ * memory instead. It is never written to disk, and it only lasts until
+ * it is closed.
+ *
+ * Parameters
+ * - file: Filename of the chidb file to open/create
+ * - db: Out parameter. Returns a pointer to a chidb struct. The chidb
+ *       struct is an opaque type representing a chidb database. In
+ *       other words, an API user should not be concerned with what
+ *       is contained in a variable of type chidb, and should simply
+ *       use it as a representation of a chidb database to pass along
+ *       to other API functions.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_ECANTOPEN: Unable to open the database file
+ * - CHIDB_ECORRUPT: The database file is not well formed
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_open(const char *file, chidb **db); 
+
+
+/* Opens a chidb file with additional options
+ *
+ * Same as chidb_open, but allows selecting how the database file
+ * is accessed.
+ *
+ * Parameters
+ * - file: Filename of the chidb file to open/create
+ * - db: Out parameter. Returns a pointer to a chidb struct.
+ * - flags: Bitwise OR of CHIDB_OPEN_* flags:
+ *     - CHIDB_OPEN_MMAP: Map the database file into memory and read pages
+ *       directly from the mapping instead of copying them into the
+ *       page cache. Modified pages are copied on write, so changes only
+ *       reach the file through the pager's write path.
+ *     - CHIDB_OPEN_WAL: Append committed pages to a write-ahead log
+ *       (the file name followed by "-wal") instead of writing them
+ *       in place. The log is copied into the database periodically,
+ *       and when the database is closed.
+ *     - CHIDB_OPEN_URING: Submit the reads and writes of operations that
+ *       touch several pages all at once, using io_uring. Falls back to
+ *       regular system calls if io_uring is not available.
+ *     - CHIDB_OPEN_COMPRESS: If the file is created, store its pages
+ *       compressed, so that fewer bytes are read and written. Pages are
+ *       still seen uncompressed by everything above the pager. Whether
+ *       an existing file is compressed is recorded in its header, so
+ *       this flag is ignored when opening one. CHIDB_OPEN_MMAP has no
+ *       effect on a compressed file.
+ *     - CHIDB_OPEN_DIRECT: Open the file with O_DIRECT, so that pages are
+ *       only cached once (in chidb's own cache, which is made larger to
+ *       make up for it) instead of also in the OS page cache. The page
+ *       size must be a multiple of the logical block size of the device
+ *       (see chidb_open_v3). If the file system does not support O_DIRECT,
+ *       or the file is compressed, the file is opened as usual.
+ *     - CHIDB_OPEN_PREWARM: When the database is closed, save the list of
+ *       pages that were cached (the file name followed by "-hot"). When it
+ *       is opened again, load those pages into the cache in the background,
+ *       so that it does not have to warm up one read at a time.
+ *     - CHIDB_OPEN_PACKED: If the file is created, store the leading bytes
+ *       that the keys of each index node share only once per node, so
+ *       that more entries fit in each node and indexes are shallower.
+ *       Like CHIDB_OPEN_COMPRESS, this is recorded in the file header,
+ *       and ignored when opening an existing file.
+ *
+ * Return
+ * - Same as chidb_open
+ */
+int chidb_open_v2(const char *file, chidb **db, int flags);
+
+
+/* Opens a chidb file, choosing the page size if it is created
+ *
+ * Same as chidb_open_v2, but if the file does not exist (or is empty),
+ * it is created with pages of page_size bytes instead of the default
+ * 1024 bytes. Larger pages hold more cells per B-Tree node, which makes
+ * the B-Trees shallower, and match the block size of the device better.
+ * The page size of an existing file is never changed.
+ *
+ * Parameters
+ * - file: Filename of the chidb file to open/create
+ * - db: Out parameter. Returns a pointer to a chidb struct.
+ * - flags: Bitwise OR of CHIDB_OPEN_* flags (see chidb_open_v2)
+ * - page_size: Page size of a new file. Must be a power of two between
+ *              512 and 65536 (and, with CHIDB_OPEN_DIRECT, a multiple of
+ *              the logical block size of the device).
+ *
+ * Return
+ * - Same as chidb_open
+ * - CHIDB_EMISUSE: Invalid page size
+ */
+int chidb_open_v3(const char *file, chidb **db, int flags, uint32_t page_size);
+
+
+/* Prepares a SQL statement for execution
+ *
+ * Parameters
+ * - db: chidb database
+ * - sql: SQL statement
+ * - stmt: Out parameter. Returns a pointer to a chidb_stmt. The chidb_stmt
+ *         type is an opaque type representing a prepared SQL statement.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EINVALIDSQL: Invalid SQL
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt);
+
+
+/* Steps through a prepared SQL statement
+ *
+ * This function will run the SQL statement until a result row is available
+ * or just runs the SQL statement to completion if it is not meant to
+ * produce a result row (such as an INSERT statement)
+ *
+ * If the statement is a SELECT statement, this function returns
+ * CHIDB_ROW each time a result row is produced. The values of the
+ * result row can be accessed using the column access functions
+ * (chidb_column_*). Thus, chidb_step has to be called repeatedly
+ * to access all the rows returned by the query. Once there are no
+ * more rows left, or if the statement is not meant to produce any
+ * results, then CHIDB_DONE is returned (note that this function does
+ * not return CHIDB_OK).
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ *
+ * Return
+ * - CHIDB_ROW: Statement returned a row.
+ * - CHIDB_DONE: Statement has finished executing.
+ */
+int chidb_step(chidb_stmt *stmt);
+
+
+/* Finalizes a SQL statement, freeing all resources associated with it.
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: Statement was already finalized
+ */
+int chidb_finalize(chidb_stmt *stmt);
+
+
+/* Returns the number of columns returned by a SQL statement
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ *
+ * Return
+ * - Number of columns in the result rows. If the SQL statement is not
+ *   meant to produce any results (such as an INSERT statement), then 0
+ *   is returned.
+ */
+int chidb_column_count(chidb_stmt *stmt);
+
+
+/* Returns the type of a column
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - col: Column (columns are numbered from 0)
+ *
+ * Return
+ * - Column type (see chidb Architecture document for valid types)
+ */
+int chidb_column_type(chidb_stmt *stmt, int col);
+
+
+/* Returns the name of a column
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - col: Column (columns are numbered from 0)
+ *
+ * Return
+ * - Pointer to a null-terminated string with the name of column. The API
+ *   client does not have to free() the returned string. It is the API's
+ *   responsibility to allocate and free the memory for this string.
+ */
+const char *chidb_column_name(chidb_stmt* stmt, int col);
+
+
+/* Returns the value of a column of integer type
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - col: Column (columns are numbered from 0)
+ *
+ * Return
+ * - Integer value
+ */
+int chidb_column_int(chidb_stmt *stmt, int col);
+
+
+/* Returns the value of a column of string type
+ *
+ * Parameters
+ * - stmt: Prepared SQL statement
+ * - col: Column (columns are numbered from 0)
+ *
+ * Return
+ * - Pointer to a null-terminated string with the value. The API client
+ *   does not have to free() the returned string. It is the API's
+ *   responsibility to allocate and free the memory for this string
+ *   (note that this may happen after chidb_step is called again)
+ */
+const char *chidb_column_text(chidb_stmt *stmt, int col);
+
+
+/* Closes a chidb database
+ *
+ * Parameters
+ * - db: chidb database
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: Database that is already closed
+ */
+int chidb_close(chidb *db);
+
+
+/* Returns the I/O statistics of a database
+ *
+ * The counters are kept from the moment the database is opened (or
+ * from the last reset), across every statement run on it. To measure
+ * a single statement, take the difference between the statistics
+ * before and after running it.
+ *
+ * Parameters
+ * - db: chidb database
+ * - stats: Out parameter. Filled in with the current statistics.
+ * - reset: If true, the counters are set back to zero after they are
+ *          returned.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_stats(chidb *db, chidb_stats_t *stats, bool reset);
+
+#endif /*CHIDB_H_*/
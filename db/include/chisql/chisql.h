@@ -18,6 +18,11 @@
 #define STMT_SELECT (1)
 #define STMT_INSERT (2)
 #define STMT_DELETE (3)
+#define STMT_BEGIN (4)
+#define STMT_COMMIT (5)
+#define STMT_ROLLBACK (6)
+#define STMT_VACUUM (7)
+#define STMT_INCREMENTAL_VACUUM (8)
 
 typedef struct chisql_statement
 {
@@ -29,6 +34,7 @@ typedef struct chisql_statement
         SRA_t    *select;
         Insert_t *insert;
         Delete_t *delete;
+        int vacuum_pages;   /* Incremental vacuum: pages to remove, 0 for all */
     } stmt;
 } chisql_statement_t;
 
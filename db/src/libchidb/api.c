@@ -60,10 +60,28 @@ int chidb_stmt_optimize(chidb *db,
 
 int chidb_open(const char *file, chidb **db)
 {
+    return chidb_open_v2(file, db, CHIDB_OPEN_DEFAULT);
+}
+
+int chidb_open_v2(const char *file, chidb **db, int flags)
+{
+    return chidb_open_v3(file, db, flags, DEFAULT_PAGE_SIZE);
+}
+
+int chidb_open_v3(const char *file, chidb **db, int flags, uint32_t page_size)
+{
+    int rc;
+
     *db = malloc(sizeof(chidb));
     if (*db == NULL)
         return CHIDB_ENOMEM;
-    chidb_Btree_open(file, *db, &(*db)->bt);
+    if ((rc = chidb_Btree_openWithPageSize(file, *db, &(*db)->bt, flags, page_size)) != CHIDB_OK)
+    {
+        free(*db);
+        *db = NULL;
+        return rc == CHIDB_ECORRUPTHEADER ? CHIDB_ECORRUPT : rc;
+    }
+    (*db)->in_transaction = false;
 
     /* Additional initialization code goes here */
     return CHIDB_OK;
@@ -71,6 +89,9 @@ int chidb_open(const char *file, chidb **db)
 
 int chidb_close(chidb *db)
 {
+    /* A transaction that was not committed is discarded */
+    if (db->in_transaction)
+        chidb_Btree_rollback(db->bt);
     chidb_Btree_close(db->bt);
     free(db);
 
@@ -79,6 +100,17 @@ int chidb_close(chidb *db)
     return CHIDB_OK;
 }
 
+int chidb_stats(chidb *db, chidb_stats_t *stats, bool reset)
+{
+    Pager *pager = db->bt->pager;
+
+    *stats = pager->stats;
+    if (reset)
+        memset(&pager->stats, 0, sizeof(chidb_stats_t));
+
+    return CHIDB_OK;
+}
+
 int chidb_prepare(chidb *db, const char *sql, chidb_stmt **stmt)
 {
     int rc;
@@ -53,6 +53,7 @@
 #include "btree.h"
 #include "record.h"
 #include "pager.h"
+#include "keysearch.h"
 #include "util.h"
 
 #define READ_VARINT32(var, buffer, offset) uint32_t var; getVarint32(buffer + offset, &var);
@@ -74,18 +75,135 @@ BTreeNode chidb_Btree_createNode(BTree *bt, npage_t npage, uint8_t type) {
     *page = chidb_Pager_initMemPage(npage, bt->pager->page_size);
     int header_offset = npage == 1 ? 100 : 0;
     bool is_leaf = type == PGTYPE_TABLE_LEAF || type ==  PGTYPE_INDEX_LEAF;
+    bool packed = bt->packed_index && (type == PGTYPE_INDEX_LEAF || type == PGTYPE_INDEX_INTERNAL);
     uint16_t free_offset = is_leaf ? LEAFPG_CELLSOFFSET_OFFSET : INTPG_CELLSOFFSET_OFFSET;
     BTreeNode new_node = {
         .page=page,
         .type=type,
         .free_offset=free_offset + header_offset,
         .n_cells=0,
-        .cells_offset=bt->pager->page_size,
+        .cells_offset=bt->usable_size - (packed ? INDEX_PREFIX_SIZE : 0),
+        .links_offset=bt->linked ? bt->usable_size : 0,
+        .usable_size=bt->usable_size,
+        .max_local=bt->max_local,
+        .min_local=bt->min_local,
+        .packed=packed,
+        .prefix_len=0,
     };
     update_fields(&new_node, header_offset);
     return new_node;
 }
 
+/* Page size stored in the file header. It is stored in two bytes, so
+ * (as in SQLite) a page size of 65536 is stored as 1 */
+static uint32_t header_page_size(uint8_t *header)
+{
+    uint32_t page_size = get2byte(header + 16);
+    return page_size == 1 ? MAX_PAGE_SIZE : page_size;
+}
+
+/* Page sizes must be a power of two between 512 and 65536 */
+static bool valid_page_size(uint32_t page_size)
+{
+    return page_size >= MIN_PAGE_SIZE && page_size <= MAX_PAGE_SIZE &&
+           (page_size & (page_size - 1)) == 0;
+}
+
+/* Checks the fields of the file header that chidb does not support changing */
+static int check_header(uint8_t *header)
+{
+    char *expected = "SQLite format 3";
+    if (strncmp((char *)header, expected, strlen(expected))) {
+        chilog(WARNING, "database file is not SQLite format 3");
+        return CHIDB_ECORRUPTHEADER;
+    }
+
+    uint32_t page_size = header_page_size(header);
+    uint8_t reserved = header[HEADER_RESERVED_OFFSET];
+    uint32_t file_change_counter = get4byte(header + 24);
+    uint32_t schema_version = get4byte(header + 40);
+    uint32_t page_cache_size = get4byte(header + 48);
+    uint32_t user_cookie = get4byte(header + 60);
+
+    if (!valid_page_size(page_size) || page_size - reserved < MIN_USABLE_SIZE ||
+        file_change_counter || schema_version || user_cookie || page_cache_size != 20000) {
+        return CHIDB_ECORRUPTHEADER;
+    }
+
+    return CHIDB_OK;
+}
+
+/* Sets the number of bytes reserved at the end of each page of the file.
+ * Table leaves are linked if the reserved bytes are the ones chidb uses
+ * for the links. */
+static void set_reserved(BTree *bt, uint32_t page_size, uint8_t reserved)
+{
+    bt->usable_size = page_size - reserved;
+    bt->linked = reserved == BTREE_LINKS_SIZE;
+}
+
+/* Sets the largest payload that table leaf cells hold whole, and the
+ * smallest local prefix of the ones that spill to overflow pages, from
+ * the payload fractions of the file header (as SQLite does for index
+ * cells, so that at least four cells fit in each leaf). Files without
+ * overflow pages keep every payload whole. Must be called after
+ * set_reserved. */
+static void set_payload(BTree *bt, uint8_t *header)
+{
+    uint32_t room = bt->usable_size - 12;
+
+    bt->max_local = bt->min_local = 0;
+    bt->spilled = header[HEADER_FEATURES_OFFSET] & FEATURE_SPILLED;
+    bt->packed_index = header[HEADER_FEATURES_OFFSET] & FEATURE_PACKED_INDEX;
+    if (header[HEADER_FEATURES_OFFSET] & FEATURE_OVERFLOW) {
+        bt->max_local = room * header[HEADER_MAX_FRACTION_OFFSET] / 255 - 23;
+        bt->min_local = room * header[HEADER_MIN_FRACTION_OFFSET] / 255 - 23;
+    }
+}
+
+/* Initializes an empty file: writes the file header and an empty
+ * table leaf node (the schema table) into page 1 */
+static int init_file(BTree *bt, uint32_t page_size)
+{
+    npage_t npage;
+    int rc;
+
+    if ((rc = chidb_Pager_setPageSize(bt->pager, page_size)) != CHIDB_OK)
+        return rc;
+    set_reserved(bt, page_size, BTREE_LINKS_SIZE);
+    chidb_Pager_begin(bt->pager);
+    if ((rc = chidb_Pager_allocatePage(bt->pager, &npage)) != CHIDB_OK)
+    {
+        chidb_Pager_commit(bt->pager);
+        return rc;
+    }
+
+    BTreeNode root = chidb_Btree_createNode(bt, npage, PGTYPE_TABLE_LEAF);
+    uint8_t *header = root.page->data;
+
+    strcpy((char *)header, "SQLite format 3");
+    put2byte(header + 16, page_size == MAX_PAGE_SIZE ? 1 : page_size);
+    header[HEADER_WRITE_VERSION_OFFSET] = header[HEADER_READ_VERSION_OFFSET] =
+        (bt->pager->flags & CHIDB_OPEN_COMPRESS) ? FORMAT_VERSION_COMPRESSED : FORMAT_VERSION_LEGACY;
+    header[HEADER_RESERVED_OFFSET] = BTREE_LINKS_SIZE; /* Reserved bytes at the end of each page */
+    header[HEADER_MAX_FRACTION_OFFSET] = 64;    /* Maximum embedded payload fraction */
+    header[HEADER_MIN_FRACTION_OFFSET] = 32;    /* Minimum embedded payload fraction */
+    header[23] = 32;    /* Leaf payload fraction */
+    header[HEADER_FEATURES_OFFSET] = FEATURE_OVERFLOW |
+        ((bt->pager->flags & CHIDB_OPEN_PACKED) ? FEATURE_PACKED_INDEX : 0);
+    put4byte(header + 44, 1);       /* Schema format number */
+    put4byte(header + 48, 20000);   /* Page cache size */
+    put4byte(header + 56, 1);       /* Text encoding (UTF-8) */
+    set_payload(bt, header);
+
+    rc = chidb_Btree_writeNode(bt, &root);
+    chidb_Pager_releaseMemPage(bt->pager, root.page);
+
+    int commit_rc = chidb_Pager_commit(bt->pager);
+    return rc == CHIDB_OK ? commit_rc : rc;
+}
+
+
 /* Open a B-Tree file
  *
  * This function opens a database file and verifies that the file
@@ -110,69 +228,88 @@ BTreeNode chidb_Btree_createNode(BTree *bt, npage_t npage, uint8_t type) {
  */
 int chidb_Btree_open(const char *filename, chidb *db, BTree **bt)
 {
-    FILE *f = fopen(filename, "r+");
-    fseek(f, 0, SEEK_END);
-    long file_size = ftell(f) - 1;
-    rewind(f);
-    if (f && file_size >= 0) {
-        // TODO: use functions from pager.c to manage Pager?
-        uint8_t buffer[100];
-        int num_read;
-        if ((num_read = fread(buffer, 1, 100, f)) < 100) {
-            chilog(WARNING, "nonempty database file is smaller than 100 bytes");
-            return CHIDB_ECORRUPTHEADER;
-        }
-
-        char *expected = "SQLite format 3";
-        if (strncmp((char *)buffer, expected, strlen(expected))) {
-            chilog(WARNING, "database file is not SQLite format 3");
-            return CHIDB_ECORRUPTHEADER;
-        }
-
-        uint16_t page_size = get2byte(buffer + 16);
-        uint32_t file_change_counter = get4byte(buffer + 24);
-        uint32_t schema_version = get4byte(buffer + 40);
-        uint32_t page_cache_size = get4byte(buffer + 48);
-        uint32_t user_cookie = get4byte(buffer + 60);
-
-        if (file_change_counter || schema_version || user_cookie || page_cache_size != 20000) {
-            return CHIDB_ECORRUPTHEADER;
-        }
-
-        Pager *pager = malloc(sizeof(Pager));
-        pager->f = f;
-        pager->page_size = page_size;
-        pager->n_pages = (npage_t) file_size / page_size;
+    return chidb_Btree_openWithFlags(filename, db, bt, CHIDB_OPEN_DEFAULT);
+}
 
-        *bt = malloc(sizeof(BTree));
-        (*bt)->pager = pager;
-        (*bt)->db = db;
 
-        db->bt = *bt;
-        // fclose(f);
-    } else {
-        Pager *pager = malloc(sizeof(Pager));
-        pager->f = f;
-        pager->page_size = DEFAULT_PAGE_SIZE;
-        pager->n_pages = 1;
+/* Open a B-Tree file with additional options
+ *
+ * Same as chidb_Btree_open, but the flags parameter (a bitwise OR of
+ * CHIDB_OPEN_* flags) is passed along to the pager to select how the
+ * file is accessed.
+ */
+int chidb_Btree_openWithFlags(const char *filename, chidb *db, BTree **bt, int flags)
+{
+    return chidb_Btree_openWithPageSize(filename, db, bt, flags, DEFAULT_PAGE_SIZE);
+}
 
-        *bt = malloc(sizeof(BTree));
-        (*bt)->pager = pager;
-        (*bt)->db = db;
-        db->bt = *bt;
 
-        // write empty leaf node into mem
-        BTreeNode root = chidb_Btree_createNode(*bt, 1, PGTYPE_TABLE_LEAF);
+/* Open a B-Tree file, choosing the page size of new files
+ *
+ * Same as chidb_Btree_openWithFlags, but if the file is empty, it is
+ * initialized with pages of page_size bytes (a power of two between 512
+ * and 65536) instead of DEFAULT_PAGE_SIZE. The page size of an existing
+ * file is always the one in its header.
+ *
+ * Return
+ * - Same as chidb_Btree_open
+ * - CHIDB_EMISUSE: Invalid page size (or, with CHIDB_OPEN_DIRECT, not a
+ *   multiple of the logical block size)
+ */
+int chidb_Btree_openWithPageSize(const char *filename, chidb *db, BTree **bt, int flags, uint32_t page_size)
+{
+    Pager *pager;
+    uint8_t header[100];
+    int rc;
 
-        // write header into mem
-        strcpy((char *)root.page->data, "SQLite format 3");
-        put2byte(root.page->data + 16, DEFAULT_PAGE_SIZE);
-        put4byte(root.page->data + 48, 20000);
+    if (!valid_page_size(page_size))
+        return CHIDB_EMISUSE;
 
+    if ((rc = chidb_Pager_openWithFlags(&pager, filename, flags)) != CHIDB_OK)
+        return rc;
 
-        int result = chidb_Btree_writeNode(*bt, &root);
-        return result;
+    *bt = calloc(1, sizeof(BTree));
+    if (*bt == NULL)
+    {
+        chidb_Pager_close(pager);
+        return CHIDB_ENOMEM;
+    }
+    (*bt)->pager = pager;
+    (*bt)->db = db;
+    (*bt)->min_fill = BTREE_MIN_FILL;
+
+    rc = chidb_Pager_readHeader(pager, header);
+    if (rc == CHIDB_OK)
+    {
+        /* The file header (and not the flags) says whether pages are compressed */
+        bool compressed = header[HEADER_READ_VERSION_OFFSET] == FORMAT_VERSION_COMPRESSED;
+        set_reserved(*bt, header_page_size(header), header[HEADER_RESERVED_OFFSET]);
+        set_payload(*bt, header);
+        if ((rc = check_header(header)) == CHIDB_OK &&
+            (rc = chidb_Pager_setCompression(pager, compressed)) == CHIDB_OK &&
+            (rc = chidb_Pager_setPageSize(pager, header_page_size(header))) == CHIDB_OK)
+            rc = chidb_Pager_prewarm(pager);
     }
+    else if (rc == CHIDB_NOHEADER)
+    {
+        /* Direct I/O is done in whole blocks */
+        if ((pager->flags & CHIDB_OPEN_DIRECT) && page_size % pager->block_size != 0)
+            rc = CHIDB_EMISUSE;
+        else
+            rc = init_file(*bt, page_size);
+    }
+    else if (rc == CHIDB_ECORRUPTHEADER)
+        chilog(WARNING, "nonempty database file is smaller than 100 bytes");
+
+    if (rc != CHIDB_OK)
+    {
+        chidb_Pager_close(pager);
+        free(*bt);
+        *bt = NULL;
+        return rc;
+    }
+
+    db->bt = *bt;
     return CHIDB_OK;
 }
 
@@ -197,6 +334,58 @@ int chidb_Btree_close(BTree *bt)
     return CHIDB_OK;
 }
 
+
+/* Begin a transaction on a B-Tree file
+ *
+ * All the nodes written until the transaction is committed or rolled
+ * back are kept in memory, and written to the file together on commit.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Btree_begin(BTree *bt)
+{
+    return chidb_Pager_begin(bt->pager);
+}
+
+
+/* Commit a transaction on a B-Tree file
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no transaction to commit
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_commit(BTree *bt)
+{
+    return chidb_Pager_commit(bt->pager);
+}
+
+
+/* Roll back a transaction on a B-Tree file
+ *
+ * Discards every node written since the transaction began. BTreeNode
+ * structs loaded within the transaction must not be used afterwards.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no transaction to roll back
+ */
+int chidb_Btree_rollback(BTree *bt)
+{
+    return chidb_Pager_rollback(bt->pager);
+}
+
 /* Loads a B-Tree node from disk
  *
  * Reads a B-Tree node from a page in the disk. All the information regarding
@@ -233,9 +422,23 @@ int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **btn)
     (*btn)->free_offset = get2byte(page->data + header_offset + PGHEADER_FREE_OFFSET);
     (*btn)->n_cells = get2byte(page->data + header_offset + PGHEADER_NCELLS_OFFSET);
     (*btn)->cells_offset = get2byte(page->data + header_offset + PGHEADER_CELL_OFFSET);
+    if ((*btn)->cells_offset == 0)
+        (*btn)->cells_offset = MAX_PAGE_SIZE;
     (*btn)->page = page;
 
     update_fields(*btn, header_offset);
+    (*btn)->usable_size = bt->usable_size;
+    (*btn)->max_local = bt->max_local;
+    (*btn)->min_local = bt->min_local;
+    (*btn)->links_offset = bt->linked ? bt->usable_size : 0;
+    (*btn)->packed = bt->packed_index &&
+                     ((*btn)->type == PGTYPE_INDEX_LEAF || (*btn)->type == PGTYPE_INDEX_INTERNAL);
+    (*btn)->prefix_len = (*btn)->packed ? page->data[header_offset + PGHEADER_PREFIX_OFFSET] : 0;
+    (*btn)->prev_leaf = (*btn)->next_leaf = 0;
+    if ((*btn)->links_offset != 0 && (*btn)->type == PGTYPE_TABLE_LEAF) {
+        (*btn)->prev_leaf = get4byte(page->data + (*btn)->links_offset + LINKS_PREV_OFFSET);
+        (*btn)->next_leaf = get4byte(page->data + (*btn)->links_offset + LINKS_NEXT_OFFSET);
+    }
 
     return CHIDB_OK;
 }
@@ -271,7 +474,9 @@ int chidb_Btree_freeMemNode(BTree *bt, BTreeNode *btn)
  *
  * Since the cell offset array and the cells themselves are modified directly on the
  * page, the values we need to update are "type", "free_offset", "n_cells",
- * "cells_offset" and "right_page".
+ * "cells_offset", "right_page", the sibling links ("prev_leaf" and
+ * "next_leaf", which are 0 in nodes other than table leaves), and the
+ * length of the prefix of packed index nodes ("prefix_len").
  *
  * Parameters
  * - btn: the BTreeNode to sync
@@ -282,10 +487,18 @@ void chidb_Btree_syncNode(BTreeNode *btn)
     btn->page->data[header_offset + PGHEADER_PGTYPE_OFFSET] = btn->type;
     put2byte(btn->page->data + header_offset + PGHEADER_FREE_OFFSET, btn->free_offset);
     put2byte(btn->page->data + header_offset + PGHEADER_NCELLS_OFFSET, btn->n_cells);
-    put2byte(btn->page->data + header_offset + PGHEADER_CELL_OFFSET, btn->cells_offset);
+    put2byte(btn->page->data + header_offset + PGHEADER_CELL_OFFSET,
+             btn->cells_offset == MAX_PAGE_SIZE ? 0 : btn->cells_offset);
+    if (btn->packed) {
+        btn->page->data[header_offset + PGHEADER_PREFIX_OFFSET] = btn->prefix_len;
+    }
     if (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL) {
         put4byte(btn->page->data + header_offset + PGHEADER_RIGHTPG_OFFSET, btn->right_page);
     }
+    if (btn->links_offset != 0) {
+        put4byte(btn->page->data + btn->links_offset + LINKS_PREV_OFFSET, btn->prev_leaf);
+        put4byte(btn->page->data + btn->links_offset + LINKS_NEXT_OFFSET, btn->next_leaf);
+    }
 }
 
 
@@ -306,9 +519,225 @@ int chidb_Btree_writeNode(BTree *bt, BTreeNode *btn)
 }
 
 
+/* Allocate a page for a B-Tree
+ *
+ * Takes a page from the freelist, if there are free pages, or adds a new
+ * page at the end of the file otherwise. The freelist is a list of trunk
+ * pages, starting at the one referenced from offset 32 of the file header
+ * (which is followed by the total number of free pages). Each trunk page
+ * contains the number of the next trunk page, the number of leaf pages it
+ * references, and the page numbers of those leaf pages. Leaf pages are
+ * handed out first; a trunk page is handed out once it has no leaves.
+ *
+ * The contents of a page taken from the freelist are undefined.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: Out parameter. Returns the number of the allocated page.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_allocatePage(BTree *bt, npage_t *npage)
+{
+    MemPage *header, *trunk;
+    int rc;
+
+    if ((rc = chidb_Pager_readPage(bt->pager, 1, &header)) != CHIDB_OK)
+        return rc;
+
+    npage_t ntrunk = get4byte(header->data + HEADER_FREELIST_TRUNK_OFFSET);
+    uint32_t nfree = get4byte(header->data + HEADER_FREELIST_COUNT_OFFSET);
+    if (ntrunk == 0)
+    {
+        chidb_Pager_releaseMemPage(bt->pager, header);
+        return chidb_Pager_allocatePage(bt->pager, npage);
+    }
+
+    chidb_Pager_begin(bt->pager);
+    if ((rc = chidb_Pager_readPage(bt->pager, ntrunk, &trunk)) == CHIDB_OK)
+    {
+        uint32_t nleaves = get4byte(trunk->data + FREELIST_NLEAVES_OFFSET);
+        if (nleaves > 0)
+        {
+            *npage = get4byte(trunk->data + FREELIST_LEAVES_OFFSET + 4 * (nleaves - 1));
+            put4byte(trunk->data + FREELIST_NLEAVES_OFFSET, nleaves - 1);
+            rc = chidb_Pager_writePage(bt->pager, trunk);
+        }
+        else
+        {
+            *npage = ntrunk;
+            put4byte(header->data + HEADER_FREELIST_TRUNK_OFFSET, get4byte(trunk->data + FREELIST_NEXT_OFFSET));
+        }
+        chidb_Pager_releaseMemPage(bt->pager, trunk);
+    }
+    if (rc == CHIDB_OK)
+    {
+        put4byte(header->data + HEADER_FREELIST_COUNT_OFFSET, nfree - 1);
+        rc = chidb_Pager_writePage(bt->pager, header);
+    }
+    chidb_Pager_releaseMemPage(bt->pager, header);
+
+    int commit_rc = chidb_Pager_commit(bt->pager);
+    return rc == CHIDB_OK ? commit_rc : rc;
+}
+
+
+// forget the rightmost leaves (see chidb_Btree_insert) of the B-Trees that
+// a page is the root or the rightmost leaf of, when it is reused
+static void append_forget(BTree *bt, npage_t npage)
+{
+    for (int i = 0; i < BTREE_APPEND_SLOTS; i++) {
+        if (bt->appends[i].nroot == npage || bt->appends[i].nleaf == npage)
+            bt->appends[i].nroot = 0;
+    }
+}
+
+
+/* Free a page of a B-Tree
+ *
+ * Adds a page to the freelist (see chidb_Btree_freePages).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npage: Page to free
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page cannot be freed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_freePage(BTree *bt, npage_t npage)
+{
+    return chidb_Btree_freePages(bt, &npage, 1);
+}
+
+
+/* Free pages of a B-Tree
+ *
+ * Adds pages to the freelist, so that they can be reused by
+ * chidb_Btree_allocatePage. Each page becomes a leaf of the first trunk
+ * page if it has room for it, or the new first trunk page otherwise.
+ * The file header and the first trunk page are read and written once
+ * for all the pages, and the pages that become leaves are not read or
+ * written at all. The pages must not be referenced from any B-Tree.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npages: Pages to free
+ * - n: Number of pages
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: One of the pages cannot be freed (none are)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_freePages(BTree *bt, npage_t *npages, uint32_t n)
+{
+    MemPage *header, *trunk = NULL;
+    uint32_t nleaves = 0;
+    int rc;
+
+    for (uint32_t i = 0; i < n; i++)
+        if (npages[i] <= 1 || npages[i] > bt->pager->n_pages)
+            return CHIDB_EPAGENO;
+    if (n == 0)
+        return CHIDB_OK;
+
+    chidb_Pager_begin(bt->pager);
+    if ((rc = chidb_Pager_readPage(bt->pager, 1, &header)) != CHIDB_OK)
+    {
+        chidb_Pager_commit(bt->pager);
+        return rc;
+    }
+
+    npage_t ntrunk = get4byte(header->data + HEADER_FREELIST_TRUNK_OFFSET);
+    uint32_t nfree = get4byte(header->data + HEADER_FREELIST_COUNT_OFFSET);
+    if (ntrunk != 0 && (rc = chidb_Pager_readPage(bt->pager, ntrunk, &trunk)) == CHIDB_OK)
+        nleaves = get4byte(trunk->data + FREELIST_NLEAVES_OFFSET);
+
+    for (uint32_t i = 0; rc == CHIDB_OK && i < n; i++)
+    {
+        append_forget(bt, npages[i]);
+        if (trunk != NULL && nleaves < FREELIST_MAX_LEAVES(bt->usable_size))
+        {
+            put4byte(trunk->data + FREELIST_LEAVES_OFFSET + 4 * nleaves++, npages[i]);
+            nfree++;
+            continue;
+        }
+
+        /* No room in the first trunk page: the page becomes the first trunk */
+        if (trunk != NULL)
+        {
+            put4byte(trunk->data + FREELIST_NLEAVES_OFFSET, nleaves);
+            rc = chidb_Pager_writePage(bt->pager, trunk);
+            chidb_Pager_releaseMemPage(bt->pager, trunk);
+            trunk = NULL;
+        }
+        if (rc == CHIDB_OK && (rc = chidb_Pager_readPage(bt->pager, npages[i], &trunk)) == CHIDB_OK)
+        {
+            memset(trunk->data, 0, bt->pager->page_size);
+            put4byte(trunk->data + FREELIST_NEXT_OFFSET, ntrunk);
+            ntrunk = npages[i];
+            nleaves = 0;
+            nfree++;
+        }
+    }
+    if (trunk != NULL)
+    {
+        if (rc == CHIDB_OK)
+        {
+            put4byte(trunk->data + FREELIST_NLEAVES_OFFSET, nleaves);
+            rc = chidb_Pager_writePage(bt->pager, trunk);
+        }
+        chidb_Pager_releaseMemPage(bt->pager, trunk);
+    }
+
+    if (rc == CHIDB_OK)
+    {
+        put4byte(header->data + HEADER_FREELIST_TRUNK_OFFSET, ntrunk);
+        put4byte(header->data + HEADER_FREELIST_COUNT_OFFSET, nfree);
+        rc = chidb_Pager_writePage(bt->pager, header);
+    }
+    chidb_Pager_releaseMemPage(bt->pager, header);
+
+    int commit_rc = chidb_Pager_commit(bt->pager);
+    return rc == CHIDB_OK ? commit_rc : rc;
+}
+
+
+/* Returns the number of pages in the freelist
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nfree: Out parameter. Number of free pages.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_getFreelistCount(BTree *bt, uint32_t *nfree)
+{
+    MemPage *header;
+    int rc;
+
+    if ((rc = chidb_Pager_readPage(bt->pager, 1, &header)) != CHIDB_OK)
+        return rc;
+    *nfree = get4byte(header->data + HEADER_FREELIST_COUNT_OFFSET);
+    chidb_Pager_releaseMemPage(bt->pager, header);
+
+    return CHIDB_OK;
+}
+
+
 /* Create a new B-Tree node
  *
- * Allocates a new page in the file and initializes it as a B-Tree node.
+ * Allocates a page (see chidb_Btree_allocatePage) and initializes it as
+ * a B-Tree node.
  *
  * Parameters
  * - bt: B-Tree file
@@ -324,10 +753,21 @@ int chidb_Btree_writeNode(BTree *bt, BTreeNode *btn)
  */
 int chidb_Btree_newNode(BTree *bt, npage_t *npage, uint8_t type)
 {
-    chidb_Pager_allocatePage(bt->pager, npage);
+    int result;
+
+    chidb_Pager_begin(bt->pager);
+    if ((result = chidb_Btree_allocatePage(bt, npage)) != CHIDB_OK)
+    {
+        chidb_Pager_commit(bt->pager);
+        return result;
+    }
 
     BTreeNode new_node = chidb_Btree_createNode(bt, *npage, type);
-    return chidb_Btree_writeNode(bt, &new_node);
+    result = chidb_Btree_writeNode(bt, &new_node);
+    chidb_Pager_releaseMemPage(bt->pager, new_node.page);
+
+    int commit_result = chidb_Pager_commit(bt->pager);
+    return result == CHIDB_OK ? commit_result : result;
 }
 
 
@@ -350,8 +790,165 @@ int chidb_Btree_newNode(BTree *bt, npage_t *npage, uint8_t type)
  */
 int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type)
 {
+    append_forget(bt, npage);
     BTreeNode node = chidb_Btree_createNode(bt, npage, type);
-    return chidb_Btree_writeNode(bt, &node);
+    int result = chidb_Btree_writeNode(bt, &node);
+    chidb_Pager_releaseMemPage(bt->pager, node.page);
+    return result;
+}
+
+
+// number of bytes of a payload of data_size bytes that a table leaf cell
+// holds in its node (see set_payload). a payload that spills keeps the
+// rest in whole overflow pages, and (as in SQLite) as little as possible
+// in the last one, unless that would leave more than max_local bytes in
+// the node
+static uint32_t local_size(uint32_t usable_size, uint32_t max_local, uint32_t min_local, uint32_t data_size)
+{
+    if (max_local == 0 || data_size <= max_local) {
+        return data_size;
+    }
+    uint32_t local = min_local + (data_size - min_local) % (usable_size - OVERFLOW_DATA_OFFSET);
+    return local <= max_local ? local : min_local;
+}
+
+static uint32_t node_local_size(BTreeNode *btn, uint32_t data_size)
+{
+    return local_size(btn->usable_size, btn->max_local, btn->min_local, data_size);
+}
+
+// number of leading bytes that two keys share (up to INDEX_MAX_PREFIX).
+// the keys between two others share at least as many bytes with them
+static uint8_t key_prefix_len(chidb_key_t a, chidb_key_t b)
+{
+    uint8_t len = 0;
+    while (len < INDEX_MAX_PREFIX && (a >> (24 - 8 * len)) == (b >> (24 - 8 * len))) {
+        len++;
+    }
+    return len;
+}
+
+// the prefix of a packed index node is stored as a whole key, whose first
+// prefix_len bytes are the prefix
+static uint8_t *node_prefix(BTreeNode *btn)
+{
+    return btn->page->data + btn->usable_size - INDEX_PREFIX_SIZE;
+}
+
+// end of the cell area of a node (the prefix of packed index nodes is
+// after it)
+static uint32_t cells_end(BTreeNode *btn)
+{
+    return btn->usable_size - (btn->packed ? INDEX_PREFIX_SIZE : 0);
+}
+
+static size_t packed_cell_size(uint8_t type, uint8_t prefix_len)
+{
+    return (type == PGTYPE_INDEX_INTERNAL ? PACKEDINTCELL_SUFFIX_OFFSET : PACKEDLEAFCELL_SUFFIX_OFFSET) +
+           8 - prefix_len;
+}
+
+// length of the prefix of a packed index node once a key is added to it
+static uint8_t packed_prefix_with(BTreeNode *btn, chidb_key_t key)
+{
+    if (btn->n_cells == 0) {
+        return INDEX_MAX_PREFIX;
+    }
+    uint8_t len = key_prefix_len(get4byte(node_prefix(btn)), key);
+    return len < btn->prefix_len ? len : btn->prefix_len;
+}
+
+// read the key (and primary key, unless keyPk is NULL) of a cell of a
+// packed index node
+static chidb_key_t packed_get_key(BTreeNode *btn, uint8_t *cell_data, chidb_key_t *keyPk)
+{
+    uint8_t *prefix = node_prefix(btn);
+    uint8_t *suffix = cell_data + (btn->type == PGTYPE_INDEX_INTERNAL ?
+                                   PACKEDINTCELL_SUFFIX_OFFSET : PACKEDLEAFCELL_SUFFIX_OFFSET);
+    uint8_t len = btn->prefix_len;
+    uint32_t key = 0;
+
+    for (int i = 0; i < 4; i++) {
+        key = key << 8 | (i < len ? prefix[i] : suffix[i - len]);
+    }
+    if (keyPk != NULL) {
+        *keyPk = get4byte(suffix + 4 - len);
+    }
+    return key;
+}
+
+// write the key and primary key of a cell of a packed index node (the key
+// must start with the prefix of the node)
+static void packed_put_key(BTreeNode *btn, uint8_t *cell_data, chidb_key_t key, chidb_key_t keyPk)
+{
+    uint8_t *suffix = cell_data + (btn->type == PGTYPE_INDEX_INTERNAL ?
+                                   PACKEDINTCELL_SUFFIX_OFFSET : PACKEDLEAFCELL_SUFFIX_OFFSET);
+    uint8_t len = btn->prefix_len;
+
+    for (int i = len; i < 4; i++) {
+        suffix[i - len] = key >> (8 * (3 - i));
+    }
+    put4byte(suffix + 4 - len, keyPk);
+}
+
+// rewrite the cells of a packed index node with a shorter prefix (the
+// caller makes sure they fit). the cells are written in order from the
+// end of the cell area, so the last one is the one at cells_offset, as
+// when cells are appended (see bulk_pop_cell)
+static void packed_repack(BTreeNode *btn, uint8_t prefix_len)
+{
+    ncell_t n = btn->n_cells;
+    BTreeCell cells[n];
+    size_t size = packed_cell_size(btn->type, prefix_len);
+
+    chilog(TRACE, "repacking page %d with a prefix of %d bytes", btn->page->npage, prefix_len);
+    for (ncell_t i = 0; i < n; i++) {
+        chidb_Btree_getCell(btn, i, cells + i);
+    }
+    btn->prefix_len = prefix_len;
+    btn->cells_offset = cells_end(btn);
+    for (ncell_t i = 0; i < n; i++) {
+        btn->cells_offset -= size;
+        uint8_t *cell_data = btn->page->data + btn->cells_offset;
+        if (btn->type == PGTYPE_INDEX_INTERNAL) {
+            put4byte(cell_data + INDEXINTCELL_CHILD_OFFSET, (cells[i].fields).indexInternal.child_page);
+        }
+        packed_put_key(btn, cell_data, cells[i].key, (cells[i].fields).indexInternal.keyPk);
+        put2byte(btn->celloffset_array + i*2, btn->cells_offset);
+    }
+}
+
+// shorten the prefix of a packed index node, if needed, for a cell with
+// key to be added to it. the first cell of an empty node sets the prefix
+static void packed_fit_key(BTreeNode *btn, chidb_key_t key)
+{
+    uint8_t prefix_len = packed_prefix_with(btn, key);
+
+    if (btn->n_cells == 0) {
+        put4byte(node_prefix(btn), key);
+        btn->prefix_len = prefix_len;
+    } else if (prefix_len < btn->prefix_len) {
+        packed_repack(btn, prefix_len);
+    }
+}
+
+
+/* Get the local size of a payload
+ *
+ * Returns the number of bytes of a payload that a table leaf cell holds
+ * in its node. If it is less than the size of the payload, the rest is
+ * stored in overflow pages (see FEATURE_OVERFLOW).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - data_size: Number of bytes of the payload
+ *
+ * Return
+ * - Number of bytes of the payload stored in the node
+ */
+uint32_t chidb_Btree_localSize(BTree *bt, uint32_t data_size)
+{
+    return local_size(bt->usable_size, bt->max_local, bt->min_local, data_size);
 }
 
 
@@ -375,7 +972,7 @@ int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type)
  */
 int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
 {
-    if (ncell < 0 || ncell > btn->n_cells) {
+    if (ncell < 0 || ncell >= btn->n_cells) {
         return CHIDB_ECELLNO;
     }
 
@@ -391,19 +988,32 @@ int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
         getVarint32(cell_data + 4, &key);
     } else if (cell->type == PGTYPE_INDEX_INTERNAL) {
         uint32_t child_page = get4byte(cell_data);
-        uint32_t keyPk = get4byte(cell_data + 12);;
+        uint32_t keyPk;
+        if (btn->packed) {
+            key = packed_get_key(btn, cell_data, &keyPk);
+        } else {
+            keyPk = get4byte(cell_data + 12);
+            key = get4byte(cell_data + 8);
+        }
         (cell->fields).indexInternal.child_page = child_page;
         (cell->fields).indexInternal.keyPk = keyPk;
-        key = get4byte(cell_data + 8);
     } else if (cell->type == PGTYPE_TABLE_LEAF) {
         READ_VARINT32(data_size, cell_data, 0)
+        uint32_t local_size = node_local_size(btn, data_size);
         (cell->fields).tableLeaf.data_size = data_size;
         (cell->fields).tableLeaf.data = cell_data + 8;
+        (cell->fields).tableLeaf.local_size = local_size;
+        (cell->fields).tableLeaf.overflow = local_size < data_size ? get4byte(cell_data + 8 + local_size) : 0;
         getVarint32(cell_data + 4, &key);
     } else if (cell->type == PGTYPE_INDEX_LEAF) {
-        uint32_t keyPk = get4byte(cell_data + 8);;
+        uint32_t keyPk;
+        if (btn->packed) {
+            key = packed_get_key(btn, cell_data, &keyPk);
+        } else {
+            keyPk = get4byte(cell_data + 8);
+            key = get4byte(cell_data + 4);
+        }
         (cell->fields).indexLeaf.keyPk = keyPk;
-        key = get4byte(cell_data + 4);
     } else {
         // TODO
     }
@@ -413,23 +1023,163 @@ int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
 }
 
 
-/* Insert a new cell into a B-Tree node
- *
- * Inserts a new cell into a B-Tree node at a specified position ncell.
- * This involves the following:
- *  1. Add the cell at the top of the cell area. This involves "translating"
- *     the BTreeCell into the chidb format (refer to The chidb File Format
- *     document for the format of cells).
- *  2. Modify cells_offset in BTreeNode to reflect the growth in the cell area.
- *  3. Modify the cell offset array so that all values in positions >= ncell
- *     are shifted one position forward in the array. Then, set the value of
- *     position ncell to be the offset of the newly added cell.
+/* Get the key of a cell
  *
- * This function assumes that there is enough space for this cell in this node.
+ * Reads only the key of a cell, straight from the page, without decoding
+ * the rest of it (see chidb_Btree_getCell).
  *
  * Parameters
- * - btn: BTreeNode to insert cell in
- * - ncell: Cell number
+ * - btn: BTreeNode where cell is contained
+ * - ncell: Cell number (must be valid)
+ *
+ * Return
+ * - Key of the cell
+ */
+chidb_key_t chidb_Btree_getCellKey(BTreeNode *btn, ncell_t ncell)
+{
+    uint8_t *cell_data = btn->page->data + get2byte(btn->celloffset_array + ncell*2);
+    uint32_t key;
+
+    switch (btn->type)
+    {
+    case PGTYPE_TABLE_INTERNAL:
+        getVarint32(cell_data + TABLEINTCELL_KEY_OFFSET, &key);
+        return key;
+    case PGTYPE_TABLE_LEAF:
+        getVarint32(cell_data + TABLELEAFCELL_KEY_OFFSET, &key);
+        return key;
+    case PGTYPE_INDEX_INTERNAL:
+        if (btn->packed)
+            return packed_get_key(btn, cell_data, NULL);
+        return get4byte(cell_data + INDEXINTCELL_KEYIDX_OFFSET);
+    default:
+        if (btn->packed)
+            return packed_get_key(btn, cell_data, NULL);
+        return get4byte(cell_data + INDEXLEAFCELL_KEYIDX_OFFSET);
+    }
+}
+
+
+/* Get the child page of a cell of an internal node, or the right page if
+ * ncell is the number of cells in the node */
+npage_t chidb_Btree_getChildPage(BTreeNode *btn, ncell_t ncell)
+{
+    BTreeNodeKeys *decoded = btn->page->decoded;
+
+    if (ncell >= btn->n_cells)
+        return btn->right_page;
+    if (decoded != NULL && decoded->n_cells == btn->n_cells)
+        return decoded->children[ncell];
+    /* The child page is the first field of both kinds of internal cells */
+    return get4byte(btn->page->data + get2byte(btn->celloffset_array + ncell*2) + TABLEINTCELL_CHILD_OFFSET);
+}
+
+
+/* Returns the decoded form of an internal node, decoding it if it is not
+ * cached yet, or NULL if the node is not decoded. Only the nodes that
+ * are in the buffer pool (or mapped) are decoded, since the decoded form
+ * is cached along with their page. */
+static BTreeNodeKeys *btree_node_keys(BTreeNode *btn)
+{
+    BTreeNodeKeys *decoded = btn->page->decoded;
+    size_t npadded = chidb_KeySearch_padded(btn->n_cells);
+    size_t header = (sizeof(BTreeNodeKeys) + KEYSEARCH_ALIGN - 1) / KEYSEARCH_ALIGN * KEYSEARCH_ALIGN;
+
+    if (decoded != NULL && decoded->n_cells == btn->n_cells)
+        return decoded;
+    if (btn->type != PGTYPE_TABLE_INTERNAL && btn->type != PGTYPE_INDEX_INTERNAL)
+        return NULL;
+    if (!btn->page->pooled && !btn->page->mapped)
+        return NULL;
+
+    chidb_Pager_dropDecoded(btn->page);
+    if (posix_memalign((void **) &decoded, KEYSEARCH_ALIGN,
+                       header + npadded * sizeof(int32_t) + btn->n_cells * sizeof(npage_t)) != 0)
+        return NULL;
+    decoded->n_cells = btn->n_cells;
+    decoded->keys = (int32_t *) ((uint8_t *) decoded + header);
+    decoded->children = (npage_t *) (decoded->keys + npadded);
+    for (ncell_t i = 0; i < btn->n_cells; i++) {
+        uint8_t *cell = btn->page->data + get2byte(btn->celloffset_array + i*2);
+        decoded->keys[i] = chidb_KeySearch_key(chidb_Btree_getCellKey(btn, i));
+        decoded->children[i] = get4byte(cell + TABLEINTCELL_CHILD_OFFSET);
+    }
+    for (size_t i = btn->n_cells; i < npadded; i++) {
+        decoded->keys[i] = chidb_KeySearch_key(UINT32_MAX);
+    }
+    btn->page->decoded = decoded;
+
+    return decoded;
+}
+
+
+/* Search a B-Tree node
+ *
+ * Binary search over the cell offset array of a node, for the first cell
+ * whose key is greater than or equal to key. Since cells are sorted by
+ * key, this is:
+ *  - In a leaf, the cell with that key, or the position where a cell
+ *    with that key would be inserted.
+ *  - In a table internal node, the cell whose child page leads to the key
+ *    (or n_cells, if it is the right page).
+ *  - In an index internal node, the cell with that key, or the cell whose
+ *    child page leads to it (or n_cells, if it is the right page).
+ *
+ * Only the keys of O(log n) cells are read. The keys of internal nodes,
+ * which are searched over and over, are decoded into an array the first
+ * time the node is searched, which is kept with its page in the buffer
+ * pool, and searched with vector instructions (see keysearch.c).
+ *
+ * Parameters
+ * - btn: BTreeNode to search in
+ * - key: Key to search for
+ *
+ * Return
+ * - Cell number, between 0 and n_cells (both included)
+ */
+ncell_t chidb_Btree_searchNode(BTreeNode *btn, chidb_key_t key)
+{
+    BTreeNodeKeys *decoded = btree_node_keys(btn);
+    ncell_t lo = 0, hi = btn->n_cells;
+
+    if (decoded != NULL)
+        return chidb_KeySearch_lowerBound(decoded->keys, btn->n_cells, key);
+
+    while (lo < hi)
+    {
+        ncell_t mid = lo + (hi - lo) / 2;
+        if (chidb_Btree_getCellKey(btn, mid) < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+
+/* Insert a new cell into a B-Tree node
+ *
+ * Inserts a new cell into a B-Tree node at a specified position ncell.
+ * This involves the following:
+ *  1. Add the cell at the top of the cell area. This involves "translating"
+ *     the BTreeCell into the chidb format (refer to The chidb File Format
+ *     document for the format of cells).
+ *  2. Modify cells_offset in BTreeNode to reflect the growth in the cell area.
+ *  3. Modify the cell offset array so that all values in positions >= ncell
+ *     are shifted one position forward in the array. Then, set the value of
+ *     position ncell to be the offset of the newly added cell.
+ *
+ * In packed index nodes (see FEATURE_PACKED_INDEX), a key that does not
+ * start with the prefix of the node shortens the prefix first, so the
+ * other cells of the node are rewritten with longer key suffixes.
+ *
+ * This function assumes that there is enough space for this cell in this node
+ * (including the space taken by a shorter prefix; see is_insertable).
+ *
+ * Parameters
+ * - btn: BTreeNode to insert cell in
+ * - ncell: Cell number
  * - cell: BTreeCell to insert.
  *
  * Return
@@ -445,6 +1195,12 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
         return CHIDB_ECELLNO;
     }
 
+    // the node may be searched again before it is written
+    chidb_Pager_dropDecoded(btn->page);
+    if (btn->packed) {
+        packed_fit_key(btn, cell->key);
+    }
+
     // pointer to start of cells
     uint8_t *cells_offset = btn->page->data + btn->cells_offset;
     // write cell
@@ -452,6 +1208,13 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
         putVarint32(cells_offset - 4, cell->key);
         put4byte(cells_offset - 8, (cell->fields).tableInternal.child_page);
         btn->cells_offset -= 8;
+    } else if (btn->packed) {
+        btn->cells_offset -= packed_cell_size(cell->type, btn->prefix_len);
+        if (cell->type == PGTYPE_INDEX_INTERNAL) {
+            put4byte(btn->page->data + btn->cells_offset + INDEXINTCELL_CHILD_OFFSET,
+                     (cell->fields).indexInternal.child_page);
+        }
+        packed_put_key(btn, btn->page->data + btn->cells_offset, cell->key, (cell->fields).indexInternal.keyPk);
     } else if (cell->type == PGTYPE_INDEX_INTERNAL) {
         put4byte(cells_offset - 4, (cell->fields).indexInternal.keyPk);
         put4byte(cells_offset - 8, cell->key);
@@ -462,11 +1225,18 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
         put4byte(cells_offset - 16, (cell->fields).indexInternal.child_page);
         btn->cells_offset -= 16;
     } else if (cell->type == PGTYPE_TABLE_LEAF) {
+        // a payload that spills is followed by its first overflow page
         uint32_t data_size = (cell->fields).tableLeaf.data_size;
-        memcpy(cells_offset - data_size, (cell->fields).tableLeaf.data, data_size);
-        putVarint32(cells_offset - data_size - 4, cell->key);
-        putVarint32(cells_offset - data_size - 8, data_size);
-        btn->cells_offset -= (data_size + 8);
+        uint32_t local = node_local_size(btn, data_size);
+        if (local < data_size) {
+            put4byte(cells_offset - TABLELEAFCELL_OVERFLOW_SIZE, (cell->fields).tableLeaf.overflow);
+            cells_offset -= TABLELEAFCELL_OVERFLOW_SIZE;
+            btn->cells_offset -= TABLELEAFCELL_OVERFLOW_SIZE;
+        }
+        memcpy(cells_offset - local, (cell->fields).tableLeaf.data, local);
+        putVarint32(cells_offset - local - 4, cell->key);
+        putVarint32(cells_offset - local - 8, data_size);
+        btn->cells_offset -= (local + 8);
     } else if (cell->type == PGTYPE_INDEX_LEAF) {
         put4byte(cells_offset - 4, (cell->fields).indexInternal.keyPk);
         put4byte(cells_offset - 8, cell->key);
@@ -490,6 +1260,79 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
     return CHIDB_OK;
 }
 
+
+// number of bytes a cell takes up in a page of a node (without its cell
+// offset) see chidb file format document for details
+static size_t cell_size(BTreeNode *btn, BTreeCell *btc) {
+    if (btn->packed) {
+        return packed_cell_size(btc->type, btn->n_cells == 0 ? INDEX_MAX_PREFIX : btn->prefix_len);
+    } else if (btc->type == PGTYPE_TABLE_LEAF) {
+        uint32_t data_size = (btc->fields).tableLeaf.data_size;
+        uint32_t local = node_local_size(btn, data_size);
+        return TABLELEAFCELL_SIZE_WITHOUTDATA + local + (local < data_size ? TABLELEAFCELL_OVERFLOW_SIZE : 0);
+    } else if (btc->type == PGTYPE_TABLE_INTERNAL) {
+        return TABLEINTCELL_SIZE;
+    } else if (btc->type == PGTYPE_INDEX_LEAF) {
+        return INDEXLEAFCELL_SIZE;
+    } else {
+        return INDEXINTCELL_SIZE;
+    }
+}
+
+
+/* Remove a cell from a B-Tree node
+ *
+ * Removes the cell at position ncell of a B-Tree node. This involves the
+ * following:
+ *  1. Move the cells above it in the cell area down over it, so that the
+ *     cell area stays contiguous, and modify cells_offset accordingly.
+ *  2. Modify the offsets of the cells that were moved.
+ *  3. Shift the values of the cell offset array in positions > ncell one
+ *     position back.
+ *
+ * The changes are not effective until the node is written with
+ * chidb_Btree_writeNode.
+ *
+ * Parameters
+ * - btn: BTreeNode to remove the cell from
+ * - ncell: Cell number
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECELLNO: The provided cell number is invalid
+ */
+int chidb_Btree_removeCell(BTreeNode *btn, ncell_t ncell)
+{
+    BTreeCell cell;
+
+    if (chidb_Btree_getCell(btn, ncell, &cell) != CHIDB_OK) {
+        return CHIDB_ECELLNO;
+    }
+    chilog(TRACE, "removing cell with key %d from index %d of page %d",
+           cell.key, ncell, btn->page->npage);
+
+    // the node may be searched again before it is written
+    chidb_Pager_dropDecoded(btn->page);
+
+    uint16_t offset = get2byte(btn->celloffset_array + ncell*2);
+    size_t size = cell_size(btn, &cell);
+    memmove(btn->page->data + btn->cells_offset + size, btn->page->data + btn->cells_offset,
+            offset - btn->cells_offset);
+    btn->cells_offset += size;
+
+    memmove(btn->celloffset_array + ncell*2, btn->celloffset_array + (ncell + 1)*2,
+            (btn->n_cells - ncell - 1) * 2);
+    btn->n_cells--;
+    btn->free_offset -= 2;
+    for (ncell_t i = 0; i < btn->n_cells; i++) {
+        uint16_t cell_offset = get2byte(btn->celloffset_array + i*2);
+        if (cell_offset < offset) {
+            put2byte(btn->celloffset_array + i*2, cell_offset + size);
+        }
+    }
+    return CHIDB_OK;
+}
+
 /* Find an entry in a table B-Tree
  *
  * Finds the data associated for a given key in a table B-Tree
@@ -507,41 +1350,204 @@ int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell)
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-// TODO: error handling, and switch to iterative version from textbook (p.489)
-int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size)
+int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint32_t *size)
 {
-    chilog(TRACE, "searching for key %d at node %d", key, nroot);
     BTreeNode *btn;
-    chidb_Btree_getNodeByPage(bt, nroot, &btn);
+    BTreeCell btc;
+    npage_t npage = nroot;
+    ncell_t ncell;
+    int result;
 
-    // if it's a leaf, search cells with key == key
-    if (btn->type == PGTYPE_TABLE_LEAF) {
-        for (int i = 0; i < btn->n_cells; i++) {
-           BTreeCell btc;
-           chilog(TRACE, "\tleaf cell %d has value %d", i, btc.key);
-           chidb_Btree_getCell(btn, i, &btc);
-            if (btc.key == key) {
-                *size = btc.fields.tableLeaf.data_size;
-                *data = btc.fields.tableLeaf.data;
-                return CHIDB_OK;
-            }
-        }
+    chilog(TRACE, "searching for key %d at node %d", key, nroot);
+    for (;;)
+    {
+        if ((result = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
+            return result;
+        ncell = chidb_Btree_searchNode(btn, key);
+        if (btn->type != PGTYPE_TABLE_INTERNAL)
+            break;
+        npage = chidb_Btree_getChildPage(btn, ncell);
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+
+    /* Index B-Trees have no data */
+    if (btn->type != PGTYPE_TABLE_LEAF || ncell == btn->n_cells ||
+        chidb_Btree_getCellKey(btn, ncell) != key)
+    {
+        chidb_Btree_freeMemNode(bt, btn);
         return CHIDB_ENOTFOUND;
-    // otherwise, recursively call find on the correct child
-    } else if (btn->type == PGTYPE_TABLE_INTERNAL) {
-        for (int i = 0; i < btn->n_cells; i++) {
-            BTreeCell btc;
-            chidb_Btree_getCell(btn, i, &btc);
-            chilog(TRACE, "\tinternal cell %d has value %d", i, btc.key);
-            if (key <= btc.key) {
-                return chidb_Btree_find(
-                    bt, btc.fields.tableInternal.child_page, key, data, size);
-            }
+    }
+
+    // the cell points into the page, which may be evicted once unpinned
+    chidb_Btree_getCell(btn, ncell, &btc);
+    *size = btc.fields.tableLeaf.data_size;
+    *data = malloc(*size);
+    if (*data == NULL)
+    {
+        chidb_Btree_freeMemNode(bt, btn);
+        return CHIDB_ENOMEM;
+    }
+    result = chidb_Btree_readPayload(bt, &btc, 0, *size, *data);
+    chidb_Btree_freeMemNode(bt, btn);
+    if (result != CHIDB_OK)
+    {
+        free(*data);
+        return result;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Read part of the payload of a table leaf cell
+ *
+ * Copies size bytes of the payload of a cell, starting at byte offset,
+ * from the node (which must still be loaded) and, if they lie past its
+ * local prefix, from the overflow pages. Overflow pages are only read if
+ * they are needed, and the ones past the last byte requested are not
+ * read at all.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - cell: Table leaf cell, as returned by chidb_Btree_getCell
+ * - offset: First byte of the payload to copy
+ * - size: Number of bytes to copy
+ * - buf: Out parameter. Buffer of at least size bytes.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The bytes are past the end of the payload
+ * - CHIDB_ECORRUPT: The overflow chain is shorter than the payload
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_readPayload(BTree *bt, BTreeCell *cell, uint32_t offset, uint32_t size, uint8_t *buf)
+{
+    uint32_t local = cell->fields.tableLeaf.local_size;
+    uint32_t per_page = bt->usable_size - OVERFLOW_DATA_OFFSET;
+    npage_t npage = cell->fields.tableLeaf.overflow;
+    MemPage *page;
+    int rc;
+
+    if (cell->type != PGTYPE_TABLE_LEAF || offset > cell->fields.tableLeaf.data_size ||
+        size > cell->fields.tableLeaf.data_size - offset)
+        return CHIDB_EMISUSE;
+    if (npage == 0)
+        local = cell->fields.tableLeaf.data_size;
+
+    if (offset < local)
+    {
+        uint32_t n = size < local - offset ? size : local - offset;
+        memcpy(buf, cell->fields.tableLeaf.data + offset, n);
+        buf += n;
+        offset += n;
+        size -= n;
+    }
+
+    // byte pos of the payload is at the start of overflow page npage
+    for (uint32_t pos = local; size > 0; pos += per_page)
+    {
+        if (npage == 0)
+            return CHIDB_ECORRUPT;
+        if ((rc = chidb_Pager_readPage(bt->pager, npage, &page)) != CHIDB_OK)
+            return rc;
+        bt->pager->stats.overflow_reads++;
+        if (offset < pos + per_page)
+        {
+            uint32_t n = size < pos + per_page - offset ? size : pos + per_page - offset;
+            memcpy(buf, page->data + OVERFLOW_DATA_OFFSET + (offset - pos), n);
+            buf += n;
+            offset += n;
+            size -= n;
         }
-        return chidb_Btree_find(bt, btn->right_page, key, data, size);
-    } else { // something went wrong, why are we in an index tree?
-        return CHIDB_ENOTFOUND;
+        npage = get4byte(page->data + OVERFLOW_NEXT_OFFSET);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+
+    return CHIDB_OK;
+}
+
+
+// record in the file header that a row has spilled to overflow pages
+static int mark_spilled(BTree *bt)
+{
+    MemPage *header;
+    int rc;
+
+    if (bt->spilled)
+        return CHIDB_OK;
+    chidb_Pager_begin(bt->pager);
+    if ((rc = chidb_Pager_readPage(bt->pager, 1, &header)) == CHIDB_OK)
+    {
+        header->data[HEADER_FEATURES_OFFSET] |= FEATURE_SPILLED;
+        rc = chidb_Pager_writePage(bt->pager, header);
+        chidb_Pager_releaseMemPage(bt->pager, header);
     }
+    int commit_rc = chidb_Pager_commit(bt->pager);
+    if (rc == CHIDB_OK && (rc = commit_rc) == CHIDB_OK)
+        bt->spilled = true;
+
+    return rc;
+}
+
+// write the part of the payload of a new table leaf cell that does not
+// fit in its node to a chain of new overflow pages, and point the cell at
+// the first one (the data of the cell is the whole payload). the pages
+// are taken from the freelist, or added at the end of the file if at_end
+static int overflow_write(BTree *bt, BTreeCell *cell, bool at_end)
+{
+    uint32_t data_size = cell->fields.tableLeaf.data_size;
+    uint32_t local = chidb_Btree_localSize(bt, data_size);
+    uint32_t per_page = bt->usable_size - OVERFLOW_DATA_OFFSET;
+    uint32_t n = (data_size - local + per_page - 1) / per_page;
+    npage_t *npages = malloc(n * sizeof(npage_t));
+    uint32_t allocated = 0;
+    int rc = CHIDB_OK;
+
+    if (npages == NULL)
+        return CHIDB_ENOMEM;
+
+    // the pages are allocated first, so that each one can point at the
+    // next (and usually in ascending order, so they are read sequentially)
+    while (allocated < n &&
+           (rc = at_end ? chidb_Pager_allocatePage(bt->pager, &npages[allocated]) :
+                          chidb_Btree_allocatePage(bt, &npages[allocated])) == CHIDB_OK)
+        allocated++;
+
+    if (rc == CHIDB_OK)
+        rc = mark_spilled(bt);
+    for (uint32_t i = 0; i < n && rc == CHIDB_OK; i++)
+    {
+        uint32_t pos = local + i * per_page;
+        uint32_t len = data_size - pos < per_page ? data_size - pos : per_page;
+        MemPage *page = malloc(sizeof(MemPage));
+        if (page == NULL)
+        {
+            rc = CHIDB_ENOMEM;
+            break;
+        }
+        *page = chidb_Pager_initMemPage(npages[i], bt->pager->page_size);
+        if (page->data == NULL)
+        {
+            free(page);
+            rc = CHIDB_ENOMEM;
+            break;
+        }
+        put4byte(page->data + OVERFLOW_NEXT_OFFSET, i + 1 < n ? npages[i + 1] : 0);
+        memcpy(page->data + OVERFLOW_DATA_OFFSET, cell->fields.tableLeaf.data + pos, len);
+        rc = chidb_Pager_writePage(bt->pager, page);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+
+    if (rc == CHIDB_OK)
+    {
+        cell->fields.tableLeaf.local_size = local;
+        cell->fields.tableLeaf.overflow = npages[0];
+    }
+    else if (!at_end)
+        chidb_Btree_freePages(bt, npages, allocated);
+    free(npages);
+
+    return rc;
 }
 
 
@@ -566,7 +1572,7 @@ int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data,
  * - CHIDB_ENOMEM: Could not allocate memory
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
-int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint16_t size)
+int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint32_t size)
 {
     BTreeCell btc = {
         .type = PGTYPE_TABLE_LEAF,
@@ -610,33 +1616,66 @@ int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chid
 }
 
 
+// number of bytes of free space that inserting a cell into a node takes
+// up (without its cell offset). in packed index nodes whose prefix its key
+// does not start with, this includes the bytes that every cell grows by
+static size_t insert_size(BTreeNode *btn, BTreeCell *btc) {
+    if (!btn->packed) {
+        return cell_size(btn, btc);
+    }
+    uint8_t prefix_len = packed_prefix_with(btn, btc->key);
+    return packed_cell_size(btc->type, prefix_len) + btn->n_cells * (btn->prefix_len - prefix_len);
+}
+
 // return true if there is enough room in the node to insert the cell without splitting
-// see chidb file format document for details
 bool is_insertable(BTreeNode *btn, BTreeCell *btc) {
     size_t num_bytes_available = btn->cells_offset - btn->free_offset;
-    size_t num_bytes_needed = 2; // 2 bytes for the cell offset
-    if (btc->type == PGTYPE_TABLE_LEAF) {
-        num_bytes_needed += 8 + (btc->fields).tableLeaf.data_size;
-    } else if (btc->type == PGTYPE_TABLE_INTERNAL) {
-        num_bytes_needed += 8;
-    } else if (btc->type == PGTYPE_INDEX_LEAF) {
-        num_bytes_needed += 16;
-    } else if (btc->type == PGTYPE_TABLE_INTERNAL) {
-        num_bytes_needed += 12;
-    } else {
-        // TODO
-    }
+    size_t num_bytes_needed = 2 + insert_size(btn, btc); // 2 bytes for the cell offset
     chilog(TRACE, "bytes available: %d, needed: %d", num_bytes_available, num_bytes_needed);
     return num_bytes_available >= num_bytes_needed;
 }
 
+// choose the cell of an overfull packed index node (n cells, sorted by
+// key) that goes up to the parent when the node is split. index B-Trees
+// have no separators of their own to truncate, so the shortest separator
+// is found among the cells themselves: of the ones in the middle quarter
+// of the node, the one where the keys differ earliest, whose halves share
+// the longest prefixes (and thus take up the least space). the one closest
+// to the median wins ties
+static int packed_split_index(BTreeNode *btn, BTreeCell *cells, int n, int median)
+{
+    // an empty node has the same header, and no cell offsets
+    size_t capacity = cells_end(btn) - (btn->free_offset - 2 * btn->n_cells);
+    int best = median, best_len = -1;
+
+    for (int d = 0; d <= n / 8; d++) {
+        for (int m = median - d; m <= median + d; m += (d == 0 ? 1 : 2 * d)) {
+            if (m < 1 || m > n - 2) {
+                continue;
+            }
+            uint8_t left = key_prefix_len(cells[0].key, cells[m - 1].key);
+            uint8_t right = key_prefix_len(cells[m + 1].key, cells[n - 1].key);
+            if (left + right > best_len &&
+                m * (2 + packed_cell_size(btn->type, left)) <= capacity &&
+                (n - m - 1) * (2 + packed_cell_size(btn->type, right)) <= capacity) {
+                best = m;
+                best_len = left + right;
+            }
+        }
+    }
+    return best;
+}
+
+static int insert_cell(BTree *bt, npage_t nroot, BTreeCell *to_insert);
+static int overflow_free(BTree *bt, npage_t npage);
+
 /* Insert a BTreeCell into a B-Tree
  *
  * The chidb_Btree_insert function handles b tree insertion of a new cell/record
  * in the same spirit as the pseudocode of fig 11.15 of the sailboat textbook:
  * First we search for the leaf page which should contain our new BTreeCell
  * using the same logic as chidb_Btree_find, but while keeping track of the
- * encountered tree nodes along the way in a linked list.
+ * encountered tree nodes along the way.
  * Once we have found the leaf node, we keep splitting and moving back up the
  * traversed path towards the root until we find a node that is not full where
  * we can insert without splitting. In the simplest case, this would be the leaf
@@ -644,6 +1683,23 @@ bool is_insertable(BTreeNode *btn, BTreeCell *btc) {
  * the tree. If we end up reaching the root, then we split the root and create
  * a new root node.
  *
+ * Most insertions into tables use the next rowid, so they append to the
+ * rightmost leaf. The rightmost leaf of recently used B-Trees, and their
+ * largest key, are remembered (in bt->appends), so that larger keys go
+ * straight into that leaf while it has room. Nodes split by an append
+ * keep BTREE_APPEND_SPLIT percent of their cells instead of half of them,
+ * since nothing will be inserted into them after it; otherwise appends
+ * would leave a trail of half-empty nodes.
+ *
+ * In files with sibling links (see BTREE_LINKS_SIZE), the two leaves a
+ * table leaf is split into take its place in the list of leaves, and the
+ * leaf that followed it is updated to point back at the right one.
+ *
+ * In files with overflow pages (see FEATURE_OVERFLOW), the part of the
+ * data of a table entry that does not fit in its cell is written to a
+ * chain of overflow pages first. The cell then has a fixed size, no
+ * matter how large the data is.
+ *
  * Parameters
  * - bt: B-Tree file
  * - nroot: Page number of the root node of the B-Tree we want to insert
@@ -657,80 +1713,191 @@ bool is_insertable(BTreeNode *btn, BTreeCell *btc) {
  * - CHIDB_EIO: An I/O error has occurred when accessing the file
  */
 int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *to_insert)
+{
+    BTreeCell spilled;
+    int result = CHIDB_OK;
+
+    /* All the nodes modified by the insertion are committed together */
+    chidb_Pager_begin(bt->pager);
+    if (to_insert->type == PGTYPE_TABLE_LEAF &&
+        chidb_Btree_localSize(bt, to_insert->fields.tableLeaf.data_size) < to_insert->fields.tableLeaf.data_size)
+    {
+        spilled = *to_insert;
+        result = overflow_write(bt, &spilled, false);
+        to_insert = &spilled;
+    }
+    if (result == CHIDB_OK)
+        result = insert_cell(bt, nroot, to_insert);
+    /* Duplicates are found before anything else is modified */
+    if (result == CHIDB_EDUPLICATE && to_insert == &spilled)
+        overflow_free(bt, spilled.fields.tableLeaf.overflow);
+    int commit_result = chidb_Pager_commit(bt->pager);
+    return result == CHIDB_OK ? commit_result : result;
+}
+
+// release the nodes of an insertion path, from the root down to depth
+static void free_path(BTree *bt, BTreeNode **path, int depth) {
+    for (int i = 0; i < depth; i++) {
+        chidb_Btree_freeMemNode(bt, path[i]);
+    }
+    free(path);
+}
+
+// append a cell to the remembered rightmost leaf of a B-Tree, if its key
+// is larger than any in the B-Tree and the leaf has room for it. the leaf
+// is checked against what was remembered, in case it has changed since
+// (if it has, the insertion takes the usual path)
+static int append_cell(BTree *bt, npage_t nroot, BTreeCell *to_insert, bool *appended)
+{
+    BTreeAppend *append = &bt->appends[nroot % BTREE_APPEND_SLOTS];
+    BTreeNode *leaf;
+    int result = CHIDB_OK;
+
+    *appended = false;
+    if (append->nroot != nroot || append->change_count != bt->pager->change_count ||
+        to_insert->key <= append->max_key)
+        return CHIDB_OK;
+    if (chidb_Btree_getNodeByPage(bt, append->nleaf, &leaf) != CHIDB_OK) {
+        append->nroot = 0;
+        return CHIDB_OK;
+    }
+    if (leaf->type == to_insert->type && leaf->n_cells > 0 &&
+        chidb_Btree_getCellKey(leaf, leaf->n_cells - 1) == append->max_key) {
+        if (is_insertable(leaf, to_insert)) {
+            *appended = true;
+            if ((result = chidb_Btree_insertCell(leaf, leaf->n_cells, to_insert)) == CHIDB_OK)
+                result = chidb_Btree_writeNode(bt, leaf);
+            append->max_key = to_insert->key;
+        }
+    } else {
+        append->nroot = 0;
+    }
+    chidb_Btree_freeMemNode(bt, leaf);
+
+    return result;
+}
+
+// point the previous-leaf link of a leaf at another leaf
+static int link_prev_leaf(BTree *bt, npage_t npage, npage_t prev)
+{
+    BTreeNode *leaf;
+    int result;
+
+    if ((result = chidb_Btree_getNodeByPage(bt, npage, &leaf)) != CHIDB_OK) {
+        return result;
+    }
+    leaf->prev_leaf = prev;
+    result = chidb_Btree_writeNode(bt, leaf);
+    chidb_Btree_freeMemNode(bt, leaf);
+    return result;
+}
+
+// remember the rightmost leaf of a B-Tree
+static void append_remember(BTree *bt, npage_t nroot, npage_t nleaf, chidb_key_t max_key)
+{
+    BTreeAppend *append = &bt->appends[nroot % BTREE_APPEND_SLOTS];
+
+    append->nroot = nroot;
+    append->nleaf = nleaf;
+    append->max_key = max_key;
+    append->change_count = bt->pager->change_count;
+}
+
+static int insert_cell(BTree *bt, npage_t nroot, BTreeCell *to_insert)
 {
     chilog(TRACE, "inserting key %d at node %d", to_insert->key, nroot);
-    BTreeNode *btn;
-    chidb_Btree_getNodeByPage(bt, nroot, &btn);
-    ll_node current = { .val=btn };
-    ll path = { .head=&current, .tail=&current };
+    BTreeNode *btn, **path = NULL;
+    int depth = 0, path_alloc = 0;
+    npage_t npage = nroot;
+    ncell_t ncell;
+    bool rightmost = true, appended;
+    int result;
 
-    // find leaf node to insert into and keep track of path
-    while (!(btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF)) {
-        BTreeNode *next = NULL;
-        for (int i = 0; i < btn->n_cells; i++) {
-            BTreeCell btc;
-            chidb_Btree_getCell(btn, i, &btc);
-            chilog(TRACE, "\tinternal cell %d has value %d", i, btc.key);
-            // if this is the first cell geq the value we are looking for,
-            // get the child depending on whether it's a table or btree node.
-            // for btree nodes, if the key matches then it must exist and we return
-            // EDUPLICATE
-            if (btn->type == PGTYPE_TABLE_INTERNAL) {
-                if (to_insert->key <= btc.key) {
-                    chidb_Btree_getNodeByPage(
-                        bt, btc.fields.tableInternal.child_page, &next);
-                    break;
-                }
-            } else {
-                chilog(TRACE, "\tinternal cell %d has value %d", i, btc.key);
-                if (to_insert->key == btc.key) {
-                    return CHIDB_EDUPLICATE;
-                } else if (to_insert->key < btc.key) {
-                    chidb_Btree_getNodeByPage(
-                        bt, btc.fields.indexInternal.child_page, &next);
-                    break;
-                }
-            }
+    if ((result = append_cell(bt, nroot, to_insert, &appended)) != CHIDB_OK || appended) {
+        return result;
+    }
 
+    // find leaf node to insert into and keep track of path, from the root
+    // (path[0]) down to the leaf (path[depth - 1])
+    for (;;) {
+        if (depth == path_alloc) {
+            path_alloc = path_alloc ? 2 * path_alloc : 8;
+            BTreeNode **new_path = realloc(path, path_alloc * sizeof(BTreeNode *));
+            if (new_path == NULL) {
+                free_path(bt, path, depth);
+                return CHIDB_ENOMEM;
+            }
+            path = new_path;
+        }
+        if ((result = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
+            free_path(bt, path, depth);
+            return result;
         }
-        if (next == NULL) { 
-            chidb_Btree_getNodeByPage(bt, btn->right_page, &next);
+        path[depth++] = btn;
+
+        // the first cell geq the key we are looking for leads to it. in index
+        // B-Trees, entries are in internal nodes too, so a match there means
+        // the entry already exists
+        ncell = chidb_Btree_searchNode(btn, to_insert->key);
+        if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF ||
+            (btn->type == PGTYPE_INDEX_INTERNAL && ncell < btn->n_cells &&
+             chidb_Btree_getCellKey(btn, ncell) == to_insert->key)) {
+            break;
         }
-        btn = next;
-        current.val = btn;
-        (path.tail)->next = &current;
-        current.prev = path.tail;
-        path.tail = &current;
+        rightmost = rightmost && ncell == btn->n_cells;
+        npage = chidb_Btree_getChildPage(btn, ncell);
     }
+    if (ncell < btn->n_cells && chidb_Btree_getCellKey(btn, ncell) == to_insert->key) {
+        free_path(bt, path, depth);
+        return CHIDB_EDUPLICATE;
+    }
+
+    // an append to the rightmost leaf leaves it as the rightmost leaf,
+    // unless it is split
+    bool is_append = rightmost && ncell == btn->n_cells;
+    npage_t nleaf = btn->page->npage;
+    chidb_key_t max_key = is_append ? to_insert->key :
+                          btn->n_cells > 0 ? chidb_Btree_getCellKey(btn, btn->n_cells - 1) : 0;
 
+    BTreeCell separator;
     npage_t prev_right = -1;
     // for a more balanced split, should split by space instead of # of cells
     while (!(is_insertable(btn, to_insert))) {
-        bool btn_is_root = path.tail->val == btn;
-        // take in to account our not yet inserted cell when getting median
-        int median_index = btn->n_cells / 2;
-
-        // create an array of pointers to cells of the overfull node (i.e.
-        // the current cells + the cell we want to inserted), sorted by key
+        bool btn_is_root = depth == 1;
+        bool is_table = btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_TABLE_INTERNAL;
+        bt->pager->stats.node_splits++;
+
+        // create an array of the cells of the overfull node (i.e. the
+        // current cells + the cell we want to insert), sorted by key. when
+        // the cell comes from a split child, the cell after it (or the right
+        // page) must now point to the right half of that child
         BTreeCell overfull_node[btn->n_cells + 1];
-        bool inserted = false;
+        npage_t right_page = btn->right_page;
+        ncell = chidb_Btree_searchNode(btn, to_insert->key);
+
+        // take in to account our not yet inserted cell when getting median.
+        // appends (to the rightmost node of each level) leave the left node
+        // nearly full, and only a few cells in the right one
+        int median_index = btn->n_cells / 2;
+        bool split_append = rightmost && ncell == btn->n_cells && btn->n_cells >= 2;
+        if (split_append) {
+            median_index = btn->n_cells * BTREE_APPEND_SPLIT / 100;
+        }
         for (int i = 0; i < btn->n_cells; i++) {
-            BTreeCell btc;
-            chidb_Btree_getCell(btn, i, &btc);
-            chilog(TRACE, "\tinternal cell %d has value %d", i, btc.key);
-            if (to_insert->key < btc.key && !inserted) {
-                inserted = true;
-                overfull_node[i] = *to_insert;
-                overfull_node[i + 1] = btc;
-                if (prev_right != -1) { // in internal node
-                    (overfull_node[i + 1].fields).tableInternal.child_page = prev_right;
-                }
+            chidb_Btree_getCell(btn, i, overfull_node + (i < ncell ? i : i + 1));
+        }
+        overfull_node[ncell] = *to_insert;
+        if (prev_right != -1) { // in internal node
+            if (ncell == btn->n_cells) {
+                right_page = prev_right;
+            } else if (is_table) {
+                (overfull_node[ncell + 1].fields).tableInternal.child_page = prev_right;
             } else {
-                overfull_node[inserted ? i + 1 : i] = btc;
+                (overfull_node[ncell + 1].fields).indexInternal.child_page = prev_right;
             }
         }
-        if (!inserted) {
-            overfull_node[btn->n_cells] = *to_insert;
+        if (btn->packed && !split_append) {
+            median_index = packed_split_index(btn, overfull_node, btn->n_cells + 1, median_index);
         }
 
         // here left/right child refers to the two split nodes of the overfull node -
@@ -741,14 +1908,14 @@ int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *to_insert)
         // and only allocate a new page for the right child
         npage_t left_child_npage;
         if (btn_is_root) {
-            chidb_Pager_allocatePage(bt->pager, &left_child_npage);
+            chidb_Btree_allocatePage(bt, &left_child_npage);
         } else {
             left_child_npage = btn->page->npage;
         }
         BTreeNode left_child = chidb_Btree_createNode(bt, left_child_npage, btn->type);
 
         npage_t right_child_npage;
-        chidb_Pager_allocatePage(bt->pager, &right_child_npage);
+        chidb_Btree_allocatePage(bt, &right_child_npage);
         BTreeNode right_child = chidb_Btree_createNode(bt, right_child_npage, btn->type);
 
         for (int i = 0; i < median_index; i++) {
@@ -761,48 +1928,73 @@ int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *to_insert)
             chidb_Btree_insertCell(&right_child, i - median_index - 1, overfull_node + i);
         }
 
-        to_insert = malloc(sizeof(BTreeCell));
-        if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_TABLE_INTERNAL) {
-            to_insert->type = PGTYPE_TABLE_INTERNAL;
-            to_insert->key = overfull_node[median_index].key;
-            // we are inserting a node into parent whose child is the left split node
-            // (the right split node is set later, since we need the parent node)
-            (to_insert->fields).tableInternal.child_page = left_child_npage;
+        // the split leaves take the place of btn in the list of leaves (the
+        // leaves split from a root have no other siblings)
+        npage_t next_leaf = btn->next_leaf;
+        if (btn->type == PGTYPE_TABLE_LEAF) {
+            left_child.prev_leaf = btn->prev_leaf;
+            left_child.next_leaf = right_child_npage;
+            right_child.prev_leaf = left_child_npage;
+            right_child.next_leaf = next_leaf;
+        }
+
+        // the median goes up to the parent, pointing to the left split node
+        // (the parent's pointer to btn is changed to the right one later)
+        separator.key = overfull_node[median_index].key;
+        if (is_table) {
+            separator.type = PGTYPE_TABLE_INTERNAL;
+            (separator.fields).tableInternal.child_page = left_child_npage;
             if (btn->type == PGTYPE_TABLE_INTERNAL) {
-                right_child.right_page = left_child.right_page;
-                left_child.right_page = (overfull_node[median_index].fields).tableInternal.child_page;    
+                left_child.right_page = (overfull_node[median_index].fields).tableInternal.child_page;
+                right_child.right_page = right_page;
             }
         } else {
-            to_insert->type = PGTYPE_INDEX_INTERNAL;
-            to_insert->key = overfull_node[median_index].key;
-            (to_insert->fields).indexInternal.keyPk = overfull_node[median_index].fields.indexInternal.keyPk;
-            (to_insert->fields).indexInternal.child_page = left_child_npage;
+            separator.type = PGTYPE_INDEX_INTERNAL;
+            (separator.fields).indexInternal.keyPk = overfull_node[median_index].fields.indexInternal.keyPk;
+            (separator.fields).indexInternal.child_page = left_child_npage;
             if (btn->type == PGTYPE_INDEX_INTERNAL) {
-                right_child.right_page = left_child.right_page;
                 left_child.right_page = (overfull_node[median_index].fields).indexInternal.child_page;
+                right_child.right_page = right_page;
             }
         }
+        to_insert = &separator;
         prev_right = right_child_npage;
+        if (nleaf == btn->page->npage) // the leaf was split
+            nleaf = right_child_npage;
 
         // write the new split nodes, and insert into the parent
         chidb_Btree_writeNode(bt, &left_child);
         chidb_Btree_writeNode(bt, &right_child);
+        chidb_Pager_releaseMemPage(bt->pager, left_child.page);
+        chidb_Pager_releaseMemPage(bt->pager, right_child.page);
+        if (next_leaf != 0 && (result = link_prev_leaf(bt, next_leaf, right_child_npage)) != CHIDB_OK) {
+            free_path(bt, path, depth);
+            return result;
+        }
 
         if (btn_is_root) { // overwrite btn as the new root and return
             npage_t nroot = btn->page->npage;
             chilog(TRACE, "writing new root to page %d", nroot);
-            uint8_t root_type = btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_TABLE_INTERNAL ?
-                                PGTYPE_TABLE_INTERNAL :
-                                PGTYPE_INDEX_INTERNAL;
+            uint8_t root_type = is_table ? PGTYPE_TABLE_INTERNAL : PGTYPE_INDEX_INTERNAL;
             BTreeNode new_root = chidb_Btree_createNode(bt, nroot, root_type);
-            int result = chidb_Btree_insertNonFull(bt, &new_root, to_insert, prev_right);
+            if (nroot == 1) // keep the file header
+                memcpy(new_root.page->data, btn->page->data, 100);
+            result = chidb_Btree_insertNonFull(bt, &new_root, to_insert, prev_right);
+            chidb_Pager_releaseMemPage(bt->pager, new_root.page);
+            free_path(bt, path, depth);
+            if (result == CHIDB_OK && rightmost) {
+                append_remember(bt, nroot, nleaf, max_key);
+            }
             return result;
         }
-        path.tail = (path.tail)->prev;
         chidb_Btree_freeMemNode(bt, btn);
-        btn = (path.tail)->val;
+        btn = path[--depth - 1];
+    }
+    result = chidb_Btree_insertNonFull(bt, btn, to_insert, prev_right);
+    free_path(bt, path, depth);
+    if (result == CHIDB_OK && rightmost) {
+        append_remember(bt, nroot, nleaf, max_key);
     }
-    int result = chidb_Btree_insertNonFull(bt, btn, to_insert, prev_right);
     return result;
 }
 
@@ -827,32 +2019,1406 @@ int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *to_insert)
  */
 int chidb_Btree_insertNonFull(BTree *bt, BTreeNode *btn, BTreeCell *to_insert, npage_t right_child)
 {
-    int insertion_index = -1;
-    for (int i = 0; i < btn->n_cells; i++) {
-        BTreeCell btc;
-        chidb_Btree_getCell(btn, i, &btc);
-        chilog(TRACE, "\tinternal cell %d has value %d", i, btc.key);
-        if (to_insert->key < btc.key) {
-            insertion_index = i;
-            break;
-        } else if (to_insert->key == btc.key) {
-            return CHIDB_EDUPLICATE;
-        }
+    ncell_t insertion_index = chidb_Btree_searchNode(btn, to_insert->key);
+    if (insertion_index < btn->n_cells && chidb_Btree_getCellKey(btn, insertion_index) == to_insert->key) {
+        return CHIDB_EDUPLICATE;
     }
-    insertion_index = insertion_index == -1 ? btn->n_cells : insertion_index;
     if (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL) { // update pointers
         if (insertion_index == btn->n_cells) { // appended as largest cell
             btn->right_page = right_child;
-        } else {
-            BTreeCell btc;
-            chidb_Btree_getCell(btn, insertion_index, &btc);
-            if (btn->type == PGTYPE_TABLE_INTERNAL) {
-                btc.fields.tableInternal.child_page = right_child;
-            } else {
-                btc.fields.indexInternal.child_page = right_child;
-            }
+        } else { // the child page is the first field of internal cells
+            uint16_t cell_offset = get2byte(btn->celloffset_array + insertion_index*2);
+            put4byte(btn->page->data + cell_offset + TABLEINTCELL_CHILD_OFFSET, right_child);
         }
     }
     int result = chidb_Btree_insertCell(btn, insertion_index, to_insert);
     return result == CHIDB_OK ? chidb_Btree_writeNode(bt, btn) : result;
 }
+
+
+/* Set the fill threshold of deletions
+ *
+ * Nodes that entries are deleted from are rebalanced (merged with a
+ * sibling, or given some of its cells) once less than min_fill percent
+ * of their space is used (see chidb_Btree_delete). Lower thresholds make
+ * deletions cheaper, and leave sparser nodes behind.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - min_fill: Percentage of the space of a node (0-50). With 0, only
+ *             the nodes that are left empty are rebalanced.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: min_fill is not valid
+ */
+int chidb_Btree_setMinFill(BTree *bt, uint8_t min_fill)
+{
+    if (min_fill > 50)
+        return CHIDB_EMISUSE;
+    bt->min_fill = min_fill;
+    return CHIDB_OK;
+}
+
+static int delete_cell(BTree *bt, npage_t nroot, chidb_key_t key);
+static int delete_range(BTree *bt, npage_t nroot, chidb_key_t lo, chidb_key_t hi);
+
+/* Delete an entry from a B-Tree
+ *
+ * Deletes the entry with a given key from a table or index B-Tree. The
+ * leaf that holds it is found in the same way as in chidb_Btree_insert,
+ * keeping track of the path to it, and the cell is removed from it. In
+ * index B-Trees, entries that are in an internal node are replaced by
+ * the entry that precedes them (the last one of the rightmost leaf of
+ * their child), which is removed from that leaf instead.
+ *
+ * Most deletions end there: nodes are only rebalanced once they are less
+ * than bt->min_fill percent full (see chidb_Btree_setMinFill), or empty.
+ * An underflowed node is merged with a sibling (the left one, or the
+ * right one for the first child of its parent) if their cells fit in one
+ * page; the page left over is freed (see chidb_Btree_freePage), and the
+ * separator between them is removed from the parent, which may underflow
+ * in turn. Otherwise, the cells of both nodes are redistributed evenly
+ * between them, and the separator is replaced. A root that is left with
+ * a single child takes the contents of that child, so the B-Tree gets
+ * one level shorter (unless the root is page 1 and the child does not
+ * fit after the file header).
+ *
+ * In files with sibling links, merged leaves take the place of both in
+ * the list of leaves.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to delete
+ *          the entry from.
+ * - key: Entry key (keyIdx, in index B-Trees)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: No entry with the given key was found
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_delete(BTree *bt, npage_t nroot, chidb_key_t key)
+{
+    /* All the nodes modified by the deletion are committed together */
+    chidb_Pager_begin(bt->pager);
+    int result = delete_cell(bt, nroot, key);
+    int commit_result = chidb_Pager_commit(bt->pager);
+    return result == CHIDB_OK ? commit_result : result;
+}
+
+/* Delete a range of entries from a table B-Tree
+ *
+ * Deletes the entries with keys between lo and hi (both included) from
+ * a table B-Tree, without visiting them one by one. The children of the
+ * internal nodes on the paths to the keys lo and hi that only hold keys
+ * in the range are detached from their parents, and all of their pages
+ * are added to the freelist at once (see chidb_Btree_freePages), reading
+ * only the internal nodes of those subtrees (and, if rows of the file have
+ * spilled to overflow pages, their leaves, to free the overflow pages of
+ * their cells too; see FEATURE_SPILLED). The entries in the range are
+ * removed from the (at most two) leaves at the ends of the paths, and, in
+ * files with sibling links, the leaves before and after the ones that
+ * were detached are linked to each other. Then, the nodes along the two
+ * paths are rebalanced from the leaves up, as in chidb_Btree_delete.
+ *
+ * The cost is that of the two paths and of the pages freed, rather than
+ * that of deleting every entry.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of the B-Tree we want to delete
+ *          the entries from.
+ * - lo: Smallest key to delete
+ * - hi: Largest key to delete. Nothing is deleted if hi is less than lo.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The B-Tree is not a table B-Tree
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_deleteRange(BTree *bt, npage_t nroot, chidb_key_t lo, chidb_key_t hi)
+{
+    if (hi < lo)
+        return CHIDB_OK;
+
+    chidb_Pager_begin(bt->pager);
+    int result = delete_range(bt, nroot, lo, hi);
+    int commit_result = chidb_Pager_commit(bt->pager);
+    return result == CHIDB_OK ? commit_result : result;
+}
+
+// number of bytes of the page of a node taken up by its header
+static size_t node_header_size(BTreeNode *btn) {
+    bool is_leaf = btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF;
+    return (btn->page->npage == 1 ? 100 : 0) +
+           (is_leaf ? LEAFPG_CELLSOFFSET_OFFSET : INTPG_CELLSOFFSET_OFFSET);
+}
+
+// return true if a node is empty, or uses less than min_fill percent of
+// the space of its page. the cell area is contiguous, so the bytes it
+// takes up are the ones between cells_offset and its end
+static bool underflows(BTree *bt, BTreeNode *btn) {
+    size_t capacity = cells_end(btn) - node_header_size(btn);
+    size_t used = cells_end(btn) - btn->cells_offset + 2 * btn->n_cells;
+    return btn->n_cells == 0 || used * 100 < capacity * bt->min_fill;
+}
+
+// point the child page of cell ncell of an internal node (or its right
+// page) at another page
+static void set_child_page(BTreeNode *btn, ncell_t ncell, npage_t child) {
+    chidb_Pager_dropDecoded(btn->page);
+    if (ncell == btn->n_cells) {
+        btn->right_page = child;
+    } else { // the child page is the first field of internal cells
+        uint16_t cell_offset = get2byte(btn->celloffset_array + ncell*2);
+        put4byte(btn->page->data + cell_offset + TABLEINTCELL_CHILD_OFFSET, child);
+    }
+}
+
+// return true if the key of a separator of an internal node can be
+// replaced with key. in packed index nodes, a key that does not start with
+// the prefix makes every cell grow, unless it replaces the only one
+static bool separator_fits(BTreeNode *btn, chidb_key_t key) {
+    if (!btn->packed || btn->n_cells <= 1) {
+        return true;
+    }
+    uint8_t prefix_len = packed_prefix_with(btn, key);
+    return btn->n_cells * (btn->prefix_len - prefix_len) <= btn->cells_offset - btn->free_offset;
+}
+
+// replace the key of a separator (cell ncell of an internal node) in place
+// (see separator_fits). both kinds of internal cells have a fixed size (in
+// packed index nodes, the size of every cell of the node), so the cell
+// does not move, unless the prefix of a packed node has to be shortened
+static void set_separator(BTreeNode *btn, ncell_t ncell, BTreeCell *separator) {
+    chidb_Pager_dropDecoded(btn->page);
+    if (btn->packed && btn->n_cells == 1) {
+        put4byte(node_prefix(btn), separator->key);
+    } else if (btn->packed) {
+        packed_fit_key(btn, separator->key);
+    }
+    uint8_t *cell = btn->page->data + get2byte(btn->celloffset_array + ncell*2);
+    if (btn->type == PGTYPE_TABLE_INTERNAL) {
+        putVarint32(cell + TABLEINTCELL_KEY_OFFSET, separator->key);
+    } else if (btn->packed) {
+        packed_put_key(btn, cell, separator->key, separator->fields.indexInternal.keyPk);
+    } else {
+        put4byte(cell + INDEXINTCELL_KEYIDX_OFFSET, separator->key);
+        put4byte(cell + INDEXINTCELL_KEYPK_OFFSET, separator->fields.indexInternal.keyPk);
+    }
+}
+
+// bytes taken up (with their cell offsets) by cells from to to - 1 of the
+// cells of two nodes being rebalanced, once in a node of their own. bytes[j]
+// is the space taken up by the first j cells, except in packed index
+// nodes, where the size of the cells depends on the prefix they share
+static size_t cells_bytes(BTreeNode *node, BTreeCell *cells, size_t *bytes, int from, int to) {
+    if (!node->packed || from >= to) {
+        return bytes[to] - bytes[from];
+    }
+    uint8_t prefix_len = key_prefix_len(cells[from].key, cells[to - 1].key);
+    return (to - from) * (2 + packed_cell_size(node->type, prefix_len));
+}
+
+// rebalance an underflowed node (child i of parent) with a sibling: merge
+// them into the left one if they fit in one page, or move cells between
+// them otherwise. parent is modified and written, and freed is set to the
+// page left over by a merge (0 if they were not merged), which the caller
+// must free once it has released node
+static int rebalance(BTree *bt, BTreeNode *parent, ncell_t i, BTreeNode *node, npage_t *freed)
+{
+    BTreeNode *sibling, *left, *right;
+    BTreeCell *cells, separator;
+    size_t *bytes, total = 0;
+    int n = 0, result;
+
+    *freed = 0;
+    if (parent->n_cells == 0) { // a lone child has no siblings
+        return CHIDB_OK;
+    }
+
+    // the separator between the two nodes is cell s of the parent
+    ncell_t s = i > 0 ? i - 1 : i;
+    npage_t nsibling = chidb_Btree_getChildPage(parent, i > 0 ? s : s + 1);
+    if ((result = chidb_Btree_getNodeByPage(bt, nsibling, &sibling)) != CHIDB_OK) {
+        return result;
+    }
+    left = i > 0 ? sibling : node;
+    right = i > 0 ? node : sibling;
+    npage_t nleft = left->page->npage, nright = right->page->npage;
+
+    // the cells of both nodes, in order. the separator comes down between
+    // them, except in table leaves (where it is a copy of the last key of
+    // the left node)
+    cells = malloc((left->n_cells + right->n_cells + 1) * sizeof(BTreeCell));
+    bytes = malloc((left->n_cells + right->n_cells + 2) * sizeof(size_t));
+    if (cells == NULL || bytes == NULL) {
+        free(cells);
+        free(bytes);
+        chidb_Btree_freeMemNode(bt, sibling);
+        return CHIDB_ENOMEM;
+    }
+    for (ncell_t j = 0; j < left->n_cells; j++) {
+        chidb_Btree_getCell(left, j, cells + n++);
+    }
+    if (node->type != PGTYPE_TABLE_LEAF) {
+        chidb_Btree_getCell(parent, s, &separator);
+        cells[n].type = node->type;
+        cells[n].key = separator.key;
+        if (node->type == PGTYPE_TABLE_INTERNAL) {
+            cells[n].fields.tableInternal.child_page = left->right_page;
+        } else if (node->type == PGTYPE_INDEX_INTERNAL) {
+            cells[n].fields.indexInternal.keyPk = separator.fields.indexInternal.keyPk;
+            cells[n].fields.indexInternal.child_page = left->right_page;
+        } else {
+            cells[n].fields.indexLeaf.keyPk = separator.fields.indexInternal.keyPk;
+        }
+        n++;
+    }
+    for (ncell_t j = 0; j < right->n_cells; j++) {
+        chidb_Btree_getCell(right, j, cells + n++);
+    }
+    // bytes[j] is the space taken up by the first j cells
+    bytes[0] = 0;
+    for (int j = 0; j < n; j++) {
+        bytes[j + 1] = bytes[j] + 2 + cell_size(node, cells + j);
+    }
+    total = cells_bytes(node, cells, bytes, 0, n);
+    size_t capacity = cells_end(node) - node_header_size(node);
+
+    BTreeNode new_left = chidb_Btree_createNode(bt, nleft, node->type);
+    new_left.prev_leaf = left->prev_leaf;
+    if (total <= capacity) {
+        // merge: everything goes into the left node
+        bt->pager->stats.node_merges++;
+        for (int j = 0; j < n; j++) {
+            chidb_Btree_insertCell(&new_left, j, cells + j);
+        }
+        new_left.right_page = right->right_page;
+        new_left.next_leaf = right->next_leaf;
+        if ((result = chidb_Btree_writeNode(bt, &new_left)) == CHIDB_OK && right->next_leaf != 0) {
+            result = link_prev_leaf(bt, right->next_leaf, nleft);
+        }
+        chidb_Pager_releaseMemPage(bt->pager, new_left.page);
+
+        // the parent loses the separator, and the pointer to the right node
+        // now points to the merged one
+        if (result == CHIDB_OK) {
+            set_child_page(parent, s + 1, nleft);
+            chidb_Btree_removeCell(parent, s);
+            result = chidb_Btree_writeNode(bt, parent);
+            *freed = nright;
+        }
+    } else {
+        // redistribute: cells[m] is the first cell of the right node (table
+        // leaves) or the new separator, choosing the m that splits the bytes
+        // most evenly while both nodes (and the parent) fit and have at
+        // least one cell
+        bool is_table_leaf = node->type == PGTYPE_TABLE_LEAF;
+        int m = -1;
+        size_t best = SIZE_MAX;
+        for (int j = 1; j < (is_table_leaf ? n : n - 1); j++) {
+            size_t left_bytes = cells_bytes(node, cells, bytes, 0, j);
+            size_t right_bytes = cells_bytes(node, cells, bytes, is_table_leaf ? j : j + 1, n);
+            size_t diff = left_bytes > right_bytes ? left_bytes - right_bytes : right_bytes - left_bytes;
+            if (left_bytes <= capacity && right_bytes <= capacity && diff < best &&
+                (is_table_leaf || separator_fits(parent, cells[j].key))) {
+                m = j;
+                best = diff;
+            }
+        }
+        if (m != -1) {
+            BTreeNode new_right = chidb_Btree_createNode(bt, nright, node->type);
+            for (int j = 0; j < m; j++) {
+                chidb_Btree_insertCell(&new_left, j, cells + j);
+            }
+            for (int j = is_table_leaf ? m : m + 1; j < n; j++) {
+                chidb_Btree_insertCell(&new_right, new_right.n_cells, cells + j);
+            }
+            new_right.right_page = right->right_page;
+            new_left.next_leaf = left->next_leaf;
+            new_right.prev_leaf = right->prev_leaf;
+            new_right.next_leaf = right->next_leaf;
+
+            separator.key = cells[is_table_leaf ? m - 1 : m].key;
+            if (node->type == PGTYPE_TABLE_INTERNAL) {
+                new_left.right_page = cells[m].fields.tableInternal.child_page;
+            } else if (node->type == PGTYPE_INDEX_INTERNAL) {
+                new_left.right_page = cells[m].fields.indexInternal.child_page;
+                separator.fields.indexInternal.keyPk = cells[m].fields.indexInternal.keyPk;
+            } else if (node->type == PGTYPE_INDEX_LEAF) {
+                separator.fields.indexInternal.keyPk = cells[m].fields.indexLeaf.keyPk;
+            }
+
+            // both nodes are built before either is written, since the
+            // cells point into the pages of the old ones
+            if ((result = chidb_Btree_writeNode(bt, &new_left)) == CHIDB_OK) {
+                result = chidb_Btree_writeNode(bt, &new_right);
+            }
+            chidb_Pager_releaseMemPage(bt->pager, new_right.page);
+            if (result == CHIDB_OK) {
+                set_separator(parent, s, &separator);
+                result = chidb_Btree_writeNode(bt, parent);
+            }
+        }
+        chidb_Pager_releaseMemPage(bt->pager, new_left.page);
+    }
+
+    free(cells);
+    free(bytes);
+    chidb_Btree_freeMemNode(bt, sibling);
+    return result;
+}
+
+// replace a root that has no cells (only a right page) with its only
+// child, and free the child's page
+static int collapse_root(BTree *bt, BTreeNode *root)
+{
+    BTreeNode *child;
+    BTreeCell cell;
+    npage_t nchild = root->right_page;
+    int result;
+
+    if ((result = chidb_Btree_getNodeByPage(bt, nchild, &child)) != CHIDB_OK) {
+        return result;
+    }
+    BTreeNode new_root = chidb_Btree_createNode(bt, root->page->npage, child->type);
+    if (child->n_cells * 2 + (cells_end(child) - child->cells_offset) >
+        new_root.cells_offset - new_root.free_offset) { // page 1, after the file header
+        chidb_Pager_releaseMemPage(bt->pager, new_root.page);
+        chidb_Btree_freeMemNode(bt, child);
+        return CHIDB_OK;
+    }
+    chilog(TRACE, "moving page %d into root %d", nchild, root->page->npage);
+    if (root->page->npage == 1) { // keep the file header
+        memcpy(new_root.page->data, root->page->data, 100);
+    }
+    for (ncell_t j = 0; j < child->n_cells; j++) {
+        chidb_Btree_getCell(child, j, &cell);
+        chidb_Btree_insertCell(&new_root, j, &cell);
+    }
+    new_root.right_page = child->right_page;
+    result = chidb_Btree_writeNode(bt, &new_root);
+    chidb_Pager_releaseMemPage(bt->pager, new_root.page);
+    chidb_Btree_freeMemNode(bt, child);
+
+    return result == CHIDB_OK ? chidb_Btree_freePage(bt, nchild) : result;
+}
+
+static int delete_cell(BTree *bt, npage_t nroot, chidb_key_t key)
+{
+    chilog(TRACE, "deleting key %d from node %d", key, nroot);
+    BTreeNode *btn, **path = NULL;
+    ncell_t *indices = NULL;
+    int depth = 0, path_alloc = 0, found = -1;
+    npage_t npage = nroot;
+    ncell_t ncell, found_cell = 0;
+    bool successor = false;
+    int result;
+
+    // find the leaf (or, in index B-Trees, the internal node) with the
+    // key, and keep track of the path to it, from the root (path[0]) down,
+    // and of the cell taken at each node (indices). once found in an
+    // internal node, keep going down to the rightmost leaf of its child,
+    // where the entry that precedes it is. the first cell of a packed
+    // index node is replaced with the entry that follows it instead (the
+    // leftmost one of the next child), which, unlike the one that precedes
+    // it, shares the prefix of the node (see separator_fits)
+    for (;;) {
+        if (depth == path_alloc) {
+            path_alloc = path_alloc ? 2 * path_alloc : 8;
+            BTreeNode **new_path = realloc(path, path_alloc * sizeof(BTreeNode *));
+            ncell_t *new_indices = new_path == NULL ? NULL : realloc(indices, path_alloc * sizeof(ncell_t));
+            if (new_path != NULL) {
+                path = new_path;
+            }
+            if (new_indices == NULL) {
+                free(indices);
+                free_path(bt, path, depth);
+                return CHIDB_ENOMEM;
+            }
+            indices = new_indices;
+        }
+        if ((result = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
+            free(indices);
+            free_path(bt, path, depth);
+            return result;
+        }
+        path[depth++] = btn;
+
+        ncell = found == -1 ? chidb_Btree_searchNode(btn, key) : successor ? 0 : btn->n_cells;
+        indices[depth - 1] = ncell;
+        if (btn->type == PGTYPE_TABLE_LEAF || btn->type == PGTYPE_INDEX_LEAF) {
+            break;
+        }
+        if (found == -1 && btn->type == PGTYPE_INDEX_INTERNAL && ncell < btn->n_cells &&
+            chidb_Btree_getCellKey(btn, ncell) == key) {
+            found = depth - 1;
+            found_cell = ncell;
+            successor = btn->packed && ncell == 0 && btn->n_cells > 1;
+            if (successor) {
+                indices[depth - 1] = ++ncell;
+            }
+        }
+        npage = chidb_Btree_getChildPage(btn, ncell);
+    }
+
+    if (found != -1) {
+        // move the last (or first) entry of the leaf up into the internal
+        // node
+        BTreeCell neighbour;
+        if (btn->n_cells == 0) {
+            free(indices);
+            free_path(bt, path, depth);
+            return CHIDB_ECORRUPT;
+        }
+        ncell = successor ? 0 : btn->n_cells - 1;
+        chidb_Btree_getCell(btn, ncell, &neighbour);
+        neighbour.fields.indexInternal.keyPk = neighbour.fields.indexLeaf.keyPk;
+        set_separator(path[found], found_cell, &neighbour);
+        if ((result = chidb_Btree_writeNode(bt, path[found])) != CHIDB_OK) {
+            free(indices);
+            free_path(bt, path, depth);
+            return result;
+        }
+    } else if (ncell == btn->n_cells || chidb_Btree_getCellKey(btn, ncell) != key) {
+        free(indices);
+        free_path(bt, path, depth);
+        return CHIDB_ENOTFOUND;
+    }
+
+    // the overflow pages of the entry, if any, are freed with it
+    BTreeCell removed;
+    chidb_Btree_getCell(btn, ncell, &removed);
+    npage_t overflow = removed.type == PGTYPE_TABLE_LEAF ? removed.fields.tableLeaf.overflow : 0;
+    chidb_Btree_removeCell(btn, ncell);
+    result = chidb_Btree_writeNode(bt, btn);
+    if (result == CHIDB_OK && overflow != 0) {
+        result = overflow_free(bt, overflow);
+    }
+
+    // rebalance the nodes that underflow, from the leaf up, while merges
+    // take cells away from their parents
+    while (result == CHIDB_OK && depth > 1 && underflows(bt, path[depth - 1])) {
+        npage_t freed;
+        result = rebalance(bt, path[depth - 2], indices[depth - 2], path[depth - 1], &freed);
+        chidb_Btree_freeMemNode(bt, path[--depth]);
+        if (result == CHIDB_OK && freed != 0) {
+            result = chidb_Btree_freePage(bt, freed);
+        } else {
+            break;
+        }
+    }
+    btn = path[0];
+    if (result == CHIDB_OK && depth == 1 && btn->n_cells == 0 &&
+        (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL)) {
+        result = collapse_root(bt, btn);
+    }
+
+    free(indices);
+    free_path(bt, path, depth);
+    return result;
+}
+
+
+
+/* Pages collected by a range deletion, to be freed together */
+typedef struct RangePages
+{
+    npage_t *pages;
+    uint32_t n;
+    uint32_t alloc;
+    npage_t first_leaf;         /* First and last leaves (in key order) of */
+    npage_t last_leaf;          /* the subtrees that were detached, and */
+    int64_t first_lower;        /* the bounds of their keys */
+    int64_t last_upper;
+} RangePages;
+
+static int range_add_page(RangePages *rp, npage_t npage)
+{
+    if (rp->n == rp->alloc) {
+        uint32_t alloc = rp->alloc ? 2 * rp->alloc : 64;
+        npage_t *pages = realloc(rp->pages, alloc * sizeof(npage_t));
+        if (pages == NULL) {
+            return CHIDB_ENOMEM;
+        }
+        rp->pages = pages;
+        rp->alloc = alloc;
+    }
+    rp->pages[rp->n++] = npage;
+    return CHIDB_OK;
+}
+
+// collect the pages of an overflow chain
+static int overflow_collect(BTree *bt, npage_t npage, RangePages *rp)
+{
+    MemPage *page;
+    int result;
+
+    while (npage != 0) {
+        if ((result = range_add_page(rp, npage)) != CHIDB_OK ||
+            (result = chidb_Pager_readPage(bt->pager, npage, &page)) != CHIDB_OK) {
+            return result;
+        }
+        npage = get4byte(page->data + OVERFLOW_NEXT_OFFSET);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+    return CHIDB_OK;
+}
+
+// free the pages of an overflow chain (see chidb_Btree_freePages)
+static int overflow_free(BTree *bt, npage_t npage)
+{
+    RangePages rp = {NULL, 0, 0, 0, 0, 0, 0};
+    int result = overflow_collect(bt, npage, &rp);
+
+    if (result == CHIDB_OK) {
+        result = chidb_Btree_freePages(bt, rp.pages, rp.n);
+    }
+    free(rp.pages);
+    return result;
+}
+
+// collect the overflow pages of the cells from first to last (excluded)
+// of a table leaf
+static int overflow_collect_cells(BTree *bt, BTreeNode *btn, int first, int last, RangePages *rp)
+{
+    BTreeCell cell;
+    int result = CHIDB_OK;
+
+    for (int i = first; i < last && result == CHIDB_OK; i++) {
+        chidb_Btree_getCell(btn, i, &cell);
+        result = overflow_collect(bt, cell.fields.tableLeaf.overflow, rp);
+    }
+    return result;
+}
+
+// collect the pages of a subtree that is height levels above the leaves,
+// and its first and last leaves. only its internal nodes are read: the
+// leaves are known from their parents (unless rows of the file have
+// spilled to overflow pages, which are only known from the cells of the
+// leaves)
+static int range_collect(BTree *bt, npage_t npage, int height, RangePages *rp, npage_t *first, npage_t *last)
+{
+    BTreeNode *btn;
+    int result;
+
+    if ((result = range_add_page(rp, npage)) != CHIDB_OK) {
+        return result;
+    }
+    if (height == 0) {
+        if (*first == 0) {
+            *first = npage;
+        }
+        *last = npage;
+        if (!bt->spilled) {
+            return CHIDB_OK;
+        }
+        if ((result = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
+            return result;
+        }
+        result = overflow_collect_cells(bt, btn, 0, btn->n_cells, rp);
+        chidb_Btree_freeMemNode(bt, btn);
+        return result;
+    }
+    if ((result = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
+        return result;
+    }
+    for (ncell_t i = 0; i <= btn->n_cells && result == CHIDB_OK; i++) {
+        result = range_collect(bt, chidb_Btree_getChildPage(btn, i), height - 1, rp, first, last);
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+    return result;
+}
+
+// remove the keys between lo and hi from the subtree rooted at npage,
+// which holds keys greater than lower and less than or equal to upper.
+// the children of an internal node whose bounds are within the range (all
+// of them but the ones that lo and hi fall in, and maybe those too) are
+// detached along with the cells that point to them, and their pages are
+// collected. the children that lo and hi fall in, if they were not, are
+// visited in turn: the keys left in them are below lo and above hi, so
+// the cell kept between them still separates them. children that are
+// not in the range at all are not visited.
+static int range_remove(BTree *bt, npage_t npage, int height, int64_t lower, int64_t upper,
+                        chidb_key_t lo, chidb_key_t hi, RangePages *rp)
+{
+    BTreeNode *btn;
+    int result;
+
+    if ((result = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
+        return result;
+    }
+    int first = chidb_Btree_searchNode(btn, lo);
+    int last = chidb_Btree_searchNode(btn, hi);
+    int n = btn->n_cells;
+
+    if (btn->type == PGTYPE_TABLE_LEAF) {
+        // the cells from first to last (if it is hi itself), removed from
+        // the last one down
+        if (last < n && chidb_Btree_getCellKey(btn, last) == hi) {
+            last++;
+        }
+        if ((result = overflow_collect_cells(bt, btn, first, last, rp)) != CHIDB_OK) {
+            chidb_Btree_freeMemNode(bt, btn);
+            return result;
+        }
+        for (int i = last - 1; i >= first; i--) {
+            chidb_Btree_removeCell(btn, i);
+        }
+        if (last > first) {
+            result = chidb_Btree_writeNode(bt, btn);
+        }
+        chidb_Btree_freeMemNode(bt, btn);
+        return result;
+    }
+
+    // the children from a to b are detached. a node keeps at least one
+    // child, even if all of them are in the range (in the root)
+    int64_t first_lower = first > 0 ? chidb_Btree_getCellKey(btn, first - 1) : lower;
+    int64_t first_upper = first < n ? chidb_Btree_getCellKey(btn, first) : upper;
+    int64_t last_lower = last > 0 ? chidb_Btree_getCellKey(btn, last - 1) : lower;
+    int64_t last_upper = last < n ? chidb_Btree_getCellKey(btn, last) : upper;
+    int a = first_lower + 1 >= lo ? first : first + 1;
+    int b = last_upper <= hi ? last : last - 1;
+    if (a == 0 && b == n) {
+        a = 1;
+    }
+    npage_t nfirst = chidb_Btree_getChildPage(btn, first);
+    npage_t nlast = chidb_Btree_getChildPage(btn, last);
+
+    if (a <= b) {
+        npage_t first_leaf = 0, last_leaf = 0;
+        for (int i = a; i <= b && result == CHIDB_OK; i++) {
+            result = range_collect(bt, chidb_Btree_getChildPage(btn, i), height - 1, rp, &first_leaf, &last_leaf);
+        }
+        int64_t run_lower = a > 0 ? chidb_Btree_getCellKey(btn, a - 1) : lower;
+        int64_t run_upper = b < n ? chidb_Btree_getCellKey(btn, b) : upper;
+        if (rp->first_leaf == 0 || run_lower < rp->first_lower) {
+            rp->first_leaf = first_leaf;
+            rp->first_lower = run_lower;
+        }
+        if (rp->last_leaf == 0 || run_upper > rp->last_upper) {
+            rp->last_leaf = last_leaf;
+            rp->last_upper = run_upper;
+        }
+
+        // the cells of the children detached, or, if the right page is one
+        // of them, the cell of the child before them, which becomes the
+        // right page
+        int shift = b == n ? 1 : 0;
+        if (b == n) {
+            btn->right_page = chidb_Btree_getChildPage(btn, a - 1);
+        }
+        for (int i = b - shift; i >= a - shift; i--) {
+            chidb_Btree_removeCell(btn, i);
+        }
+        if (result == CHIDB_OK) {
+            result = chidb_Btree_writeNode(bt, btn);
+        }
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+
+    if (result == CHIDB_OK && (first < a || first > b)) {
+        result = range_remove(bt, nfirst, height - 1, first_lower, first_upper, lo, hi, rp);
+    }
+    if (result == CHIDB_OK && (last < a || last > b) && last != first) {
+        result = range_remove(bt, nlast, height - 1, last_lower, last_upper, lo, hi, rp);
+    }
+    return result;
+}
+
+// rebalance the child of parent in page npage (see rebalance) while it
+// underflows, following it into its left sibling when they are merged,
+// and count the merges
+static int range_rebalance_child(BTree *bt, BTreeNode *parent, npage_t npage, int *merges)
+{
+    BTreeNode *child;
+    int result = CHIDB_OK;
+
+    for (;;) {
+        ncell_t i = 0;
+        while (i <= parent->n_cells && chidb_Btree_getChildPage(parent, i) != npage) {
+            i++;
+        }
+        if (i > parent->n_cells) { // merged into the other boundary child
+            return CHIDB_OK;
+        }
+        if ((result = chidb_Btree_getNodeByPage(bt, npage, &child)) != CHIDB_OK) {
+            return result;
+        }
+        if (!underflows(bt, child)) {
+            chidb_Btree_freeMemNode(bt, child);
+            return CHIDB_OK;
+        }
+        npage_t nleft = i > 0 ? chidb_Btree_getChildPage(parent, i - 1) : npage;
+        npage_t freed;
+        result = rebalance(bt, parent, i, child, &freed);
+        chidb_Btree_freeMemNode(bt, child);
+        if (result != CHIDB_OK || freed == 0) {
+            return result;
+        }
+        if ((result = chidb_Btree_freePage(bt, freed)) != CHIDB_OK) {
+            return result;
+        }
+        (*merges)++;
+        npage = nleft;
+    }
+}
+
+// rebalance the nodes along the paths to the leaves of lo and hi, from
+// the leaves up (the rest of the B-Tree was not modified)
+static int range_rebalance(BTree *bt, npage_t npage, chidb_key_t lo, chidb_key_t hi, int *merges)
+{
+    BTreeNode *btn;
+    int result;
+
+    if ((result = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
+        return result;
+    }
+    if (btn->type == PGTYPE_TABLE_LEAF) {
+        chidb_Btree_freeMemNode(bt, btn);
+        return CHIDB_OK;
+    }
+
+    npage_t nfirst = chidb_Btree_getChildPage(btn, chidb_Btree_searchNode(btn, lo));
+    npage_t nlast = chidb_Btree_getChildPage(btn, chidb_Btree_searchNode(btn, hi));
+    result = range_rebalance(bt, nfirst, lo, hi, merges);
+    if (result == CHIDB_OK && nlast != nfirst) {
+        result = range_rebalance(bt, nlast, lo, hi, merges);
+    }
+    if (result == CHIDB_OK && nlast != nfirst) {
+        result = range_rebalance_child(bt, btn, nlast, merges);
+    }
+    if (result == CHIDB_OK) {
+        result = range_rebalance_child(bt, btn, nfirst, merges);
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+    return result;
+}
+
+static int delete_range(BTree *bt, npage_t nroot, chidb_key_t lo, chidb_key_t hi)
+{
+    RangePages rp = {NULL, 0, 0, 0, 0, 0, 0};
+    BTreeNode *btn;
+    npage_t npage = nroot;
+    int height = 0, result;
+
+    // the height of the B-Tree, so that the leaves of the subtrees that
+    // are detached are not read
+    for (;;) {
+        if ((result = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK) {
+            return result;
+        }
+        if (btn->type != PGTYPE_TABLE_INTERNAL) {
+            break;
+        }
+        npage = chidb_Btree_getChildPage(btn, 0);
+        chidb_Btree_freeMemNode(bt, btn);
+        height++;
+    }
+    uint8_t type = btn->type;
+    chidb_Btree_freeMemNode(bt, btn);
+    if (type != PGTYPE_TABLE_LEAF) {
+        return CHIDB_EMISUSE;
+    }
+
+    // the rightmost leaf may lose its last keys, or its page
+    append_forget(bt, nroot);
+    result = range_remove(bt, nroot, height, -1, UINT32_MAX, lo, hi, &rp);
+
+    // the leaves before and after the ones that were detached are linked
+    // to each other
+    if (result == CHIDB_OK && bt->linked && rp.first_leaf != 0) {
+        npage_t prev = 0, next = 0;
+        if ((result = chidb_Btree_getNodeByPage(bt, rp.first_leaf, &btn)) == CHIDB_OK) {
+            prev = btn->prev_leaf;
+            chidb_Btree_freeMemNode(bt, btn);
+        }
+        if (result == CHIDB_OK && (result = chidb_Btree_getNodeByPage(bt, rp.last_leaf, &btn)) == CHIDB_OK) {
+            next = btn->next_leaf;
+            chidb_Btree_freeMemNode(bt, btn);
+        }
+        if (result == CHIDB_OK && prev != 0 &&
+            (result = chidb_Btree_getNodeByPage(bt, prev, &btn)) == CHIDB_OK) {
+            btn->next_leaf = next;
+            result = chidb_Btree_writeNode(bt, btn);
+            chidb_Btree_freeMemNode(bt, btn);
+        }
+        if (result == CHIDB_OK && next != 0) {
+            result = link_prev_leaf(bt, next, prev);
+        }
+    }
+    if (result == CHIDB_OK) {
+        result = chidb_Btree_freePages(bt, rp.pages, rp.n);
+    }
+    free(rp.pages);
+
+    // a node whose siblings were detached may be left as the only child
+    // of its parent, which cannot rebalance it until the parent is merged
+    // with one of its own siblings: the paths are rebalanced again while
+    // that happens. a root left with a single child takes its place
+    int merges = 1;
+    while (result == CHIDB_OK && merges > 0) {
+        merges = 0;
+        result = range_rebalance(bt, nroot, lo, hi, &merges);
+        while (result == CHIDB_OK) {
+            if ((result = chidb_Btree_getNodeByPage(bt, nroot, &btn)) != CHIDB_OK) {
+                break;
+            }
+            npage_t nchild = btn->right_page;
+            bool collapse = btn->type == PGTYPE_TABLE_INTERNAL && btn->n_cells == 0;
+            if (collapse) {
+                result = collapse_root(bt, btn);
+            }
+            chidb_Btree_freeMemNode(bt, btn);
+            if (!collapse || result != CHIDB_OK) {
+                break;
+            }
+            // unless the child did not fit in page 1
+            if ((result = chidb_Btree_getNodeByPage(bt, nroot, &btn)) == CHIDB_OK) {
+                collapse = btn->type == PGTYPE_TABLE_INTERNAL && btn->right_page == nchild;
+                chidb_Btree_freeMemNode(bt, btn);
+                if (collapse) {
+                    break;
+                }
+            }
+        }
+    }
+
+    return result;
+}
+
+
+/* State of a bulk load (see chidb_Btree_bulkLoad). Level 0 holds the
+ * leaves, and each level above holds the internal nodes that point to the
+ * nodes of the level below. Each level has an open node, which is filled
+ * until it is full and then written, and a child waiting for the
+ * separator that follows it. */
+typedef struct BulkLevel
+{
+    BTreeNode node;
+    npage_t child;
+} BulkLevel;
+
+typedef struct BulkLoad
+{
+    BTree *bt;
+    bool is_table;
+    BulkLevel *levels;
+    int n_levels;
+    int levels_alloc;
+    size_t leaf_budget;         /* Bytes of a leaf that may be filled */
+    BTreeCell held;             /* Index B-Trees: entry of a full leaf that */
+    bool has_held;              /* goes up once the next one arrives */
+    BTreeNode pending;          /* Last leaf, written once the page of the */
+    bool has_pending;           /* next one is known (to link them) */
+} BulkLoad;
+
+static int bulk_add_level(BulkLoad *bl)
+{
+    uint8_t type;
+
+    if (bl->n_levels == bl->levels_alloc) {
+        int n = bl->levels_alloc ? 2 * bl->levels_alloc : 8;
+        BulkLevel *levels = realloc(bl->levels, n * sizeof(BulkLevel));
+        if (levels == NULL)
+            return CHIDB_ENOMEM;
+        bl->levels = levels;
+        bl->levels_alloc = n;
+    }
+    if (bl->n_levels == 0)
+        type = bl->is_table ? PGTYPE_TABLE_LEAF : PGTYPE_INDEX_LEAF;
+    else
+        type = bl->is_table ? PGTYPE_TABLE_INTERNAL : PGTYPE_INDEX_INTERNAL;
+    // nodes get a page number once they are written
+    bl->levels[bl->n_levels].node = chidb_Btree_createNode(bl->bt, 0, type);
+    if (bl->levels[bl->n_levels].node.page->data == NULL)
+        return CHIDB_ENOMEM;
+    bl->levels[bl->n_levels].child = 0;
+    bl->n_levels++;
+
+    return CHIDB_OK;
+}
+
+// write the pending leaf, linked to the leaf that follows it (NULL if it
+// is the last one), which becomes the pending leaf
+static int bulk_write_leaf(BulkLoad *bl, BTreeNode *next)
+{
+    int rc = CHIDB_OK;
+
+    if (bl->has_pending) {
+        if (bl->is_table && next != NULL) {
+            bl->pending.next_leaf = next->page->npage;
+            next->prev_leaf = bl->pending.page->npage;
+        }
+        rc = chidb_Btree_writeNode(bl->bt, &bl->pending);
+        chidb_Pager_releaseMemPage(bl->bt->pager, bl->pending.page);
+        bl->has_pending = false;
+    }
+    if (next != NULL) {
+        bl->pending = *next;
+        bl->has_pending = true;
+    }
+    return rc;
+}
+
+// write the open node of a level to a new page at the end of the file, and
+// open a new, empty node in its place
+static int bulk_write_node(BulkLoad *bl, int level, npage_t *npage)
+{
+    BTreeNode *btn = &bl->levels[level].node;
+    uint8_t type = btn->type;
+    int rc;
+
+    if ((rc = chidb_Pager_allocatePage(bl->bt->pager, npage)) != CHIDB_OK)
+        return rc;
+    btn->page->npage = *npage;
+    if (level == 0) {
+        rc = bulk_write_leaf(bl, btn);
+    } else {
+        rc = chidb_Btree_writeNode(bl->bt, btn);
+        chidb_Pager_releaseMemPage(bl->bt->pager, btn->page);
+    }
+
+    *btn = chidb_Btree_createNode(bl->bt, 0, type);
+    if (rc != CHIDB_OK)
+        return rc;
+    return btn->page->data == NULL ? CHIDB_ENOMEM : CHIDB_OK;
+}
+
+static int bulk_add_child(BulkLoad *bl, int level, npage_t child)
+{
+    int rc;
+
+    if (level == bl->n_levels && (rc = bulk_add_level(bl)) != CHIDB_OK)
+        return rc;
+    bl->levels[level].child = child;
+
+    return CHIDB_OK;
+}
+
+// take the last cell appended to a node out of it (the prefix of a packed
+// index node is left as it is)
+static void bulk_pop_cell(BTreeNode *btn, BTreeCell *cell)
+{
+    chidb_Btree_getCell(btn, btn->n_cells - 1, cell);
+    btn->cells_offset += cell_size(btn, cell);
+    btn->n_cells--;
+    btn->free_offset -= 2;
+}
+
+// add the separator that follows the waiting child of a level. if the
+// open node is full, its last cell goes up to the next level instead (so
+// that the next node of the level never ends up without cells)
+static int bulk_add_separator(BulkLoad *bl, int level, BTreeCell *separator)
+{
+    BulkLevel *l = &bl->levels[level];
+    BTreeCell last;
+    npage_t npage;
+    int rc;
+
+    if (bl->is_table)
+        (separator->fields).tableInternal.child_page = l->child;
+    else
+        (separator->fields).indexInternal.child_page = l->child;
+    l->child = 0;
+
+    if (!is_insertable(&l->node, separator)) {
+        bulk_pop_cell(&l->node, &last);
+        l->node.right_page = bl->is_table ? (last.fields).tableInternal.child_page :
+                                            (last.fields).indexInternal.child_page;
+        if ((rc = bulk_write_node(bl, level, &npage)) != CHIDB_OK ||
+            (rc = bulk_add_child(bl, level + 1, npage)) != CHIDB_OK ||
+            (rc = bulk_add_separator(bl, level + 1, &last)) != CHIDB_OK)
+            return rc;
+        l = &bl->levels[level];
+    }
+    return chidb_Btree_insertCell(&l->node, l->node.n_cells, separator);
+}
+
+// write a full leaf, with the entry that separates it from the next one
+static int bulk_next_leaf(BulkLoad *bl, BTreeCell *separator)
+{
+    npage_t npage;
+    int rc;
+
+    if ((rc = bulk_write_node(bl, 0, &npage)) != CHIDB_OK ||
+        (rc = bulk_add_child(bl, 1, npage)) != CHIDB_OK)
+        return rc;
+    return bulk_add_separator(bl, 1, separator);
+}
+
+static bool bulk_leaf_fits(BulkLoad *bl, BTreeNode *leaf, BTreeCell *cell)
+{
+    size_t used = (cells_end(leaf) - leaf->cells_offset) + (leaf->free_offset - LEAFPG_CELLSOFFSET_OFFSET);
+    size_t needed = 2 + insert_size(leaf, cell);
+
+    if (!is_insertable(leaf, cell))
+        return false;
+    return leaf->n_cells == 0 || used + needed <= bl->leaf_budget;
+}
+
+static int bulk_add_entry(BulkLoad *bl, BTreeCell *cell)
+{
+    BTreeNode *leaf = &bl->levels[0].node;
+    BTreeCell separator;
+    int rc;
+
+    if (bl->has_held) {
+        bl->has_held = false;
+        if ((rc = bulk_next_leaf(bl, &bl->held)) != CHIDB_OK)
+            return rc;
+        leaf = &bl->levels[0].node; // levels may have moved
+    }
+    if (bulk_leaf_fits(bl, leaf, cell))
+        return chidb_Btree_insertCell(leaf, leaf->n_cells, cell);
+
+    if (!bl->is_table) {
+        // in index B-Trees, the entry that separates two leaves is in their
+        // parent, and not in a leaf
+        bl->held = *cell;
+        bl->held.type = PGTYPE_INDEX_INTERNAL;
+        (bl->held.fields).indexInternal.keyPk = (cell->fields).indexLeaf.keyPk;
+        bl->has_held = true;
+        return CHIDB_OK;
+    }
+    separator.type = PGTYPE_TABLE_INTERNAL;
+    separator.key = chidb_Btree_getCellKey(leaf, leaf->n_cells - 1);
+    if ((rc = bulk_next_leaf(bl, &separator)) != CHIDB_OK)
+        return rc;
+    leaf = &bl->levels[0].node;
+    return chidb_Btree_insertCell(leaf, leaf->n_cells, cell);
+}
+
+// copy the top node of the B-Tree into its root page
+static int bulk_write_root(BulkLoad *bl, npage_t nroot, BTreeNode *top)
+{
+    BTreeNode *old_root;
+    BTreeNode root;
+    BTreeCell cell;
+    uint8_t header[100];
+    npage_t right_page = top->right_page;
+    uint8_t type = top->type;
+    int rc;
+
+    if ((rc = chidb_Btree_getNodeByPage(bl->bt, nroot, &old_root)) != CHIDB_OK)
+        return rc;
+    memcpy(header, old_root->page->data, sizeof(header));
+    chidb_Btree_freeMemNode(bl->bt, old_root);
+
+    // the root has 100 bytes less if it is the first page of the file. if
+    // the top node does not fit, it goes in a page of its own, as the only
+    // child of the root
+    if (nroot == 1 && top->cells_offset - top->free_offset < sizeof(header)) {
+        if ((rc = bulk_write_node(bl, bl->n_levels - 1, &right_page)) != CHIDB_OK)
+            return rc;
+        type = bl->is_table ? PGTYPE_TABLE_INTERNAL : PGTYPE_INDEX_INTERNAL;
+        top = NULL;
+    }
+
+    root = chidb_Btree_createNode(bl->bt, nroot, type);
+    if (root.page->data == NULL)
+        return CHIDB_ENOMEM;
+    if (nroot == 1) // keep the file header
+        memcpy(root.page->data, header, sizeof(header));
+    for (ncell_t i = 0; top != NULL && i < top->n_cells; i++) {
+        chidb_Btree_getCell(top, i, &cell);
+        chidb_Btree_insertCell(&root, i, &cell);
+    }
+    root.right_page = right_page;
+    rc = chidb_Btree_writeNode(bl->bt, &root);
+    chidb_Pager_releaseMemPage(bl->bt->pager, root.page);
+
+    return rc;
+}
+
+static int bulk_finish(BulkLoad *bl, npage_t nroot)
+{
+    BTreeNode *leaf = &bl->levels[0].node;
+    BTreeCell separator;
+    npage_t npage;
+    int rc;
+
+    // a held entry needs a leaf after it. it goes in the last leaf if there
+    // is room left. otherwise, the last entry of the leaf takes its place
+    // as the separator, and it goes in a leaf of its own
+    if (bl->has_held) {
+        bl->has_held = false;
+        bl->held.type = PGTYPE_INDEX_LEAF;
+        if (!is_insertable(leaf, &bl->held)) {
+            bulk_pop_cell(leaf, &separator);
+            separator.type = PGTYPE_INDEX_INTERNAL;
+            if ((rc = bulk_next_leaf(bl, &separator)) != CHIDB_OK)
+                return rc;
+            leaf = &bl->levels[0].node;
+        }
+        if ((rc = chidb_Btree_insertCell(leaf, leaf->n_cells, &bl->held)) != CHIDB_OK)
+            return rc;
+    }
+
+    // close the last node of each level, which is the rightmost child of
+    // the last node of the level above
+    for (int level = 0; level < bl->n_levels - 1; level++) {
+        if (level > 0)
+            bl->levels[level].node.right_page = bl->levels[level].child;
+        if ((rc = bulk_write_node(bl, level, &npage)) != CHIDB_OK ||
+            (rc = bulk_add_child(bl, level + 1, npage)) != CHIDB_OK)
+            return rc;
+    }
+    if (bl->n_levels > 1)
+        bl->levels[bl->n_levels - 1].node.right_page = bl->levels[bl->n_levels - 1].child;
+
+    if ((rc = bulk_write_root(bl, nroot, &bl->levels[bl->n_levels - 1].node)) != CHIDB_OK)
+        return rc;
+    return bulk_write_leaf(bl, NULL);
+}
+
+
+/* Build a B-Tree from sorted entries
+ *
+ * Fills an empty B-Tree with entries that are already sorted by key,
+ * without inserting them one by one. Nodes are built bottom-up: leaves
+ * are filled in order (up to fill percent of their space, so that there
+ * is room left for later insertions), and each full node is written to a
+ * new page at the end of the file, and becomes a child of a node in the
+ * level above. Thus, the pages are written sequentially, once each, and
+ * only the last node of each level is kept in memory (and the last full
+ * leaf, which is written once the page of the next one is known, so that
+ * table leaves can be linked to their siblings). The top node is written
+ * to the root page last, so the B-Tree stays empty until the load is
+ * complete.
+ *
+ * Entries are returned by the next function, with the key and fields of
+ * the type of cell of the leaves of the B-Tree (the type field is
+ * ignored). For table B-Trees, the data of an entry only has to stay
+ * valid until next is called again. Data that does not fit in a cell is
+ * written to overflow pages as the entry is loaded.
+ *
+ * If the load fails, the pages added to the file are removed (unless
+ * there is a transaction in progress, which should then be rolled back).
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - nroot: Page number of the root node of an empty B-Tree
+ * - fill: Percentage of each leaf that is filled (1-100)
+ * - next: Function that returns the next entry in cell, in ascending key
+ *         order, and CHIDB_OK, or CHIDB_DONE when there are no more
+ *         entries (any other value is an error that stops the load)
+ * - arg: Passed on to next
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: Two entries have the same key
+ * - CHIDB_EMISUSE: The B-Tree is not empty, fill is not valid, or the
+ *                  entries are not sorted
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - Any error returned by next
+ */
+int chidb_Btree_bulkLoad(BTree *bt, npage_t nroot, uint8_t fill, chidb_Btree_loadNext next, void *arg)
+{
+    BulkLoad bl = {.bt = bt};
+    BTreeNode *root;
+    BTreeCell cell;
+    chidb_key_t last = 0;
+    npage_t n_pages = bt->pager->n_pages;
+    int rc;
+
+    if (fill == 0 || fill > 100)
+        return CHIDB_EMISUSE;
+    if ((rc = chidb_Btree_getNodeByPage(bt, nroot, &root)) != CHIDB_OK)
+        return rc;
+    bl.is_table = root->type == PGTYPE_TABLE_LEAF || root->type == PGTYPE_TABLE_INTERNAL;
+    rc = root->n_cells == 0 && (root->type == PGTYPE_TABLE_LEAF || root->type == PGTYPE_INDEX_LEAF) ?
+         CHIDB_OK : CHIDB_EMISUSE;
+    chidb_Btree_freeMemNode(bt, root);
+    if (rc != CHIDB_OK)
+        return rc;
+    bl.leaf_budget = (size_t) (bt->usable_size - LEAFPG_CELLSOFFSET_OFFSET) * fill / 100;
+
+    if ((rc = bulk_add_level(&bl)) != CHIDB_OK)
+        return rc;
+    for (uint64_t i = 0; (rc = next(arg, &cell)) == CHIDB_OK; i++) {
+        if (i > 0 && cell.key <= last) {
+            rc = cell.key == last ? CHIDB_EDUPLICATE : CHIDB_EMISUSE;
+            break;
+        }
+        last = cell.key;
+        cell.type = bl.is_table ? PGTYPE_TABLE_LEAF : PGTYPE_INDEX_LEAF;
+        // overflow pages go right before the leaf of their entry
+        if (bl.is_table && chidb_Btree_localSize(bt, cell.fields.tableLeaf.data_size) < cell.fields.tableLeaf.data_size &&
+            (rc = overflow_write(bt, &cell, true)) != CHIDB_OK)
+            break;
+        if ((rc = bulk_add_entry(&bl, &cell)) != CHIDB_OK)
+            break;
+    }
+    if (rc == CHIDB_DONE)
+        rc = bulk_finish(&bl, nroot);
+
+    for (int level = 0; level < bl.n_levels; level++)
+        chidb_Pager_releaseMemPage(bt->pager, bl.levels[level].node.page);
+    if (bl.has_pending)
+        chidb_Pager_releaseMemPage(bt->pager, bl.pending.page);
+    free(bl.levels);
+    if (rc != CHIDB_OK && bt->pager->write_depth == 0)
+        chidb_Pager_truncate(bt->pager, n_pages);
+
+    return rc;
+}
+
+
+/* (key, primary key) pairs of an index that is being built */
+typedef struct IndexEntries
+{
+    BTreeCell *cells;
+    uint32_t n;
+    uint32_t alloc;
+    uint32_t next;
+    uint8_t column;
+} IndexEntries;
+
+// visit the leaves of a table B-Tree in order, adding an index entry for
+// each row whose column is not NULL
+static int btree_index_rows(BTree *bt, npage_t npage, IndexEntries *entries)
+{
+    BTreeNode *btn;
+    int rc;
+
+    if ((rc = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
+        return rc;
+    if (btn->type == PGTYPE_TABLE_INTERNAL) {
+        for (ncell_t i = 0; i <= btn->n_cells && rc == CHIDB_OK; i++)
+            rc = btree_index_rows(bt, chidb_Btree_getChildPage(btn, i), entries);
+        chidb_Btree_freeMemNode(bt, btn);
+        return rc;
+    }
+    if (btn->type != PGTYPE_TABLE_LEAF) {
+        chidb_Btree_freeMemNode(bt, btn);
+        return CHIDB_EMISUSE;
+    }
+
+    for (ncell_t i = 0; i < btn->n_cells && rc == CHIDB_OK; i++) {
+        BTreeCell btc;
+        DBRecord *dbr;
+        int8_t v8;
+        int16_t v16;
+        int32_t v32;
+
+        chidb_Btree_getCell(btn, i, &btc);
+        uint8_t *payload = btc.fields.tableLeaf.data;
+        if (btc.fields.tableLeaf.overflow != 0) {
+            if ((payload = malloc(btc.fields.tableLeaf.data_size)) == NULL) {
+                rc = CHIDB_ENOMEM;
+                break;
+            }
+            rc = chidb_Btree_readPayload(bt, &btc, 0, btc.fields.tableLeaf.data_size, payload);
+        }
+        if (rc == CHIDB_OK)
+            rc = chidb_DBRecord_unpack(&dbr, payload);
+        if (payload != btc.fields.tableLeaf.data)
+            free(payload);
+        if (rc != CHIDB_OK)
+            break;
+        if (entries->column >= dbr->nfields) {
+            rc = CHIDB_EMISUSE;
+        } else if (entries->n == entries->alloc &&
+                   (entries->cells = realloc(entries->cells, (entries->alloc = entries->alloc ? 2 * entries->alloc : 1024) * sizeof(BTreeCell))) == NULL) {
+            rc = CHIDB_ENOMEM;
+        } else {
+            BTreeCell *entry = &entries->cells[entries->n];
+            entry->type = PGTYPE_INDEX_LEAF;
+            (entry->fields).indexLeaf.keyPk = btc.key;
+            switch (chidb_DBRecord_getType(dbr, entries->column)) {
+            case SQL_NULL:
+                entries->n--;
+                break;
+            case SQL_INTEGER_1BYTE:
+                chidb_DBRecord_getInt8(dbr, entries->column, &v8);
+                entry->key = v8;
+                break;
+            case SQL_INTEGER_2BYTE:
+                chidb_DBRecord_getInt16(dbr, entries->column, &v16);
+                entry->key = v16;
+                break;
+            case SQL_INTEGER_4BYTE:
+                chidb_DBRecord_getInt32(dbr, entries->column, &v32);
+                entry->key = v32;
+                break;
+            default:
+                rc = CHIDB_EMISMATCH;
+            }
+            entries->n++;
+        }
+        chidb_DBRecord_destroy(dbr);
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return rc;
+}
+
+static int btree_cmp_entries(const void *a, const void *b)
+{
+    chidb_key_t ka = ((const BTreeCell *) a)->key, kb = ((const BTreeCell *) b)->key;
+    return (ka > kb) - (ka < kb);
+}
+
+static int btree_next_entry(void *arg, BTreeCell *cell)
+{
+    IndexEntries *entries = arg;
+
+    if (entries->next == entries->n)
+        return CHIDB_DONE;
+    *cell = entries->cells[entries->next++];
+    return CHIDB_OK;
+}
+
+
+/* Build an index of a table
+ *
+ * Fills an empty index B-Tree with an entry for each row of a table
+ * B-Tree: the value of an integer column of the row (rows where it is NULL
+ * are left out), and the key of the row. The entries are collected and
+ * sorted first, and then loaded in one go with chidb_Btree_bulkLoad
+ * (with BULKLOAD_INDEX_FILL), which is what CREATE INDEX does on a table
+ * that already has rows.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - ntable: Page number of the root node of the table B-Tree
+ * - column: Column of the table that is indexed
+ * - nindex: Page number of the root node of an empty index B-Tree
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EDUPLICATE: Two rows have the same value in the column
+ * - CHIDB_EMISMATCH: The column is not an integer column
+ * - CHIDB_EMISUSE: ntable is not a table B-Tree (or a row does not have
+ *                  that column), or nindex is not an empty index B-Tree
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_buildIndex(BTree *bt, npage_t ntable, uint8_t column, npage_t nindex)
+{
+    IndexEntries entries = {.column = column};
+    BTreeNode *btn;
+    int rc;
+
+    if ((rc = chidb_Btree_getNodeByPage(bt, nindex, &btn)) != CHIDB_OK)
+        return rc;
+    rc = btn->type == PGTYPE_INDEX_LEAF && btn->n_cells == 0 ? CHIDB_OK : CHIDB_EMISUSE;
+    chidb_Btree_freeMemNode(bt, btn);
+
+    if (rc == CHIDB_OK)
+        rc = btree_index_rows(bt, ntable, &entries);
+    if (rc == CHIDB_OK) {
+        qsort(entries.cells, entries.n, sizeof(BTreeCell), btree_cmp_entries);
+        rc = chidb_Btree_bulkLoad(bt, nindex, BULKLOAD_INDEX_FILL, btree_next_entry, &entries);
+    }
+    free(entries.cells);
+
+    return rc;
+}
@@ -54,7 +54,7 @@
 #define PGHEADER_FREE_OFFSET (1)
 #define PGHEADER_NCELLS_OFFSET (3)
 #define PGHEADER_CELL_OFFSET (5)
-#define PGHEADER_ZERO_OFFSET (7)
+#define PGHEADER_PREFIX_OFFSET (7)
 #define PGHEADER_RIGHTPG_OFFSET (8)
 
 #define LEAFPG_CELLSOFFSET_OFFSET (8)
@@ -71,6 +71,7 @@
 
 #define TABLEINTCELL_SIZE (8)
 #define TABLELEAFCELL_SIZE_WITHOUTDATA (8)
+#define TABLELEAFCELL_OVERFLOW_SIZE (4)
 
 #define INDEXINTCELL_CHILD_OFFSET (0)
 #define INDEXINTCELL_KEYIDX_OFFSET (8)
@@ -83,10 +84,116 @@
 #define INDEXINTCELL_SIZE (16)
 #define INDEXLEAFCELL_SIZE (12)
 
+/* Freelist. The file header points to the first freelist trunk page and
+ * holds the total number of free pages. Each trunk page holds the number
+ * of the next trunk page, and the numbers of up to FREELIST_MAX_LEAVES
+ * free "leaf" pages. */
+#define HEADER_FREELIST_TRUNK_OFFSET (32)
+#define HEADER_FREELIST_COUNT_OFFSET (36)
+
+#define FREELIST_NEXT_OFFSET (0)
+#define FREELIST_NLEAVES_OFFSET (4)
+#define FREELIST_LEAVES_OFFSET (8)
+#define FREELIST_MAX_LEAVES(page_size) (((page_size) - FREELIST_LEAVES_OFFSET) / 4)
+
+/* Percentage of each leaf filled by chidb_Btree_bulkLoad when building an
+ * index (leaving room for the entries of rows inserted later) */
+#define BULKLOAD_INDEX_FILL (90)
+
+/* File format read/write versions (header bytes 18 and 19). Files with
+ * compressed pages (see compress.c) use a version that SQLite, and older
+ * versions of chidb, refuse to read. */
+#define HEADER_WRITE_VERSION_OFFSET (18)
+#define HEADER_READ_VERSION_OFFSET (19)
+#define FORMAT_VERSION_LEGACY (1)
+#define FORMAT_VERSION_COMPRESSED (3)
+
+/* Sibling links. New files reserve BTREE_LINKS_SIZE bytes at the end of
+ * each page (header byte 20, as in SQLite), where table leaves store the
+ * page numbers of the previous and next leaves of their B-Tree (0 at
+ * either end), so that cursors can go from leaf to leaf directly. Files
+ * without reserved bytes have no links. */
+#define HEADER_RESERVED_OFFSET (20)
+#define BTREE_LINKS_SIZE (8)
+#define LINKS_PREV_OFFSET (0)
+#define LINKS_NEXT_OFFSET (4)
+
+/* Optional features of the file format, in a byte of the file header that
+ * SQLite reserves for expansion (and older versions of chidb leave as 0) */
+#define HEADER_FEATURES_OFFSET (72)
+#define FEATURE_OVERFLOW (0x01)
+
+/* Set once a row spills to overflow pages, so that range deletions (which
+ * must then read the leaves they detach, to free the overflow pages of
+ * their cells) can skip the leaves of files that never had large rows.
+ * Cleared by a vacuum that finds no overflow pages. */
+#define FEATURE_SPILLED (0x02)
+
+/* Packed index nodes. In files with FEATURE_PACKED_INDEX, each index node
+ * stores the leading bytes that the keys of its cells share (its prefix)
+ * only once, in the last INDEX_PREFIX_SIZE bytes before the usable end of
+ * its page, and its cells only hold the remaining bytes of their keys
+ * (the key suffix), without the header of the cells of other files:
+ *
+ *   leaf cell:     [key suffix (4 - p bytes)][primary key (4 bytes)]
+ *   internal cell: [child page (4 bytes)][key suffix][primary key]
+ *
+ * where p, the length of the prefix (0 to INDEX_MAX_PREFIX), is stored in
+ * byte 7 of the page header (which is 0 in other nodes). All the cells of
+ * a node have the same size. Inserting a key that does not start with the
+ * prefix shortens it, and rewrites the cells of the node with longer
+ * suffixes (see chidb_Btree_insertCell). */
+#define FEATURE_PACKED_INDEX (0x04)
+#define INDEX_PREFIX_SIZE (4)
+#define INDEX_MAX_PREFIX (3)
+#define PACKEDINTCELL_SUFFIX_OFFSET (4)
+#define PACKEDLEAFCELL_SUFFIX_OFFSET (0)
+
+/* Overflow pages. In files with FEATURE_OVERFLOW, the payload of a table
+ * leaf cell that is larger than max_local bytes is split, as in SQLite,
+ * into a local prefix (see chidb_Btree_localSize), followed in the cell by
+ * the number of the first page of a chain of overflow pages that hold the
+ * rest. Each overflow page holds the number of the next one (0 in the
+ * last one), followed by up to usable_size - 4 bytes of payload. max_local
+ * and min_local come from the maximum and minimum embedded payload
+ * fractions of the file header (bytes 21 and 22). */
+#define HEADER_MAX_FRACTION_OFFSET (21)
+#define HEADER_MIN_FRACTION_OFFSET (22)
+#define OVERFLOW_NEXT_OFFSET (0)
+#define OVERFLOW_DATA_OFFSET (4)
+
+/* Smallest number of bytes of a page that nodes can use (as in SQLite) */
+#define MIN_USABLE_SIZE (480)
+
 // Advance declarations
 typedef struct BTreeCell BTreeCell;
 typedef struct BTreeNode BTreeNode;
 
+/* Rightmost leaf of a B-Tree, remembered so that keys larger than any in
+ * the B-Tree (such as new rowids) can be appended to it without searching
+ * for it from the root (see chidb_Btree_insert) */
+typedef struct BTreeAppend
+{
+    npage_t nroot;              /* Root of the B-Tree (0 if the slot is unused) */
+    npage_t nleaf;              /* Its rightmost leaf */
+    chidb_key_t max_key;        /* Largest key in the B-Tree (the last one of nleaf) */
+    uint32_t change_count;      /* Pager change_count when it was remembered */
+} BTreeAppend;
+
+/* Number of B-Trees whose rightmost leaf is remembered (by root page) */
+#define BTREE_APPEND_SLOTS (16)
+
+/* Percentage of the cells of a node that stay in it (in the left node)
+ * when an append splits it, instead of half of them, so that B-Trees that
+ * grow by appends are left with nearly full nodes */
+#define BTREE_APPEND_SPLIT (90)
+
+/* Default percentage of its space below which a node that entries have
+ * been deleted from is merged with a sibling, or given some of its cells
+ * (see chidb_Btree_delete). Nodes above it are left alone, so that most
+ * deletions only write the leaf they delete from. */
+#define BTREE_MIN_FILL (40)
+
 /* The BTree struct represent a "B-Tree file". It contains a pointer to the
  * chidb database it is a part of, and a pointer to a Pager, which it will
  * use to access pages on the file */
@@ -94,14 +201,24 @@ typedef struct BTree
 {
     chidb *db;
     Pager *pager;
+    uint32_t usable_size;       /* Bytes of each page before the reserved ones */
+    bool linked;                /* Table leaves are linked to their siblings */
+    uint32_t max_local;         /* Largest payload stored whole in a table leaf
+                                   cell (0 if the file has no overflow pages) */
+    uint32_t min_local;         /* Smallest local prefix of a payload that spills */
+    bool spilled;               /* See FEATURE_SPILLED */
+    bool packed_index;          /* See FEATURE_PACKED_INDEX */
+    uint8_t min_fill;           /* See BTREE_MIN_FILL */
+    BTreeAppend appends[BTREE_APPEND_SLOTS];
 } Btree;
 
 /* The BTreeNode struct is an in-memory representation of a B-Tree node. Thus,
  * most of the values in this struct are simply a copy, for ease of access,
  * of what can be found in the raw disk page. When modifying type, free_offset,
- * n_cells, cells_offset, or right_page, do so in the corresponding field
- * of the BTreeNode variable (the changes will be effective once the BTreeNode
- * is written to disk, using chidb_Btree_writeNode). Modifications of the
+ * n_cells, cells_offset, right_page, prev_leaf or next_leaf, do so in the
+ * corresponding field of the BTreeNode variable (the changes will be
+ * effective once the BTreeNode is written to disk, using
+ * chidb_Btree_writeNode). Modifications of the
  * cell offset array or of the cells should be done directly on the in-memory
  * page returned by the Pager.
  *
@@ -112,13 +229,36 @@ struct BTreeNode
 {
     MemPage *page;             /* In-memory page returned by the Pager */
     uint8_t type;              /* Type of page  */
-    uint16_t free_offset;      /* Byte offset of free space in page */
+    uint32_t free_offset;      /* Byte offset of free space in page */
     ncell_t n_cells;           /* Number of cells */
-    uint16_t cells_offset;     /* Byte offset of start of cells in page */
+    uint32_t cells_offset;     /* Byte offset of start of cells in page (65536
+                                  in an empty node of a 64 KiB page, which is
+                                  stored as 0 in the page header) */
     npage_t right_page;        /* Right page (internal nodes only) */
     uint8_t *celloffset_array; /* Pointer to start of cell offset array in the in-memory page */
+    uint32_t links_offset;     /* Byte offset of the sibling links (0 if the
+                                  file has none) */
+    npage_t prev_leaf;         /* Previous and next leaves of the B-Tree */
+    npage_t next_leaf;         /* (linked table leaves only, 0 otherwise) */
+    uint32_t usable_size;      /* Copies of the fields of the BTree, which */
+    uint32_t max_local;        /* are needed to find out the size of table */
+    uint32_t min_local;        /* leaf cells (see chidb_Btree_localSize) */
+    bool packed;               /* Packed index node (see FEATURE_PACKED_INDEX) */
+    uint8_t prefix_len;        /* Length of its prefix (0 in other nodes) */
 };
 
+/* Decoded form of an internal node, kept in the decoded field of its
+ * MemPage (see chidb_Btree_searchNode): the keys of its cells, in the
+ * format of keysearch.h (i.e., contiguous, aligned, and padded to whole
+ * blocks), and their child pages. Both arrays are in the same allocation
+ * as the struct. */
+typedef struct BTreeNodeKeys
+{
+    ncell_t n_cells;
+    int32_t *keys;
+    npage_t *children;
+} BTreeNodeKeys;
+
 /* BTreeCell is an in-memory representation of a cell. See The chidb File Format
  * document for more details on the meaning of each field */
 struct BTreeCell
@@ -133,8 +273,12 @@ struct BTreeCell
         } tableInternal;
         struct
         {
-            uint32_t data_size;  /* Number of bytes of data stored in this cell */
-            uint8_t *data;       /* Pointer to in-memory copy of data stored in this cell */
+            uint32_t data_size;  /* Number of bytes of data (payload) of this cell */
+            uint8_t *data;       /* Pointer to in-memory copy of data stored in this cell
+                                    (only the first local_size bytes, in cells read
+                                    from a node whose payload spills) */
+            uint32_t local_size; /* Number of bytes of data stored in the node */
+            npage_t overflow;    /* First overflow page (0 if the payload does not spill) */
         } tableLeaf;
         struct
         {
@@ -148,8 +292,7 @@ struct BTreeCell
     } fields;
 };
 
-// basic linked list data structure for keeping track of our traversal path
-// when doing insertions
+// basic linked list data structure for keeping track of a cursor's path
 typedef struct ll_node {
     struct ll_node *prev;
     void *val;
@@ -164,24 +307,51 @@ typedef struct ll {
 BTreeNode chidb_Btree_createNode(BTree *bt, npage_t npage, uint8_t type);
 
 int chidb_Btree_open(const char *filename, chidb *db, BTree **bt);
+int chidb_Btree_openWithFlags(const char *filename, chidb *db, BTree **bt, int flags);
+int chidb_Btree_openWithPageSize(const char *filename, chidb *db, BTree **bt, int flags, uint32_t page_size);
 int chidb_Btree_close(BTree *bt);
+int chidb_Btree_begin(BTree *bt);
+int chidb_Btree_commit(BTree *bt);
+int chidb_Btree_rollback(BTree *bt);
 
 int chidb_Btree_getNodeByPage(BTree *bt, npage_t npage, BTreeNode **node);
 int chidb_Btree_freeMemNode(BTree *bt, BTreeNode *btn);
 
 void chidb_Btree_syncNode(BTreeNode *btn);
+int chidb_Btree_allocatePage(BTree *bt, npage_t *npage);
+int chidb_Btree_freePage(BTree *bt, npage_t npage);
+int chidb_Btree_freePages(BTree *bt, npage_t *npages, uint32_t n);
+int chidb_Btree_getFreelistCount(BTree *bt, uint32_t *nfree);
+int chidb_Btree_vacuum(BTree *bt);
+int chidb_Btree_incrementalVacuum(BTree *bt, uint32_t npages);
+
 int chidb_Btree_newNode(BTree *bt, npage_t *npage, uint8_t type);
 int chidb_Btree_initEmptyNode(BTree *bt, npage_t npage, uint8_t type);
 int chidb_Btree_writeNode(BTree *bt, BTreeNode *node);
 
 int chidb_Btree_getCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell);
+uint32_t chidb_Btree_localSize(BTree *bt, uint32_t data_size);
+int chidb_Btree_readPayload(BTree *bt, BTreeCell *cell, uint32_t offset, uint32_t size, uint8_t *buf);
+chidb_key_t chidb_Btree_getCellKey(BTreeNode *btn, ncell_t ncell);
+npage_t chidb_Btree_getChildPage(BTreeNode *btn, ncell_t ncell);
+ncell_t chidb_Btree_searchNode(BTreeNode *btn, chidb_key_t key);
 int chidb_Btree_insertCell(BTreeNode *btn, ncell_t ncell, BTreeCell *cell);
+int chidb_Btree_removeCell(BTreeNode *btn, ncell_t ncell);
 
-int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint16_t *size);
+int chidb_Btree_find(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t **data, uint32_t *size);
 
-int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint16_t size);
+int chidb_Btree_insertInTable(BTree *bt, npage_t nroot, chidb_key_t key, uint8_t *data, uint32_t size);
 int chidb_Btree_insertInIndex(BTree *bt, npage_t nroot, chidb_key_t keyIdx, chidb_key_t keyPk);
 int chidb_Btree_insert(BTree *bt, npage_t nroot, BTreeCell *btc);
 int chidb_Btree_insertNonFull(BTree *bt, BTreeNode *btn, BTreeCell *to_insert, npage_t right_child);
 
+int chidb_Btree_setMinFill(BTree *bt, uint8_t min_fill);
+int chidb_Btree_delete(BTree *bt, npage_t nroot, chidb_key_t key);
+int chidb_Btree_deleteRange(BTree *bt, npage_t nroot, chidb_key_t lo, chidb_key_t hi);
+
+/* Returns the next entry of a bulk load (see chidb_Btree_bulkLoad) */
+typedef int (*chidb_Btree_loadNext)(void *arg, BTreeCell *cell);
+int chidb_Btree_bulkLoad(BTree *bt, npage_t nroot, uint8_t fill, chidb_Btree_loadNext next, void *arg);
+int chidb_Btree_buildIndex(BTree *bt, npage_t ntable, uint8_t column, npage_t nindex);
+
 #endif /*BTREE_H_*/
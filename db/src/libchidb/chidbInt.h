@@ -63,9 +63,22 @@
 
 
 #define DEFAULT_PAGE_SIZE (1024)
+#define MIN_PAGE_SIZE (512)
+#define MAX_PAGE_SIZE (65536)
+
+/* Alignment of the buffers that pages are read into and written from,
+ * as required by O_DIRECT (CHIDB_OPEN_DIRECT) */
+#define IO_BUFFER_ALIGN (4096)
 
 #define MAX_STR_LEN (256)
 
+/* Fields of the records of the schema table (in page 1): type, name,
+ * tbl_name, rootpage, and sql */
+#define SCHEMA_NAME_FIELD (1)
+#define SCHEMA_TBL_NAME_FIELD (2)
+#define SCHEMA_ROOTPAGE_FIELD (3)
+#define SCHEMA_SQL_FIELD (4)
+
 typedef uint16_t ncell_t;
 typedef uint32_t npage_t;
 typedef uint32_t chidb_key_t;
@@ -84,6 +97,7 @@ typedef struct BTree BTree;
 struct chidb
 {
     BTree   *bt;
+    bool    in_transaction;     /* BEGIN was run, and not yet COMMIT/ROLLBACK */
 };
 
 #endif /*CHIDBINT_H_*/
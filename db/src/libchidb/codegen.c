@@ -37,18 +37,270 @@
  *
  */
 
+#include <strings.h>
 #include <chidb/chidb.h>
 #include <chisql/chisql.h>
 #include "dbm.h"
 #include "util.h"
+#include "record.h"
 
-  /* ...code... */
+/* Finds the schema record of a table in the schema B-Tree (or in its
+ * subtree rooted at npage), and returns its root page and the SQL that
+ * created it. *nroot is left as it is if the table is not found, and
+ * *indexed is set to true if the schema has an index on the table. */
+static int codegen_find_table(BTree *bt, npage_t npage, const char *name, npage_t *nroot, char **sql,
+                              bool *indexed)
+{
+    BTreeNode *btn;
+    BTreeCell cell;
+    DBRecord *dbr;
+    char *tname;
+    int32_t root;
+    int rc;
+
+    if ((rc = chidb_Btree_getNodeByPage(bt, npage, &btn)) != CHIDB_OK)
+        return rc;
+
+    for (ncell_t i = 0; i <= btn->n_cells && rc == CHIDB_OK; i++)
+    {
+        if (btn->type == PGTYPE_TABLE_INTERNAL)
+        {
+            rc = codegen_find_table(bt, chidb_Btree_getChildPage(btn, i), name, nroot, sql, indexed);
+            continue;
+        }
+        if (i == btn->n_cells)
+            break;
+
+        /* The SQL of long schema records spills to overflow pages */
+        chidb_Btree_getCell(btn, i, &cell);
+        uint8_t *payload = cell.fields.tableLeaf.data;
+        if (cell.fields.tableLeaf.overflow != 0)
+        {
+            if ((payload = malloc(cell.fields.tableLeaf.data_size)) == NULL)
+            {
+                rc = CHIDB_ENOMEM;
+                break;
+            }
+            rc = chidb_Btree_readPayload(bt, &cell, 0, cell.fields.tableLeaf.data_size, payload);
+        }
+        if (rc == CHIDB_OK)
+            rc = chidb_DBRecord_unpack(&dbr, payload);
+        if (payload != cell.fields.tableLeaf.data)
+            free(payload);
+        if (rc != CHIDB_OK)
+            break;
+        if (chidb_DBRecord_getType(dbr, 0) == SQL_TEXT &&
+            chidb_DBRecord_getType(dbr, SCHEMA_NAME_FIELD) == SQL_TEXT &&
+            chidb_DBRecord_getType(dbr, SCHEMA_SQL_FIELD) == SQL_TEXT)
+        {
+            char *type;
+            chidb_DBRecord_getString(dbr, 0, &type);
+            chidb_DBRecord_getString(dbr, SCHEMA_NAME_FIELD, &tname);
+            if (!strcmp(type, "table") && !strcasecmp(tname, name) && *nroot == 0 &&
+                chidb_DBRecord_getInt32(dbr, SCHEMA_ROOTPAGE_FIELD, &root) == CHIDB_OK)
+            {
+                *nroot = root;
+                chidb_DBRecord_getString(dbr, SCHEMA_SQL_FIELD, sql);
+            }
+            free(tname);
+
+            /* The table an index is on is in its tbl_name field */
+            if (!strcmp(type, "index") && chidb_DBRecord_getType(dbr, SCHEMA_TBL_NAME_FIELD) == SQL_TEXT)
+            {
+                chidb_DBRecord_getString(dbr, SCHEMA_TBL_NAME_FIELD, &tname);
+                if (!strcasecmp(tname, name))
+                    *indexed = true;
+                free(tname);
+            }
+            free(type);
+        }
+        chidb_DBRecord_destroy(dbr);
+    }
+
+    chidb_Btree_freeMemNode(bt, btn);
+    return rc;
+}
+
+
+/* Returns the name of the INTEGER PRIMARY KEY column of a table (whose
+ * values are the keys of its B-Tree), given the SQL that created it, or
+ * NULL if it does not have one */
+static char *codegen_primary_key(const char *sql)
+{
+    chisql_statement_t *create;
+    char *pk = NULL;
+
+    if (chisql_parser(sql, &create) != CHIDB_OK)
+        return NULL;
+    if (create->type != STMT_CREATE)
+    {
+        free(create->text);
+        free(create);
+        return NULL;
+    }
+
+    if (create->stmt.create->t == CREATE_TABLE)
+        for (Column_t *col = create->stmt.create->table->columns; col && !pk; col = col->next)
+            for (Constraint_t *cons = col->constraints; cons && !pk; cons = cons->next)
+                if (cons->t == CONS_PRIMARY_KEY && col->type == TYPE_INT)
+                    pk = strdup(col->name);
+
+    Create_free(create->stmt.create);
+    free(create->text);
+    free(create);
+    return pk;
+}
+
+
+/* Returns true if an expression is a reference to a column */
+static bool codegen_is_column(Expression_t *expr, const char *column)
+{
+    if (expr->t != EXPR_TERM)
+        return false;
+    if (expr->expr.term.t == TERM_COLREF)
+        return !strcasecmp(expr->expr.term.ref->columnName, column);
+    if (expr->expr.term.t == TERM_ID)
+        return !strcasecmp(expr->expr.term.id, column);
+    return false;
+}
+
+static bool codegen_is_integer(Expression_t *expr)
+{
+    return expr->t == EXPR_TERM && expr->expr.term.t == TERM_LITERAL &&
+           expr->expr.term.val->t == TYPE_INT;
+}
+
+
+/* Narrows the range of keys [*lo, *hi] to the ones that satisfy a WHERE
+ * condition on the primary key of a table: comparisons between the key
+ * and integers (in either order), and ANDs of them. Returns false if the
+ * condition has any other form. */
+static bool codegen_key_range(Condition_t *cond, const char *pk, int64_t *lo, int64_t *hi)
+{
+    Expression_t *key, *value;
+    enum CondType t = cond->t;
+
+    if (t == RA_COND_AND)
+        return codegen_key_range(cond->cond.binary.cond1, pk, lo, hi) &&
+               codegen_key_range(cond->cond.binary.cond2, pk, lo, hi);
+    if (t != RA_COND_EQ && t != RA_COND_LT && t != RA_COND_GT &&
+        t != RA_COND_LEQ && t != RA_COND_GEQ)
+        return false;
+
+    key = cond->cond.comp.expr1;
+    value = cond->cond.comp.expr2;
+    if (!codegen_is_column(key, pk))
+    {
+        /* 5 < pk is pk > 5 */
+        key = cond->cond.comp.expr2;
+        value = cond->cond.comp.expr1;
+        t = t == RA_COND_LT ? RA_COND_GT : t == RA_COND_GT ? RA_COND_LT :
+            t == RA_COND_LEQ ? RA_COND_GEQ : t == RA_COND_GEQ ? RA_COND_LEQ : t;
+    }
+    if (!codegen_is_column(key, pk) || !codegen_is_integer(value))
+        return false;
+
+    int64_t v = value->expr.term.val->val.ival;
+    if ((t == RA_COND_EQ || t == RA_COND_GT || t == RA_COND_GEQ) && *lo < (t == RA_COND_GT ? v + 1 : v))
+        *lo = t == RA_COND_GT ? v + 1 : v;
+    if ((t == RA_COND_EQ || t == RA_COND_LT || t == RA_COND_LEQ) && *hi > (t == RA_COND_LT ? v - 1 : v))
+        *hi = t == RA_COND_LT ? v - 1 : v;
+    return true;
+}
+
+
+/* DELETE statements whose WHERE clause selects a range of primary keys
+ * (such as DELETE FROM t WHERE pk < x) delete the range in one go (see
+ * the DeleteRange instruction), instead of visiting the rows to delete.
+ * The range is only detached from the table B-Tree, so tables with
+ * indexes are not handled here (their indexes would keep entries for the
+ * deleted rows). Returns false if the statement is not one of them. */
+static bool codegen_delete_range(chidb_stmt *stmt, Delete_t *del, int *rc)
+{
+    npage_t nroot = 0;
+    char *sql = NULL, *pk = NULL;
+    int64_t lo = 0, hi = UINT32_MAX;
+    bool indexed = false;
+    int opnum = 0;
+
+    *rc = codegen_find_table(stmt->db->bt, 1, del->table_name, &nroot, &sql, &indexed);
+    if (*rc != CHIDB_OK || nroot == 0 || indexed)
+    {
+        free(sql);
+        return *rc != CHIDB_OK;
+    }
+    pk = codegen_primary_key(sql);
+    free(sql);
+    if (pk == NULL || del->where == NULL || !codegen_key_range(del->where, pk, &lo, &hi))
+    {
+        free(pk);
+        return false;
+    }
+    free(pk);
+
+    /* Registers hold 32-bit integers: a range with no upper end is given
+     * a NULL one, and ranges that start above INT32_MAX are not handled */
+    if (lo > INT32_MAX)
+        return false;
+    chidb_dbm_op_t ops[] = {
+            {lo > 0 ? Op_Integer : Op_Null, lo > 0 ? lo : 0, 0, 0, NULL},
+            {hi <= INT32_MAX ? Op_Integer : Op_Null, hi <= INT32_MAX ? hi : 0, 1, 0, NULL},
+            {Op_DeleteRange, nroot, 0, 1, NULL},
+            {Op_Halt, 0, 0, 0, NULL},
+    };
+
+    /* Empty ranges delete nothing */
+    stmt->nCols = 0;
+    for(int i = lo > hi || hi < 0 ? 3 : 0; i < 4; i++)
+        chidb_stmt_set_op(stmt, &ops[i], opnum++);
+
+    return true;
+}
 
 int chidb_stmt_codegen(chidb_stmt *stmt, chisql_statement_t *sql_stmt)
 {
     int opnum = 0;
     int nOps;
 
+    /* Transaction control statements are a single instruction */
+    if (sql_stmt->type == STMT_BEGIN || sql_stmt->type == STMT_COMMIT ||
+        sql_stmt->type == STMT_ROLLBACK)
+    {
+        chidb_dbm_op_t txn_ops[] = {
+                {sql_stmt->type == STMT_BEGIN ? Op_Begin :
+                 sql_stmt->type == STMT_COMMIT ? Op_Commit : Op_Rollback, 0, 0, 0, NULL},
+                {Op_Halt, 0, 0, 0, NULL},
+        };
+
+        stmt->nCols = 0;
+        for(int i=0; i < 2; i++)
+            chidb_stmt_set_op(stmt, &txn_ops[i], opnum++);
+
+        return CHIDB_OK;
+    }
+
+    if (sql_stmt->type == STMT_VACUUM || sql_stmt->type == STMT_INCREMENTAL_VACUUM)
+    {
+        chidb_dbm_op_t vacuum_ops[] = {
+                {Op_Vacuum, sql_stmt->type == STMT_INCREMENTAL_VACUUM,
+                 sql_stmt->type == STMT_INCREMENTAL_VACUUM ? sql_stmt->stmt.vacuum_pages : 0, 0, NULL},
+                {Op_Halt, 0, 0, 0, NULL},
+        };
+
+        stmt->nCols = 0;
+        for(int i=0; i < 2; i++)
+            chidb_stmt_set_op(stmt, &vacuum_ops[i], opnum++);
+
+        return CHIDB_OK;
+    }
+
+    if (sql_stmt->type == STMT_DELETE)
+    {
+        int rc;
+        if (codegen_delete_range(stmt, sql_stmt->stmt.delete, &rc))
+            return rc;
+    }
+
     /* Manually load a program that just produces five result rows, with
      * three columns: an integer identifier, the SQL query (text), and NULL. */
 
@@ -0,0 +1,344 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module implements the page compression used by the pager when a
+ * database is created with CHIDB_OPEN_COMPRESS: a small LZ77 codec (in
+ * the style of LZ4, with no external dependencies), and the format of
+ * the compressed page images stored in the file.
+ *
+ * Codec. The compressed data is a sequence of sequences, each of them a
+ * run of literal bytes followed by a match (a copy of earlier output):
+ *
+ *   token (1 byte)     High 4 bits: number of literals
+ *                      Low 4 bits: length of the match, minus LZ_MIN_MATCH
+ *   [length bytes]     If a length in the token is 15, the rest of it
+ *                      follows as a run of 255s ended by a smaller byte
+ *   literals
+ *   offset (2 bytes)   Little-endian distance back to the match
+ *   [length bytes]     Rest of the match length, as above
+ *
+ * The last sequence ends after its literals. Matches are found with a
+ * hash table of the positions of 4-byte strings, and are extended as
+ * far as they go (greedy parsing), which is fast and good enough for
+ * B-Tree pages: the repeated parts of records, the zeroes of the free
+ * space, and text.
+ *
+ * Page images. Every page still takes up page_size bytes of the file, at
+ * the usual offset, so that page numbers and the file size work as they
+ * do without compression. A page is stored as:
+ *
+ *      0  COMPRESS_MAGIC (2 bytes)
+ *      2  Length of the compressed data (2 bytes)
+ *      4  Compressed data
+ *
+ * and the rest of its slot is not used (and neither read nor written).
+ * A page that does not compress to less than page_size bytes is stored
+ * as is. This is told apart from a compressed image by its first two
+ * bytes, which in chidb are never COMPRESS_MAGIC: the first byte of a
+ * page is the type of a B-Tree node, or the high byte of a page number
+ * (in freelist pages), and page 1 (the file header) is never compressed.
+ *
+ */
+
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <string.h>
+#include <stdlib.h>
+#include "compress.h"
+#include "util.h"
+
+#define LZ_MIN_MATCH (4)
+#define LZ_MAX_OFFSET (65535)
+#define LZ_HASH_BITS (12)
+#define LZ_NO_POSITION (UINT32_MAX)
+
+
+static inline uint32_t lz_read32(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, sizeof(v));
+    return v;
+}
+
+static inline uint32_t lz_hash(uint32_t v)
+{
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+/* Writes what does not fit in a token of a length */
+static uint8_t *lz_put_length(uint8_t *op, size_t len)
+{
+    for (; len >= 255; len -= 255)
+        *op++ = 255;
+    *op++ = len;
+    return op;
+}
+
+/* Reads the rest of a length that did not fit in a token */
+static int lz_get_length(const uint8_t **ip, const uint8_t *end, size_t *len)
+{
+    uint8_t b;
+
+    do
+    {
+        if (*ip == end)
+            return CHIDB_ECORRUPT;
+        b = *(*ip)++;
+        *len += b;
+    } while (b == 255);
+
+    return CHIDB_OK;
+}
+
+/* Writes a sequence (a match length of 0 means the last sequence, which
+ * has no match), or returns NULL if it does not fit before op_end */
+static uint8_t *lz_put_sequence(uint8_t *op, uint8_t *op_end, const uint8_t *lit, size_t nlit,
+                                size_t offset, size_t mlen)
+{
+    size_t mcode = mlen > 0 ? mlen - LZ_MIN_MATCH : 0;
+
+    if ((size_t) (op_end - op) < 1 + (nlit / 255 + 1) + nlit + 2 + (mcode / 255 + 1))
+        return NULL;
+
+    *op++ = (nlit < 15 ? nlit : 15) << 4 | (mcode < 15 ? mcode : 15);
+    if (nlit >= 15)
+        op = lz_put_length(op, nlit - 15);
+    memcpy(op, lit, nlit);
+    op += nlit;
+
+    if (mlen == 0)
+        return op;
+
+    *op++ = offset & 0xff;
+    *op++ = offset >> 8;
+    if (mcode >= 15)
+        op = lz_put_length(op, mcode - 15);
+
+    return op;
+}
+
+
+/* Compress a buffer
+ *
+ * Parameters
+ * - src: Data to compress
+ * - len: Length of src
+ * - dst: Buffer for the compressed data
+ * - cap: Size of dst
+ *
+ * Return
+ * - Length of the compressed data, or 0 if it does not fit in cap bytes
+ */
+size_t chidb_Compress_lz(const uint8_t *src, size_t len, uint8_t *dst, size_t cap)
+{
+    uint32_t table[1 << LZ_HASH_BITS];
+    const uint8_t *ip = src, *anchor = src, *end = src + len;
+    uint8_t *op = dst, *op_end = dst + cap;
+
+    memset(table, 0xff, sizeof(table));
+
+    while (len >= LZ_MIN_MATCH && ip <= end - LZ_MIN_MATCH)
+    {
+        uint32_t seq = lz_read32(ip);
+        uint32_t h = lz_hash(seq);
+        uint32_t ref = table[h];
+
+        table[h] = ip - src;
+        if (ref == LZ_NO_POSITION || (ip - src) - ref > LZ_MAX_OFFSET || lz_read32(src + ref) != seq)
+        {
+            ip++;
+            continue;
+        }
+
+        size_t mlen = LZ_MIN_MATCH;
+        while (ip + mlen < end && src[ref + mlen] == ip[mlen])
+            mlen++;
+
+        if ((op = lz_put_sequence(op, op_end, anchor, ip - anchor, (ip - src) - ref, mlen)) == NULL)
+            return 0;
+        ip += mlen;
+        anchor = ip;
+    }
+
+    if ((op = lz_put_sequence(op, op_end, anchor, end - anchor, 0, 0)) == NULL)
+        return 0;
+
+    return op - dst;
+}
+
+
+/* Decompress a buffer
+ *
+ * Parameters
+ * - src: Compressed data
+ * - len: Length of src
+ * - dst: Buffer for the decompressed data
+ * - dst_len: Exact length of the decompressed data
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The compressed data is not valid, or does not
+ *   decompress to exactly dst_len bytes
+ */
+int chidb_Compress_unlz(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len)
+{
+    const uint8_t *ip = src, *end = src + len;
+    uint8_t *op = dst, *op_end = dst + dst_len;
+
+    while (ip < end)
+    {
+        uint8_t token = *ip++;
+        size_t nlit = token >> 4, mlen = token & 0x0f, offset;
+
+        if (nlit == 15 && lz_get_length(&ip, end, &nlit) != CHIDB_OK)
+            return CHIDB_ECORRUPT;
+        if ((size_t) (end - ip) < nlit || (size_t) (op_end - op) < nlit)
+            return CHIDB_ECORRUPT;
+        memcpy(op, ip, nlit);
+        op += nlit;
+        ip += nlit;
+
+        if (ip == end)
+            break;
+
+        if (end - ip < 2)
+            return CHIDB_ECORRUPT;
+        offset = ip[0] | ip[1] << 8;
+        ip += 2;
+        if (mlen == 15 && lz_get_length(&ip, end, &mlen) != CHIDB_OK)
+            return CHIDB_ECORRUPT;
+        mlen += LZ_MIN_MATCH;
+        if (offset == 0 || offset > (size_t) (op - dst) || (size_t) (op_end - op) < mlen)
+            return CHIDB_ECORRUPT;
+
+        /* A match may overlap the bytes it produces (e.g., a run of zeroes) */
+        if (offset >= mlen)
+            memcpy(op, op - offset, mlen);
+        else
+            for (size_t i = 0; i < mlen; i++)
+                op[i] = op[i - offset];
+        op += mlen;
+    }
+
+    return op == op_end ? CHIDB_OK : CHIDB_ECORRUPT;
+}
+
+
+/* Build the image of a page that is stored in the file
+ *
+ * Parameters
+ * - npage: Page number
+ * - page: Contents of the page
+ * - page_size: Size of a page
+ * - buf: Buffer of page_size bytes, for the image of a compressed page
+ * - len: Out parameter. Number of bytes of the image (page_size if the
+ *        page is stored uncompressed).
+ *
+ * Return
+ * - The image: buf if the page is compressed, or page itself
+ */
+uint8_t *chidb_Compress_page(npage_t npage, uint8_t *page, uint32_t page_size, uint8_t *buf, uint32_t *len)
+{
+    size_t n = 0;
+
+    /* Page 1 is read before the file is known to be compressed */
+    if (npage != 1)
+        n = chidb_Compress_lz(page, page_size, buf + COMPRESS_HEADER_SIZE,
+                              page_size - COMPRESS_HEADER_SIZE - 1);
+
+    if (n == 0)
+    {
+        *len = page_size;
+        return page;
+    }
+
+    put2byte(buf, COMPRESS_MAGIC);
+    put2byte(buf + 2, n);
+    *len = n + COMPRESS_HEADER_SIZE;
+    return buf;
+}
+
+
+/* Number of bytes of a page image
+ *
+ * Parameters
+ * - image: Start of the image
+ * - n: Number of bytes of the image available in image (at least
+ *      COMPRESS_HEADER_SIZE, unless the image is shorter than that)
+ * - page_size: Size of a page
+ *
+ * Return
+ * - Number of bytes that the image takes up in the file
+ */
+uint32_t chidb_Compress_imageSize(const uint8_t *image, uint32_t n, uint32_t page_size)
+{
+    if (n >= COMPRESS_HEADER_SIZE && get2byte(image) == COMPRESS_MAGIC &&
+        get2byte(image + 2) + COMPRESS_HEADER_SIZE < page_size)
+        return get2byte(image + 2) + COMPRESS_HEADER_SIZE;
+
+    return page_size;
+}
+
+
+/* Recover the contents of a page from its image
+ *
+ * Parameters
+ * - image: Image of the page, as read from the file
+ * - len: Number of bytes read. An uncompressed image shorter than a page
+ *        (at the end of the file) is padded with zeroes.
+ * - page: Buffer of page_size bytes for the contents of the page
+ * - page_size: Size of a page
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The image is truncated or not valid
+ */
+int chidb_Compress_expand(const uint8_t *image, uint32_t len, uint8_t *page, uint32_t page_size)
+{
+    uint32_t size = chidb_Compress_imageSize(image, len, page_size);
+
+    if (size == page_size)
+    {
+        uint32_t n = len < page_size ? len : page_size;
+        memcpy(page, image, n);
+        memset(page + n, 0, page_size - n);
+        return CHIDB_OK;
+    }
+
+    if (len < size)
+        return CHIDB_ECORRUPT;
+
+    return chidb_Compress_unlz(image + COMPRESS_HEADER_SIZE, size - COMPRESS_HEADER_SIZE, page, page_size);
+}
@@ -0,0 +1,62 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Page compression header. See compress.c for more details.
+ *
+ */
+
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef COMPRESS_H_
+#define COMPRESS_H_
+
+#include "chidbInt.h"
+
+/* A compressed page image starts with a magic number and the length of
+ * the compressed data that follows it */
+#define COMPRESS_MAGIC (0xC55A)
+#define COMPRESS_HEADER_SIZE (4)
+
+/* Number of bytes of a page image read before its length is known: enough
+ * for most compressed pages, and no more than one filesystem block */
+#define COMPRESS_PROBE_SIZE (4096)
+
+size_t chidb_Compress_lz(const uint8_t *src, size_t len, uint8_t *dst, size_t cap);
+int chidb_Compress_unlz(const uint8_t *src, size_t len, uint8_t *dst, size_t dst_len);
+uint8_t *chidb_Compress_page(npage_t npage, uint8_t *page, uint32_t page_size, uint8_t *buf, uint32_t *len);
+uint32_t chidb_Compress_imageSize(const uint8_t *image, uint32_t n, uint32_t page_size);
+int chidb_Compress_expand(const uint8_t *image, uint32_t len, uint8_t *page, uint32_t page_size);
+
+#endif /*COMPRESS_H_*/
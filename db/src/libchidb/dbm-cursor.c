@@ -41,78 +41,210 @@
 #include "dbm-cursor.h"
 #include <chidb/log.h>
 
-int chidb_dbm_init_cursor(chidb_dbm_cursor_t *cursor, char *dbfile, chidb *db, npage_t root) {
-  if (root != 1) {
-    chilog(ERROR, "opening bt with root page != 1 not yet implemented. root: %d", root);
-    exit(1);
-  }
-  BTree *bt = malloc(sizeof(Btree));
-  chidb_Btree_open(dbfile, db, &bt);
-  cursor->bt = bt;
+// cursors borrow the B-Tree file (and thus the pager) of the database, so
+// every cursor of every statement on it shares one page cache and one fd
+int chidb_dbm_init_cursor(chidb_dbm_cursor_t *cursor, chidb *db, npage_t root) {
+  cursor->bt = db->bt;
+  cursor->root = root;
+  chidb_Pager_initReadAhead(&cursor->ra);
   (cursor->path).head = NULL;
   (cursor->path).tail = NULL;
   return CHIDB_OK;
 }
 
-int chidb_dbm_free_cursor(chidb_dbm_cursor_t *cursor) {
-  // free cursor path
+// release every node of the cursor path
+static void cursor_clear(chidb_dbm_cursor_t *cursor) {
   ll_node *curr, *next;
   curr = (cursor->path).head;
   while (curr != NULL) {
     next = curr->next;
     cell_cursor *node = (cell_cursor*)(curr->val);
     chidb_Btree_freeMemNode(cursor->bt, node->btn);
+    free(node);
     free(curr);
     curr = next;
   }
 
-  free(&(cursor->path));
-  chidb_Btree_close(cursor->bt);
-  cursor->type = CURSOR_UNSPECIFIED;
-  return CHIDB_OK;
+  (cursor->path).head = NULL;
+  (cursor->path).tail = NULL;
 }
 
-bool chidb_dbm_rewind(chidb_dbm_cursor_t *cursor) {
-  // TODO: keep track of root npage?
+// append a node to the cursor path, pointing at cell index
+static void cursor_push(chidb_dbm_cursor_t *cursor, BTreeNode *btn, ncell_t index) {
+  cell_cursor *node_val = malloc(sizeof(cell_cursor));
+  node_val->btn = btn;
+  node_val->index = index;
+  ll_node *node = malloc(sizeof(ll_node));
+  node->val = node_val;
+  node->prev = (cursor->path).tail;
+  node->next = NULL;
+  if ((cursor->path).tail != NULL) {
+    (cursor->path).tail->next = node;
+  } else {
+    (cursor->path).head = node;
+  }
+  (cursor->path).tail = node;
+}
+
+// remove the last node of the cursor path (which must not be the root)
+static void cursor_pop(chidb_dbm_cursor_t *cursor) {
+  ll_node *node = (cursor->path).tail;
+  cell_cursor *node_val = (cell_cursor*)node->val;
+  chidb_Btree_freeMemNode(cursor->bt, node_val->btn);
+  free(node_val);
+  (cursor->path).tail = node->prev;
+  (cursor->path).tail->next = NULL;
+  free(node);
+}
+
+static bool is_internal(BTreeNode *btn) {
+  return btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL;
+}
+
+// leaves that are linked to their siblings (see BTREE_LINKS_SIZE)
+static bool is_linked(BTreeNode *btn) {
+  return btn->type == PGTYPE_TABLE_LEAF && btn->links_offset != 0;
+}
+
+// once the cursor is on a linked leaf, it moves through the sibling links,
+// so the rest of the path is released
+static void cursor_keep_leaf(chidb_dbm_cursor_t *cursor) {
+  ll_node *leaf = (cursor->path).tail;
+  if (!is_linked(((cell_cursor*)leaf->val)->btn)) {
+    return;
+  }
+  while ((cursor->path).head != leaf) {
+    ll_node *node = (cursor->path).head;
+    cell_cursor *node_val = (cell_cursor*)node->val;
+    chidb_Btree_freeMemNode(cursor->bt, node_val->btn);
+    free(node_val);
+    (cursor->path).head = node->next;
+    free(node);
+  }
+  leaf->prev = NULL;
+}
+
+// move the cursor from its linked leaf to the first (forward) or last
+// entry of the sibling at npage, skipping empty leaves. return false,
+// leaving the cursor where it is, if there is no such entry
+static bool cursor_follow_link(chidb_dbm_cursor_t *cursor, npage_t npage, bool forward) {
+  cell_cursor *curr = (cell_cursor*)(cursor->path).tail->val;
   BTreeNode *btn;
-  chidb_Btree_getNodeByPage(cursor->bt, 1, &btn);
-  cell_cursor *curr_cell_cursor = malloc(sizeof(cell_cursor));
-  curr_cell_cursor->btn = btn;
-  curr_cell_cursor->index = 0;
-
-  ll path = cursor->path;
-  while (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL) {
-    // save current btn into path linked list
-    ll_node *curr = malloc(sizeof(ll_node));
-    curr->prev = path.tail;
-    curr->val = curr_cell_cursor;
-    (path.tail)->next = curr;
-    path.tail = curr;
-    if (path.head == NULL) {
-      path.head = curr;
+
+  while (npage != 0 && chidb_Btree_getNodeByPage(cursor->bt, npage, &btn) == CHIDB_OK) {
+    chidb_Pager_readAhead(cursor->bt->pager, &cursor->ra, npage);
+    if (btn->n_cells > 0) {
+      chidb_Btree_freeMemNode(cursor->bt, curr->btn);
+      curr->btn = btn;
+      curr->index = forward ? 0 : btn->n_cells - 1;
+      return true;
     }
+    npage = forward ? btn->next_leaf : btn->prev_leaf;
+    chidb_Btree_freeMemNode(cursor->bt, btn);
+  }
+  return false;
+}
+
+// extend the path from its last node down to the leftmost entry below the
+// child it points at
+static void cursor_descend_leftmost(chidb_dbm_cursor_t *cursor) {
+  cell_cursor *curr = (cell_cursor*)(cursor->path).tail->val;
+  while (is_internal(curr->btn)) {
+    BTreeNode *btn;
+    chidb_Btree_getNodeByPage(cursor->bt, chidb_Btree_getChildPage(curr->btn, curr->index), &btn);
+    cursor_push(cursor, btn, 0);
+    curr = (cell_cursor*)(cursor->path).tail->val;
+
+    // only leaves are fed to read-ahead: the internal nodes of a scan are
+    // few, and would break up the access pattern
+    if (!is_internal(btn)) {
+      chidb_Pager_readAhead(cursor->bt->pager, &cursor->ra, btn->page->npage);
+    }
+  }
+  cursor_keep_leaf(cursor);
+}
+
+// extend the path from its last node down to the rightmost entry below the
+// child it points at
+static void cursor_descend_rightmost(chidb_dbm_cursor_t *cursor) {
+  cell_cursor *curr = (cell_cursor*)(cursor->path).tail->val;
+  while (is_internal(curr->btn)) {
+    BTreeNode *btn;
+    chidb_Btree_getNodeByPage(cursor->bt, chidb_Btree_getChildPage(curr->btn, curr->index), &btn);
+    // internal nodes point at their right page, and leaves at their last cell
+    cursor_push(cursor, btn, is_internal(btn) ? btn->n_cells : btn->n_cells - 1);
+    curr = (cell_cursor*)(cursor->path).tail->val;
 
-    // traverse down leftmost child
-    BTreeCell btc;
-    chidb_Btree_getCell(btn, 0, &btc);
-    if (btn->type == PGTYPE_TABLE_INTERNAL) {
-      chidb_Btree_getNodeByPage(cursor->bt, btc.fields.tableInternal.child_page, &btn);
-    } else {
-      chidb_Btree_getNodeByPage(cursor->bt, btc.fields.indexInternal.child_page, &btn);
+    if (!is_internal(btn)) {
+      chidb_Pager_readAhead(cursor->bt->pager, &cursor->ra, btn->page->npage);
     }
-    curr_cell_cursor = malloc(sizeof(cell_cursor));
-    curr_cell_cursor->btn = btn;
-    curr_cell_cursor->index = 0;
   }
-  if (btn->n_cells == 0) { // we should only have an empty leaf if this is an empty tree
+  cursor_keep_leaf(cursor);
+}
+
+// position the cursor at the first entry with a key >= key, descending with
+// a binary search of each node. return false if there is no such entry
+static bool cursor_seek(chidb_dbm_cursor_t *cursor, chidb_key_t key) {
+  npage_t npage = cursor->root;
+  BTreeNode *btn;
+  ncell_t index;
+
+  cursor_clear(cursor);
+  chidb_Pager_initReadAhead(&cursor->ra);
+  for (;;) {
+    chidb_Btree_getNodeByPage(cursor->bt, npage, &btn);
+    index = chidb_Btree_searchNode(btn, key);
+    cursor_push(cursor, btn, index);
+    if (!is_internal(btn)) {
+      break;
+    }
+    // entries of index B-Trees are in internal nodes too
+    if (btn->type == PGTYPE_INDEX_INTERNAL && index < btn->n_cells &&
+        chidb_Btree_getCellKey(btn, index) == key) {
+      return true;
+    }
+    npage = chidb_Btree_getChildPage(btn, index);
+  }
+  chidb_Pager_readAhead(cursor->bt->pager, &cursor->ra, btn->page->npage);
+  cursor_keep_leaf(cursor);
+  if (index < btn->n_cells) {
+    return true;
+  }
+  if (btn->n_cells == 0) { // empty tree
     return false;
   }
-  ll_node *curr = malloc(sizeof(ll_node));
-  curr->prev = path.tail;
-  curr->val = curr_cell_cursor;
-  (path.tail)->next = curr;
-  path.tail = curr;
-  return true;
+  // every key in the leaf is smaller: the entry is the one after its last
+  ((cell_cursor*)(cursor->path).tail->val)->index = btn->n_cells - 1;
+  return chidb_dbm_next(cursor);
+}
+
+static chidb_key_t cursor_key(chidb_dbm_cursor_t *cursor) {
+  cell_cursor *curr = (cell_cursor*)(cursor->path).tail->val;
+  return chidb_Btree_getCellKey(curr->btn, curr->index);
+}
+
+int chidb_dbm_free_cursor(chidb_dbm_cursor_t *cursor) {
+  // free cursor path
+  cursor_clear(cursor);
+  // the B-Tree belongs to the database, and stays open
+  cursor->bt = NULL;
+  cursor->type = CURSOR_UNSPECIFIED;
+  return CHIDB_OK;
+}
+
+bool chidb_dbm_rewind(chidb_dbm_cursor_t *cursor) {
+  BTreeNode *btn;
+  cursor_clear(cursor);
+  chidb_Pager_initReadAhead(&cursor->ra);
+  chidb_Btree_getNodeByPage(cursor->bt, cursor->root, &btn);
+  cursor_push(cursor, btn, 0);
+  if (!is_internal(btn)) {
+    chidb_Pager_readAhead(cursor->bt->pager, &cursor->ra, btn->page->npage);
+  }
+  cursor_descend_leftmost(cursor);
+
+  // we should only have an empty leaf if this is an empty tree
+  return ((cell_cursor*)(cursor->path).tail->val)->btn->n_cells > 0;
 }
 
 bool chidb_dbm_next(chidb_dbm_cursor_t *cursor) {
@@ -121,55 +253,122 @@ bool chidb_dbm_next(chidb_dbm_cursor_t *cursor) {
     exit(1);
   }
 
+  cell_cursor *curr = (cell_cursor*)(cursor->path).tail->val;
+  if (is_internal(curr->btn)) {
+    if (curr->index >= curr->btn->n_cells) {
+      // only the root is left once we are past the last row
+      return false;
+    }
+    // at an entry of an index internal node: the next one is the leftmost
+    // entry of the subtree to its right
+    curr->index++;
+    cursor_descend_leftmost(cursor);
+    return true;
+  }
+  if (curr->index + 1 < curr->btn->n_cells) {
+    curr->index++;
+    return true;
+  }
+  if (is_linked(curr->btn)) {
+    if (cursor_follow_link(cursor, curr->btn->next_leaf, true)) {
+      return true;
+    }
+    curr->index = curr->btn->n_cells;
+    return false;
+  }
+
   // traverse up towards the root until we find a node that we can advance in
-  ll_node *curr_node = (cursor->path).tail;
-  cell_cursor *curr_node_val = (cell_cursor*)curr_node->val;
-  while (!(curr_node_val->index < curr_node_val->btn->n_cells)) {
-    if (curr_node == (cursor->path).head) {
+  for (;;) {
+    if ((cursor->path).tail == (cursor->path).head) {
       // we have reached the root, so we must be at the last row
+      curr->index = curr->btn->n_cells;
       return false;
     }
-    // traverse up the tree and free the node we just saw
-    curr_node = curr_node->prev;
-    chidb_Btree_freeMemNode(cursor->bt, curr_node_val->btn);
-    curr_node_val = (cell_cursor*)curr_node->val;
-    free(curr_node->next);
-    curr_node->next = NULL;
-  }
-
-  // update path from current node down to a leaf
-  curr_node_val->index++;
-  ll_node *new_node;
-  cell_cursor *new_node_val;
-  while (curr_node_val->btn->type == PGTYPE_TABLE_INTERNAL || curr_node_val->btn->type == PGTYPE_INDEX_INTERNAL) {
-    BTreeNode *btn;
-    BTreeCell btc;
-    chidb_Btree_getCell(curr_node_val->btn, curr_node_val->index, &btc);
-    if (curr_node_val->btn->type == PGTYPE_TABLE_INTERNAL) {
-      chidb_Btree_getNodeByPage(cursor->bt, btc.fields.tableInternal.child_page, &btn);
-    } else {
-      chidb_Btree_getNodeByPage(cursor->bt, btc.fields.indexInternal.child_page, &btn);
+    cursor_pop(cursor);
+    curr = (cell_cursor*)(cursor->path).tail->val;
+    if (curr->index < curr->btn->n_cells) {
+      break;
     }
-    new_node_val = malloc(sizeof(cell_cursor));
-    new_node_val->btn = btn;
-    new_node_val->index = 0;
-    new_node = malloc(sizeof(ll_node));
-    new_node->val = new_node_val;
-    new_node->prev = curr_node;
-    new_node->next = NULL;
-    curr_node->next = new_node;
-
-    curr_node = new_node;
-    curr_node_val = new_node_val;
-  }
-  (cursor->path).tail = curr_node;
+  }
+
+  // in index B-Trees, the entry between two children comes after the left one
+  if (curr->btn->type == PGTYPE_INDEX_INTERNAL) {
+    return true;
+  }
+  curr->index++;
+  cursor_descend_leftmost(cursor);
   return true;
 }
 
 bool chidb_dbm_prev(chidb_dbm_cursor_t *cursor) {
+  if ((cursor->path).head == NULL) {
+    chilog(ERROR, "calling prev before setting cursor with rewind or seek command");
+    exit(1);
+  }
+
+  cell_cursor *curr = (cell_cursor*)(cursor->path).tail->val;
+  if (is_internal(curr->btn)) {
+    // at an entry of an index internal node (or past the last row): the
+    // previous one is the rightmost entry of the subtree to its left
+    cursor_descend_rightmost(cursor);
+    return true;
+  }
+  if (curr->index > 0) {
+    curr->index--;
+    return true;
+  }
+  if (is_linked(curr->btn)) {
+    return cursor_follow_link(cursor, curr->btn->prev_leaf, false);
+  }
+
+  // find the closest node above that we can go back in. if there is none,
+  // we are at the first row, and the cursor stays there
+  ll_node *node = (cursor->path).tail->prev;
+  while (node != NULL && ((cell_cursor*)node->val)->index == 0) {
+    node = node->prev;
+  }
+  if (node == NULL) {
+    return false;
+  }
+  while ((cursor->path).tail != node) {
+    cursor_pop(cursor);
+  }
+  curr = (cell_cursor*)node->val;
+  curr->index--;
+
+  // in index B-Trees, the entry between two children comes before the right one
+  if (curr->btn->type == PGTYPE_INDEX_INTERNAL) {
+    return true;
+  }
+  cursor_descend_rightmost(cursor);
   return true;
 }
 
 bool chidb_dbm_seek(chidb_dbm_cursor_t *cursor, chidb_key_t key) {
-  return true;
+  return cursor_seek(cursor, key) && cursor_key(cursor) == key;
+}
+
+bool chidb_dbm_seekGe(chidb_dbm_cursor_t *cursor, chidb_key_t key) {
+  return cursor_seek(cursor, key);
+}
+
+bool chidb_dbm_seekGt(chidb_dbm_cursor_t *cursor, chidb_key_t key) {
+  if (!cursor_seek(cursor, key)) {
+    return false;
+  }
+  return cursor_key(cursor) != key || chidb_dbm_next(cursor);
+}
+
+// the entry before the first one >= key (or the last entry, if there is
+// no such entry) is the last one < key
+bool chidb_dbm_seekLt(chidb_dbm_cursor_t *cursor, chidb_key_t key) {
+  cursor_seek(cursor, key);
+  return chidb_dbm_prev(cursor);
+}
+
+bool chidb_dbm_seekLe(chidb_dbm_cursor_t *cursor, chidb_key_t key) {
+  if (cursor_seek(cursor, key) && cursor_key(cursor) == key) {
+    return true;
+  }
+  return chidb_dbm_prev(cursor);
 }
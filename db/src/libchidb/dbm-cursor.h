@@ -62,19 +62,31 @@ typedef enum chidb_dbm_cursor_type
 typedef struct chidb_dbm_cursor
 {
     chidb_dbm_cursor_type_t type;
-    // a linked list of cell cursors, going from root to leaf. O(logn) space
-    // but allows for incr/decr in amortized O(1)... an easier implementation
-    // might be to have pointers between consecutive leaf nodes so that the
-    // "bottom layer" of the tree is doubly linked list
+    // a linked list of cell cursors, going from root to leaf. in table
+    // B-Trees whose leaves are linked to their siblings (see
+    // BTREE_LINKS_SIZE), only the leaf is kept once the cursor is
+    // positioned, and next/prev go from leaf to leaf through the links.
+    // otherwise (index B-Trees, which have entries in their internal nodes
+    // too, and files without links), next/prev climb up the path and
+    // descend again at the end of each leaf
     ll path;
     BTree *bt;
+    // root page of the B-Tree the cursor walks, where rewind and seek start
+    npage_t root;
+    // access pattern of the leaves visited so far, so that the pager can
+    // read ahead the next leaves of a scan
+    PagerReadAhead ra;
 } chidb_dbm_cursor_t;
 
-int chidb_dbm_init_cursor(chidb_dbm_cursor_t *cursor, char *dbfile, chidb *db, npage_t root);
+int chidb_dbm_init_cursor(chidb_dbm_cursor_t *cursor, chidb *db, npage_t root);
 int chidb_dbm_free_cursor(chidb_dbm_cursor_t *cursor);
 bool chidb_dbm_rewind(chidb_dbm_cursor_t *cursor); // return false if tree is empty
 bool chidb_dbm_next(chidb_dbm_cursor_t *cursor); // return false if cursor is at the last row
 bool chidb_dbm_prev(chidb_dbm_cursor_t *cursor); // return false if cursor is at the first row
-bool chidb_dbm_seek(chidb_dbm_cursor_t *cursor, chidb_key_t key);
+bool chidb_dbm_seek(chidb_dbm_cursor_t *cursor, chidb_key_t key); // return false if there is no row with key
+bool chidb_dbm_seekGe(chidb_dbm_cursor_t *cursor, chidb_key_t key); // return false if all rows have smaller keys
+bool chidb_dbm_seekGt(chidb_dbm_cursor_t *cursor, chidb_key_t key); // return false if no row has a larger key
+bool chidb_dbm_seekLt(chidb_dbm_cursor_t *cursor, chidb_key_t key); // return false if no row has a smaller key
+bool chidb_dbm_seekLe(chidb_dbm_cursor_t *cursor, chidb_key_t key); // return false if all rows have larger keys
 
 #endif /* DBM_CURSOR_H_ */
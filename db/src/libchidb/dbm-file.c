@@ -134,18 +134,9 @@ int __chidb_dbm_file_load_db(chidb_dbm_file_t *dbmf, char *line, const char* dbf
 
     if (strcmp(tokens[0], "NO") == 0 && strcmp(tokens[0], "DBFILE"))
     {
-        rc = snprintf(dbmf->dbfile, MAX_FILENAME_SIZE, "%s/chidb-tmp-XXXXXX", genfiledir);
-        if (rc >= MAX_FILENAME_SIZE)
-            return CHIDB_ENOMEM;
-
-        int tmpfile = mkstemp(dbmf->dbfile);
-
-        if (tmpfile == -1)
-            return CHIDB_EIO;
-
-        close(tmpfile);
-
-        dbmf->delete_dbfile = true;
+        /* A scratch database, which only has to last as long as the program */
+        strcpy(dbmf->dbfile, ":memory:");
+        dbmf->delete_dbfile = false;
     }
     else if (strcmp(tokens[0], "CREATE") == 0)
     {
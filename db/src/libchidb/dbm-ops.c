@@ -42,6 +42,7 @@
 #include "dbm.h"
 #include "btree.h"
 #include "record.h"
+#include "util.h"
 
 
 /* Function pointer for dispatch table */
@@ -96,7 +97,6 @@ int chidb_dbm_op_OpenRead (chidb_stmt *stmt, chidb_dbm_op_t *op)
     stmt->cursors[op->p1].type = CURSOR_READ;
     return chidb_dbm_init_cursor(
         stmt->cursors + op->p1,
-        stmt->dbfile,
         stmt->db,
         op->p2);
 }
@@ -107,7 +107,6 @@ int chidb_dbm_op_OpenWrite (chidb_stmt *stmt, chidb_dbm_op_t *op)
     stmt->cursors[op->p1].type = CURSOR_WRITE;
     return chidb_dbm_init_cursor(
         stmt->cursors + op->p1,
-        stmt->dbfile,
         stmt->db,
         op->p2);
 }
@@ -139,51 +138,172 @@ int chidb_dbm_op_Next (chidb_stmt *stmt, chidb_dbm_op_t *op)
 
 int chidb_dbm_op_Prev (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    if (!chidb_dbm_prev(stmt->cursors + op->p1)) {
+    if (chidb_dbm_prev(stmt->cursors + op->p1)) {
         stmt->pc = op->p2;
     }
     return CHIDB_OK;
 }
 
 
+/* Reads the key to seek to from register p3. Returns false (after logging
+ * a warning) if it does not hold an integer */
+static bool seek_key(chidb_stmt *stmt, chidb_dbm_op_t *op, chidb_key_t *key)
+{
+    if (!IS_VALID_REGISTER(stmt, op->p3) || stmt->reg[op->p3].type != REG_INT32) {
+        chilog(WARNING, "got invalid register");
+        return false;
+    }
+    *key = stmt->reg[op->p3].value.i;
+    return true;
+}
+
+
 int chidb_dbm_op_Seek (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
+    chidb_key_t key;
+    if (seek_key(stmt, op, &key) && !chidb_dbm_seek(stmt->cursors + op->p1, key)) {
+        stmt->pc = op->p2;
+    }
     return CHIDB_OK;
 }
 
 
 int chidb_dbm_op_SeekGt (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
+    chidb_key_t key;
+    if (seek_key(stmt, op, &key) && !chidb_dbm_seekGt(stmt->cursors + op->p1, key)) {
+        stmt->pc = op->p2;
+    }
     return CHIDB_OK;
 }
 
 
 int chidb_dbm_op_SeekGe (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
-
+    chidb_key_t key;
+    if (seek_key(stmt, op, &key) && !chidb_dbm_seekGe(stmt->cursors + op->p1, key)) {
+        stmt->pc = op->p2;
+    }
     return CHIDB_OK;
 }
 
 int chidb_dbm_op_SeekLt (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
-
+    chidb_key_t key;
+    if (seek_key(stmt, op, &key) && !chidb_dbm_seekLt(stmt->cursors + op->p1, key)) {
+        stmt->pc = op->p2;
+    }
     return CHIDB_OK;
 }
 
 
 int chidb_dbm_op_SeekLe (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
-
+    chidb_key_t key;
+    if (seek_key(stmt, op, &key) && !chidb_dbm_seekLe(stmt->cursors + op->p1, key)) {
+        stmt->pc = op->p2;
+    }
     return CHIDB_OK;
 }
 
+/* Column p1 p2 p3 *
+ *
+ * Store in register p3 the value of column p2 of the row that cursor p1
+ * points to. Only the record header and the bytes of the column are read
+ * from the row: the overflow pages of a large row are only read if the
+ * column lies past the part of the row stored in its leaf (see
+ * chidb_Btree_readPayload).
+ */
 int chidb_dbm_op_Column (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
-    /* Your code goes here */
+    chidb_dbm_cursor_t *cursor = stmt->cursors + op->p1;
+    cell_cursor *curr = (cell_cursor*)(cursor->path).tail->val;
+    int32_t dest = op->p3;
+    uint8_t header[0xFF];
+    uint32_t offset, type = SQL_NULL;
+    BTreeCell cell;
+    int rc;
+
+    if ((rc = chidb_Btree_getCell(curr->btn, curr->index, &cell)) != CHIDB_OK)
+        return rc;
+    if (cell.type != PGTYPE_TABLE_LEAF)
+    {
+        stmt->error = strdup("columns can only be read from table rows");
+        return CHIDB_EMISMATCH;
+    }
+
+    /* The record header: its size, and the type of each field */
+    if ((rc = chidb_Btree_readPayload(cursor->bt, &cell, 0, 1, header)) != CHIDB_OK)
+        return rc;
+    uint8_t header_size = header[0];
+    if (header_size < 1 || header_size > cell.fields.tableLeaf.data_size)
+        return CHIDB_ECORRUPT;
+    if ((rc = chidb_Btree_readPayload(cursor->bt, &cell, 1, header_size - 1, header + 1)) != CHIDB_OK)
+        return rc;
+
+    offset = header_size;
+    for (uint32_t pos = 1, field = 0; pos < header_size; field++)
+    {
+        uint32_t t;
+        if (header[pos] & 0x80)
+        {
+            if (pos + 4 > header_size)
+                return CHIDB_ECORRUPT;
+            getVarint32(header + pos, &t);
+            pos += 4;
+        }
+        else
+            t = header[pos++];
+
+        if (field == op->p2)
+        {
+            type = t;
+            break;
+        }
+        offset += t == SQL_INTEGER_4BYTE ? 4 : t >= SQL_TEXT ? (t - SQL_TEXT) / 2 : t;
+    }
+
+    if (dest >= stmt->nReg && (rc = realloc_reg(stmt, dest + 1)) != CHIDB_OK)
+        return rc;
+    chidb_dbm_register_t *reg = stmt->reg + dest;
+    if (reg->type == REG_STRING)
+        free(reg->value.s);
+
+    /* A column past the last field of the record is NULL */
+    if (type == SQL_NULL)
+    {
+        reg->type = REG_NULL;
+        return CHIDB_OK;
+    }
+    if (type >= SQL_TEXT)
+    {
+        uint32_t len = (type - SQL_TEXT) / 2;
+        char *s = malloc(len + 1);
+        if (s == NULL)
+        {
+            reg->type = REG_NULL;
+            return CHIDB_ENOMEM;
+        }
+        if ((rc = chidb_Btree_readPayload(cursor->bt, &cell, offset, len, (uint8_t*) s)) != CHIDB_OK)
+        {
+            free(s);
+            reg->type = REG_NULL;
+            return rc;
+        }
+        s[len] = '\0';
+        reg->type = REG_STRING;
+        reg->value.s = s;
+        return CHIDB_OK;
+    }
+
+    uint8_t buf[4];
+    uint32_t len = type == SQL_INTEGER_4BYTE ? 4 : type;
+    reg->type = REG_NULL;
+    if ((rc = chidb_Btree_readPayload(cursor->bt, &cell, offset, len, buf)) != CHIDB_OK)
+        return rc;
+    reg->type = REG_INT32;
+    reg->value.i = len == 1 ? (int8_t) buf[0] : len == 2 ? (int16_t) get2byte(buf) : (int32_t) get4byte(buf);
+    chilog(TRACE, "column %d of cursor %d is %d", op->p2, op->p1, reg->value.i);
 
     return CHIDB_OK;
 }
@@ -537,6 +657,123 @@ int chidb_dbm_op_SCopy (chidb_stmt *stmt, chidb_dbm_op_t *op)
 }
 
 
+/* Begin * * * *
+ *
+ * Start an explicit transaction: the pages modified by the statements
+ * run until the next Commit or Rollback are only written on Commit.
+ */
+int chidb_dbm_op_Begin (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (stmt->db->in_transaction)
+    {
+        stmt->error = strdup("cannot start a transaction within a transaction");
+        return CHIDB_EMISUSE;
+    }
+
+    int rc = chidb_Btree_begin(stmt->db->bt);
+    if (rc == CHIDB_OK)
+        stmt->db->in_transaction = true;
+    return rc;
+}
+
+
+/* Commit * * * *
+ *
+ * Commit the transaction started with Begin.
+ */
+int chidb_dbm_op_Commit (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (!stmt->db->in_transaction)
+    {
+        stmt->error = strdup("cannot commit - no transaction is active");
+        return CHIDB_EMISUSE;
+    }
+
+    stmt->db->in_transaction = false;
+    return chidb_Btree_commit(stmt->db->bt);
+}
+
+
+/* Rollback * * * *
+ *
+ * Discard the changes done since Begin.
+ */
+int chidb_dbm_op_Rollback (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    if (!stmt->db->in_transaction)
+    {
+        stmt->error = strdup("cannot rollback - no transaction is active");
+        return CHIDB_EMISUSE;
+    }
+
+    stmt->db->in_transaction = false;
+    return chidb_Btree_rollback(stmt->db->bt);
+}
+
+
+/* Vacuum p1 p2 * *
+ *
+ * If p1 is 0, rewrite the database file so that every B-Tree is stored
+ * in contiguous pages, and remove the free pages (VACUUM). Otherwise,
+ * remove up to p2 free pages from the end of the file, or all of them
+ * if p2 is 0 (PRAGMA INCREMENTAL_VACUUM).
+ */
+int chidb_dbm_op_Vacuum (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    int rc;
+
+    if (op->p1 == 0)
+    {
+        if (stmt->db->in_transaction)
+        {
+            stmt->error = strdup("cannot VACUUM from within a transaction");
+            return CHIDB_EMISUSE;
+        }
+        rc = chidb_Btree_vacuum(stmt->db->bt);
+    }
+    else
+        rc = chidb_Btree_incrementalVacuum(stmt->db->bt, op->p2);
+
+    /* A failed vacuum rolls back the transaction it is part of */
+    if (rc != CHIDB_OK)
+        stmt->db->in_transaction = false;
+    return rc;
+}
+
+/* DeleteRange p1 p2 p3 *
+ *
+ * Delete the rows of the table B-Tree rooted at page p1 whose keys are
+ * between the values of registers p2 and p3 (both included), without
+ * visiting them one by one (see chidb_Btree_deleteRange). A NULL in
+ * either register leaves that end of the range open.
+ */
+int chidb_dbm_op_DeleteRange (chidb_stmt *stmt, chidb_dbm_op_t *op)
+{
+    chidb_key_t lo = 0, hi = UINT32_MAX;
+
+    if (!IS_VALID_REGISTER(stmt, op->p2) || !IS_VALID_REGISTER(stmt, op->p3) ||
+        (stmt->reg[op->p2].type != REG_INT32 && stmt->reg[op->p2].type != REG_NULL) ||
+        (stmt->reg[op->p3].type != REG_INT32 && stmt->reg[op->p3].type != REG_NULL))
+    {
+        stmt->error = strdup("the bounds of a range deletion must be integers or NULL");
+        return CHIDB_EMISMATCH;
+    }
+
+    /* Keys are never negative */
+    if (stmt->reg[op->p2].type == REG_INT32 && stmt->reg[op->p2].value.i > 0)
+        lo = stmt->reg[op->p2].value.i;
+    if (stmt->reg[op->p3].type == REG_INT32)
+    {
+        if (stmt->reg[op->p3].value.i < 0)
+            return CHIDB_OK;
+        hi = stmt->reg[op->p3].value.i;
+    }
+
+    chilog(TRACE, "deleting keys %u to %u from table %d", lo, hi, op->p1);
+    return chidb_Btree_deleteRange(stmt->db->bt, op->p1, lo, hi);
+}
+
+
 int chidb_dbm_op_Halt (chidb_stmt *stmt, chidb_dbm_op_t *op)
 {
     /* Your code goes here */
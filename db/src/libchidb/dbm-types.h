@@ -92,6 +92,11 @@
         OP(CreateIndex) \
         OP(Copy)        \
         OP(SCopy)       \
+        OP(Begin)       \
+        OP(Commit)      \
+        OP(Rollback)    \
+        OP(Vacuum)      \
+        OP(DeleteRange) \
         OP(Halt)
 
 /* The following generates an enum type for the opcode. It expands to:
@@ -0,0 +1,212 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module searches the decoded key arrays that the B-Tree module
+ * keeps for its internal nodes (see chidb_Btree_searchNode).
+ *
+ * A search first does a binary search over the last key of each block
+ * of KEYSEARCH_BLOCK keys, to find the block where the search ends, and
+ * then counts the keys of that block that are smaller than the key with
+ * a few vector comparisons (with SSE2 or AVX2, whichever the CPU supports
+ * best, as detected at runtime). Since the keys are sorted, that count
+ * is the position of the key in the block. On other architectures, a
+ * plain binary search is done instead.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdlib.h>
+#include "keysearch.h"
+
+#if defined(__GNUC__) && (defined(__x86_64__) || defined(__i386__))
+#define KEYSEARCH_X86
+#include <immintrin.h>
+#endif
+
+typedef uint32_t (*keysearch_fn)(const int32_t *keys, uint32_t n, int32_t key);
+
+static keysearch_fn keysearch_kernel = NULL;
+static int keysearch_kernel_id;
+
+
+static uint32_t keysearch_scalar(const int32_t *keys, uint32_t n, int32_t key)
+{
+    uint32_t lo = 0, hi = n;
+
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (keys[mid] < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+/* Returns the first block whose last key is not smaller than key, or the
+ * number of blocks if there is none (in which case every key is smaller) */
+static inline __attribute__((always_inline))
+uint32_t keysearch_block(const int32_t *keys, uint32_t n, int32_t key)
+{
+    uint32_t lo = 0, hi = (n + KEYSEARCH_BLOCK - 1) / KEYSEARCH_BLOCK;
+
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (keys[mid * KEYSEARCH_BLOCK + KEYSEARCH_BLOCK - 1] < key)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo;
+}
+
+#ifdef KEYSEARCH_X86
+
+__attribute__((target("sse2")))
+static uint32_t keysearch_sse2(const int32_t *keys, uint32_t n, int32_t key)
+{
+    uint32_t block = keysearch_block(keys, n, key);
+    const __m128i *v = (const __m128i *) (keys + block * KEYSEARCH_BLOCK);
+    __m128i k = _mm_set1_epi32(key);
+    uint32_t mask;
+
+    if (block * KEYSEARCH_BLOCK >= n)
+        return n;
+
+    /* One bit for each key smaller than key */
+    mask = _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k, _mm_load_si128(v))))
+         | _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k, _mm_load_si128(v + 1)))) << 4
+         | _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k, _mm_load_si128(v + 2)))) << 8
+         | _mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(k, _mm_load_si128(v + 3)))) << 12;
+
+    return block * KEYSEARCH_BLOCK + __builtin_popcount(mask);
+}
+
+__attribute__((target("avx2,popcnt")))
+static uint32_t keysearch_avx2(const int32_t *keys, uint32_t n, int32_t key)
+{
+    uint32_t block = keysearch_block(keys, n, key);
+    const __m256i *v = (const __m256i *) (keys + block * KEYSEARCH_BLOCK);
+    __m256i k = _mm256_set1_epi32(key);
+    uint32_t mask;
+
+    if (block * KEYSEARCH_BLOCK >= n)
+        return n;
+
+    mask = _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, _mm256_load_si256(v))))
+         | _mm256_movemask_ps(_mm256_castsi256_ps(_mm256_cmpgt_epi32(k, _mm256_load_si256(v + 1)))) << 8;
+
+    return block * KEYSEARCH_BLOCK + __builtin_popcount(mask);
+}
+
+#endif
+
+
+/* Select the search kernel
+ *
+ * The best kernel supported by the CPU is used by default. This is only
+ * meant to compare kernels with each other (e.g., in tests).
+ *
+ * Parameters
+ * - kernel: KEYSEARCH_SCALAR, KEYSEARCH_SSE2 or KEYSEARCH_AVX2
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: The kernel is not supported by this CPU
+ */
+int chidb_KeySearch_setKernel(int kernel)
+{
+    switch (kernel)
+    {
+    case KEYSEARCH_SCALAR:
+        keysearch_kernel = keysearch_scalar;
+        break;
+#ifdef KEYSEARCH_X86
+    case KEYSEARCH_SSE2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("sse2"))
+            return CHIDB_EMISUSE;
+        keysearch_kernel = keysearch_sse2;
+        break;
+    case KEYSEARCH_AVX2:
+        __builtin_cpu_init();
+        if (!__builtin_cpu_supports("avx2") || !__builtin_cpu_supports("popcnt"))
+            return CHIDB_EMISUSE;
+        keysearch_kernel = keysearch_avx2;
+        break;
+#endif
+    default:
+        return CHIDB_EMISUSE;
+    }
+    keysearch_kernel_id = kernel;
+
+    return CHIDB_OK;
+}
+
+/* Returns the kernel in use (the best one, if none has been selected) */
+int chidb_KeySearch_getKernel(void)
+{
+    if (keysearch_kernel == NULL &&
+        chidb_KeySearch_setKernel(KEYSEARCH_AVX2) != CHIDB_OK &&
+        chidb_KeySearch_setKernel(KEYSEARCH_SSE2) != CHIDB_OK)
+        chidb_KeySearch_setKernel(KEYSEARCH_SCALAR);
+
+    return keysearch_kernel_id;
+}
+
+
+/* Search a key array
+ *
+ * Parameters
+ * - keys: Sorted array of keys (stored with chidb_KeySearch_key), aligned
+ *         and padded as described in keysearch.h
+ * - n: Number of keys in the array (not counting the padding)
+ * - key: Key to search for
+ *
+ * Return
+ * - Position of the first key that is greater than or equal to key, or
+ *   n if every key is smaller
+ */
+uint32_t chidb_KeySearch_lowerBound(const int32_t *keys, uint32_t n, chidb_key_t key)
+{
+    if (keysearch_kernel == NULL)
+        chidb_KeySearch_getKernel();
+
+    return keysearch_kernel(keys, n, chidb_KeySearch_key(key));
+}
@@ -0,0 +1,74 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Vectorized search of sorted key arrays -- header
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef KEYSEARCH_H_
+#define KEYSEARCH_H_
+
+#include "chidbInt.h"
+
+/* Keys are searched in blocks of KEYSEARCH_BLOCK keys (64 bytes, one cache
+ * line). Key arrays must be aligned to KEYSEARCH_ALIGN bytes, and padded
+ * to a whole number of blocks with chidb_KeySearch_key(UINT32_MAX). */
+#define KEYSEARCH_BLOCK (16)
+#define KEYSEARCH_ALIGN (64)
+
+/* Search kernels (see chidb_KeySearch_setKernel) */
+#define KEYSEARCH_SCALAR (0)
+#define KEYSEARCH_SSE2 (1)
+#define KEYSEARCH_AVX2 (2)
+
+/* Key as stored in a key array. SSE2 and AVX2 only compare signed
+ * integers, so keys are stored with their top bit flipped, which makes
+ * signed comparisons order them as unsigned ones. */
+static inline int32_t chidb_KeySearch_key(chidb_key_t key)
+{
+    return (int32_t) (key ^ 0x80000000u);
+}
+
+static inline size_t chidb_KeySearch_padded(uint32_t n)
+{
+    return (n + KEYSEARCH_BLOCK - 1) / KEYSEARCH_BLOCK * KEYSEARCH_BLOCK;
+}
+
+uint32_t chidb_KeySearch_lowerBound(const int32_t *keys, uint32_t n, chidb_key_t key);
+int chidb_KeySearch_setKernel(int kernel);
+int chidb_KeySearch_getKernel(void);
+
+#endif /* KEYSEARCH_H_ */
@@ -9,12 +9,84 @@
  * modify the page returned by the pager and instruct the pager to
  * write it back to disk.
  *
- * The default pager is very simple and always creates an in-memory copy
- * of any page that is read (even if that page has already been read before).
- * More specifically, pages are read into a MemPage structure, which must
- * be freed (using the releaseMemPage function) once they are not needed.
- * In a real database, the pager component typically does some caching
- * of pages to reduce the number of disk accesses.
+ * Pages are cached in a buffer pool owned by the pager. Reading a page
+ * returns the pool frame that holds it, pinned on behalf of the caller, so
+ * that repeated reads of the same page (e.g., the root and interior nodes
+ * of a B-Tree) do not go to the file. Every page returned by readPage must
+ * be unpinned with releaseMemPage once it is not needed. Frames that are
+ * not pinned are recycled using the CLOCK algorithm once the pool is full.
+ *
+ * If the pager is opened with CHIDB_OPEN_MMAP, the file is instead mapped
+ * into memory and readPage returns pages that point directly into the
+ * mapping, without copying them. The mapping is private, so modifying a
+ * mapped page gives the pager its own copy of that page (copy-on-write),
+ * and the file is only modified when the page is written with writePage.
+ *
+ * Writes can be grouped into transactions, delimited by chidb_Pager_begin
+ * and chidb_Pager_commit (or chidb_Pager_rollback). Within a transaction,
+ * writePage does not write anything: modified pages stay in memory (marked
+ * dirty, so that they are not evicted) until the transaction is committed,
+ * at which point they are written in page number order, coalescing adjacent
+ * pages into a single write. Rolling back simply discards them.
+ *
+ * If the pager is opened with CHIDB_OPEN_URING, operations on several
+ * pages (reading a run of pages, committing a transaction) submit all of
+ * their reads or writes at once through io_uring (see uring.c), instead of
+ * issuing them one system call at a time.
+ *
+ * Scans can ask the pager to detect sequential or strided access (see
+ * chidb_Pager_readAhead), in which case the pages that the scan is about
+ * to read are prefetched by the kernel in the background (posix_fadvise,
+ * or madvise in mmap mode), so that a full scan does not wait for each
+ * page in turn.
+ *
+ * If the pager is opened with CHIDB_OPEN_WAL, committed pages are appended
+ * to the write-ahead log (see wal.c) instead of being written in place, and
+ * a writePage outside of a transaction is committed immediately. Pages are
+ * read from the WAL if it has a version of them.
+ *
+ * If the pager is opened with CHIDB_OPEN_COMPRESS (or compression is turned
+ * on with chidb_Pager_setCompression), pages are compressed when they are
+ * written, and decompressed into their buffer pool frames when they are
+ * read (see compress.c). Every page keeps its place in the file, but only
+ * the bytes of its compressed image are read or written. The page map
+ * remembers how many bytes each page takes up, so that a page that has
+ * been seen before is read again with a single read of just those bytes.
+ *
+ * If the pager is opened with CHIDB_OPEN_DIRECT, the file is opened with
+ * O_DIRECT, so that the OS does not keep a second copy of the pages in
+ * its page cache. Every frame is then aligned for direct I/O, the buffer
+ * pool is made larger (DEFAULT_DIRECT_CACHE_FRAMES) to take the place of
+ * the page cache, and reads ahead are not requested from the OS. Direct
+ * I/O is turned off if the file system refuses it, if the page size is not
+ * a multiple of the logical block size, or if the pages are compressed.
+ *
+ * As pages are allocated, the file is grown on disk a chunk at a time
+ * (DEFAULT_PREALLOC_CHUNK bytes, see chidb_Pager_setPreallocation) with
+ * fallocate, keeping its size as it is. The file system can then give it
+ * a few large extents, up front, instead of allocating blocks (and
+ * updating its metadata) every time a write goes past the end of the
+ * file. The size of the file still says how many pages it has, and the
+ * space that ends up unused is given back when the pager is closed.
+ *
+ * If the pager is opened with CHIDB_OPEN_PREWARM, the pages in its buffer
+ * pool are saved to a hot page file when it is closed, and
+ * chidb_Pager_prewarm loads them back in the background (see prewarm.c).
+ * Loaded pages are taken from the prewarmer instead of read when there is
+ * a miss, and the rest go into the buffer pool when it is done. With
+ * CHIDB_OPEN_WAL, CHIDB_OPEN_COMPRESS or CHIDB_OPEN_MMAP, where a page
+ * may not be the same as its bytes in the file, the hot pages are only
+ * read ahead into the OS page cache.
+ *
+ * If the file name is ":memory:", there is no file at all: the database
+ * lives in an arena of memory chunks that is read and written just like
+ * the file would be, so everything above the pager works the same way.
+ * Since there is nothing to map, log or batch, CHIDB_OPEN_MMAP,
+ * CHIDB_OPEN_WAL, CHIDB_OPEN_URING and CHIDB_OPEN_COMPRESS are ignored.
+ *
+ * The Pager counts the pages it hands out, the ones it has to read, and
+ * the pages and bytes it reads and writes, and keeps a histogram of how
+ * long its reads and writes take (see chidb_stats).
  *
  */
 
@@ -53,16 +125,24 @@
 
 #include <string.h>
 #include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <limits.h>
 #include <sys/types.h>
 #include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/uio.h>
+#include <time.h>
 #include <unistd.h>
-#include <stdio.h>
 
 #include <chidb/log.h>
 
 #include "chidbInt.h"
 
 #include "pager.h"
+#include "util.h"
+
+#define MIN(a, b) (((a) < (b)) ? (a) : (b))
 
 /* Open a file
  *
@@ -71,7 +151,8 @@
  * Parameters
  * - pager: An out parameter. Used to return a pointer to the
  *			 newly created Pager.
- * - filename: Database file (might not exist)
+ * - filename: Database file (might not exist), or ":memory:" for an
+ *             in-memory database
  *
  * Return
  * - CHIDB_OK: Operation successful
@@ -80,198 +161,2169 @@
  */
 int chidb_Pager_open(Pager **pager, const char *filename)
 {
-    *pager = malloc(sizeof(Pager));
-    if (pager == NULL)
-        return CHIDB_ENOMEM;
-    (*pager)->f = fopen(filename, "r+");
+    return chidb_Pager_openWithFlags(pager, filename, CHIDB_OPEN_DEFAULT);
+}
 
-    if ((*pager)->f == NULL)
-        (*pager)->f = fopen(filename, "w+");
 
-    if ((*pager)->f == NULL)
-        return CHIDB_EIO;
-    else
-        return CHIDB_OK;
+/* Logical block size of the device that holds a file: the alignment of
+ * file offsets and sizes that O_DIRECT requires */
+static uint32_t pager_block_size(int fd)
+{
+#ifdef STATX_DIOALIGN
+    struct statx stx;
+
+    if (statx(fd, "", AT_EMPTY_PATH, STATX_DIOALIGN, &stx) == 0 &&
+        (stx.stx_mask & STATX_DIOALIGN) && stx.stx_dio_offset_align != 0)
+        return stx.stx_dio_offset_align;
+#endif
+    return PAGER_DEFAULT_BLOCK_SIZE;
 }
 
 
-/* Set the page size
- *
- * This tells the pager what the size of each page is.
- * This function must be called before operating on pages.
- * It will not verify if the page size makes size. If an incorrect
- * page size is provided, this will result in unexpected behaviour.
- *
- * Parameters
- * - pager: A Pager.
- * - pagesize: Size of a page (in bytes)
+/* Open a file with additional options
  *
- * Return
- * - CHIDB_OK: Operation successful
+ * Same as chidb_Pager_open, but the flags parameter (a bitwise OR of
+ * CHIDB_OPEN_* flags) selects how the file is accessed.
  */
-int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize)
+int chidb_Pager_openWithFlags(Pager **pager, const char *filename, int flags)
 {
-    pager->page_size = pagesize;
-    chidb_Pager_getRealDBSize(pager, &pager->n_pages);
+    *pager = calloc(1, sizeof(Pager));
+    if (*pager == NULL)
+        return CHIDB_ENOMEM;
 
-    return CHIDB_OK;
+    if (strcmp(filename, PAGER_MEMORY_FILENAME) == 0)
+    {
+        (*pager)->in_memory = true;
+        (*pager)->fd = -1;
+        flags &= ~(CHIDB_OPEN_MMAP | CHIDB_OPEN_WAL | CHIDB_OPEN_URING | CHIDB_OPEN_COMPRESS |
+                   CHIDB_OPEN_DIRECT | CHIDB_OPEN_PREWARM);
+    }
+    else if ((flags & CHIDB_OPEN_DIRECT) &&
+             ((*pager)->fd = open(filename, O_RDWR | O_CREAT | O_DIRECT, 0644)) >= 0)
+    {
+        /* Mapped pages would go through the page cache */
+        flags &= ~CHIDB_OPEN_MMAP;
+        (*pager)->block_size = pager_block_size((*pager)->fd);
+    }
+    else if (((*pager)->fd = open(filename, O_RDWR | O_CREAT, 0644)) < 0)
+    {
+        free(*pager);
+        return CHIDB_EIO;
+    }
+    else if (flags & CHIDB_OPEN_DIRECT)
+    {
+        chilog(WARNING, "O_DIRECT is not supported for %s, using the page cache", filename);
+        flags &= ~CHIDB_OPEN_DIRECT;
+    }
+    (*pager)->flags = flags;
+    if (!(*pager)->in_memory)
+        (*pager)->prealloc_chunk = DEFAULT_PREALLOC_CHUNK;
+
+    if ((flags & CHIDB_OPEN_URING) && chidb_Uring_open(&(*pager)->ring) != CHIDB_OK)
+    {
+        chilog(WARNING, "io_uring is not available, using synchronous I/O");
+        (*pager)->flags &= ~CHIDB_OPEN_URING;
+    }
+
+    if (flags & CHIDB_OPEN_WAL)
+    {
+        npage_t db_size;
+        int rc;
+
+        /* Mapped pages would bypass the WAL */
+        (*pager)->flags &= ~CHIDB_OPEN_MMAP;
+
+        if ((rc = chidb_Wal_open(&(*pager)->wal, filename, (*pager)->fd, (*pager)->flags)) != CHIDB_OK)
+        {
+            if ((*pager)->ring != NULL)
+                chidb_Uring_close((*pager)->ring);
+            close((*pager)->fd);
+            free(*pager);
+            return rc;
+        }
+        chidb_Wal_getState((*pager)->wal, &(*pager)->wal_generation, &(*pager)->wal_frame, &db_size);
+    }
+
+    if (flags & CHIDB_OPEN_COMPRESS)
+        chidb_Pager_setCompression(*pager, true);
+
+    if ((flags & CHIDB_OPEN_PREWARM) &&
+        ((*pager)->hot_filename = malloc(strlen(filename) + 5)) != NULL)
+        sprintf((*pager)->hot_filename, "%s-hot", filename);
+
+    return chidb_Pager_setCacheSize(*pager, ((*pager)->flags & CHIDB_OPEN_DIRECT) ?
+                                            DEFAULT_DIRECT_CACHE_FRAMES : DEFAULT_CACHE_FRAMES);
 }
 
 
-/* Read the chidb file header
+/* Turns off direct I/O on the file (see CHIDB_OPEN_DIRECT) */
+static void pager_direct_off(Pager *pager, const char *why)
+{
+    int fl;
+
+    if (!(pager->flags & CHIDB_OPEN_DIRECT))
+        return;
+    chilog(WARNING, "Not using O_DIRECT: %s", why);
+    if ((fl = fcntl(pager->fd, F_GETFL)) != -1)
+        fcntl(pager->fd, F_SETFL, fl & ~O_DIRECT);
+    pager->flags &= ~CHIDB_OPEN_DIRECT;
+}
+
+
+/* Current time in microseconds, for the latency histograms */
+static inline uint64_t pager_now_us()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t) ts.tv_sec * 1000000 + ts.tv_nsec / 1000;
+}
+
+/* Adds an operation that took us microseconds to a latency histogram */
+static void pager_stats_latency(uint64_t *hist, uint64_t us)
+{
+    int i = 0;
+
+    while (i < CHIDB_STATS_BUCKETS - 1 && us >= ((uint64_t) 1 << i))
+        i++;
+    hist[i]++;
+}
+
+
+/* Offset of a page in the file */
+static inline off_t pager_offset(Pager *pager, npage_t npage)
+{
+    return (off_t)(npage - 1) * pager->page_size;
+}
+
+
+/* Copies len bytes at offset off of the arena of an in-memory database
+ * into buf (or, if write is true, from buf into the arena, growing it
+ * as needed). Reads stop at the end of the database.
  *
- * This function reads in the header of a chidb file and returns it
- * in a byte array. Note that this function can be called even if
- * the page size is unknown, since the chidb header always occupies
- * the first 100 bytes of the file.
+ * Returns the number of bytes copied, or -1 if the arena cannot grow */
+static ssize_t pager_arena_copy(Pager *pager, uint8_t *buf, size_t len, off_t off, bool write)
+{
+    size_t done = 0;
+
+    if (!write)
+        len = (size_t) off >= pager->arena_size ? 0 : MIN(len, pager->arena_size - off);
+    else if (off + len > pager->arena_chunks * PAGER_ARENA_CHUNK)
+    {
+        size_t n = (off + len + PAGER_ARENA_CHUNK - 1) / PAGER_ARENA_CHUNK;
+        uint8_t **arena = realloc(pager->arena, n * sizeof(uint8_t *));
+
+        if (arena == NULL)
+            return -1;
+        memset(arena + pager->arena_chunks, 0, (n - pager->arena_chunks) * sizeof(uint8_t *));
+        pager->arena = arena;
+        pager->arena_chunks = n;
+    }
+
+    while (done < len)
+    {
+        size_t chunk = (off + done) / PAGER_ARENA_CHUNK, in_chunk = (off + done) % PAGER_ARENA_CHUNK;
+        size_t n = MIN(len - done, PAGER_ARENA_CHUNK - in_chunk);
+
+        if (pager->arena[chunk] == NULL)
+        {
+            if (!write)
+                memset(buf + done, 0, n);
+            else if ((pager->arena[chunk] = calloc(PAGER_ARENA_CHUNK, 1)) == NULL)
+                return -1;
+        }
+        if (write)
+            memcpy(pager->arena[chunk] + in_chunk, buf + done, n);
+        else if (pager->arena[chunk] != NULL)
+            memcpy(buf + done, pager->arena[chunk] + in_chunk, n);
+        done += n;
+    }
+    if (write && off + len > pager->arena_size)
+        pager->arena_size = off + len;
+
+    return done;
+}
+
+/* Shrinks the arena of an in-memory database to size bytes */
+static void pager_arena_truncate(Pager *pager, size_t size)
+{
+    size_t keep = (size + PAGER_ARENA_CHUNK - 1) / PAGER_ARENA_CHUNK;
+
+    if (size >= pager->arena_size)
+        return;
+    for (size_t i = keep; i < pager->arena_chunks; i++)
+    {
+        free(pager->arena[i]);
+        pager->arena[i] = NULL;
+    }
+    if (size % PAGER_ARENA_CHUNK != 0 && pager->arena[keep - 1] != NULL)
+        memset(pager->arena[keep - 1] + size % PAGER_ARENA_CHUNK, 0,
+               PAGER_ARENA_CHUNK - size % PAGER_ARENA_CHUNK);
+    pager->arena_size = size;
+}
+
+/* chidb_preadv on the file, or on the arena of an in-memory database */
+static ssize_t pager_preadv(Pager *pager, struct iovec *iov, int iovcnt, off_t off)
+{
+    ssize_t total = 0, n;
+
+    if (!pager->in_memory)
+        return chidb_preadv(pager->fd, iov, iovcnt, off);
+
+    for (int i = 0; i < iovcnt; i++, total += n)
+        if ((n = pager_arena_copy(pager, iov[i].iov_base, iov[i].iov_len, off + total, false)) < (ssize_t) iov[i].iov_len)
+            return total + n;
+
+    return total;
+}
+
+/* chidb_pwritev on the file, or on the arena of an in-memory database */
+static int pager_pwritev(Pager *pager, struct iovec *iov, int iovcnt, off_t off)
+{
+    if (!pager->in_memory)
+        return chidb_pwritev(pager->fd, iov, iovcnt, off);
+
+    for (int i = 0; i < iovcnt; off += iov[i++].iov_len)
+        if (pager_arena_copy(pager, iov[i].iov_base, iov[i].iov_len, off, true) < 0)
+            return CHIDB_ENOMEM;
+
+    return CHIDB_OK;
+}
+
+
+/* Hash a page number into a bucket of the buffer pool hash table */
+static inline uint32_t pager_hash(Pager *pager, npage_t npage)
+{
+    return (npage * 2654435761u) & pager->hash_mask;
+}
+
+/* Returns the frame holding page npage, or NULL if it is not cached */
+static MemPage *pager_lookup(Pager *pager, npage_t npage)
+{
+    MemPage *frame;
+
+    if (pager->hash == NULL)
+        return NULL;
+
+    for (frame = pager->hash[pager_hash(pager, npage)]; frame != NULL; frame = frame->hash_next)
+        if (frame->npage == npage)
+            return frame;
+
+    return NULL;
+}
+
+static void pager_hash_insert(Pager *pager, MemPage *frame)
+{
+    uint32_t bucket = pager_hash(pager, frame->npage);
+    frame->hash_next = pager->hash[bucket];
+    pager->hash[bucket] = frame;
+}
+
+static void pager_hash_remove(Pager *pager, MemPage *frame)
+{
+    MemPage **p;
+
+    for (p = &pager->hash[pager_hash(pager, frame->npage)]; *p != NULL; p = &(*p)->hash_next)
+        if (*p == frame)
+        {
+            *p = frame->hash_next;
+            break;
+        }
+    frame->hash_next = NULL;
+    frame->npage = 0;
+}
+
+/* Allocates a new, unused frame and adds it to the pool */
+static MemPage *pager_frame_new(Pager *pager)
+{
+    MemPage *frame, **frames;
+
+    if (pager->n_frames == pager->frames_alloc)
+    {
+        uint32_t n = pager->frames_alloc ? 2 * pager->frames_alloc : 16;
+        frames = realloc(pager->frames, sizeof(MemPage *) * n);
+        if (frames == NULL)
+            return NULL;
+        pager->frames = frames;
+        pager->frames_alloc = n;
+    }
+
+    frame = calloc(1, sizeof(MemPage));
+    if (frame == NULL)
+        return NULL;
+    if (posix_memalign((void **) &frame->data, IO_BUFFER_ALIGN, pager->page_size) != 0)
+    {
+        free(frame);
+        return NULL;
+    }
+    frame->pooled = true;
+
+    pager->frames[pager->n_frames++] = frame;
+    return frame;
+}
+
+/* Finds a frame that can hold a new page
  *
- * Parameters
- * - pager: A Pager.
- * - header: Pointer to a byte array with enough space for 100 bytes.
+ * If the pool has not reached its capacity, a new frame is allocated.
+ * Otherwise, CLOCK sweeps over the frames, clearing the reference bit
+ * of recently used frames, until it finds an unpinned frame that has
+ * not been referenced since the last sweep. If every frame is pinned
+ * (or dirty), the pool grows past its capacity rather than failing the read.
  *
- * Return
- * - CHIDB_OK: Operation successful
- * - CHIDB_NOHEADER: The file does not have a header. This will
+ * The returned frame is not in the hash table.
  */
-int chidb_Pager_readHeader(Pager *pager, uint8_t *header)
+static MemPage *pager_frame_victim(Pager *pager)
 {
-    int count;
-    count = fseek(pager->f, 0, SEEK_SET);
-    count = fread(header, 1, 100, pager->f);
-    if (count != 100)
-        return CHIDB_NOHEADER;
-    else
-        return CHIDB_OK;
+    /* Dirty frames do not count towards the capacity of the pool */
+    if (pager->n_frames < pager->max_frames + pager->n_dirty)
+        return pager_frame_new(pager);
+
+    /* Two full sweeps are enough to clear every reference bit */
+    for (uint32_t i = 0; i < 2 * pager->n_frames; i++)
+    {
+        MemPage *frame = pager->frames[pager->clock_hand];
+        pager->clock_hand = (pager->clock_hand + 1) % pager->n_frames;
+
+        if (frame->pin_count > 0 || frame->dirty)
+            continue;
+
+        if (frame->referenced)
+        {
+            frame->referenced = false;
+            continue;
+        }
+
+        if (frame->npage != 0)
+            pager_hash_remove(pager, frame);
+        frame->stale = false;
+        chidb_Pager_dropDecoded(frame);
+        return frame;
+    }
+
+    chilog(DEBUG, "All %i frames are pinned or dirty, growing buffer pool", pager->n_frames);
+    return pager_frame_new(pager);
 }
 
+/* Frees every frame in the buffer pool */
+static void pager_frames_free(Pager *pager)
+{
+    for (uint32_t i = 0; i < pager->n_frames; i++)
+    {
+        if (pager->frames[i]->pin_count > 0)
+            chilog(WARNING, "Page %i is still pinned", pager->frames[i]->npage);
+        free(pager->frames[i]->decoded);
+        free(pager->frames[i]->data);
+        free(pager->frames[i]);
+    }
+    free(pager->frames);
+    pager->frames = NULL;
+    pager->n_frames = 0;
+    pager->frames_alloc = 0;
+    pager->clock_hand = 0;
+    if (pager->hash != NULL)
+        memset(pager->hash, 0, sizeof(MemPage *) * (pager->hash_mask + 1));
+}
 
-/* Allocate an extra page on the file
- *
- * Parameters
- * - pager: A Pager.
- * - npage: An out parameter that will contain the page number of the
- *          new page.
+
+/* Stops a frame from being found by lookups
  *
- * Return
- * - CHIDB_OK: Operation successful
+ * If the frame is pinned, whoever pinned it keeps using it, and it is
+ * recycled once it is unpinned.
  */
-int chidb_Pager_allocatePage(Pager *pager, npage_t *npage)
+static void pager_frame_invalidate(Pager *pager, MemPage *frame)
 {
-    /* We simply increment the page number counter. readPage
-     * and writePage take care of the rest. */
-    *npage = ++pager->n_pages;
+    npage_t npage = frame->npage;
 
-    return CHIDB_OK;
+    pager_hash_remove(pager, frame);
+    if (frame->pin_count > 0)
+    {
+        frame->npage = npage;
+        frame->stale = true;
+    }
 }
 
+/* Drops the cached pages that other Pagers have committed to the WAL
+ * since this Pager last looked at it */
+static void pager_wal_refresh(Pager *pager)
+{
+    uint32_t generation, max_frame;
+    npage_t db_size, npage;
+    MemPage *frame;
+    bool reset;
 
-/* Read a page from file
- *
- * This page reads a page from the file, and creates an in-memory copy
- * in a MemPage struct (see header file for more details on this struct).
- * Always use chidb_Pager_releaseMemPage to free the memory allocated for
- * a MemPage created by this function.
- * Any changes done to a MemPage will not be effective until you call
- * chidb_Pager_writePage with that MemPage.
+    chidb_Wal_getState(pager->wal, &generation, &max_frame, &db_size);
+    if (generation == pager->wal_generation && max_frame == pager->wal_frame)
+        return;
+    pager->change_count++;
+
+    /* If the WAL has been reset, we cannot tell which pages changed */
+    reset = generation != pager->wal_generation;
+    for (uint32_t f = pager->wal_frame + 1; !reset && f <= max_frame; f++)
+    {
+        if ((npage = chidb_Wal_framePage(pager->wal, generation, f)) == 0)
+            reset = true;
+        else if ((frame = pager_lookup(pager, npage)) != NULL)
+            pager_frame_invalidate(pager, frame);
+    }
+    /* Pages past the end of the database (if it shrunk) are dropped too */
+    for (uint32_t i = 0; i < pager->n_frames; i++)
+        if (pager->frames[i]->npage != 0 && !pager->frames[i]->stale && !pager->frames[i]->dirty &&
+            (reset || (db_size != 0 && pager->frames[i]->npage > db_size)))
+            pager_frame_invalidate(pager, pager->frames[i]);
+
+    pager->wal_generation = generation;
+    pager->wal_frame = max_frame;
+    if (db_size != 0)
+        pager->n_pages = pager->valid_pages = db_size;
+}
+
+
+/* Number of pages in each chunk of the file mapping */
+static inline size_t pager_map_chunk_pages(Pager *pager)
+{
+    return PAGER_MMAP_CHUNK / pager->page_size;
+}
+
+/* Returns the descriptor of a mapped page, or NULL if it is not mapped */
+static inline MemPage *pager_map_lookup(Pager *pager, npage_t npage)
+{
+    size_t off = (size_t)(npage - 1) * pager->page_size;
+
+    if (pager->map == NULL || off + pager->page_size > pager->map_size)
+        return NULL;
+
+    return &pager->map_pages[off / PAGER_MMAP_CHUNK][(npage - 1) % pager_map_chunk_pages(pager)];
+}
+
+/* Extends the file mapping so that it covers pages 1 through npage
  *
- * Parameters
- * - pager: A Pager.
- * - npage: Page number of page to read.
- * - page: Out parameter. Used to return a pointer to newly created MemPage
+ * The whole mapping lives in a range of address space reserved up front, so
+ * extending it never moves pages that have already been handed out. The file
+ * itself is grown to cover the mapped pages, since touching a mapped page
+ * past the end of the file would raise SIGBUS.
  *
  * Return
- * - CHIDB_OK: Operation successful
- * - CHIDB_ENOMEM: Could not allocate memory
- * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - CHIDB_OK: Page npage is mapped
+ * - CHIDB_ENOMEM: The page cannot be mapped (the caller should fall back
+ *   to the buffer pool)
  */
-int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
+static int pager_map_extend(Pager *pager, npage_t npage)
 {
-    if (npage > pager->n_pages || npage <= 0)
-        return CHIDB_EPAGENO;
-    int n;
+    size_t end = (size_t)npage * pager->page_size;
+    int fd = pager->fd;
 
-    *page = malloc(sizeof(MemPage));
-    if (page == NULL)
+    if (end > PAGER_MMAP_LIMIT || PAGER_MMAP_CHUNK % pager->page_size != 0)
         return CHIDB_ENOMEM;
-    (*page)->npage = npage;
-    (*page)->data = calloc(pager->page_size, 1);
-    if ((*page)->data == NULL)
-        return CHIDB_ENOMEM;
-    fseek(pager->f, (npage - 1) * pager->page_size, SEEK_SET);
-    n = fread((*page)->data, 1, pager->page_size, pager->f);
-    chilog(TRACE, "Read %i bytes from page %i into memory [%x data: %x]", n, npage, *page, (*page)->data);
+
+    if (pager->map == NULL)
+    {
+        void *map = mmap(NULL, PAGER_MMAP_LIMIT, PROT_NONE,
+                         MAP_PRIVATE | MAP_ANONYMOUS | MAP_NORESERVE, -1, 0);
+        if (map == MAP_FAILED)
+        {
+            chilog(WARNING, "Could not reserve address space for mmap, using buffer pool");
+            pager->flags &= ~CHIDB_OPEN_MMAP;
+            return CHIDB_ENOMEM;
+        }
+        pager->map = map;
+        pager->map_size = 0;
+        pager->map_pages = calloc(PAGER_MMAP_LIMIT / PAGER_MMAP_CHUNK, sizeof(MemPage *));
+        if (pager->map_pages == NULL)
+            return CHIDB_ENOMEM;
+    }
+
+    if (pager->file_size < (off_t) end)
+    {
+        struct stat buf;
+
+        if (fstat(fd, &buf) == 0)
+            pager->file_size = buf.st_size;
+        if (pager->file_size < (off_t) end)
+        {
+            if (ftruncate(fd, end) != 0)
+                return CHIDB_ENOMEM;
+            pager->file_size = end;
+        }
+    }
+
+    while (pager->map_size < end)
+    {
+        size_t chunk = pager->map_size / PAGER_MMAP_CHUNK;
+        size_t chunk_pages = pager_map_chunk_pages(pager);
+        MemPage *descs;
+
+        if (mmap(pager->map + pager->map_size, PAGER_MMAP_CHUNK, PROT_READ | PROT_WRITE,
+                 MAP_PRIVATE | MAP_FIXED, fd, pager->map_size) == MAP_FAILED)
+            return CHIDB_ENOMEM;
+
+        descs = calloc(chunk_pages, sizeof(MemPage));
+        if (descs == NULL)
+            return CHIDB_ENOMEM;
+        for (size_t i = 0; i < chunk_pages; i++)
+        {
+            descs[i].npage = chunk * chunk_pages + i + 1;
+            descs[i].data = pager->map + pager->map_size + i * pager->page_size;
+            descs[i].mapped = true;
+        }
+        pager->map_pages[chunk] = descs;
+
+        pager->map_size += PAGER_MMAP_CHUNK;
+    }
 
     return CHIDB_OK;
 }
 
+/* Unmaps the file and frees the mapped page descriptors */
+static void pager_map_free(Pager *pager)
+{
+    if (pager->map == NULL)
+        return;
+
+    for (size_t i = 0; i < pager->map_size / PAGER_MMAP_CHUNK; i++)
+    {
+        for (size_t j = 0; j < pager_map_chunk_pages(pager); j++)
+            free(pager->map_pages[i][j].decoded);
+        free(pager->map_pages[i]);
+    }
+    free(pager->map_pages);
+    munmap(pager->map, PAGER_MMAP_LIMIT);
+    pager->map = NULL;
+    pager->map_pages = NULL;
+    pager->map_size = 0;
+}
 
-/* Write a page to file
+
+/* Stops loading hot pages in the background (see chidb_Pager_prewarm) */
+static void pager_prewarm_stop(Pager *pager)
+{
+    if (pager->prewarm == NULL)
+        return;
+    pager->stats.bytes_read += pager->prewarm->bytes_read;
+    chidb_Prewarm_stop(pager->prewarm);
+    pager->prewarm = NULL;
+}
+
+/* Once the hot pages have been loaded, puts the ones that have not been
+ * taken yet into the buffer pool, as long as there are free frames */
+static void pager_prewarm_finish(Pager *pager)
+{
+    uint32_t i = 0;
+    npage_t npage;
+    uint8_t *data;
+    MemPage *frame;
+
+    if (!chidb_Prewarm_done(pager->prewarm))
+        return;
+
+    while ((data = chidb_Prewarm_next(pager->prewarm, &i, &npage)) != NULL &&
+           pager->n_frames < pager->max_frames + pager->n_dirty)
+    {
+        if (npage > pager->valid_pages || pager_lookup(pager, npage) != NULL)
+            continue;
+        if ((frame = pager_frame_new(pager)) == NULL)
+            break;
+        memcpy(frame->data, data, pager->page_size);
+        frame->npage = npage;
+        pager_hash_insert(pager, frame);
+    }
+    pager_prewarm_stop(pager);
+}
+
+
+/* Set the size of the buffer pool
  *
- * This page writes the in-memory copy of a page (stored in a MemPage
- * struct) back to disk.
+ * Frames are allocated on demand, so this only sets an upper bound on the
+ * number of pages that the pager will keep in memory (pinned pages may
+ * temporarily push the pool beyond this bound). If the pool currently
+ * holds more frames than nframes, unpinned frames are dropped.
  *
  * Parameters
  * - pager: A Pager.
- * - page: In-memory copy of page to write
+ * - nframes: Maximum number of frames in the pool
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EPAGENO: The page has an incorrect page number
- * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ * - CHIDB_ENOMEM: Could not allocate memory
  */
-int	chidb_Pager_writePage(Pager *pager, MemPage *page)
+int chidb_Pager_setCacheSize(Pager *pager, uint32_t nframes)
 {
-    if (page->npage > pager->n_pages)
-        return CHIDB_EPAGENO;
-    int n;
-    fseek(pager->f, (page->npage - 1) * pager->page_size, SEEK_SET);
-    n = fwrite(page->data, 1, pager->page_size, pager->f);
-    if (n != pager->page_size) {
-        return CHIDB_EIO;
+    uint32_t nbuckets = 1;
+
+    if (nframes == 0)
+        nframes = 1;
+
+    /* Keep the load factor of the hash table at or below 1/2 */
+    while (nbuckets < 2 * nframes)
+        nbuckets <<= 1;
+
+    if (nbuckets - 1 != pager->hash_mask || pager->hash == NULL)
+    {
+        MemPage **hash = calloc(nbuckets, sizeof(MemPage *));
+        if (hash == NULL)
+            return CHIDB_ENOMEM;
+        free(pager->hash);
+        pager->hash = hash;
+        pager->hash_mask = nbuckets - 1;
+
+        for (uint32_t i = 0; i < pager->n_frames; i++)
+            if (pager->frames[i]->npage != 0 && !pager->frames[i]->stale)
+                pager_hash_insert(pager, pager->frames[i]);
     }
-    chilog(TRACE, "Wrote %i bytes to page %i", n, page->npage);
+
+    pager->max_frames = nframes;
+
+    /* Drop unpinned frames beyond the new capacity */
+    for (uint32_t i = 0; i < pager->n_frames && pager->n_frames > nframes; )
+    {
+        MemPage *frame = pager->frames[i];
+        if (frame->pin_count > 0 || frame->dirty)
+        {
+            i++;
+            continue;
+        }
+        if (frame->npage != 0)
+            pager_hash_remove(pager, frame);
+        free(frame->decoded);
+        free(frame->data);
+        free(frame);
+        pager->frames[i] = pager->frames[--pager->n_frames];
+    }
+    pager->clock_hand = 0;
+
     return CHIDB_OK;
 }
 
 
-/* Release an in-memory copy of a page
+/* Allocates the staging buffer for page images, if the pager compresses
+ * pages and the page size is known */
+static int pager_zbuf_alloc(Pager *pager)
+{
+    uint8_t *zbuf;
+
+    if (!(pager->flags & CHIDB_OPEN_COMPRESS) || pager->page_size == 0)
+        return CHIDB_OK;
+    if ((zbuf = realloc(pager->zbuf, pager->page_size)) == NULL)
+        return CHIDB_ENOMEM;
+    pager->zbuf = zbuf;
+
+    return CHIDB_OK;
+}
+
+/* Turn page compression on or off
+ *
+ * This tells the pager whether the pages of the file are stored
+ * compressed. Like chidb_Pager_setPageSize, it must be called before
+ * operating on pages. Compressed pages cannot be read through a memory
+ * mapping, so turning compression on also turns off CHIDB_OPEN_MMAP.
+ * The pages of an in-memory database are never compressed.
  *
  * Parameters
  * - pager: A Pager.
- * - page: In-memory copy of page to write
+ * - compress: Whether pages are compressed
  *
  * Return
  * - CHIDB_OK: Operation successful
- * - CHIDB_EPAGENO: The page has an incorrect page number
+ * - CHIDB_ENOMEM: Could not allocate memory
  */
-int	chidb_Pager_releaseMemPage(Pager *pager, MemPage *page)
+int chidb_Pager_setCompression(Pager *pager, bool compress)
 {
-    if (page->npage > pager->n_pages)
-        return CHIDB_EPAGENO;
+    if (pager->wal != NULL)
+        chidb_Wal_setCompression(pager->wal, compress);
 
-    chilog(TRACE, "Releasing page %i from memory [%x data: %x]", page->npage, page, page->data);
-    free(page->data);
-    free(page);
+    if (!compress || pager->in_memory)
+    {
+        pager->flags &= ~CHIDB_OPEN_COMPRESS;
+        return CHIDB_OK;
+    }
 
-    return CHIDB_OK;
+    /* Page images are not a whole number of blocks long */
+    pager_direct_off(pager, "compressed pages cannot be written directly");
+
+    pager->flags |= CHIDB_OPEN_COMPRESS;
+    pager->flags &= ~CHIDB_OPEN_MMAP;
+    pager_map_free(pager);
+
+    return pager_zbuf_alloc(pager);
 }
 
 
-/* Computes the number of pages in a file.
+/* Set the preallocation chunk size
+ *
+ * When a page is allocated past the space that the file already has
+ * on disk, the file is given another chunk bytes (rounded up to whole
+ * pages) with fallocate. The size of the file is not changed, so this
+ * only affects how its blocks are laid out. If the file system does not
+ * support preallocation, it is turned off. In-memory databases are never
+ * preallocated.
  *
  * Parameters
  * - pager: A Pager.
- * - npages: Out parameter. Number of pages.
+ * - chunk: Bytes to preallocate at a time (0 turns preallocation off)
  *
  * Return
  * - CHIDB_OK: Operation successful
  */
-int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages)
+int chidb_Pager_setPreallocation(Pager *pager, size_t chunk)
+{
+    if (!pager->in_memory)
+        pager->prealloc_chunk = chunk;
+
+    return CHIDB_OK;
+}
+
+
+/* Set the page size
+ *
+ * This tells the pager what the size of each page is.
+ * This function must be called before operating on pages.
+ * It will not verify if the page size makes size. If an incorrect
+ * page size is provided, this will result in unexpected behaviour.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - pagesize: Size of a page (in bytes)
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Pager_setPageSize(Pager *pager, uint32_t pagesize)
+{
+    /* Frames, mapped pages and the page map are laid out for the old page size */
+    if (pagesize != pager->page_size)
+    {
+        pager_prewarm_stop(pager);
+        pager_frames_free(pager);
+        pager_map_free(pager);
+        free(pager->page_map);
+        pager->page_map = NULL;
+        pager->page_map_alloc = 0;
+    }
+
+    if ((pager->flags & CHIDB_OPEN_DIRECT) && pagesize % pager->block_size != 0)
+        pager_direct_off(pager, "the page size is not a multiple of the block size");
+
+    pager->page_size = pagesize;
+    if (pager_zbuf_alloc(pager) != CHIDB_OK)
+        return CHIDB_ENOMEM;
+    chidb_Pager_getRealDBSize(pager, &pager->n_pages);
+    pager->valid_pages = pager->n_pages;
+
+    /* The WAL may hold pages past the end of the file */
+    if (pager->wal != NULL)
+    {
+        uint32_t generation, max_frame;
+        npage_t db_size;
+
+        chidb_Wal_getState(pager->wal, &generation, &max_frame, &db_size);
+        if (db_size > pager->n_pages)
+            pager->n_pages = pager->valid_pages = db_size;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Read the chidb file header
+ *
+ * This function reads in the header of a chidb file and returns it
+ * in a byte array. Note that this function can be called even if
+ * the page size is unknown, since the chidb header always occupies
+ * the first 100 bytes of the file.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - header: Pointer to a byte array with enough space for 100 bytes.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_NOHEADER: The file does not have a header. This will
+ *   happen if the file is empty (e.g., it has just been created)
+ * - CHIDB_ECORRUPTHEADER: The file is shorter than a header
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_readHeader(Pager *pager, uint8_t *header)
+{
+    struct iovec iov = {.iov_base = header, .iov_len = 100};
+    ssize_t count;
+    bool found = false;
+
+    if (pager->wal != NULL && chidb_Wal_readPage(pager->wal, 1, header, 100, &found) != CHIDB_OK)
+        return CHIDB_EIO;
+    if (found)
+        return CHIDB_OK;
+
+    /* A direct read must cover a whole block, into an aligned buffer */
+    if (pager->flags & CHIDB_OPEN_DIRECT)
+    {
+        if (posix_memalign(&iov.iov_base, IO_BUFFER_ALIGN, pager->block_size) != 0)
+            return CHIDB_ENOMEM;
+        iov.iov_len = pager->block_size;
+    }
+    count = pager_preadv(pager, &iov, 1, 0);
+    if (iov.iov_base != header)
+    {
+        if (count > 0)
+            memcpy(header, iov.iov_base, count < 100 ? count : 100);
+        free(iov.iov_base);
+    }
+
+    if (count < 0)
+        return CHIDB_EIO;
+    else if (count == 0)
+        return CHIDB_NOHEADER;
+    else if (count < 100)
+        return CHIDB_ECORRUPTHEADER;
+    else
+        return CHIDB_OK;
+}
+
+
+/* Makes sure that page npage has space allocated on disk, growing the
+ * file (but not its size) by a whole chunk if it does not. Failing to
+ * preallocate is not an error: the page is allocated when it is written. */
+static void pager_preallocate(Pager *pager, npage_t npage)
+{
+#ifdef FALLOC_FL_KEEP_SIZE
+    off_t start = pager_offset(pager, npage);
+    off_t len = pager->prealloc_chunk;
+
+    if (pager->prealloc_chunk == 0 || pager_offset(pager, npage + 1) <= pager->prealloc_end)
+        return;
+
+    if (start < pager->prealloc_end)
+        start = pager->prealloc_end;
+    len = (len + pager->page_size - 1) / pager->page_size * pager->page_size;
+    if (len < pager->page_size)
+        len = pager->page_size;
+
+    if (fallocate(pager->fd, FALLOC_FL_KEEP_SIZE, start, len) == 0)
+    {
+        pager->prealloc_end = start + len;
+        chilog(TRACE, "Preallocated %li bytes at offset %li", (long) len, (long) start);
+    }
+    else if (errno == EOPNOTSUPP || errno == ENOSYS)
+    {
+        chilog(WARNING, "The file system does not support preallocation, turning it off");
+        pager->prealloc_chunk = 0;
+    }
+#endif
+}
+
+/* Gives back the space preallocated past the end of the file. (Punching
+ * a hole would not do: file systems like ext4 ignore holes past the end
+ * of the file, but truncating a file frees every block past its size.) */
+static void pager_preallocate_trim(Pager *pager)
+{
+    struct stat buf;
+
+    if (pager->in_memory || fstat(pager->fd, &buf) != 0 || buf.st_size >= pager->prealloc_end)
+        return;
+    if (ftruncate(pager->fd, buf.st_size) == 0)
+        pager->prealloc_end = buf.st_size;
+}
+
+
+/* Allocate an extra page on the file
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: An out parameter that will contain the page number of the
+ *          new page.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_allocatePage(Pager *pager, npage_t *npage)
+{
+    /* We simply increment the page number counter. readPage
+     * and writePage take care of the rest. */
+    *npage = ++pager->n_pages;
+    pager->stats.pages_allocated++;
+
+    if (!pager->in_memory)
+        pager_preallocate(pager, *npage);
+
+    /* In mmap mode, grow the file and the mapping along with the database */
+    if (pager->flags & CHIDB_OPEN_MMAP)
+        pager_map_extend(pager, *npage);
+
+    return CHIDB_OK;
+}
+
+
+/* Throws away the changes done to a dirty page: a buffer pool frame is
+ * dropped (so that the page is read again from the file), and a mapped
+ * page is read again from the file. */
+static void pager_discard(Pager *pager, MemPage *frame)
+{
+    frame->dirty = false;
+    if (frame->mapped)
+    {
+        struct iovec iov = {.iov_base = frame->data, .iov_len = pager->page_size};
+        pager_preadv(pager, &iov, 1, pager_offset(pager, frame->npage));
+        chidb_Pager_dropDecoded(frame);
+    }
+    else
+        pager_frame_invalidate(pager, frame);
+}
+
+/* Shrinks the file to the pages that are still valid. In mmap mode,
+ * the file is then grown back (with zeroes) to the current number of
+ * pages, since every page that is mapped must be backed by the file. */
+static int pager_truncate_file(Pager *pager)
+{
+    off_t size = pager_offset(pager, pager->valid_pages + 1);
+    struct stat buf;
+
+    pager->truncated = false;
+    if (pager->in_memory)
+    {
+        pager_arena_truncate(pager, size);
+        return CHIDB_OK;
+    }
+    if (fstat(pager->fd, &buf) != 0)
+        return CHIDB_EIO;
+    if (buf.st_size <= size)
+        return CHIDB_OK;
+    if (ftruncate(pager->fd, size) != 0)
+        return CHIDB_EIO;
+    if (pager->map != NULL)
+    {
+        if (pager->n_pages > pager->valid_pages)
+        {
+            size = pager_offset(pager, pager->n_pages + 1);
+            if (size > buf.st_size)
+                size = buf.st_size;
+            if (ftruncate(pager->fd, size) != 0)
+                return CHIDB_EIO;
+        }
+        pager->file_size = size;
+    }
+    /* Shrinking the file also frees the blocks preallocated past its end */
+    pager->prealloc_end = size;
+
+    chilog(TRACE, "Truncated file to %i pages", pager->valid_pages);
+    return CHIDB_OK;
+}
+
+
+/* Remove pages from the end of the file
+ *
+ * Pages npages+1 onwards stop existing: they are dropped from the buffer
+ * pool (along with any changes done to them in the current transaction),
+ * and the file is shrunk. Within a transaction, the file is only shrunk
+ * when the transaction is committed.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npages: New number of pages.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The file has fewer than npages pages
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_truncate(Pager *pager, npage_t npages)
+{
+    if (npages > pager->n_pages)
+        return CHIDB_EPAGENO;
+
+    /* In WAL mode, the new size only takes effect through a commit */
+    if (pager->write_depth == 0 && pager->wal != NULL)
+    {
+        chidb_Pager_begin(pager);
+        chidb_Pager_truncate(pager, npages);
+        return chidb_Pager_commit(pager);
+    }
+
+    for (uint32_t i = 0; i < pager->n_dirty; )
+    {
+        if (pager->dirty[i]->npage > npages)
+        {
+            pager_discard(pager, pager->dirty[i]);
+            pager->dirty[i] = pager->dirty[--pager->n_dirty];
+        }
+        else
+            i++;
+    }
+    for (uint32_t i = 0; i < pager->n_frames; i++)
+        if (pager->frames[i]->npage > npages && !pager->frames[i]->stale)
+            pager_frame_invalidate(pager, pager->frames[i]);
+    pager->n_pages = npages;
+    pager->change_count++;
+    if (pager->valid_pages > npages)
+        pager->valid_pages = npages;
+
+    if (pager->write_depth > 0)
+    {
+        pager->truncated = true;
+        return CHIDB_OK;
+    }
+
+    return pager_truncate_file(pager);
+}
+
+
+/* Bytes that the image of a page takes up in the file, according to the
+ * page map (0 if it does not know) */
+static inline uint32_t pager_page_map_get(Pager *pager, npage_t npage)
+{
+    return npage < pager->page_map_alloc ? pager->page_map[npage] : 0;
+}
+
+static void pager_page_map_set(Pager *pager, npage_t npage, uint32_t len)
+{
+    if (npage >= pager->page_map_alloc)
+    {
+        npage_t n = pager->page_map_alloc ? pager->page_map_alloc : 256;
+        uint32_t *map;
+
+        while (n <= npage)
+            n *= 2;
+        /* The page map is only a hint, so it can do without the entry */
+        if ((map = realloc(pager->page_map, n * sizeof(uint32_t))) == NULL)
+            return;
+        memset(map + pager->page_map_alloc, 0, (n - pager->page_map_alloc) * sizeof(uint32_t));
+        pager->page_map = map;
+        pager->page_map_alloc = n;
+    }
+    pager->page_map[npage] = len;
+}
+
+/* Reads a page of a compressed file into data
+ *
+ * If the page map knows the size of the image of the page, just that many
+ * bytes are read. Otherwise, the first COMPRESS_PROBE_SIZE bytes are read,
+ * and then whatever the header of the image says is still missing.
+ *
+ * Returns the number of bytes read from the file, or -1 on an I/O error
+ * (or if the image is corrupt).
+ */
+static ssize_t pager_read_compressed(Pager *pager, npage_t npage, uint8_t *data)
+{
+    off_t off = pager_offset(pager, npage);
+    uint32_t len = pager_page_map_get(pager, npage), size;
+    struct iovec iov;
+    ssize_t n, m;
+
+    if (len == 0)
+        len = pager->page_size < COMPRESS_PROBE_SIZE ? pager->page_size : COMPRESS_PROBE_SIZE;
+    iov.iov_base = pager->zbuf;
+    iov.iov_len = len;
+    if ((n = pager_preadv(pager, &iov, 1, off)) < 0)
+        return -1;
+
+    /* Unless the file ended, read the rest of the image */
+    size = chidb_Compress_imageSize(pager->zbuf, n, pager->page_size);
+    if (size > n && n == len)
+    {
+        iov.iov_base = pager->zbuf + n;
+        iov.iov_len = size - n;
+        if ((m = pager_preadv(pager, &iov, 1, off + n)) < 0)
+            return -1;
+        n += m;
+    }
+
+    if (chidb_Compress_expand(pager->zbuf, n, data, pager->page_size) != CHIDB_OK)
+    {
+        chilog(ERROR, "Page %i does not hold a valid compressed page", npage);
+        return -1;
+    }
+    pager_page_map_set(pager, npage, size);
+
+    return n;
+}
+
+
+/* Read a page from file
+ *
+ * This function returns the buffer pool frame holding a page, reading
+ * the page from the file only if it is not already cached. The frame
+ * is pinned (i.e., it will not be evicted) until chidb_Pager_releaseMemPage
+ * is called on it. Since frames are shared, any changes done to a
+ * MemPage are visible to other readers of the same page, but they
+ * will not be effective in the file until you call chidb_Pager_writePage
+ * with that MemPage.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npage: Page number of page to read.
+ * - page: Out parameter. Used to return a pointer to newly created MemPage
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int	chidb_Pager_readPage(Pager *pager, npage_t npage, MemPage **page)
+{
+    if (npage > pager->n_pages || npage <= 0)
+        return CHIDB_EPAGENO;
+    ssize_t n;
+    struct iovec iov;
+    MemPage *frame;
+    bool found = false, prewarmed = false;
+    uint64_t start;
+
+    if (pager->wal != NULL && pager->write_depth == 0)
+        pager_wal_refresh(pager);
+    if (pager->prewarm != NULL)
+        pager_prewarm_finish(pager);
+    pager->stats.page_reads++;
+
+    if ((pager->flags & CHIDB_OPEN_MMAP) &&
+        ((frame = pager_map_lookup(pager, npage)) != NULL || pager_map_extend(pager, npage) == CHIDB_OK))
+    {
+        frame = pager_map_lookup(pager, npage);
+        if (npage > pager->valid_pages && frame->pin_count == 0 && !frame->dirty)
+        {
+            memset(frame->data, 0, pager->page_size);
+            chidb_Pager_dropDecoded(frame);
+        }
+        frame->pin_count++;
+        pager->stats.cache_hits++;
+        *page = frame;
+        return CHIDB_OK;
+    }
+
+    if ((frame = pager_lookup(pager, npage)) != NULL)
+    {
+        frame->pin_count++;
+        frame->referenced = true;
+        pager->stats.cache_hits++;
+        *page = frame;
+        return CHIDB_OK;
+    }
+
+    pager->stats.cache_misses++;
+    if ((frame = pager_frame_victim(pager)) == NULL)
+        return CHIDB_ENOMEM;
+    start = pager_now_us();
+
+    /* Pages past the valid ones may still have stale contents in the file
+     * (or in the WAL), if they were truncated and allocated again */
+    if (npage > pager->valid_pages)
+    {
+        memset(frame->data, 0, pager->page_size);
+        found = true;
+    }
+    else if (pager->wal != NULL &&
+             chidb_Wal_readPage(pager->wal, npage, frame->data, pager->page_size, &found) != CHIDB_OK)
+        return CHIDB_EIO;
+    else if (pager->prewarm != NULL && chidb_Prewarm_read(pager->prewarm, npage, frame->data))
+        found = prewarmed = true;
+
+    iov.iov_base = frame->data;
+    iov.iov_len = pager->page_size;
+    if (found)
+        n = pager->page_size;
+    else if (pager->flags & CHIDB_OPEN_COMPRESS)
+        n = pager_read_compressed(pager, npage, frame->data);
+    else
+        n = pager_preadv(pager, &iov, 1, pager_offset(pager, npage));
+    if (n < 0)
+    {
+        frame->referenced = false;
+        return CHIDB_EIO;
+    }
+    if (npage <= pager->valid_pages && !prewarmed)
+    {
+        pager->stats.bytes_read += n;
+        pager_stats_latency(pager->stats.read_latency, pager_now_us() - start);
+    }
+    chilog(TRACE, "Read %i bytes from page %i into memory [%x data: %x]", n, npage, frame, frame->data);
+
+    frame->npage = npage;
+    frame->pin_count = 1;
+    frame->referenced = true;
+    pager_hash_insert(pager, frame);
+    *page = frame;
+
+    return CHIDB_OK;
+}
+
+
+/* Propagates a page that is about to be written to the other in-memory
+ * copies of it (the buffer pool frame and the mapped page) */
+static void pager_update_copies(Pager *pager, MemPage *page)
+{
+    MemPage *frame;
+
+    if (!page->pooled && (frame = pager_lookup(pager, page->npage)) != NULL)
+    {
+        memcpy(frame->data, page->data, pager->page_size);
+        chidb_Pager_dropDecoded(frame);
+    }
+    if (!page->mapped && (frame = pager_map_lookup(pager, page->npage)) != NULL)
+    {
+        memcpy(frame->data, page->data, pager->page_size);
+        chidb_Pager_dropDecoded(frame);
+    }
+}
+
+
+/* Writes pages of a compressed file, sorted by page number
+ *
+ * The image of a page does not fill its slot, so there are no runs of
+ * adjacent pages to coalesce: every page is written on its own (with
+ * io_uring, all of the writes are submitted at once). If the image of the
+ * last page is shorter than a page, the file is grown to cover the whole
+ * page, so that the file is always a whole number of pages long.
+ */
+static int pager_write_compressed(Pager *pager, MemPage **sorted, uint32_t n)
+{
+    bool batch = pager->ring != NULL && n > 1;
+    uint8_t *bufs = NULL, *image;
+    struct iovec *iov = NULL;
+    UringOp *ops = NULL;
+    uint32_t len = pager->page_size;
+    uint64_t start = pager_now_us();
+    int rc = CHIDB_OK;
+
+    if (batch &&
+        ((bufs = malloc((size_t) n * pager->page_size)) == NULL ||
+         (iov = malloc(n * sizeof(struct iovec))) == NULL ||
+         (ops = malloc(n * sizeof(UringOp))) == NULL))
+    {
+        free(bufs);
+        free(iov);
+        return CHIDB_ENOMEM;
+    }
+
+    for (uint32_t i = 0; i < n && rc == CHIDB_OK; i++)
+    {
+        off_t off = pager_offset(pager, sorted[i]->npage);
+        uint8_t *buf = batch ? bufs + (size_t) i * pager->page_size : pager->zbuf;
+
+        pager_update_copies(pager, sorted[i]);
+        image = chidb_Compress_page(sorted[i]->npage, sorted[i]->data, pager->page_size, buf, &len);
+        pager_page_map_set(pager, sorted[i]->npage, len);
+        pager->stats.bytes_written += len;
+
+        if (batch)
+        {
+            iov[i] = (struct iovec) {.iov_base = image, .iov_len = len};
+            ops[i] = (UringOp) {.write = true, .fd = pager->fd, .iov = &iov[i], .iovcnt = 1, .offset = off};
+        }
+        else
+        {
+            struct iovec v = {.iov_base = image, .iov_len = len};
+            rc = pager_pwritev(pager, &v, 1, off);
+        }
+    }
+    if (batch)
+        rc = chidb_Uring_run(pager->ring, ops, n);
+    pager->stats.page_writes += n;
+    pager_stats_latency(pager->stats.write_latency, pager_now_us() - start);
+    chilog(TRACE, "Wrote %i compressed pages", n);
+
+    if (rc == CHIDB_OK && n > 0 && len < pager->page_size)
+    {
+        off_t end = pager_offset(pager, sorted[n - 1]->npage + 1);
+        struct stat buf;
+
+        if (fstat(pager->fd, &buf) != 0 || (buf.st_size < end && ftruncate(pager->fd, end) != 0))
+            rc = CHIDB_EIO;
+    }
+
+    free(bufs);
+    free(iov);
+    free(ops);
+    return rc;
+}
+
+
+/* Adds a page to the pages modified by the current transaction */
+static int pager_mark_dirty(Pager *pager, MemPage *frame)
+{
+    frame->referenced = true;
+    if (frame->dirty)
+        return CHIDB_OK;
+
+    if (pager->n_dirty == pager->dirty_alloc)
+    {
+        uint32_t n = pager->dirty_alloc ? 2 * pager->dirty_alloc : 64;
+        MemPage **dirty = realloc(pager->dirty, n * sizeof(MemPage *));
+        if (dirty == NULL)
+            return CHIDB_ENOMEM;
+        pager->dirty = dirty;
+        pager->dirty_alloc = n;
+    }
+    pager->dirty[pager->n_dirty++] = frame;
+    frame->dirty = true;
+
+    return CHIDB_OK;
+}
+
+/* Writes a page within a transaction: the page is kept in memory, in its
+ * buffer pool frame or mapped page, until the transaction is committed */
+static int pager_defer_write(Pager *pager, MemPage *page)
+{
+    MemPage *frame = page;
+
+    if ((!page->pooled && !page->mapped) || page->stale)
+    {
+        pager_update_copies(pager, page);
+        if ((frame = pager_map_lookup(pager, page->npage)) == NULL &&
+            (frame = pager_lookup(pager, page->npage)) == NULL)
+        {
+            if ((frame = pager_frame_victim(pager)) == NULL)
+                return CHIDB_ENOMEM;
+            frame->npage = page->npage;
+            pager_hash_insert(pager, frame);
+            memcpy(frame->data, page->data, pager->page_size);
+        }
+    }
+
+    return pager_mark_dirty(pager, frame);
+}
+
+
+/* Write a page to file
+ *
+ * This page writes the in-memory copy of a page (stored in a MemPage
+ * struct) back to disk. If the page is a private MemPage and the page
+ * is also cached in the buffer pool, the cached frame is updated too.
+ * Within a transaction, the page is only written when the transaction
+ * is committed.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - page: In-memory copy of page to write
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page has an incorrect page number
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int	chidb_Pager_writePage(Pager *pager, MemPage *page)
+{
+    if (page->npage > pager->n_pages)
+        return CHIDB_EPAGENO;
+    struct iovec iov = {.iov_base = page->data, .iov_len = pager->page_size};
+
+    /* The page may have been modified since it was decoded */
+    chidb_Pager_dropDecoded(page);
+
+    /* The prewarmer may have loaded the old version of the page */
+    if (pager->prewarm != NULL)
+        chidb_Prewarm_forget(pager->prewarm, page->npage);
+
+    if (pager->write_depth > 0)
+        return pager_defer_write(pager, page);
+
+    /* In WAL mode, a write outside of a transaction is a transaction by itself */
+    if (pager->wal != NULL)
+    {
+        int rc;
+
+        chidb_Pager_begin(pager);
+        if ((rc = pager_defer_write(pager, page)) != CHIDB_OK)
+        {
+            chidb_Pager_rollback(pager);
+            return rc;
+        }
+        return chidb_Pager_commit(pager);
+    }
+
+    if (pager->flags & CHIDB_OPEN_COMPRESS)
+    {
+        int rc;
+
+        if ((rc = pager_write_compressed(pager, &page, 1)) != CHIDB_OK)
+            return rc;
+    }
+    else
+    {
+        uint64_t start = pager_now_us();
+
+        pager_update_copies(pager, page);
+
+        if (pager_pwritev(pager, &iov, 1, pager_offset(pager, page->npage)) != CHIDB_OK)
+            return CHIDB_EIO;
+        pager->stats.page_writes++;
+        pager->stats.bytes_written += pager->page_size;
+        pager_stats_latency(pager->stats.write_latency, pager_now_us() - start);
+    }
+    if (page->npage > pager->valid_pages)
+        pager->valid_pages = page->npage;
+    chilog(TRACE, "Wrote %i bytes to page %i", pager->page_size, page->npage);
+    return CHIDB_OK;
+}
+
+
+/* Read a run of adjacent pages
+ *
+ * Same as calling chidb_Pager_readPage on pages first through first+n-1,
+ * except that the pages that are not cached are read with as few
+ * system calls as possible (one for each run of uncached pages).
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - first: Page number of the first page to read.
+ * - n: Number of pages to read.
+ * - pages: Out parameter. An array of n MemPage pointers, used to
+ *          return the pages (which must be released individually).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: Some page does not exist
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_readPages(Pager *pager, npage_t first, uint32_t n, MemPage **pages)
+{
+    if (first <= 0 || n == 0 || first - 1 + n > pager->n_pages)
+        return CHIDB_EPAGENO;
+    struct iovec *iov;
+    UringOp *ops;
+    uint32_t i = 0, run, nops = 0, nread = 0;
+    uint64_t start;
+    int rc = CHIDB_OK;
+
+    if ((pager->flags & (CHIDB_OPEN_MMAP | CHIDB_OPEN_COMPRESS)) || pager->wal != NULL ||
+        first - 1 + n > pager->valid_pages)
+    {
+        for (; i < n; i++)
+            if ((rc = chidb_Pager_readPage(pager, first + i, &pages[i])) != CHIDB_OK)
+                goto fail;
+        return CHIDB_OK;
+    }
+
+    iov = malloc(n * sizeof(struct iovec));
+    ops = malloc(n * sizeof(UringOp));
+    if (iov == NULL || ops == NULL)
+    {
+        free(iov);
+        free(ops);
+        return CHIDB_ENOMEM;
+    }
+
+    /* Claim a frame for every page that is not cached, and plan one read
+     * for each run of uncached pages. Claimed frames are pinned (and not
+     * in the hash table yet) so that they are not handed out twice. */
+    while (i < n && rc == CHIDB_OK)
+    {
+        MemPage *frame;
+
+        if ((frame = pager_lookup(pager, first + i)) != NULL)
+        {
+            frame->pin_count++;
+            frame->referenced = true;
+            pager->stats.cache_hits++;
+            pages[i++] = frame;
+            continue;
+        }
+
+        for (run = 0; i + run < n && run < PAGER_IOV_MAX &&
+                      pager_lookup(pager, first + i + run) == NULL; run++)
+        {
+            if ((frame = pager_frame_victim(pager)) == NULL)
+            {
+                rc = CHIDB_ENOMEM;
+                break;
+            }
+            frame->pin_count = 1;
+            frame->npage = 0;
+            pages[i + run] = frame;
+            iov[i + run].iov_base = frame->data;
+            iov[i + run].iov_len = pager->page_size;
+        }
+        if (run > 0)
+            ops[nops++] = (UringOp) {.write = false, .fd = pager->fd, .iov = &iov[i], .iovcnt = run,
+                                     .offset = pager_offset(pager, first + i)};
+        i += run;
+        nread += run;
+    }
+    pager->stats.page_reads += i;
+    pager->stats.cache_misses += nread;
+
+    /* Run the reads: all at once through io_uring, or one after the other */
+    if (rc == CHIDB_OK && pager->ring != NULL && nops > 1)
+    {
+        start = pager_now_us();
+        rc = chidb_Uring_run(pager->ring, ops, nops);
+        pager_stats_latency(pager->stats.read_latency, pager_now_us() - start);
+    }
+    else
+        for (uint32_t j = 0; rc == CHIDB_OK && j < nops; j++)
+        {
+            start = pager_now_us();
+            if (pager_preadv(pager, ops[j].iov, ops[j].iovcnt, ops[j].offset) < 0)
+                rc = CHIDB_EIO;
+            pager_stats_latency(pager->stats.read_latency, pager_now_us() - start);
+        }
+    if (rc == CHIDB_OK)
+        pager->stats.bytes_read += (uint64_t) nread * pager->page_size;
+
+    /* Claimed frames are only cached if every read succeeded */
+    for (uint32_t j = 0; j < i; j++)
+        if (pages[j]->pooled && pages[j]->npage == 0)
+        {
+            if (rc != CHIDB_OK)
+            {
+                pages[j]->pin_count = 0;
+                pages[j] = NULL;
+                continue;
+            }
+            pages[j]->npage = first + j;
+            pages[j]->referenced = true;
+            pager_hash_insert(pager, pages[j]);
+        }
+    chilog(TRACE, "Read pages %i through %i into memory (%i reads)", first, first + n - 1, nops);
+
+    free(iov);
+    free(ops);
+    if (rc == CHIDB_OK)
+        return CHIDB_OK;
+
+fail:
+    while (i > 0)
+        if (pages[--i] != NULL)
+            chidb_Pager_releaseMemPage(pager, pages[i]);
+    return rc;
+}
+
+
+static int pager_cmp_npage(const void *a, const void *b)
+{
+    npage_t na = (*(MemPage * const *) a)->npage, nb = (*(MemPage * const *) b)->npage;
+    return (na > nb) - (na < nb);
+}
+
+static int pager_cmp_pageno(const void *a, const void *b)
+{
+    npage_t na = *(const npage_t *) a, nb = *(const npage_t *) b;
+    return (na > nb) - (na < nb);
+}
+
+/* Same as pager_write_sorted, but submits the writes of every run at once */
+static int pager_uring_write_sorted(Pager *pager, MemPage **sorted, uint32_t n)
+{
+    struct iovec *iov = malloc(n * sizeof(struct iovec));
+    UringOp *ops = malloc(n * sizeof(UringOp));
+    uint32_t i, run, nops = 0;
+    int rc;
+
+    if (iov == NULL || ops == NULL)
+    {
+        free(iov);
+        free(ops);
+        return CHIDB_ENOMEM;
+    }
+
+    for (i = 0; i < n; i += run)
+    {
+        for (run = 0; i + run < n && run < PAGER_IOV_MAX; run++)
+        {
+            if (run > 0 && sorted[i + run]->npage != sorted[i + run - 1]->npage + 1)
+                break;
+            pager_update_copies(pager, sorted[i + run]);
+            iov[i + run].iov_base = sorted[i + run]->data;
+            iov[i + run].iov_len = pager->page_size;
+        }
+        ops[nops++] = (UringOp) {.write = true, .fd = pager->fd, .iov = &iov[i], .iovcnt = run,
+                                 .offset = pager_offset(pager, sorted[i]->npage)};
+    }
+
+    uint64_t start = pager_now_us();
+    rc = chidb_Uring_run(pager->ring, ops, nops);
+    pager->stats.page_writes += n;
+    pager->stats.bytes_written += (uint64_t) n * pager->page_size;
+    pager_stats_latency(pager->stats.write_latency, pager_now_us() - start);
+    chilog(TRACE, "Wrote %i pages with %i writes through io_uring", n, nops);
+
+    free(iov);
+    free(ops);
+    return rc;
+}
+
+/* Writes pages sorted by page number, one pwritev per run of adjacent pages */
+static int pager_write_sorted(Pager *pager, MemPage **sorted, uint32_t n)
+{
+    struct iovec iov[PAGER_IOV_MAX];
+    uint32_t i, run;
+    int rc = CHIDB_OK;
+
+    if (pager->flags & CHIDB_OPEN_COMPRESS)
+        return pager_write_compressed(pager, sorted, n);
+    if (pager->ring != NULL && n > 1)
+        return pager_uring_write_sorted(pager, sorted, n);
+
+    for (i = 0; i < n && rc == CHIDB_OK; i += run)
+    {
+        for (run = 0; i + run < n && run < PAGER_IOV_MAX; run++)
+        {
+            if (run > 0 && sorted[i + run]->npage != sorted[i + run - 1]->npage + 1)
+                break;
+            pager_update_copies(pager, sorted[i + run]);
+            iov[run].iov_base = sorted[i + run]->data;
+            iov[run].iov_len = pager->page_size;
+        }
+        uint64_t start = pager_now_us();
+        rc = pager_pwritev(pager, iov, run, pager_offset(pager, sorted[i]->npage));
+        pager->stats.page_writes += run;
+        pager->stats.bytes_written += (uint64_t) run * pager->page_size;
+        pager_stats_latency(pager->stats.write_latency, pager_now_us() - start);
+        chilog(TRACE, "Wrote pages %i through %i", sorted[i]->npage, sorted[i + run - 1]->npage);
+    }
+
+    return rc;
+}
+
+/* Write several pages to file
+ *
+ * Same as calling chidb_Pager_writePage on each page, except that the
+ * pages are written in page number order, and each run of adjacent
+ * pages is written with a single system call.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - pages: Array of in-memory copies of the pages to write
+ * - n: Number of pages
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: Some page has an incorrect page number (no page is written)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_writePages(Pager *pager, MemPage **pages, uint32_t n)
+{
+    MemPage **sorted;
+    uint32_t i;
+    int rc = CHIDB_OK;
+
+    for (i = 0; i < n; i++)
+        if (pages[i]->npage > pager->n_pages || pages[i]->npage <= 0)
+            return CHIDB_EPAGENO;
+    if (pager->prewarm != NULL)
+        for (i = 0; i < n; i++)
+            chidb_Prewarm_forget(pager->prewarm, pages[i]->npage);
+
+    if (pager->wal != NULL || pager->write_depth > 0)
+    {
+        chidb_Pager_begin(pager);
+        for (i = 0; i < n && rc == CHIDB_OK; i++)
+            rc = chidb_Pager_writePage(pager, pages[i]);
+        int commit_rc = chidb_Pager_commit(pager);
+        return rc != CHIDB_OK ? rc : commit_rc;
+    }
+
+    if ((sorted = malloc(n * sizeof(MemPage *))) == NULL)
+        return CHIDB_ENOMEM;
+    memcpy(sorted, pages, n * sizeof(MemPage *));
+    qsort(sorted, n, sizeof(MemPage *), pager_cmp_npage);
+
+    rc = pager_write_sorted(pager, sorted, n);
+
+    free(sorted);
+    return rc;
+}
+
+
+/* Asks the kernel to start reading pages first through first+n-1 into
+ * the page cache, without waiting for them */
+static void pager_prefetch(Pager *pager, npage_t first, uint32_t n)
+{
+    off_t off = pager_offset(pager, first), len = (off_t) n * pager->page_size;
+
+    if (pager->in_memory || (pager->flags & CHIDB_OPEN_DIRECT))
+        return;
+    if (pager->map != NULL)
+    {
+        uintptr_t mask = (uintptr_t) sysconf(_SC_PAGESIZE) - 1;
+        uintptr_t start = (uintptr_t) (pager->map + off) & ~mask;
+
+        if ((size_t) (off + len) > pager->map_size)
+            len = pager->map_size > (size_t) off ? (off_t) pager->map_size - off : 0;
+        if (len > 0)
+            madvise((void *) start, (uintptr_t) (pager->map + off + len) - start, MADV_WILLNEED);
+        return;
+    }
+
+    posix_fadvise(pager->fd, off, len, POSIX_FADV_WILLNEED);
+}
+
+
+/* Initialize the read-ahead state of a scan
+ *
+ * Parameters
+ * - ra: Read-ahead state
+ */
+void chidb_Pager_initReadAhead(PagerReadAhead *ra)
+{
+    memset(ra, 0, sizeof(PagerReadAhead));
+}
+
+
+/* Record a page access of a scan, and read ahead if it follows a pattern
+ *
+ * Once PAGER_READAHEAD_TRIGGER consecutive accesses of a scan are the
+ * same distance apart (e.g., pages 7, 8, 9 or pages 20, 16, 12), the next
+ * PAGER_READAHEAD_PAGES pages along that stride are prefetched in the
+ * background. Prefetching is done in windows: the next window is requested
+ * when the scan is halfway through the current one, so that the scan never
+ * catches up with the I/O. Any other access resets the detection.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - ra: Read-ahead state of the scan
+ * - npage: Page that the scan is accessing
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page number is not valid
+ */
+int chidb_Pager_readAhead(Pager *pager, PagerReadAhead *ra, npage_t npage)
+{
+    if (npage <= 0 || npage > pager->n_pages)
+        return CHIDB_EPAGENO;
+
+    int64_t stride = (int64_t) npage - ra->last;
+    if (stride == 0)
+        return CHIDB_OK;
+
+    if (ra->last != 0 && stride == ra->stride)
+        ra->hits++;
+    else
+    {
+        ra->stride = ra->last != 0 ? stride : 0;
+        ra->hits = ra->last != 0 ? 1 : 0;
+        ra->window_end = npage;
+    }
+    ra->last = npage;
+
+    if (ra->hits < PAGER_READAHEAD_TRIGGER)
+        return CHIDB_OK;
+
+    /* Wait until the scan is halfway through the current window */
+    int64_t ahead = ((int64_t) ra->window_end - npage) / ra->stride;
+    if (ahead > PAGER_READAHEAD_PAGES / 2)
+        return CHIDB_OK;
+
+    int64_t from = (int64_t) ra->window_end + ra->stride;
+    int64_t to = (int64_t) npage + ra->stride * PAGER_READAHEAD_PAGES;
+    if (to > pager->n_pages)
+        to = pager->n_pages;
+    if (to < 1)
+        to = 1;
+
+    if (ra->stride == 1 && from <= to)
+        pager_prefetch(pager, from, to - from + 1);
+    else if (ra->stride == -1 && to <= from)
+        pager_prefetch(pager, to, from - to + 1);
+    else
+    {
+        for (int64_t p = from; ra->stride > 0 ? p <= to : p >= to; p += ra->stride)
+            if (pager_lookup(pager, p) == NULL)
+                pager_prefetch(pager, p, 1);
+    }
+    chilog(TRACE, "Read ahead pages %i through %i (stride %i)", (int) from, (int) to, (int) ra->stride);
+    ra->window_end = to;
+
+    return CHIDB_OK;
+}
+
+
+
+/* Loads the pages saved by the last session in the background
+ *
+ * If the pager was opened with CHIDB_OPEN_PREWARM, and the pages that
+ * were in the buffer pool when the file was last closed were saved,
+ * this starts loading them (at most as many as fit in the buffer pool).
+ * This must be called once the page size is known, and before any
+ * other operation on pages.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful (or there is nothing to load)
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Pager_prewarm(Pager *pager)
+{
+    npage_t *pages;
+    uint32_t n;
+    int rc;
+
+    if (pager->hot_filename == NULL || pager->prewarm != NULL || pager->page_size == 0)
+        return CHIDB_OK;
+    rc = chidb_Prewarm_load(pager->hot_filename, pager->page_size, pager->valid_pages,
+                            pager->max_frames, &pages, &n);
+    if (rc != CHIDB_OK)
+        return rc == CHIDB_ENOTFOUND ? CHIDB_OK : rc;
+
+    /* The WAL may have newer versions of the pages, compressed pages have
+     * to be expanded, and mapped pages are not in the buffer pool */
+    if (pager->flags & (CHIDB_OPEN_WAL | CHIDB_OPEN_COMPRESS | CHIDB_OPEN_MMAP))
+    {
+        for (uint32_t i = 0, run; i < n; i += run)
+        {
+            for (run = 1; i + run < n && pages[i + run] == pages[i] + run; run++)
+                ;
+            pager_prefetch(pager, pages[i], run);
+        }
+        free(pages);
+        return CHIDB_OK;
+    }
+
+    return chidb_Prewarm_start(&pager->prewarm, pager->fd, pager->page_size, pages, n);
+}
+
+/* Saves the pages in the buffer pool (and the ones that were loaded by
+ * chidb_Pager_prewarm but not used yet) to the hot page file */
+static int pager_prewarm_save(Pager *pager)
+{
+    npage_t *pages;
+    uint32_t n = 0, m = 0;
+    int rc;
+
+    /* Mapped pages are cached by the OS, which does not tell which ones */
+    if (pager->hot_filename == NULL || pager->page_size == 0 || pager->map != NULL)
+        return CHIDB_OK;
+
+    if ((pages = malloc((pager->n_frames + (pager->prewarm ? pager->prewarm->n_pages : 0) + 1) *
+                        sizeof(npage_t))) == NULL)
+        return CHIDB_ENOMEM;
+    for (uint32_t i = 0; i < pager->n_frames; i++)
+        if (pager->frames[i]->npage != 0 && !pager->frames[i]->stale &&
+            pager->frames[i]->npage <= pager->valid_pages)
+            pages[n++] = pager->frames[i]->npage;
+    if (pager->prewarm != NULL)
+        for (uint32_t i = 0; i < pager->prewarm->n_pages; i++)
+            if (!pager->prewarm->used[i] && pager->prewarm->pages[i] <= pager->valid_pages)
+                pages[n++] = pager->prewarm->pages[i];
+
+    qsort(pages, n, sizeof(npage_t), pager_cmp_pageno);
+    for (uint32_t i = 0; i < n; i++)
+        if (m == 0 || pages[i] != pages[m - 1])
+            pages[m++] = pages[i];
+
+    rc = chidb_Prewarm_save(pager->hot_filename, pager->page_size, pages, m);
+    free(pages);
+    return rc;
+}
+
+/* Release an in-memory copy of a page
+ *
+ * Unpins a buffer pool frame returned by chidb_Pager_readPage (the frame
+ * stays cached until it is evicted), or frees a private MemPage.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - page: In-memory copy of page to write
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EPAGENO: The page has an incorrect page number
+ */
+int	chidb_Pager_releaseMemPage(Pager *pager, MemPage *page)
+{
+    if (page->npage > pager->n_pages)
+        return CHIDB_EPAGENO;
+
+    chilog(TRACE, "Releasing page %i from memory [%x data: %x]", page->npage, page, page->data);
+    if (page->pooled || page->mapped)
+    {
+        assert(page->pin_count > 0);
+        page->pin_count--;
+        return CHIDB_OK;
+    }
+
+    free(page->decoded);
+    free(page->data);
+    free(page);
+
+    return CHIDB_OK;
+}
+
+
+/* Drop the decoded form of a page
+ *
+ * Modules above the pager may keep a decoded form of a page in its
+ * MemPage (see chidb_Btree_searchNode), which is only valid as long as
+ * the page does not change. The pager drops it whenever it changes the
+ * contents of a page (or reuses its frame for another page), and when the
+ * page is written. A module that modifies a page must drop it too, if it
+ * reads the page again before writing it.
+ *
+ * Parameters
+ * - page: A MemPage
+ */
+void chidb_Pager_dropDecoded(MemPage *page)
+{
+    free(page->decoded);
+    page->decoded = NULL;
+}
+
+
+/* Computes the number of pages in a file.
+ *
+ * Parameters
+ * - pager: A Pager.
+ * - npages: Out parameter. Number of pages.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages)
 {
     struct stat buf;
-    fstat(fileno(pager->f), &buf);
+
+    if (pager->in_memory)
+    {
+        *npages = pager->arena_size / pager->page_size;
+        return CHIDB_OK;
+    }
+    if (fstat(pager->fd, &buf) != 0)
+        return CHIDB_EIO;
     *npages = buf.st_size / pager->page_size;
 
+    /* The image of the last page of a compressed file may be cut short
+     * (if the file was not grown after writing it) */
+    if ((pager->flags & CHIDB_OPEN_COMPRESS) && buf.st_size % pager->page_size != 0)
+        (*npages)++;
+
+    return CHIDB_OK;
+}
+
+
+/* Ends the current transaction as far as its dirty pages are concerned,
+ * discarding their changes if discard is true */
+static void pager_dirty_clear(Pager *pager, bool discard)
+{
+    for (uint32_t i = 0; i < pager->n_dirty; i++)
+    {
+        if (discard)
+            pager_discard(pager, pager->dirty[i]);
+        else
+            pager->dirty[i]->dirty = false;
+    }
+    pager->n_dirty = 0;
+}
+
+/* Appends the dirty pages to the WAL, and releases the write lock */
+static int pager_wal_commit(Pager *pager)
+{
+    npage_t *npages = NULL;
+    uint8_t **data = NULL;
+    uint32_t n = pager->n_dirty, generation, max_frame;
+    npage_t db_size;
+    uint64_t lsn = 0, start, elapsed = 0;
+    int rc = CHIDB_OK;
+
+    if (n > 0)
+    {
+        if ((npages = malloc(n * sizeof(npage_t))) == NULL ||
+            (data = malloc(n * sizeof(uint8_t *))) == NULL)
+            rc = CHIDB_ENOMEM;
+        for (uint32_t i = 0; rc == CHIDB_OK && i < n; i++)
+        {
+            npages[i] = pager->dirty[i]->npage;
+            data[i] = pager->dirty[i]->data;
+        }
+        if (rc == CHIDB_OK)
+        {
+            start = pager_now_us();
+            rc = chidb_Wal_append(pager->wal, pager->page_size, npages, data, n, pager->n_pages, &lsn);
+            elapsed = pager_now_us() - start;
+        }
+
+        /* If the commit failed, its pages are dropped, so that they are read
+         * again (in their last committed version) */
+        pager_dirty_clear(pager, rc != CHIDB_OK);
+        if (rc != CHIDB_OK)
+        {
+            pager->n_pages = pager->txn_n_pages;
+            pager->valid_pages = pager->txn_valid_pages;
+            pager->change_count++;
+        }
+        else
+        {
+            pager->valid_pages = pager->n_pages;
+            pager->stats.page_writes += n;
+            pager->stats.bytes_written += (uint64_t) n * (WAL_FRAME_HEADER_SIZE + pager->page_size);
+        }
+    }
+
+    /* Nobody else can commit while we hold the write lock, so the WAL
+     * does not have anything that this Pager has not seen */
+    chidb_Wal_getState(pager->wal, &generation, &max_frame, &db_size);
+    if (rc == CHIDB_OK && max_frame >= WAL_AUTOCHECKPOINT)
+    {
+        rc = chidb_Wal_checkpoint(pager->wal);
+        chidb_Wal_getState(pager->wal, &generation, &max_frame, &db_size);
+    }
+    pager->wal_generation = generation;
+    pager->wal_frame = max_frame;
+
+    chidb_Wal_endWrite(pager->wal);
+
+    /* Wait for the commit to be durable after releasing the write lock,
+     * so that the fdatasync can be shared with other committers */
+    if (rc == CHIDB_OK && n > 0)
+    {
+        start = pager_now_us();
+        rc = chidb_Wal_sync(pager->wal, lsn);
+        pager_stats_latency(pager->stats.write_latency, elapsed + pager_now_us() - start);
+    }
+
+    free(npages);
+    free(data);
+    return rc;
+}
+
+
+/* Begin a write transaction
+ *
+ * Every page written within the transaction is kept in memory until
+ * the transaction is committed (or rolled back). Transactions can be
+ * nested; only the outermost commit has any effect.
+ *
+ * In WAL mode, this also acquires the write lock (blocking until no other
+ * Pager on the same database is writing) and makes sure that the pages
+ * read from now on are up to date.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ */
+int chidb_Pager_begin(Pager *pager)
+{
+    if (pager->write_depth++ > 0)
+        return CHIDB_OK;
+
+    if (pager->wal != NULL)
+    {
+        chidb_Wal_beginWrite(pager->wal);
+        pager_wal_refresh(pager);
+    }
+    pager->txn_n_pages = pager->n_pages;
+    pager->txn_valid_pages = pager->valid_pages;
+
+    return CHIDB_OK;
+}
+
+
+/* Commit a write transaction
+ *
+ * Committing the outermost transaction writes the pages modified in it,
+ * sorted by page number. In WAL mode, the pages are appended to the WAL,
+ * the write lock is released, and this function waits until the commit
+ * is durable.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no transaction to commit
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Pager_commit(Pager *pager)
+{
+    int rc;
+
+    if (pager->write_depth == 0)
+        return CHIDB_EMISUSE;
+
+    if (--pager->write_depth > 0)
+        return CHIDB_OK;
+
+    if (pager->wal != NULL)
+    {
+        /* Pages that are not valid are written to the WAL (as zeroes),
+         * since the file may have stale contents for them */
+        MemPage *page;
+        for (npage_t npage = pager->valid_pages + 1; npage <= pager->n_pages; npage++)
+            if (chidb_Pager_readPage(pager, npage, &page) == CHIDB_OK)
+            {
+                pager_mark_dirty(pager, page);
+                chidb_Pager_releaseMemPage(pager, page);
+            }
+
+        /* The size of the database is recorded in the commit frame, so a
+         * commit that only changes the size still needs a frame */
+        if (pager->n_dirty == 0 && pager->n_pages != pager->txn_n_pages && pager->n_pages > 0 &&
+            chidb_Pager_readPage(pager, 1, &page) == CHIDB_OK)
+        {
+            pager_mark_dirty(pager, page);
+            chidb_Pager_releaseMemPage(pager, page);
+        }
+        pager->truncated = false;
+        if (pager->n_dirty > 0)
+            qsort(pager->dirty, pager->n_dirty, sizeof(MemPage *), pager_cmp_npage);
+        return pager_wal_commit(pager);
+    }
+
+    /* The file is shrunk first, so that the pages past the valid ones
+     * that are not written in this commit read as zeroes */
+    rc = pager->truncated ? pager_truncate_file(pager) : CHIDB_OK;
+
+    if (pager->n_dirty > 0)
+        qsort(pager->dirty, pager->n_dirty, sizeof(MemPage *), pager_cmp_npage);
+    chilog(TRACE, "Committing %i pages", pager->n_dirty);
+    if (rc == CHIDB_OK)
+        rc = pager_write_sorted(pager, pager->dirty, pager->n_dirty);
+
+    /* As in pager_wal_commit, the pages of a failed commit are dropped, so
+     * that they are read again from the file instead of being served from
+     * the cache as if they had been written */
+    pager_dirty_clear(pager, rc != CHIDB_OK);
+    if (rc != CHIDB_OK)
+    {
+        pager->n_pages = pager->txn_n_pages;
+        pager->valid_pages = pager->txn_valid_pages;
+        pager->change_count++;
+    }
+    else
+        pager->valid_pages = pager->n_pages;
+
+    return rc;
+}
+
+
+/* Roll back a write transaction
+ *
+ * Discards every change done within the current transaction (including
+ * the enclosing transactions, if it is nested), and ends it.
+ *
+ * Parameters
+ * - pager: A Pager.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EMISUSE: There is no transaction to roll back
+ */
+int chidb_Pager_rollback(Pager *pager)
+{
+    if (pager->write_depth == 0)
+        return CHIDB_EMISUSE;
+
+    chilog(TRACE, "Rolling back %i pages", pager->n_dirty);
+    pager->write_depth = 0;
+    pager->change_count++;
+    pager_dirty_clear(pager, true);
+    pager->n_pages = pager->txn_n_pages;
+    pager->valid_pages = pager->txn_valid_pages;
+    pager->truncated = false;
+
+    /* In mmap mode, the file is grown as pages are allocated */
+    if (pager->map != NULL && pager->file_size > pager_offset(pager, pager->n_pages + 1))
+    {
+        if (ftruncate(pager->fd, pager_offset(pager, pager->n_pages + 1)) == 0)
+            pager->file_size = pager->prealloc_end = pager_offset(pager, pager->n_pages + 1);
+    }
+
+    if (pager->wal != NULL)
+        chidb_Wal_endWrite(pager->wal);
+
     return CHIDB_OK;
 }
 
@@ -287,15 +2339,45 @@ int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages)
  */
 int chidb_Pager_close(Pager *pager)
 {
-    fclose(pager->f);
+    int rc = CHIDB_OK;
+
+    if (pager->write_depth > 0)
+    {
+        chilog(WARNING, "Closing a pager with an open write transaction, rolling it back");
+        chidb_Pager_rollback(pager);
+    }
+    if (pager_prewarm_save(pager) != CHIDB_OK)
+        chilog(WARNING, "Could not save the hot pages to %s", pager->hot_filename);
+    pager_prewarm_stop(pager);
+    if (pager->wal != NULL && chidb_Wal_close(pager->wal) != CHIDB_OK)
+        rc = CHIDB_EIO;
+    pager_preallocate_trim(pager);
+    if (!pager->in_memory && close(pager->fd) != 0)
+        rc = CHIDB_EIO;
+    if (pager->ring != NULL)
+        chidb_Uring_close(pager->ring);
+
+    pager_frames_free(pager);
+    pager_map_free(pager);
+    free(pager->hash);
+    free(pager->dirty);
+    free(pager->zbuf);
+    free(pager->page_map);
+    free(pager->hot_filename);
+    for (size_t i = 0; i < pager->arena_chunks; i++)
+        free(pager->arena[i]);
+    free(pager->arena);
     free(pager);
 
-    return CHIDB_OK;
+    return rc;
 }
 
-// Return a new, empty MemPage
-MemPage chidb_Pager_initMemPage(npage_t page_num, uint16_t pagesize) {
-    MemPage new_page = {.npage=page_num};
-    new_page.data = calloc(pagesize, 1);
+// Return a new, empty private MemPage (not part of the buffer pool)
+MemPage chidb_Pager_initMemPage(npage_t page_num, uint32_t pagesize) {
+    MemPage new_page = {.npage=page_num, .pooled=false};
+    if (posix_memalign((void **) &new_page.data, IO_BUFFER_ALIGN, pagesize) == 0)
+        memset(new_page.data, 0, pagesize);
+    else
+        new_page.data = NULL;
     return new_page;
 }
@@ -40,34 +40,183 @@
 #ifndef PAGER_H_
 #define PAGER_H_
 
-#include <stdio.h>
+#include <limits.h>
+#include <sys/types.h>
 #include "chidbInt.h"
+#include "wal.h"
+#include "uring.h"
+#include "compress.h"
+#include "prewarm.h"
 
+/* Default number of frames in the buffer pool */
+#define DEFAULT_CACHE_FRAMES (256)
+
+/* Default number of frames with CHIDB_OPEN_DIRECT, since the buffer pool is
+ * then the only cache of the file (the memory that the OS page cache would
+ * have used for it is free) */
+#define DEFAULT_DIRECT_CACHE_FRAMES (8192)
+
+/* Default size of the extents that the file is grown in as pages are
+ * allocated (see chidb_Pager_setPreallocation) */
+#define DEFAULT_PREALLOC_CHUNK ((size_t)1 << 20)
+
+/* Logical block size assumed when the OS does not report it */
+#define PAGER_DEFAULT_BLOCK_SIZE (512)
+
+/* Address space reserved for the memory mapping of the file (CHIDB_OPEN_MMAP),
+ * and the granularity in which the mapping is extended. */
+#define PAGER_MMAP_LIMIT (sizeof(void *) >= 8 ? ((size_t)1 << 36) : ((size_t)1 << 28))
+#define PAGER_MMAP_CHUNK ((size_t)1 << 20)
+
+/* File name that opens an in-memory database: its pages live in an arena
+ * of PAGER_ARENA_CHUNK-sized chunks that takes the place of the file */
+#define PAGER_MEMORY_FILENAME (":memory:")
+#define PAGER_ARENA_CHUNK ((size_t)1 << 20)
+
+/* Maximum number of pages read or written with a single preadv/pwritev */
+#if defined(IOV_MAX) && IOV_MAX < 256
+#define PAGER_IOV_MAX (IOV_MAX)
+#else
+#define PAGER_IOV_MAX (256)
+#endif
+
+/* Read-ahead: number of pages prefetched ahead of a sequential (or strided)
+ * scan, and number of accesses with the same stride that trigger it. */
+#define PAGER_READAHEAD_PAGES (32)
+#define PAGER_READAHEAD_TRIGGER (2)
+
+/* A MemPage is either a frame of the Pager's buffer pool (returned by
+ * chidb_Pager_readPage, and shared by every caller that reads the same
+ * page), a page of the file mapping (when the pager is in mmap mode),
+ * or a private page created with chidb_Pager_initMemPage. */
 struct MemPage
 {
     npage_t npage;
     uint8_t *data;
+
+    /* Buffer pool bookkeeping. Not meaningful for private pages. */
+    bool pooled;                /* This MemPage is a buffer pool frame */
+    bool mapped;                /* data points into the file mapping */
+    uint32_t pin_count;         /* Outstanding references; pinned frames are never evicted */
+    bool referenced;            /* CLOCK reference bit */
+    bool dirty;                 /* Modified, but not yet committed (never evicted) */
+    bool stale;                 /* A newer version was committed while the frame was pinned */
+    void *decoded;              /* Decoded form of the page kept by the B-Tree module, or
+                                   NULL. Dropped whenever the page changes. */
+    struct MemPage *hash_next;  /* Next frame in the same hash bucket */
 };
 typedef struct MemPage MemPage;
 
 struct Pager
 {
-    FILE *f;
+    int fd;
     npage_t n_pages;
-    uint16_t page_size;
+    uint32_t page_size;
+    int flags;                  /* CHIDB_OPEN_* flags */
+    bool in_memory;             /* In-memory database (fd is not used) */
+    uint32_t block_size;        /* Logical block size of the device (CHIDB_OPEN_DIRECT) */
+    Uring *ring;                /* io_uring backend (CHIDB_OPEN_URING), or NULL */
+
+    /* Preallocation. The file is grown on disk in chunks of prealloc_chunk
+     * bytes, without changing its size, so its physical end (prealloc_end)
+     * is usually past the end of its last page (n_pages). */
+    size_t prealloc_chunk;      /* Bytes allocated at a time (0: no preallocation) */
+    off_t prealloc_end;         /* Bytes of the file known to be allocated on disk */
+
+    /* Buffer pool */
+    MemPage **frames;           /* Frames allocated so far (allocated lazily) */
+    uint32_t n_frames;          /* Number of allocated frames */
+    uint32_t frames_alloc;      /* Size of the frames array */
+    uint32_t max_frames;        /* Number of frames the pool may hold */
+    uint32_t clock_hand;        /* Next frame to be examined by CLOCK */
+    MemPage **hash;             /* Page number -> frame hash table */
+    uint32_t hash_mask;         /* Number of hash buckets minus one */
+
+    /* File mapping (CHIDB_OPEN_MMAP) */
+    uint8_t *map;               /* Start of reserved address space */
+    size_t map_size;            /* Bytes of the file currently mapped */
+    off_t file_size;            /* Known size of the file, in bytes */
+    MemPage **map_pages;        /* Page descriptors, one array per mapped chunk */
+
+    /* Write transaction */
+    uint32_t write_depth;       /* Nesting depth of chidb_Pager_begin */
+    npage_t txn_n_pages;        /* Number of pages when the transaction began */
+    bool truncated;             /* The file must be shrunk on commit */
+    npage_t valid_pages;        /* Pages past this one were truncated (or have not
+                                   been written yet) and read as zeroes */
+    npage_t txn_valid_pages;    /* valid_pages when the transaction began */
+    MemPage **dirty;            /* Pages modified in the transaction */
+    uint32_t n_dirty;
+    uint32_t dirty_alloc;
+
+    /* Arena of an in-memory database. Bytes past arena_size (in chunks
+     * that are already allocated) are always zero. */
+    uint8_t **arena;            /* Chunks, allocated as they are written to */
+    size_t arena_chunks;        /* Size of the arena array */
+    size_t arena_size;          /* Size of the database, in bytes */
+
+    /* Page compression (CHIDB_OPEN_COMPRESS) */
+    uint8_t *zbuf;              /* Staging buffer for a page image */
+    uint32_t *page_map;         /* Page number -> bytes of its image in the file
+                                   (0 if not known yet). Only a hint: the image
+                                   header has the final say. */
+    npage_t page_map_alloc;
+
+    /* Write-ahead log (CHIDB_OPEN_WAL) */
+    Wal *wal;
+    uint32_t wal_generation;    /* Generation of the WAL last seen by this Pager */
+    uint32_t wal_frame;         /* Last WAL frame seen by this Pager */
+
+    /* Prewarming (CHIDB_OPEN_PREWARM) */
+    char *hot_filename;         /* File where the hot pages are saved */
+    Prewarm *prewarm;           /* Pages being loaded in the background, or NULL */
+
+    /* Incremented whenever pages may change other than through
+     * chidb_Pager_writePage (rollbacks, truncation, commits of other
+     * Pagers), so that what the layers above remember about them can be
+     * checked */
+    uint32_t change_count;
+
+    /* I/O statistics (see chidb_stats). The B-Tree module counts its
+     * node splits here too. */
+    chidb_stats_t stats;
 };
 typedef struct Pager Pager;
 
+/* Access pattern of a single scan (e.g., a cursor), used to decide whether
+ * (and what) to read ahead. Owned by the scan, not by the Pager. */
+typedef struct PagerReadAhead
+{
+    npage_t last;               /* Last page accessed (0 if none) */
+    int64_t stride;             /* Distance between the last two accesses */
+    uint32_t hits;              /* Consecutive accesses with that stride */
+    npage_t window_end;         /* Farthest page already prefetched */
+} PagerReadAhead;
+
 int chidb_Pager_open(Pager **pager, const char *filename);
-int chidb_Pager_setPageSize(Pager *pager, uint16_t pagesize);
+int chidb_Pager_openWithFlags(Pager **pager, const char *filename, int flags);
+int chidb_Pager_setPageSize(Pager *pager, uint32_t pagesize);
+int chidb_Pager_setCacheSize(Pager *pager, uint32_t nframes);
+int chidb_Pager_setCompression(Pager *pager, bool compress);
+int chidb_Pager_setPreallocation(Pager *pager, size_t chunk);
 int chidb_Pager_readHeader(Pager *pager, uint8_t *header);
 int chidb_Pager_allocatePage(Pager *pager, npage_t *npage);
+int chidb_Pager_truncate(Pager *pager, npage_t npages);
 int chidb_Pager_releaseMemPage(Pager *pager, MemPage *page);
+void chidb_Pager_dropDecoded(MemPage *page);
 int	chidb_Pager_readPage(Pager *pager, npage_t page_num, MemPage **page);
 int chidb_Pager_writePage(Pager *pager, MemPage *page);
+int chidb_Pager_readPages(Pager *pager, npage_t first, uint32_t n, MemPage **pages);
+int chidb_Pager_writePages(Pager *pager, MemPage **pages, uint32_t n);
+void chidb_Pager_initReadAhead(PagerReadAhead *ra);
+int chidb_Pager_readAhead(Pager *pager, PagerReadAhead *ra, npage_t npage);
+int chidb_Pager_prewarm(Pager *pager);
 int chidb_Pager_getRealDBSize(Pager *pager, npage_t *npages);
+int chidb_Pager_begin(Pager *pager);
+int chidb_Pager_commit(Pager *pager);
+int chidb_Pager_rollback(Pager *pager);
 int chidb_Pager_close(Pager *pager);
 
-MemPage chidb_Pager_initMemPage(npage_t page_num, uint16_t pagesize);
+MemPage chidb_Pager_initMemPage(npage_t page_num, uint32_t pagesize);
 
 #endif /*PAGER_H_*/
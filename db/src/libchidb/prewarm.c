@@ -0,0 +1,428 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module warms up the buffer pool of a database that has just been
+ * opened with CHIDB_OPEN_PREWARM.
+ *
+ * When such a database is closed, the pager saves the list of pages that
+ * were in its buffer pool (mostly the inner nodes of the B-Trees, which
+ * every lookup goes through) to a hot page file: the name of the database
+ * file followed by "-hot". When the database is opened again, a background
+ * thread reads those pages, in file order and with a single read for each
+ * run of consecutive pages, while the database is already being used.
+ * A page that the pager needs before the thread gets to it is simply read
+ * as usual. The pages that the thread has loaded are taken by the pager
+ * as it needs them, and whatever is left once the thread finishes is put
+ * in the buffer pool all at once.
+ *
+ * Only page numbers are saved, never their contents, so the hot page file
+ * can never make the pager see stale data: at worst (e.g., if the database
+ * was changed by someone else in the meantime) the wrong pages are loaded.
+ * A loaded page that the pager writes before taking it is thrown away.
+ *
+ * Hot page file format (all integers are big-endian):
+ *
+ *   Header (16 bytes)
+ *      0  Magic number (PREWARM_MAGIC)
+ *      4  Page size
+ *      8  Number of runs
+ *     12  Number of pages
+ *
+ *   Runs of consecutive pages (8 bytes each), sorted by page number
+ *      0  First page of the run
+ *      4  Number of pages in the run
+ *
+ */
+
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <string.h>
+#include <stdlib.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <chidb/log.h>
+
+#include "prewarm.h"
+#include "util.h"
+
+
+/* Save the hot pages of a database
+ *
+ * Parameters
+ * - filename: Name of the hot page file
+ * - page_size: Page size of the database
+ * - pages: Hot pages, sorted by page number, without duplicates
+ * - n: Number of hot pages. If 0, the hot page file is removed.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when writing the file
+ */
+int chidb_Prewarm_save(const char *filename, uint32_t page_size, npage_t *pages, uint32_t n)
+{
+    uint8_t *buf, *p;
+    uint32_t nruns = 0;
+    size_t len;
+    int fd, rc = CHIDB_OK;
+
+    if (n == 0)
+    {
+        unlink(filename);
+        return CHIDB_OK;
+    }
+
+    for (uint32_t i = 0; i < n; i++)
+        if (i == 0 || pages[i] != pages[i - 1] + 1)
+            nruns++;
+    len = PREWARM_HEADER_SIZE + (size_t) nruns * PREWARM_RUN_SIZE;
+    if ((buf = malloc(len)) == NULL)
+        return CHIDB_ENOMEM;
+
+    put4byte(buf, PREWARM_MAGIC);
+    put4byte(buf + 4, page_size);
+    put4byte(buf + 8, nruns);
+    put4byte(buf + 12, n);
+    p = buf + PREWARM_HEADER_SIZE;
+    for (uint32_t i = 0, run = 1; i < n; i += run, p += PREWARM_RUN_SIZE)
+    {
+        for (run = 1; i + run < n && pages[i + run] == pages[i] + run; run++)
+            ;
+        put4byte(p, pages[i]);
+        put4byte(p + 4, run);
+    }
+
+    if ((fd = open(filename, O_WRONLY | O_CREAT | O_TRUNC, 0644)) < 0)
+        rc = CHIDB_EIO;
+    else
+    {
+        if (write(fd, buf, len) != (ssize_t) len)
+            rc = CHIDB_EIO;
+        if (close(fd) != 0)
+            rc = CHIDB_EIO;
+    }
+    free(buf);
+
+    if (rc == CHIDB_OK)
+        chilog(DEBUG, "Saved %i hot pages (%i runs) to %s", n, nruns, filename);
+    return rc;
+}
+
+
+/* Load the hot pages of a database
+ *
+ * Parameters
+ * - filename: Name of the hot page file
+ * - page_size: Page size of the database. A hot page file saved with
+ *              another page size is ignored.
+ * - db_size: Number of pages in the database. Hot pages past the end
+ *            of the database are ignored.
+ * - max: Maximum number of pages to return (the first ones are kept)
+ * - pages: Out parameter. A malloc'd array with the hot pages, sorted
+ * - n: Out parameter. Number of hot pages.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOTFOUND: There is no (valid) hot page file, or it has no pages
+ * - CHIDB_ENOMEM: Could not allocate memory
+ */
+int chidb_Prewarm_load(const char *filename, uint32_t page_size, npage_t db_size, uint32_t max,
+                       npage_t **pages, uint32_t *n)
+{
+    struct stat st;
+    uint8_t *buf = NULL;
+    uint32_t nruns, total;
+    npage_t prev = 0;
+    int fd, rc = CHIDB_ENOTFOUND;
+
+    *pages = NULL;
+    *n = 0;
+    if ((fd = open(filename, O_RDONLY)) < 0)
+        return CHIDB_ENOTFOUND;
+    if (fstat(fd, &st) != 0 || st.st_size < PREWARM_HEADER_SIZE ||
+        (buf = malloc(st.st_size)) == NULL || pread(fd, buf, st.st_size, 0) != st.st_size)
+        goto out;
+
+    nruns = get4byte(buf + 8);
+    total = get4byte(buf + 12);
+    if (get4byte(buf) != PREWARM_MAGIC || get4byte(buf + 4) != page_size ||
+        st.st_size != PREWARM_HEADER_SIZE + (off_t) nruns * PREWARM_RUN_SIZE)
+        goto out;
+
+    if (total > max)
+        total = max;
+    if (total == 0 || (*pages = malloc(total * sizeof(npage_t))) == NULL)
+    {
+        rc = total == 0 ? CHIDB_ENOTFOUND : CHIDB_ENOMEM;
+        goto out;
+    }
+
+    for (uint32_t r = 0; r < nruns && *n < total; r++)
+    {
+        npage_t first = get4byte(buf + PREWARM_HEADER_SIZE + r * PREWARM_RUN_SIZE);
+        uint32_t len = get4byte(buf + PREWARM_HEADER_SIZE + r * PREWARM_RUN_SIZE + 4);
+
+        /* Runs must be sorted and must not overlap */
+        if (first <= prev || len == 0)
+        {
+            *n = 0;
+            break;
+        }
+        for (uint32_t i = 0; i < len && *n < total && first + i <= db_size; i++)
+            (*pages)[(*n)++] = first + i;
+        prev = first + len - 1;
+    }
+    rc = *n > 0 ? CHIDB_OK : CHIDB_ENOTFOUND;
+
+out:
+    if (rc != CHIDB_OK)
+    {
+        free(*pages);
+        *pages = NULL;
+        *n = 0;
+    }
+    free(buf);
+    close(fd);
+    return rc;
+}
+
+
+/* Reads pages [i, i + n) of the list, which are consecutive in the file */
+static bool prewarm_read_run(Prewarm *pw, uint32_t i, uint32_t n)
+{
+    uint8_t *buf = pw->data + (size_t) i * pw->page_size;
+    size_t len = (size_t) n * pw->page_size, done = 0;
+    off_t off = (off_t) (pw->pages[i] - 1) * pw->page_size;
+
+    while (done < len)
+    {
+        ssize_t count = pread(pw->fd, buf + done, len - done, off + done);
+        if (count <= 0)
+            return false;
+        done += count;
+    }
+    pw->bytes_read += len;
+
+    return true;
+}
+
+static void *prewarm_thread(void *arg)
+{
+    Prewarm *pw = arg;
+    uint32_t i = 0, n;
+
+    while (i < pw->n_pages && !__atomic_load_n(&pw->cancel, __ATOMIC_RELAXED))
+    {
+        for (n = 1; i + n < pw->n_pages && n < PREWARM_READ_PAGES && pw->pages[i + n] == pw->pages[i] + n; n++)
+            ;
+        /* A page that cannot be read (e.g., the file was shrunk by someone
+         * else) is left for the pager to read, and so is every page after it */
+        if (!prewarm_read_run(pw, i, n))
+            break;
+        i += n;
+        __atomic_store_n(&pw->loaded, i, __ATOMIC_RELEASE);
+    }
+    __atomic_store_n(&pw->done, true, __ATOMIC_RELEASE);
+
+    return NULL;
+}
+
+
+/* Start loading pages in the background
+ *
+ * Parameters
+ * - pw: An out parameter. Used to return a pointer to the Prewarm.
+ * - fd: The database file. If it was opened with O_DIRECT, the page size
+ *       must be a multiple of its block size.
+ * - page_size: Page size of the database
+ * - pages: Pages to load, sorted (as returned by chidb_Prewarm_load). The
+ *          Prewarm takes ownership of this array.
+ * - n: Number of pages to load
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory (or start the thread). The
+ *   pages array is freed.
+ */
+int chidb_Prewarm_start(Prewarm **pw, int fd, uint32_t page_size, npage_t *pages, uint32_t n)
+{
+    Prewarm *p;
+
+    if ((p = calloc(1, sizeof(Prewarm))) == NULL)
+    {
+        free(pages);
+        return CHIDB_ENOMEM;
+    }
+    p->fd = fd;
+    p->page_size = page_size;
+    p->pages = pages;
+    p->n_pages = n;
+
+    if (posix_memalign((void **) &p->data, IO_BUFFER_ALIGN, (size_t) n * page_size) != 0)
+        p->data = NULL;
+    if (p->data == NULL || (p->used = calloc(n, sizeof(bool))) == NULL ||
+        pthread_create(&p->thread, NULL, prewarm_thread, p) != 0)
+    {
+        free(p->used);
+        free(p->data);
+        free(p->pages);
+        free(p);
+        return CHIDB_ENOMEM;
+    }
+
+    chilog(DEBUG, "Prewarming %i pages", n);
+    *pw = p;
+    return CHIDB_OK;
+}
+
+
+/* Position of a page in the list, or -1 if it is not in it */
+static int64_t prewarm_find(Prewarm *pw, npage_t npage)
+{
+    uint32_t lo = 0, hi = pw->n_pages;
+
+    while (lo < hi)
+    {
+        uint32_t mid = lo + (hi - lo) / 2;
+        if (pw->pages[mid] < npage)
+            lo = mid + 1;
+        else
+            hi = mid;
+    }
+
+    return lo < pw->n_pages && pw->pages[lo] == npage ? (int64_t) lo : -1;
+}
+
+
+/* Take a loaded page
+ *
+ * Parameters
+ * - pw: A Prewarm.
+ * - npage: Page number
+ * - data: Buffer of page_size bytes where the page is copied
+ *
+ * Return
+ * - true: The page was copied into data. It will not be returned again.
+ * - false: The page has not been loaded (yet), or it was already taken
+ *   or forgotten. It has to be read from the file.
+ */
+bool chidb_Prewarm_read(Prewarm *pw, npage_t npage, uint8_t *data)
+{
+    int64_t i = prewarm_find(pw, npage);
+
+    if (i < 0 || pw->used[i] || i >= __atomic_load_n(&pw->loaded, __ATOMIC_ACQUIRE))
+        return false;
+    memcpy(data, pw->data + (size_t) i * pw->page_size, pw->page_size);
+    pw->used[i] = true;
+
+    return true;
+}
+
+
+/* Forget a page that has changed, so that it is never returned
+ *
+ * Parameters
+ * - pw: A Prewarm.
+ * - npage: Page number
+ */
+void chidb_Prewarm_forget(Prewarm *pw, npage_t npage)
+{
+    int64_t i = prewarm_find(pw, npage);
+
+    if (i >= 0)
+        pw->used[i] = true;
+}
+
+
+/* Has the background thread finished loading pages?
+ *
+ * Parameters
+ * - pw: A Prewarm.
+ *
+ * Return
+ * - true if it has (chidb_Prewarm_next will then go over every page
+ *   that was loaded), false otherwise
+ */
+bool chidb_Prewarm_done(Prewarm *pw)
+{
+    return __atomic_load_n(&pw->done, __ATOMIC_ACQUIRE);
+}
+
+
+/* Take the next loaded page that has not been taken or forgotten
+ *
+ * Parameters
+ * - pw: A Prewarm.
+ * - i: Position in the list to start looking from (0 the first time).
+ *      Updated to where the next call should start looking.
+ * - npage: Out parameter. Page number of the returned page.
+ *
+ * Return
+ * - Pointer to the loaded page (valid until chidb_Prewarm_stop is called),
+ *   or NULL if there are no more pages.
+ */
+uint8_t *chidb_Prewarm_next(Prewarm *pw, uint32_t *i, npage_t *npage)
+{
+    uint32_t loaded = __atomic_load_n(&pw->loaded, __ATOMIC_ACQUIRE);
+
+    for (; *i < loaded; (*i)++)
+        if (!pw->used[*i])
+        {
+            pw->used[*i] = true;
+            *npage = pw->pages[*i];
+            return pw->data + (size_t) (*i)++ * pw->page_size;
+        }
+
+    return NULL;
+}
+
+
+/* Stop loading pages, and free the Prewarm
+ *
+ * Parameters
+ * - pw: A Prewarm.
+ */
+void chidb_Prewarm_stop(Prewarm *pw)
+{
+    __atomic_store_n(&pw->cancel, true, __ATOMIC_RELAXED);
+    pthread_join(pw->thread, NULL);
+
+    free(pw->used);
+    free(pw->data);
+    free(pw->pages);
+    free(pw);
+}
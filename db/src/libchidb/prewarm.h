@@ -0,0 +1,86 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Buffer pool prewarming header. See prewarm.c for more details.
+ *
+ */
+
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef PREWARM_H_
+#define PREWARM_H_
+
+#include <pthread.h>
+#include "chidbInt.h"
+
+#define PREWARM_MAGIC (0x43485701)
+#define PREWARM_HEADER_SIZE (16)
+#define PREWARM_RUN_SIZE (8)
+
+/* Maximum number of pages loaded with a single read */
+#define PREWARM_READ_PAGES (256)
+
+/* Pages of a database being loaded by a background thread, so that they
+ * can be put in the buffer pool without waiting for a read each */
+struct Prewarm
+{
+    int fd;                     /* The database file */
+    uint32_t page_size;
+    npage_t *pages;             /* Pages to load, sorted */
+    uint32_t n_pages;
+    uint8_t *data;              /* The i-th page is loaded at i * page_size */
+    bool *used;                 /* The i-th page was taken (or changed) since
+                                   it was loaded. Only seen by the owner. */
+    uint64_t bytes_read;        /* Bytes read by the thread */
+
+    /* Shared with the thread */
+    uint32_t loaded;            /* Pages [0, loaded) have been loaded */
+    bool done;                  /* The thread has finished */
+    bool cancel;                /* The thread must stop as soon as possible */
+    pthread_t thread;
+};
+typedef struct Prewarm Prewarm;
+
+int chidb_Prewarm_save(const char *filename, uint32_t page_size, npage_t *pages, uint32_t n);
+int chidb_Prewarm_load(const char *filename, uint32_t page_size, npage_t db_size, uint32_t max,
+                       npage_t **pages, uint32_t *n);
+int chidb_Prewarm_start(Prewarm **pw, int fd, uint32_t page_size, npage_t *pages, uint32_t n);
+bool chidb_Prewarm_read(Prewarm *pw, npage_t npage, uint8_t *data);
+void chidb_Prewarm_forget(Prewarm *pw, npage_t npage);
+bool chidb_Prewarm_done(Prewarm *pw);
+uint8_t *chidb_Prewarm_next(Prewarm *pw, uint32_t *i, npage_t *npage);
+void chidb_Prewarm_stop(Prewarm *pw);
+
+#endif /*PREWARM_H_*/
@@ -231,7 +231,8 @@ int chidb_DBRecord_appendString(DBRecordBuffer *dbrb,  char *v)
     len = strlen(v);
     if (dbrb->offset + len > dbrb->buf_size)
     {
-        dbrb->buf_size += 1024;
+        /* Strings can be longer than the 1024 bytes the buffer grows by */
+        dbrb->buf_size = dbrb->offset + len + 1024;
         dbrb->dbr->data = realloc(dbrb->dbr->data, dbrb->buf_size);
     }
     memcpy(&dbrb->dbr->data[dbrb->offset], v, len);
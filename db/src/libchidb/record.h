@@ -56,7 +56,7 @@ typedef struct DBRecord DBRecord;
 struct DBRecordBuffer
 {
     DBRecord *dbr;
-    uint16_t buf_size;
+    uint32_t buf_size;
     uint8_t field;
     uint32_t offset;
     uint8_t header_size;
@@ -0,0 +1,311 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module implements an I/O backend based on Linux's io_uring, used
+ * by the pager (and the WAL checkpointer) when a database is opened with
+ * CHIDB_OPEN_URING.
+ *
+ * Operations that touch several pages (committing a transaction that split
+ * a few B-Tree nodes, reading a run of pages, checkpointing the WAL) are
+ * queued in the submission ring, and submitted to the kernel with a single
+ * io_uring_enter, which also waits for their completions. The kernel is
+ * then free to run them concurrently, instead of one pread/pwrite at a
+ * time.
+ *
+ * The ring is set up with raw system calls, so that liburing is not
+ * needed. If the kernel (or the system headers) do not support io_uring,
+ * chidb_Uring_open fails and callers fall back to synchronous I/O.
+ * Short reads and writes are completed synchronously, with the same
+ * semantics as chidb_preadv/chidb_pwritev (reading past the end of the
+ * file returns zeroes).
+ *
+ * A Uring must not be used by more than one thread at a time.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <chidb/log.h>
+#include "uring.h"
+#include "util.h"
+
+#if defined(__linux__) && defined(__has_include)
+#if __has_include(<linux/io_uring.h>) && defined(__NR_io_uring_setup)
+#include <linux/io_uring.h>
+#define URING_SUPPORTED
+#endif
+#endif
+
+
+#ifdef URING_SUPPORTED
+
+struct Uring
+{
+    int fd;
+    uint32_t sq_entries;
+
+    /* Submission queue */
+    void *sq_ring;
+    size_t sq_ring_size;
+    unsigned *sq_head, *sq_tail, *sq_mask, *sq_array;
+    struct io_uring_sqe *sqes;
+    size_t sqes_size;
+
+    /* Completion queue (may share its mapping with the submission queue) */
+    void *cq_ring;
+    size_t cq_ring_size;
+    unsigned *cq_head, *cq_tail, *cq_mask;
+    struct io_uring_cqe *cqes;
+};
+
+
+/* Open an io_uring
+ *
+ * Parameters
+ * - ring: An out parameter. Used to return a pointer to the new ring.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: io_uring is not available
+ */
+int chidb_Uring_open(Uring **ring)
+{
+    struct io_uring_params p;
+    Uring *r;
+
+    if ((r = calloc(1, sizeof(Uring))) == NULL)
+        return CHIDB_ENOMEM;
+
+    memset(&p, 0, sizeof(p));
+    if ((r->fd = syscall(__NR_io_uring_setup, URING_ENTRIES, &p)) < 0)
+    {
+        chilog(DEBUG, "io_uring_setup failed: %s", strerror(errno));
+        free(r);
+        return CHIDB_EIO;
+    }
+    r->sq_entries = p.sq_entries;
+
+    r->sq_ring_size = p.sq_off.array + p.sq_entries * sizeof(unsigned);
+    r->cq_ring_size = p.cq_off.cqes + p.cq_entries * sizeof(struct io_uring_cqe);
+    if (p.features & IORING_FEAT_SINGLE_MMAP)
+    {
+        if (r->cq_ring_size > r->sq_ring_size)
+            r->sq_ring_size = r->cq_ring_size;
+        r->cq_ring_size = 0;
+    }
+    r->sqes_size = p.sq_entries * sizeof(struct io_uring_sqe);
+
+    r->sq_ring = mmap(NULL, r->sq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQ_RING);
+    r->cq_ring = r->cq_ring_size == 0 ? r->sq_ring :
+                 mmap(NULL, r->cq_ring_size, PROT_READ | PROT_WRITE,
+                      MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_CQ_RING);
+    r->sqes = mmap(NULL, r->sqes_size, PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_POPULATE, r->fd, IORING_OFF_SQES);
+    if (r->sq_ring == MAP_FAILED || r->cq_ring == MAP_FAILED || r->sqes == MAP_FAILED)
+    {
+        if (r->sqes != MAP_FAILED)
+            munmap(r->sqes, r->sqes_size);
+        if (r->cq_ring_size != 0 && r->cq_ring != MAP_FAILED)
+            munmap(r->cq_ring, r->cq_ring_size);
+        if (r->sq_ring != MAP_FAILED)
+            munmap(r->sq_ring, r->sq_ring_size);
+        close(r->fd);
+        free(r);
+        return CHIDB_EIO;
+    }
+
+    r->sq_head = (unsigned *) ((uint8_t *) r->sq_ring + p.sq_off.head);
+    r->sq_tail = (unsigned *) ((uint8_t *) r->sq_ring + p.sq_off.tail);
+    r->sq_mask = (unsigned *) ((uint8_t *) r->sq_ring + p.sq_off.ring_mask);
+    r->sq_array = (unsigned *) ((uint8_t *) r->sq_ring + p.sq_off.array);
+    r->cq_head = (unsigned *) ((uint8_t *) r->cq_ring + p.cq_off.head);
+    r->cq_tail = (unsigned *) ((uint8_t *) r->cq_ring + p.cq_off.tail);
+    r->cq_mask = (unsigned *) ((uint8_t *) r->cq_ring + p.cq_off.ring_mask);
+    r->cqes = (struct io_uring_cqe *) ((uint8_t *) r->cq_ring + p.cq_off.cqes);
+
+    *ring = r;
+    return CHIDB_OK;
+}
+
+
+/* Completes an operation that the kernel only did part of (done bytes) */
+static int uring_finish(UringOp *op, size_t done)
+{
+    struct iovec *iov = op->iov;
+    int iovcnt = op->iovcnt;
+    off_t off = op->offset + done;
+
+    for (; iovcnt > 0 && done >= iov->iov_len; iov++, iovcnt--)
+        done -= iov->iov_len;
+    if (iovcnt > 0)
+    {
+        iov->iov_base = (uint8_t *) iov->iov_base + done;
+        iov->iov_len -= done;
+    }
+
+    if (op->write)
+        return chidb_pwritev(op->fd, iov, iovcnt, off);
+    return chidb_preadv(op->fd, iov, iovcnt, off) < 0 ? CHIDB_EIO : CHIDB_OK;
+}
+
+
+/* Run several reads and writes
+ *
+ * Queues the operations (as many as fit in the ring at a time), submits
+ * them, and waits for all of them to complete. The operations may run in
+ * any order and concurrently, so they must not overlap.
+ *
+ * Parameters
+ * - ring: A Uring.
+ * - ops: Operations to run.
+ * - n: Number of operations.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred (the other operations are
+ *   still completed)
+ */
+int chidb_Uring_run(Uring *ring, UringOp *ops, uint32_t n)
+{
+    uint32_t queued = 0, submitted = 0, completed = 0;
+    int rc = CHIDB_OK;
+
+    while (completed < n)
+    {
+        unsigned tail = *ring->sq_tail;
+        unsigned head = __atomic_load_n(ring->sq_head, __ATOMIC_ACQUIRE);
+
+        /* Fill the submission queue */
+        while (queued < n && queued - completed < ring->sq_entries && tail - head < ring->sq_entries)
+        {
+            unsigned idx = tail & *ring->sq_mask;
+            struct io_uring_sqe *sqe = &ring->sqes[idx];
+
+            memset(sqe, 0, sizeof(*sqe));
+            sqe->opcode = ops[queued].write ? IORING_OP_WRITEV : IORING_OP_READV;
+            sqe->fd = ops[queued].fd;
+            sqe->addr = (uint64_t) (uintptr_t) ops[queued].iov;
+            sqe->len = ops[queued].iovcnt;
+            sqe->off = ops[queued].offset;
+            sqe->user_data = queued;
+            ring->sq_array[idx] = idx;
+            tail++;
+            queued++;
+        }
+        __atomic_store_n(ring->sq_tail, tail, __ATOMIC_RELEASE);
+
+        /* Submit, and wait for at least one completion */
+        int ret = syscall(__NR_io_uring_enter, ring->fd, queued - submitted, 1,
+                          IORING_ENTER_GETEVENTS, NULL, 0);
+        if (ret < 0)
+        {
+            if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                continue;
+            chilog(ERROR, "io_uring_enter failed: %s", strerror(errno));
+            return CHIDB_EIO;
+        }
+        submitted += ret;
+
+        /* Reap completions */
+        unsigned chead = *ring->cq_head;
+        unsigned ctail = __atomic_load_n(ring->cq_tail, __ATOMIC_ACQUIRE);
+        for (; chead != ctail; chead++, completed++)
+        {
+            struct io_uring_cqe *cqe = &ring->cqes[chead & *ring->cq_mask];
+            UringOp *op = &ops[cqe->user_data];
+            size_t len = 0;
+
+            for (int i = 0; i < op->iovcnt; i++)
+                len += op->iov[i].iov_len;
+
+            if (cqe->res < 0)
+            {
+                chilog(ERROR, "io_uring %s failed: %s", op->write ? "write" : "read", strerror(-cqe->res));
+                rc = CHIDB_EIO;
+            }
+            else if ((size_t) cqe->res < len && uring_finish(op, cqe->res) != CHIDB_OK)
+                rc = CHIDB_EIO;
+        }
+        __atomic_store_n(ring->cq_head, chead, __ATOMIC_RELEASE);
+    }
+
+    return rc;
+}
+
+
+/* Close an io_uring
+ *
+ * Parameters
+ * - ring: A Uring.
+ */
+void chidb_Uring_close(Uring *ring)
+{
+    munmap(ring->sqes, ring->sqes_size);
+    if (ring->cq_ring_size != 0)
+        munmap(ring->cq_ring, ring->cq_ring_size);
+    munmap(ring->sq_ring, ring->sq_ring_size);
+    close(ring->fd);
+    free(ring);
+}
+
+#else /* !URING_SUPPORTED */
+
+struct Uring
+{
+    int unused;
+};
+
+int chidb_Uring_open(Uring **ring)
+{
+    return CHIDB_EIO;
+}
+
+int chidb_Uring_run(Uring *ring, UringOp *ops, uint32_t n)
+{
+    return CHIDB_EIO;
+}
+
+void chidb_Uring_close(Uring *ring)
+{
+}
+
+#endif
@@ -0,0 +1,68 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  io_uring I/O backend header. See uring.c for more details.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#ifndef URING_H_
+#define URING_H_
+
+#include <sys/types.h>
+#include <sys/uio.h>
+#include "chidbInt.h"
+
+/* Number of submission queue entries of a ring, i.e., the maximum number
+ * of operations in flight at any given time */
+#define URING_ENTRIES (64)
+
+/* A positional, vectored read or write of a file */
+typedef struct UringOp
+{
+    bool write;
+    int fd;
+    struct iovec *iov;          /* May be modified while the operation runs */
+    int iovcnt;
+    off_t offset;
+} UringOp;
+
+typedef struct Uring Uring;
+
+int chidb_Uring_open(Uring **ring);
+int chidb_Uring_run(Uring *ring, UringOp *ops, uint32_t n);
+void chidb_Uring_close(Uring *ring);
+
+#endif /*URING_H_*/
@@ -41,6 +41,8 @@
 #include <stdio.h>
 #include <string.h>
 #include <ctype.h>
+#include <errno.h>
+#include <unistd.h>
 #include "chidbInt.h"
 #include "util.h"
 #include "record.h"
@@ -62,6 +64,80 @@ void put4byte(unsigned char *p, uint32_t v)
     p[3] = (uint8_t)v;
 }
 
+/* Reads from a file into iov, starting at offset off
+ *
+ * Short reads are retried. Whatever lies past the end of the file is
+ * zero-filled. The contents of iov are modified.
+ *
+ * Returns the number of bytes read from the file, or -1 on an I/O error.
+ */
+ssize_t chidb_preadv(int fd, struct iovec *iov, int iovcnt, off_t off)
+{
+    ssize_t total = 0;
+
+    while (iovcnt > 0)
+    {
+        ssize_t n = preadv(fd, iov, iovcnt, off);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return -1;
+        }
+        if (n == 0)
+            break;
+
+        total += n;
+        off += n;
+        for (; iovcnt > 0 && (size_t) n >= iov->iov_len; iov++, iovcnt--)
+            n -= iov->iov_len;
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (uint8_t *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    for (int i = 0; i < iovcnt; i++)
+        memset(iov[i].iov_base, 0, iov[i].iov_len);
+
+    return total;
+}
+
+/* Writes iov to a file, starting at offset off
+ *
+ * Short writes are retried. The contents of iov are modified.
+ *
+ * Returns CHIDB_OK, or CHIDB_EIO if the data could not be written.
+ */
+int chidb_pwritev(int fd, struct iovec *iov, int iovcnt, off_t off)
+{
+    while (iovcnt > 0)
+    {
+        ssize_t n = pwritev(fd, iov, iovcnt, off);
+        if (n < 0)
+        {
+            if (errno == EINTR)
+                continue;
+            return CHIDB_EIO;
+        }
+        if (n == 0)
+            return CHIDB_EIO;
+
+        off += n;
+        for (; iovcnt > 0 && (size_t) n >= iov->iov_len; iov++, iovcnt--)
+            n -= iov->iov_len;
+        if (iovcnt > 0)
+        {
+            iov->iov_base = (uint8_t *) iov->iov_base + n;
+            iov->iov_len -= n;
+        }
+    }
+
+    return CHIDB_OK;
+}
+
+
 int getVarint32(const uint8_t *p, uint32_t *v)
 {
     *v = 0;
@@ -43,6 +43,7 @@
 #include "chidbInt.h"
 #include "btree.h"
 #include <chidb/utils.h>
+#include <sys/uio.h>
 
 /*
 ** Read or write a two- and four-byte big-endian integer values.
@@ -59,6 +60,9 @@ void put4byte(unsigned char *p, uint32_t v);
 int getVarint32(const uint8_t *p, uint32_t *v);
 int putVarint32(uint8_t *p, uint32_t v);
 
+ssize_t chidb_preadv(int fd, struct iovec *iov, int iovcnt, off_t off);
+int chidb_pwritev(int fd, struct iovec *iov, int iovcnt, off_t off);
+
 int chidb_astrcat(char **dst, char *src);
 
 typedef void (*fBTreeCellPrinter)(BTreeNode *, BTreeCell*);
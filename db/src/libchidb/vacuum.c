@@ -0,0 +1,716 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module implements VACUUM and incremental vacuum.
+ *
+ * Pages freed by the B-Tree are put in the freelist (see
+ * chidb_Btree_freePage), and are reused by later allocations, but the
+ * file never shrinks, and the pages of a B-Tree end up scattered
+ * across the file as it grows and shrinks.
+ *
+ * A full vacuum rewrites the file so that the pages of each B-Tree are
+ * contiguous, in level order (so the leaves of a tree are in key order),
+ * and the file contains no free pages. An incremental vacuum only
+ * shrinks the file: it moves the pages at the end of the file to free
+ * pages closer to its start, and truncates it.
+ *
+ * Both work by first finding every page that is in use (page 1, the
+ * schema tree rooted at it, and the B-Trees referenced from the schema).
+ * Every other page is considered free, so the freelist is rebuilt from
+ * scratch when the vacuum is done (and pages leaked by a crash are
+ * recovered). The whole vacuum runs in a single transaction.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <stdbool.h>
+#include <stdint.h>
+#include <stdlib.h>
+#include <string.h>
+#include <chidb/log.h>
+#include "chidbInt.h"
+#include "btree.h"
+#include "pager.h"
+#include "util.h"
+
+/* Flags kept for every page of the file */
+#define VACUUM_LIVE   (0x01)  /* The page is part of a B-Tree */
+#define VACUUM_PINNED (0x02)  /* The page cannot be moved */
+#define VACUUM_SCHEMA (0x04)  /* The page is part of the schema tree */
+#define VACUUM_OVERFLOW (0x08) /* The page is an overflow page */
+
+/* Kinds of page references */
+#define VACUUM_REF_CHILD    (0)  /* Child page of an internal node */
+#define VACUUM_REF_ROOT     (1)  /* Root of a B-Tree, in a schema record */
+#define VACUUM_REF_OVERFLOW (2)  /* Overflow page, in a table leaf cell or
+                                    in the previous overflow page */
+
+typedef struct Vacuum
+{
+    BTree *bt;
+    npage_t n_pages;
+    uint8_t *flags;     /* VACUUM_* flags of each page */
+    npage_t *parent;    /* Page that references each page (for a B-Tree
+                           root, the schema page with its schema record) */
+    npage_t *order;     /* Pages in use, in the order they will be laid out */
+    npage_t n_live;
+    npage_t n_overflow; /* Overflow pages in use */
+    npage_t *roots;     /* Roots referenced from the schema, */
+    npage_t n_roots;    /* in the order they appear in it */
+} Vacuum;
+
+/* Callback for the page references found by vacuum_refs. target is the
+ * referenced page, kind is a VACUUM_REF_* value, and ref points to where
+ * its number is stored in the page (NULL if it is stored in a form that
+ * cannot be changed in place, i.e., a rootpage field that is not a 4-byte
+ * integer, or that is in an overflow page) */
+typedef int (*vacuum_ref_fn)(Vacuum *v, npage_t npage, npage_t target, uint8_t *ref, uint8_t kind, void *arg);
+
+
+/* Returns the size of a record field given its type */
+static uint32_t vacuum_field_size(uint32_t type)
+{
+    static const uint8_t sizes[] = {0, 1, 2, 3, 4, 6, 8, 8, 0, 0};
+
+    if (type < sizeof(sizes))
+        return sizes[type];
+    return (type - (type % 2 ? 13 : 12)) / 2;
+}
+
+
+/* Finds the rootpage field of a schema record. Returns NULL if the
+ * record does not have one (or if it is not an integer) */
+static uint8_t *vacuum_rootpage_field(uint8_t *record, uint8_t *record_end, uint32_t *type)
+{
+    uint8_t header_size = record[0];
+    uint32_t offset = 0;
+
+    for (uint32_t pos = 1, field = 0; pos < header_size; field++)
+    {
+        uint32_t t;
+        if (record[pos] & 0x80)
+        {
+            getVarint32(record + pos, &t);
+            pos += 4;
+        }
+        else
+            t = record[pos++];
+
+        if (field == SCHEMA_ROOTPAGE_FIELD)
+        {
+            if ((t != 1 && t != 2 && t != 4) || record + header_size + offset + t > record_end)
+                return NULL;
+            *type = t;
+            return record + header_size + offset;
+        }
+        offset += vacuum_field_size(t);
+    }
+
+    return NULL;
+}
+
+
+/* Finds the rootpage field of a schema record whose payload spills to
+ * overflow pages, and that is not in the part of it in the cell (cell
+ * points to its data). The field is read from a copy of the whole
+ * payload, so it cannot be changed in place: *found is set if there is
+ * such a field, and *target to its value. */
+static int vacuum_spilled_rootpage(Vacuum *v, uint8_t *cell, uint32_t data_size, uint32_t local,
+                                   npage_t *target, bool *found)
+{
+    BTreeCell btc = {.type = PGTYPE_TABLE_LEAF};
+    uint32_t type;
+    uint8_t *ref;
+    int rc;
+
+    btc.fields.tableLeaf.data = cell;
+    btc.fields.tableLeaf.data_size = data_size;
+    btc.fields.tableLeaf.local_size = local;
+    btc.fields.tableLeaf.overflow = get4byte(cell + local);
+
+    uint8_t *payload = malloc(data_size);
+    if (payload == NULL)
+        return CHIDB_ENOMEM;
+    if ((rc = chidb_Btree_readPayload(v->bt, &btc, 0, data_size, payload)) == CHIDB_OK)
+    {
+        ref = vacuum_rootpage_field(payload, payload + data_size, &type);
+        *found = ref != NULL;
+        if (ref != NULL)
+            *target = type == 1 ? ref[0] : type == 2 ? get2byte(ref) : get4byte(ref);
+    }
+    free(payload);
+
+    return rc;
+}
+
+
+/* Calls fn on every page referenced from a page: the child pages of an
+ * internal node, for leaves of the schema tree, the roots of the B-Trees
+ * in their schema records, and the overflow pages of table leaf cells
+ * and of other overflow pages.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The page is not a well-formed B-Tree node
+ * - Anything else returned by fn
+ */
+static int vacuum_refs(Vacuum *v, npage_t npage, uint8_t *data, vacuum_ref_fn fn, void *arg)
+{
+    uint32_t page_size = v->bt->pager->page_size;
+    uint8_t *header = data + (npage == 1 ? 100 : 0);
+    uint8_t type = header[PGHEADER_PGTYPE_OFFSET];
+
+    /* An overflow page only references the next one in its chain */
+    if (v->flags[npage] & VACUUM_OVERFLOW)
+    {
+        npage_t next = get4byte(data + OVERFLOW_NEXT_OFFSET);
+        return next == 0 ? CHIDB_OK : fn(v, npage, next, data + OVERFLOW_NEXT_OFFSET, VACUUM_REF_OVERFLOW, arg);
+    }
+
+    ncell_t n_cells = get2byte(header + PGHEADER_NCELLS_OFFSET);
+    bool internal = type == PGTYPE_TABLE_INTERNAL || type == PGTYPE_INDEX_INTERNAL;
+    bool schema = v->flags[npage] & VACUUM_SCHEMA;
+    uint8_t *celloffsets;
+    int rc;
+
+    if (internal)
+        celloffsets = header + INTPG_CELLSOFFSET_OFFSET;
+    else if (type == PGTYPE_TABLE_LEAF || type == PGTYPE_INDEX_LEAF)
+        celloffsets = header + LEAFPG_CELLSOFFSET_OFFSET;
+    else
+        return CHIDB_ECORRUPT;
+
+    if (celloffsets + 2 * n_cells > data + page_size)
+        return CHIDB_ECORRUPT;
+
+    /* Only leaves of the schema tree, and table leaves in files with
+     * overflow pages, reference other pages */
+    if (!internal && !(type == PGTYPE_TABLE_LEAF && (schema || v->bt->max_local != 0)))
+        return CHIDB_OK;
+
+    for (ncell_t i = 0; i < n_cells; i++)
+    {
+        uint16_t offset = get2byte(celloffsets + 2 * i);
+        uint8_t *cell = data + offset;
+        uint8_t *ref;
+        uint32_t rtype = 4;
+        npage_t target;
+
+        if (offset + (internal ? 4 : TABLELEAFCELL_DATA_OFFSET + 1) > page_size)
+            return CHIDB_ECORRUPT;
+
+        if (internal)
+        {
+            /* The child pointer is the first field of both kinds of internal cells */
+            ref = cell + TABLEINTCELL_CHILD_OFFSET;
+            target = get4byte(ref);
+            if ((rc = fn(v, npage, target, ref, VACUUM_REF_CHILD, arg)) != CHIDB_OK)
+                return rc;
+            continue;
+        }
+
+        uint32_t data_size;
+        getVarint32(cell + TABLELEAFCELL_SIZE_OFFSET, &data_size);
+        uint32_t local = chidb_Btree_localSize(v->bt, data_size);
+        uint8_t *data_end = cell + TABLELEAFCELL_DATA_OFFSET + local;
+        if (local < data_size && data_end + TABLELEAFCELL_OVERFLOW_SIZE > data + page_size)
+            return CHIDB_ECORRUPT;
+
+        /* The overflow pages of a cell are read (to look for the rootpage
+         * field) before their references are handed to fn, which may
+         * change them */
+        if (schema)
+        {
+            ref = vacuum_rootpage_field(cell + TABLELEAFCELL_DATA_OFFSET,
+                                        local < data_size ? data_end : data + page_size, &rtype);
+            if (ref != NULL)
+            {
+                target = rtype == 1 ? ref[0] : rtype == 2 ? get2byte(ref) : get4byte(ref);
+                if ((rc = fn(v, npage, target, rtype == 4 ? ref : NULL, VACUUM_REF_ROOT, arg)) != CHIDB_OK)
+                    return rc;
+            }
+            else if (local < data_size)
+            {
+                bool found = false;
+                if ((rc = vacuum_spilled_rootpage(v, cell + TABLELEAFCELL_DATA_OFFSET, data_size, local,
+                                                  &target, &found)) != CHIDB_OK)
+                    return rc;
+                if (found && (rc = fn(v, npage, target, NULL, VACUUM_REF_ROOT, arg)) != CHIDB_OK)
+                    return rc;
+            }
+        }
+
+        if (local < data_size &&
+            (rc = fn(v, npage, get4byte(data_end), data_end, VACUUM_REF_OVERFLOW, arg)) != CHIDB_OK)
+            return rc;
+    }
+
+    if (internal)
+        return fn(v, npage, get4byte(header + PGHEADER_RIGHTPG_OFFSET),
+                  header + PGHEADER_RIGHTPG_OFFSET, VACUUM_REF_CHILD, arg);
+
+    return CHIDB_OK;
+}
+
+
+/* vacuum_refs callback that adds the children of a page to the level
+ * order traversal (and the roots found in the schema to v->roots) */
+static int vacuum_visit(Vacuum *v, npage_t npage, npage_t target, uint8_t *ref, uint8_t kind, void *arg)
+{
+    if (target < 2 || target > v->n_pages || (v->flags[target] & VACUUM_LIVE))
+    {
+        chilog(ERROR, "Page %i references invalid or already referenced page %i", npage, target);
+        return CHIDB_ECORRUPT;
+    }
+
+    v->flags[target] = VACUUM_LIVE;
+    v->parent[target] = npage;
+    if (kind == VACUUM_REF_ROOT)
+    {
+        if (ref == NULL)
+            v->flags[target] |= VACUUM_PINNED;
+        v->roots[v->n_roots++] = target;
+    }
+    else
+    {
+        v->flags[target] |= v->flags[npage] & VACUUM_SCHEMA;
+        if (kind == VACUUM_REF_OVERFLOW)
+        {
+            v->flags[target] |= VACUUM_OVERFLOW;
+            v->n_overflow++;
+        }
+        v->order[v->n_live++] = target;
+    }
+
+    return CHIDB_OK;
+}
+
+
+/* Adds the pages of the B-Tree rooted at the last page of v->order to it,
+ * in level order */
+static int vacuum_traverse(Vacuum *v)
+{
+    MemPage *page;
+    int rc;
+
+    for (npage_t i = v->n_live - 1; i < v->n_live; i++)
+    {
+        if ((rc = chidb_Pager_readPage(v->bt->pager, v->order[i], &page)) != CHIDB_OK)
+            return rc;
+        rc = vacuum_refs(v, v->order[i], page->data, vacuum_visit, NULL);
+        chidb_Pager_releaseMemPage(v->bt->pager, page);
+        if (rc != CHIDB_OK)
+            return rc;
+    }
+
+    return CHIDB_OK;
+}
+
+
+static void vacuum_free(Vacuum *v)
+{
+    free(v->flags);
+    free(v->parent);
+    free(v->order);
+    free(v->roots);
+}
+
+
+/* Finds every page in use. Page 1 and the schema tree come first in
+ * v->order, followed by each B-Tree, in the order of the schema. */
+static int vacuum_init(Vacuum *v, BTree *bt)
+{
+    int rc;
+
+    v->bt = bt;
+    v->n_pages = bt->pager->n_pages;
+    v->flags = calloc(v->n_pages + 1, sizeof(uint8_t));
+    v->parent = calloc(v->n_pages + 1, sizeof(npage_t));
+    v->order = malloc((v->n_pages + 1) * sizeof(npage_t));
+    v->roots = malloc((v->n_pages + 1) * sizeof(npage_t));
+    v->n_live = v->n_roots = v->n_overflow = 0;
+    if (v->flags == NULL || v->parent == NULL || v->order == NULL || v->roots == NULL)
+    {
+        vacuum_free(v);
+        return CHIDB_ENOMEM;
+    }
+
+    v->flags[1] = VACUUM_LIVE | VACUUM_PINNED | VACUUM_SCHEMA;
+    v->order[v->n_live++] = 1;
+    rc = vacuum_traverse(v);
+
+    for (npage_t i = 0; i < v->n_roots && rc == CHIDB_OK; i++)
+    {
+        v->order[v->n_live++] = v->roots[i];
+        rc = vacuum_traverse(v);
+    }
+
+    if (rc != CHIDB_OK)
+        vacuum_free(v);
+    return rc;
+}
+
+
+/* vacuum_refs callback that changes every reference to a page to the
+ * page it is mapped to in the npage_t array arg */
+static int vacuum_remap(Vacuum *v, npage_t npage, npage_t target, uint8_t *ref, uint8_t kind, void *arg)
+{
+    npage_t *map = arg;
+
+    if (ref != NULL && map[target] != target)
+        put4byte(ref, map[target]);
+
+    return CHIDB_OK;
+}
+
+
+/* Returns the sibling links of a page, or NULL if it is not a linked
+ * table leaf */
+static uint8_t *vacuum_links(Vacuum *v, npage_t npage, uint8_t *data)
+{
+    uint8_t *header = data + (npage == 1 ? 100 : 0);
+
+    if (!v->bt->linked || (v->flags[npage] & VACUUM_OVERFLOW) ||
+        header[PGHEADER_PGTYPE_OFFSET] != PGTYPE_TABLE_LEAF)
+        return NULL;
+    return data + v->bt->usable_size;
+}
+
+
+/* Changes the sibling links of a table leaf to the pages they are mapped
+ * to in map */
+static void vacuum_relink(Vacuum *v, npage_t npage, uint8_t *data, npage_t *map)
+{
+    uint8_t *links = vacuum_links(v, npage, data);
+    uint32_t offsets[] = {LINKS_PREV_OFFSET, LINKS_NEXT_OFFSET};
+
+    for (int i = 0; links != NULL && i < 2; i++)
+    {
+        npage_t target = get4byte(links + offsets[i]);
+        if (target != 0 && target <= v->n_pages)
+            put4byte(links + offsets[i], map[target]);
+    }
+}
+
+
+/* Resets the freelist, and puts in it every page that is not in use,
+ * in descending order (so that allocations hand them out in ascending
+ * order). If no row spills to overflow pages anymore, the file header
+ * says so (see FEATURE_SPILLED). */
+static int vacuum_rebuild_freelist(Vacuum *v, npage_t npages)
+{
+    MemPage *header;
+    int rc;
+
+    if ((rc = chidb_Pager_readPage(v->bt->pager, 1, &header)) != CHIDB_OK)
+        return rc;
+    put4byte(header->data + HEADER_FREELIST_TRUNK_OFFSET, 0);
+    put4byte(header->data + HEADER_FREELIST_COUNT_OFFSET, 0);
+    if (v->n_overflow == 0)
+        header->data[HEADER_FEATURES_OFFSET] &= ~FEATURE_SPILLED;
+    rc = chidb_Pager_writePage(v->bt->pager, header);
+    chidb_Pager_releaseMemPage(v->bt->pager, header);
+    if (rc == CHIDB_OK && v->n_overflow == 0)
+        v->bt->spilled = false;
+
+    for (npage_t npage = npages; npage > 1 && rc == CHIDB_OK; npage--)
+        if (!(v->flags[npage] & VACUUM_LIVE))
+            rc = chidb_Btree_freePage(v->bt, npage);
+
+    return rc;
+}
+
+
+/* Rewrites the database file
+ *
+ * Moves the pages of every B-Tree so that each B-Tree occupies a
+ * contiguous range of pages, laid out in level order (so that the leaves
+ * are in key order), and truncates the file to the pages in use.
+ * The rootpage fields of the schema, and the sibling links of the
+ * leaves, are updated accordingly. The overflow pages of large rows
+ * are moved along with the B-Tree they belong to.
+ *
+ * A B-Tree root whose rootpage field is not stored as a 4-byte integer
+ * cannot be moved, and keeps its page number. If such a page ends up
+ * past the last page in use, the pages before it are put in the freelist.
+ *
+ * The vacuum needs enough memory to hold all the pages in use.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The B-Trees in the file are not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_vacuum(BTree *bt)
+{
+    uint32_t page_size = bt->pager->page_size;
+    MemPage *page;
+    Vacuum v;
+    int rc;
+
+    chidb_Pager_begin(bt->pager);
+    if ((rc = vacuum_init(&v, bt)) != CHIDB_OK)
+    {
+        chidb_Pager_rollback(bt->pager);
+        return rc;
+    }
+
+    npage_t *map = calloc(v.n_pages + 1, sizeof(npage_t));
+    uint8_t *buf = malloc((size_t) v.n_live * page_size);
+    if (map == NULL || buf == NULL)
+        rc = CHIDB_ENOMEM;
+
+    /* Number the pages in use in order, skipping over the pinned ones */
+    npage_t next = 1, last = 1;
+    for (npage_t i = 0; i < v.n_live && rc == CHIDB_OK; i++)
+    {
+        npage_t npage = v.order[i];
+
+        if (!(v.flags[npage] & VACUUM_PINNED))
+        {
+            while (v.flags[next] & VACUUM_PINNED)
+                next++;
+            map[npage] = next++;
+        }
+        else
+            map[npage] = npage;
+        if (map[npage] > last)
+            last = map[npage];
+    }
+
+    /* Pages are copied to memory before any of them is written, since
+     * they are moved around in arbitrary permutations */
+    for (npage_t i = 0; i < v.n_live && rc == CHIDB_OK; i++)
+    {
+        if ((rc = chidb_Pager_readPage(bt->pager, v.order[i], &page)) != CHIDB_OK)
+            break;
+        memcpy(buf + (size_t) i * page_size, page->data, page_size);
+        chidb_Pager_releaseMemPage(bt->pager, page);
+        rc = vacuum_refs(&v, v.order[i], buf + (size_t) i * page_size, vacuum_remap, map);
+        vacuum_relink(&v, v.order[i], buf + (size_t) i * page_size, map);
+    }
+
+    for (npage_t i = 0; i < v.n_live && rc == CHIDB_OK; i++)
+    {
+        if ((rc = chidb_Pager_readPage(bt->pager, map[v.order[i]], &page)) != CHIDB_OK)
+            break;
+        if (memcmp(page->data, buf + (size_t) i * page_size, page_size))
+        {
+            memcpy(page->data, buf + (size_t) i * page_size, page_size);
+            rc = chidb_Pager_writePage(bt->pager, page);
+        }
+        chidb_Pager_releaseMemPage(bt->pager, page);
+    }
+
+    if (rc == CHIDB_OK)
+    {
+        chilog(DEBUG, "Vacuum: %i pages in use, %i pages in file", v.n_live, v.n_pages);
+
+        /* The flags now describe the new layout */
+        memset(v.flags, 0, v.n_pages + 1);
+        for (npage_t i = 0; i < v.n_live; i++)
+            v.flags[map[v.order[i]]] = VACUUM_LIVE;
+
+        if ((rc = chidb_Pager_truncate(bt->pager, last)) == CHIDB_OK)
+            rc = vacuum_rebuild_freelist(&v, last);
+    }
+
+    free(map);
+    free(buf);
+    vacuum_free(&v);
+
+    if (rc != CHIDB_OK)
+    {
+        chidb_Pager_rollback(bt->pager);
+        return rc;
+    }
+    return chidb_Pager_commit(bt->pager);
+}
+
+
+/* vacuum_refs callback that sets the parent of every page referenced from
+ * a page that was moved to npage */
+static int vacuum_reparent(Vacuum *v, npage_t npage, npage_t target, uint8_t *ref, uint8_t kind, void *arg)
+{
+    if (target <= v->n_pages && (v->flags[target] & VACUUM_LIVE))
+        v->parent[target] = npage;
+
+    return CHIDB_OK;
+}
+
+
+/* Points the links of the siblings of a table leaf that was moved to
+ * npage at it */
+static int vacuum_move_links(Vacuum *v, npage_t npage, uint8_t *data)
+{
+    uint8_t *links = vacuum_links(v, npage, data);
+    MemPage *sibling;
+    int rc = CHIDB_OK;
+
+    if (links == NULL)
+        return CHIDB_OK;
+
+    /* The previous leaf links to it as its next one, and vice versa */
+    npage_t siblings[] = {get4byte(links + LINKS_PREV_OFFSET), get4byte(links + LINKS_NEXT_OFFSET)};
+    uint32_t offsets[] = {LINKS_NEXT_OFFSET, LINKS_PREV_OFFSET};
+    for (int i = 0; i < 2 && rc == CHIDB_OK; i++)
+    {
+        if (siblings[i] == 0 || siblings[i] > v->n_pages)
+            continue;
+        if ((rc = chidb_Pager_readPage(v->bt->pager, siblings[i], &sibling)) != CHIDB_OK)
+            break;
+        put4byte(sibling->data + v->bt->usable_size + offsets[i], npage);
+        rc = chidb_Pager_writePage(v->bt->pager, sibling);
+        chidb_Pager_releaseMemPage(v->bt->pager, sibling);
+    }
+
+    return rc;
+}
+
+
+/* Moves a page that is in use to a free page, and updates the page that
+ * references it (and, for table leaves, their siblings) */
+static int vacuum_move(Vacuum *v, npage_t *map, npage_t from, npage_t to)
+{
+    MemPage *src, *dst, *parent;
+    int rc;
+
+    if ((rc = chidb_Pager_readPage(v->bt->pager, from, &src)) != CHIDB_OK)
+        return rc;
+    if ((rc = chidb_Pager_readPage(v->bt->pager, to, &dst)) == CHIDB_OK)
+    {
+        memcpy(dst->data, src->data, v->bt->pager->page_size);
+        rc = chidb_Pager_writePage(v->bt->pager, dst);
+
+        v->flags[to] = v->flags[from];
+        v->flags[from] = 0;
+        v->parent[to] = v->parent[from];
+        map[from] = to;
+        if (rc == CHIDB_OK)
+            rc = vacuum_refs(v, to, dst->data, vacuum_reparent, NULL);
+        if (rc == CHIDB_OK)
+            rc = vacuum_move_links(v, to, dst->data);
+        chidb_Pager_releaseMemPage(v->bt->pager, dst);
+    }
+    chidb_Pager_releaseMemPage(v->bt->pager, src);
+
+    if (rc == CHIDB_OK && (rc = chidb_Pager_readPage(v->bt->pager, v->parent[to], &parent)) == CHIDB_OK)
+    {
+        if ((rc = vacuum_refs(v, v->parent[to], parent->data, vacuum_remap, map)) == CHIDB_OK)
+            rc = chidb_Pager_writePage(v->bt->pager, parent);
+        chidb_Pager_releaseMemPage(v->bt->pager, parent);
+    }
+
+    return rc;
+}
+
+
+/* Shrinks the database file
+ *
+ * Removes up to npages pages from the end of the file. Free pages at
+ * the end of the file are simply dropped, while pages in use are moved
+ * to the lowest free pages in the file. Stops early if the file has no
+ * more free pages, or if the last page cannot be moved (see
+ * chidb_Btree_vacuum). The free pages that remain are put back in the
+ * freelist.
+ *
+ * Parameters
+ * - bt: B-Tree file
+ * - npages: Maximum number of pages to remove. If 0, the file is shrunk
+ *           as much as possible.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ECORRUPT: The B-Trees in the file are not well formed
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Btree_incrementalVacuum(BTree *bt, uint32_t npages)
+{
+    Vacuum v;
+    int rc;
+
+    chidb_Pager_begin(bt->pager);
+    if ((rc = vacuum_init(&v, bt)) != CHIDB_OK)
+    {
+        chidb_Pager_rollback(bt->pager);
+        return rc;
+    }
+
+    npage_t *map = malloc((v.n_pages + 1) * sizeof(npage_t));
+    if (map == NULL)
+        rc = CHIDB_ENOMEM;
+    else
+        for (npage_t i = 0; i <= v.n_pages; i++)
+            map[i] = i;
+
+    npage_t end = v.n_pages, lowest_free = 2;
+    while (rc == CHIDB_OK && end > 1 && (npages == 0 || v.n_pages - end < npages))
+    {
+        if (v.flags[end] & VACUUM_LIVE)
+        {
+            if (v.flags[end] & VACUUM_PINNED)
+                break;
+            while (lowest_free < end && (v.flags[lowest_free] & VACUUM_LIVE))
+                lowest_free++;
+            if (lowest_free == end)
+                break;
+            rc = vacuum_move(&v, map, end, lowest_free);
+        }
+        if (rc == CHIDB_OK)
+            end--;
+    }
+
+    if (rc == CHIDB_OK)
+    {
+        chilog(DEBUG, "Incremental vacuum: removed %i of %i pages", v.n_pages - end, v.n_pages);
+        if ((rc = chidb_Pager_truncate(bt->pager, end)) == CHIDB_OK)
+            rc = vacuum_rebuild_freelist(&v, end);
+    }
+
+    free(map);
+    vacuum_free(&v);
+
+    if (rc != CHIDB_OK)
+    {
+        chidb_Pager_rollback(bt->pager);
+        return rc;
+    }
+    return chidb_Pager_commit(bt->pager);
+}
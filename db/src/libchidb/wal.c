@@ -0,0 +1,883 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ * This module implements the write-ahead log (WAL) used by the pager
+ * when a database is opened with CHIDB_OPEN_WAL.
+ *
+ * In WAL mode, modified pages are not written in place. Instead, every
+ * commit appends the pages it modified, as frames, to the end of a
+ * separate file (the name of the database file followed by "-wal").
+ * The last frame of a commit is a commit frame, which also records
+ * the size of the database after the commit. The newest committed
+ * version of a page is found through the WAL index, an in-memory hash
+ * table from page numbers to frames. Pages that are not in the WAL
+ * are read from the database file.
+ *
+ * WAL file format (all integers are big-endian):
+ *
+ *   WAL header (32 bytes)
+ *      0  Magic number (WAL_MAGIC)
+ *      4  Format version (WAL_VERSION)
+ *      8  Page size
+ *     12  Checkpoint sequence number
+ *     16  Salt-1 and Salt-2
+ *     24  Checksum of bytes 0-23
+ *
+ *   Frame header (24 bytes), followed by the page itself
+ *      0  Page number
+ *      4  For commit frames, size of the database in pages. 0 otherwise.
+ *      8  Salt-1 and Salt-2, copied from the WAL header
+ *     16  Checksum of bytes 0-7 of the frame header and of the page
+ *
+ * The checksum of each frame continues from the checksum of the previous
+ * frame (or of the WAL header), so a frame is only valid if all the frames
+ * before it are valid too. When the WAL is opened, every frame up to the
+ * last valid commit frame is added to the index. Anything after that
+ * (e.g., a commit interrupted by a crash) is ignored, and overwritten by
+ * the next commit.
+ *
+ * Group commit: a committer appends its frames while holding the write
+ * lock, but releases the lock before waiting for its frames to become
+ * durable. A committer that finds no fdatasync in progress becomes the
+ * leader and issues one, which makes durable the frames of everyone that
+ * appended before it started. The others wait for the leader to finish
+ * and, if their frames are still not durable, one of them leads the next
+ * fdatasync. Under concurrent commits, this amortizes each fdatasync over
+ * several transactions.
+ *
+ * A checkpoint copies the newest version of every page in the WAL back
+ * into the database file, and then resets the WAL so that frames are
+ * written from its beginning again. The committer that takes the WAL past
+ * WAL_AUTOCHECKPOINT frames runs a checkpoint, and so does the last Pager
+ * to close the WAL (which also removes the -wal file).
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+
+#include <string.h>
+#include <stdlib.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <time.h>
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+#include <chidb/log.h>
+
+#include "chidbInt.h"
+#include "wal.h"
+#include "compress.h"
+#include "util.h"
+
+/* Maximum number of frames written with a single pwritev */
+#define WAL_WRITE_BATCH (64)
+
+/* Every Wal currently open in the process */
+static Wal *wal_registry = NULL;
+static pthread_mutex_t wal_registry_lock = PTHREAD_MUTEX_INITIALIZER;
+
+
+/* Continues a checksum over len bytes (len must be a multiple of 8) */
+static void wal_checksum(const uint8_t *data, size_t len, uint32_t *cksum)
+{
+    uint32_t s0 = cksum[0], s1 = cksum[1];
+
+    for (size_t i = 0; i < len; i += 8)
+    {
+        s0 += get4byte(data + i) + s1;
+        s1 += get4byte(data + i + 4) + s0;
+    }
+    cksum[0] = s0;
+    cksum[1] = s1;
+}
+
+/* Offset of a frame (its header) in the WAL file */
+static inline off_t wal_frame_offset(Wal *wal, uint32_t frame)
+{
+    return WAL_HEADER_SIZE + (off_t)(frame - 1) * (WAL_FRAME_HEADER_SIZE + wal->page_size);
+}
+
+static ssize_t wal_pread(int fd, void *buf, size_t len, off_t off)
+{
+    struct iovec iov = {.iov_base = buf, .iov_len = len};
+    return chidb_preadv(fd, &iov, 1, off);
+}
+
+static int wal_pwrite(int fd, void *buf, size_t len, off_t off)
+{
+    struct iovec iov = {.iov_base = buf, .iov_len = len};
+    return chidb_pwritev(fd, &iov, 1, off);
+}
+
+static int wal_datasync(int fd)
+{
+    while (fdatasync(fd) != 0)
+        if (errno != EINTR)
+            return CHIDB_EIO;
+    return CHIDB_OK;
+}
+
+
+/* Hash a page number into a slot of the WAL index */
+static inline uint32_t wal_slot(Wal *wal, npage_t npage)
+{
+    return (npage * 2654435761u) & wal->slots_mask;
+}
+
+/* Returns the newest committed frame holding page npage, or 0 */
+static uint32_t wal_index_lookup(Wal *wal, npage_t npage)
+{
+    if (wal->slots == NULL)
+        return 0;
+
+    for (uint32_t i = wal_slot(wal, npage); wal->slots[i] != 0; i = (i + 1) & wal->slots_mask)
+        if (wal->frame_pages[wal->slots[i] - 1] == npage)
+            return wal->slots[i];
+
+    return 0;
+}
+
+/* Makes frame the newest version of the page it holds */
+static void wal_index_set(Wal *wal, uint32_t frame)
+{
+    npage_t npage = wal->frame_pages[frame - 1];
+    uint32_t i;
+
+    for (i = wal_slot(wal, npage); wal->slots[i] != 0; i = (i + 1) & wal->slots_mask)
+        if (wal->frame_pages[wal->slots[i] - 1] == npage)
+        {
+            wal->slots[i] = frame;
+            return;
+        }
+    wal->slots[i] = frame;
+    wal->slots_used++;
+}
+
+/* Adds frames first through last to the index, growing it if needed */
+static int wal_index_add(Wal *wal, uint32_t first, uint32_t last)
+{
+    uint32_t nslots = wal->slots_mask + 1;
+
+    /* Keep the load factor at or below 1/2, assuming every frame is a new page */
+    if (wal->slots == NULL || 2 * (wal->slots_used + last - first + 1) > nslots)
+    {
+        uint32_t *old = wal->slots, oldslots = wal->slots == NULL ? 0 : nslots;
+
+        for (nslots = 64; nslots < 2 * (wal->slots_used + last - first + 1); nslots <<= 1)
+            ;
+        if ((wal->slots = calloc(nslots, sizeof(uint32_t))) == NULL)
+        {
+            wal->slots = old;
+            return CHIDB_ENOMEM;
+        }
+        wal->slots_mask = nslots - 1;
+        wal->slots_used = 0;
+        for (uint32_t i = 0; i < oldslots; i++)
+            if (old[i] != 0)
+                wal_index_set(wal, old[i]);
+        free(old);
+    }
+
+    for (uint32_t frame = first; frame <= last; frame++)
+        wal_index_set(wal, frame);
+
+    return CHIDB_OK;
+}
+
+/* Makes room for the page numbers of frames up to last */
+static int wal_frames_reserve(Wal *wal, uint32_t last)
+{
+    if (last > wal->frames_alloc)
+    {
+        uint32_t n = wal->frames_alloc ? wal->frames_alloc : 256;
+        npage_t *frame_pages;
+
+        while (n < last)
+            n <<= 1;
+        if ((frame_pages = realloc(wal->frame_pages, n * sizeof(npage_t))) == NULL)
+            return CHIDB_ENOMEM;
+        wal->frame_pages = frame_pages;
+        wal->frames_alloc = n;
+    }
+    return CHIDB_OK;
+}
+
+
+/* Writes the WAL header and restarts the checksum chain from it */
+static int wal_write_header(Wal *wal)
+{
+    uint8_t header[WAL_HEADER_SIZE];
+
+    put4byte(header, WAL_MAGIC);
+    put4byte(header + 4, WAL_VERSION);
+    put4byte(header + 8, wal->page_size);
+    put4byte(header + 12, wal->checkpoint_seq);
+    put4byte(header + 16, wal->salt[0]);
+    put4byte(header + 20, wal->salt[1]);
+    wal->cksum[0] = wal->cksum[1] = 0;
+    wal_checksum(header, 24, wal->cksum);
+    put4byte(header + 24, wal->cksum[0]);
+    put4byte(header + 28, wal->cksum[1]);
+
+    return wal_pwrite(wal->fd, header, WAL_HEADER_SIZE, 0);
+}
+
+/* Rebuilds the WAL index from the contents of the WAL file */
+static int wal_recover(Wal *wal)
+{
+    uint8_t header[WAL_HEADER_SIZE], *frame;
+    uint32_t cksum[2] = {0, 0}, page_size;
+    size_t frame_size;
+    ssize_t n;
+    int rc = CHIDB_OK;
+
+    if ((n = wal_pread(wal->fd, header, WAL_HEADER_SIZE, 0)) < 0)
+        return CHIDB_EIO;
+    if (n == 0)
+        return CHIDB_OK;
+
+    wal_checksum(header, 24, cksum);
+    page_size = get4byte(header + 8);
+    if (get4byte(header) != WAL_MAGIC || get4byte(header + 4) != WAL_VERSION ||
+        get4byte(header + 24) != cksum[0] || get4byte(header + 28) != cksum[1] ||
+        page_size < 512 || page_size > 65536 || (page_size & (page_size - 1)) != 0)
+    {
+        chilog(WARNING, "Ignoring %s, which does not have a valid header", wal->filename);
+        return CHIDB_OK;
+    }
+
+    wal->page_size = page_size;
+    wal->checkpoint_seq = get4byte(header + 12);
+    wal->salt[0] = get4byte(header + 16);
+    wal->salt[1] = get4byte(header + 20);
+    wal->cksum[0] = cksum[0];
+    wal->cksum[1] = cksum[1];
+
+    frame_size = WAL_FRAME_HEADER_SIZE + page_size;
+    if ((frame = malloc(frame_size)) == NULL)
+        return CHIDB_ENOMEM;
+
+    for (uint32_t i = 1; ; i++)
+    {
+        npage_t db_size;
+
+        if ((n = wal_pread(wal->fd, frame, frame_size, wal_frame_offset(wal, i))) < 0)
+        {
+            rc = CHIDB_EIO;
+            break;
+        }
+        if ((size_t) n < frame_size || get4byte(frame) == 0 ||
+            get4byte(frame + 8) != wal->salt[0] || get4byte(frame + 12) != wal->salt[1])
+            break;
+
+        wal_checksum(frame, 8, cksum);
+        wal_checksum(frame + WAL_FRAME_HEADER_SIZE, page_size, cksum);
+        if (get4byte(frame + 16) != cksum[0] || get4byte(frame + 20) != cksum[1])
+            break;
+
+        if ((rc = wal_frames_reserve(wal, i)) != CHIDB_OK)
+            break;
+        wal->frame_pages[i - 1] = get4byte(frame);
+
+        /* Frames only become visible once their commit frame is found */
+        if ((db_size = get4byte(frame + 4)) != 0)
+        {
+            if ((rc = wal_index_add(wal, wal->max_frame + 1, i)) != CHIDB_OK)
+                break;
+            wal->max_frame = i;
+            wal->db_size = db_size;
+            wal->cksum[0] = cksum[0];
+            wal->cksum[1] = cksum[1];
+        }
+    }
+    free(frame);
+
+    if (wal->max_frame > 0)
+        chilog(DEBUG, "Recovered %i frames from %s", wal->max_frame, wal->filename);
+
+    return rc;
+}
+
+static void wal_free(Wal *wal)
+{
+    if (wal->fd >= 0)
+        close(wal->fd);
+    if (wal->db_fd >= 0)
+        close(wal->db_fd);
+    pthread_mutex_destroy(&wal->mutex);
+    pthread_mutex_destroy(&wal->write_lock);
+    pthread_cond_destroy(&wal->sync_cond);
+    if (wal->ring != NULL)
+        chidb_Uring_close(wal->ring);
+    free(wal->frame_pages);
+    free(wal->slots);
+    free(wal->filename);
+    free(wal);
+}
+
+
+/* Open the WAL of a database file
+ *
+ * If another Pager in the process already has the database file open in
+ * WAL mode, its Wal is shared. Otherwise, the -wal file is opened (and
+ * created if it does not exist), and any frames committed to it are
+ * recovered into the WAL index.
+ *
+ * Parameters
+ * - wal: An out parameter. Used to return a pointer to the Wal.
+ * - dbfilename: Name of the database file.
+ * - dbfd: File descriptor of the database file.
+ * - flags: CHIDB_OPEN_* flags of the Pager. If it includes CHIDB_OPEN_URING,
+ *          checkpoints use io_uring (only the first Pager to open the
+ *          WAL decides this).
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Wal_open(Wal **wal, const char *dbfilename, int dbfd, int flags)
+{
+    struct stat buf;
+    Wal *w;
+    int rc;
+
+    if (fstat(dbfd, &buf) != 0)
+        return CHIDB_EIO;
+
+    pthread_mutex_lock(&wal_registry_lock);
+    for (w = wal_registry; w != NULL; w = w->next)
+        if (w->dev == buf.st_dev && w->ino == buf.st_ino)
+        {
+            w->refcount++;
+            pthread_mutex_unlock(&wal_registry_lock);
+            *wal = w;
+            return CHIDB_OK;
+        }
+
+    if ((w = calloc(1, sizeof(Wal))) == NULL)
+    {
+        pthread_mutex_unlock(&wal_registry_lock);
+        return CHIDB_ENOMEM;
+    }
+    w->fd = w->db_fd = -1;
+    pthread_mutex_init(&w->mutex, NULL);
+    pthread_mutex_init(&w->write_lock, NULL);
+    pthread_cond_init(&w->sync_cond, NULL);
+    w->dev = buf.st_dev;
+    w->ino = buf.st_ino;
+    w->refcount = 1;
+    w->generation = 1;
+    w->salt[0] = (uint32_t) time(NULL);
+    w->salt[1] = (uint32_t) getpid() * 2654435761u;
+
+    if ((w->filename = malloc(strlen(dbfilename) + 5)) == NULL)
+    {
+        wal_free(w);
+        pthread_mutex_unlock(&wal_registry_lock);
+        return CHIDB_ENOMEM;
+    }
+    sprintf(w->filename, "%s-wal", dbfilename);
+
+    if ((flags & CHIDB_OPEN_URING) && chidb_Uring_open(&w->ring) != CHIDB_OK)
+        w->ring = NULL;
+
+    if ((w->fd = open(w->filename, O_RDWR | O_CREAT, 0644)) < 0 ||
+        (w->db_fd = dup(dbfd)) < 0)
+        rc = CHIDB_EIO;
+    else
+        rc = wal_recover(w);
+
+    if (rc != CHIDB_OK)
+    {
+        wal_free(w);
+        pthread_mutex_unlock(&wal_registry_lock);
+        return rc;
+    }
+
+    w->next = wal_registry;
+    wal_registry = w;
+    pthread_mutex_unlock(&wal_registry_lock);
+
+    *wal = w;
+    return CHIDB_OK;
+}
+
+
+/* Close a WAL
+ *
+ * Drops a reference to a Wal. When the last Pager using the Wal closes
+ * it, the WAL is checkpointed and the -wal file is removed.
+ *
+ * Parameters
+ * - wal: A Wal.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred during the final checkpoint.
+ *   The -wal file is left in place, and will be recovered when the
+ *   database is opened again.
+ */
+int chidb_Wal_close(Wal *wal)
+{
+    Wal **p;
+    int rc;
+
+    pthread_mutex_lock(&wal_registry_lock);
+    if (--wal->refcount > 0)
+    {
+        pthread_mutex_unlock(&wal_registry_lock);
+        return CHIDB_OK;
+    }
+
+    for (p = &wal_registry; *p != wal; p = &(*p)->next)
+        ;
+    *p = wal->next;
+
+    /* The registry stays locked so that nobody opens (and recovers)
+     * the -wal file while it is being checkpointed and removed */
+    if ((rc = chidb_Wal_checkpoint(wal)) == CHIDB_OK)
+        unlink(wal->filename);
+    wal_free(wal);
+    pthread_mutex_unlock(&wal_registry_lock);
+
+    return rc;
+}
+
+
+/* Read a page from the WAL
+ *
+ * Parameters
+ * - wal: A Wal.
+ * - npage: Page number.
+ * - data: Buffer for the page.
+ * - len: Number of bytes of the page to read.
+ * - found: Out parameter. Set to true if the page was in the WAL (and
+ *          has been read into data), or to false if the page must be
+ *          read from the database file.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file
+ */
+int chidb_Wal_readPage(Wal *wal, npage_t npage, uint8_t *data, uint32_t len, bool *found)
+{
+    uint32_t frame;
+    int rc = CHIDB_OK;
+
+    *found = false;
+
+    pthread_mutex_lock(&wal->mutex);
+    if ((frame = wal_index_lookup(wal, npage)) != 0)
+    {
+        uint32_t n = len < wal->page_size ? len : wal->page_size;
+
+        if (wal_pread(wal->fd, data, n, wal_frame_offset(wal, frame) + WAL_FRAME_HEADER_SIZE) != (ssize_t) n)
+            rc = CHIDB_EIO;
+        else
+        {
+            memset(data + n, 0, len - n);
+            *found = true;
+        }
+    }
+    pthread_mutex_unlock(&wal->mutex);
+
+    return rc;
+}
+
+
+/* Acquire and release the write lock
+ *
+ * Only one Pager may be writing to the database at a time. A Pager must
+ * hold the write lock from before it reads the pages it is going to
+ * modify until its frames have been appended with chidb_Wal_append.
+ */
+int chidb_Wal_beginWrite(Wal *wal)
+{
+    pthread_mutex_lock(&wal->write_lock);
+    return CHIDB_OK;
+}
+
+int chidb_Wal_endWrite(Wal *wal)
+{
+    pthread_mutex_unlock(&wal->write_lock);
+    return CHIDB_OK;
+}
+
+
+/* Append a commit to the WAL
+ *
+ * Writes the given pages to the end of the WAL (the last one as the commit
+ * frame) and adds them to the WAL index, which makes them visible to
+ * readers. The frames are not necessarily durable when this function
+ * returns: call chidb_Wal_sync with the returned LSN (after releasing the
+ * write lock, so that other committers can share the fdatasync).
+ *
+ * The caller must hold the write lock.
+ *
+ * Parameters
+ * - wal: A Wal.
+ * - page_size: Size of the pages.
+ * - npages: Page numbers of the n pages.
+ * - data: Contents of the n pages.
+ * - n: Number of pages (must be at least 1).
+ * - db_size: Size of the database, in pages, after this commit.
+ * - lsn: Out parameter. Identifies the commit in chidb_Wal_sync.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the file, or
+ *   the page size does not match the page size of the WAL.
+ */
+int chidb_Wal_append(Wal *wal, uint32_t page_size, npage_t *npages, uint8_t **data, uint32_t n,
+                     npage_t db_size, uint64_t *lsn)
+{
+    uint8_t headers[WAL_WRITE_BATCH][WAL_FRAME_HEADER_SIZE];
+    struct iovec iov[2 * WAL_WRITE_BATCH];
+    uint32_t cksum[2], first;
+    int rc = CHIDB_OK;
+
+    pthread_mutex_lock(&wal->mutex);
+
+    if (wal->page_size == 0)
+    {
+        wal->page_size = page_size;
+        if ((rc = wal_write_header(wal)) != CHIDB_OK)
+            wal->page_size = 0;
+    }
+    else if (wal->page_size != page_size)
+    {
+        chilog(ERROR, "Page size %i does not match the page size of %s", page_size, wal->filename);
+        rc = CHIDB_EIO;
+    }
+
+    first = wal->max_frame + 1;
+    if (rc == CHIDB_OK)
+        rc = wal_frames_reserve(wal, wal->max_frame + n);
+
+    cksum[0] = wal->cksum[0];
+    cksum[1] = wal->cksum[1];
+    for (uint32_t i = 0; i < n && rc == CHIDB_OK; i += WAL_WRITE_BATCH)
+    {
+        uint32_t batch = n - i < WAL_WRITE_BATCH ? n - i : WAL_WRITE_BATCH;
+
+        for (uint32_t j = 0; j < batch; j++)
+        {
+            uint8_t *header = headers[j];
+
+            put4byte(header, npages[i + j]);
+            put4byte(header + 4, i + j == n - 1 ? db_size : 0);
+            put4byte(header + 8, wal->salt[0]);
+            put4byte(header + 12, wal->salt[1]);
+            wal_checksum(header, 8, cksum);
+            wal_checksum(data[i + j], page_size, cksum);
+            put4byte(header + 16, cksum[0]);
+            put4byte(header + 20, cksum[1]);
+
+            iov[2 * j].iov_base = header;
+            iov[2 * j].iov_len = WAL_FRAME_HEADER_SIZE;
+            iov[2 * j + 1].iov_base = data[i + j];
+            iov[2 * j + 1].iov_len = page_size;
+            wal->frame_pages[first + i + j - 1] = npages[i + j];
+        }
+        rc = chidb_pwritev(wal->fd, iov, 2 * batch, wal_frame_offset(wal, first + i));
+    }
+
+    /* Publish the commit */
+    if (rc == CHIDB_OK && (rc = wal_index_add(wal, first, first + n - 1)) == CHIDB_OK)
+    {
+        wal->max_frame += n;
+        wal->db_size = db_size;
+        wal->cksum[0] = cksum[0];
+        wal->cksum[1] = cksum[1];
+        wal->appended += n;
+    }
+    *lsn = wal->appended;
+
+    pthread_mutex_unlock(&wal->mutex);
+
+    return rc;
+}
+
+
+/* Wait until a commit is durable
+ *
+ * Parameters
+ * - wal: A Wal.
+ * - lsn: LSN returned by chidb_Wal_append.
+ *
+ * Return
+ * - CHIDB_OK: Every frame up to lsn is durable
+ * - CHIDB_EIO: An I/O error has occurred when syncing the file
+ */
+int chidb_Wal_sync(Wal *wal, uint64_t lsn)
+{
+    int rc = CHIDB_OK;
+
+    pthread_mutex_lock(&wal->mutex);
+    while (wal->synced < lsn && rc == CHIDB_OK)
+    {
+        if (wal->syncing)
+        {
+            pthread_cond_wait(&wal->sync_cond, &wal->mutex);
+            continue;
+        }
+
+        /* Lead an fdatasync on behalf of every frame appended so far */
+        uint64_t target = wal->appended;
+        wal->syncing = true;
+        pthread_mutex_unlock(&wal->mutex);
+
+        rc = wal_datasync(wal->fd);
+
+        pthread_mutex_lock(&wal->mutex);
+        wal->syncing = false;
+        wal->n_syncs++;
+        if (rc == CHIDB_OK && target > wal->synced)
+            wal->synced = target;
+        pthread_cond_broadcast(&wal->sync_cond);
+    }
+    pthread_mutex_unlock(&wal->mutex);
+
+    return rc;
+}
+
+
+static int wal_cmp_frame(const void *a, const void *b, void *arg)
+{
+    Wal *wal = arg;
+    npage_t na = wal->frame_pages[*(const uint32_t *) a - 1];
+    npage_t nb = wal->frame_pages[*(const uint32_t *) b - 1];
+    return (na > nb) - (na < nb);
+}
+
+/* Copies n frames (at most WAL_CHECKPOINT_BATCH) into the database file,
+ * using buf as a staging area. If the database is compressed, the pages
+ * are compressed into zbuf on their way to the file. With io_uring, all
+ * the frames are read with a single submission, and then written with
+ * another one. */
+static int wal_copy_frames(Wal *wal, uint32_t *frames, uint32_t n, uint8_t *buf, uint8_t *zbuf)
+{
+    struct iovec iov[WAL_CHECKPOINT_BATCH];
+    UringOp ops[WAL_CHECKPOINT_BATCH];
+    uint32_t len = wal->page_size;
+    int rc = CHIDB_OK;
+
+    if (wal->ring == NULL)
+    {
+        for (uint32_t i = 0; rc == CHIDB_OK && i < n; i++)
+        {
+            npage_t npage = wal->frame_pages[frames[i] - 1];
+            uint8_t *image = buf;
+
+            if (wal_pread(wal->fd, buf, wal->page_size,
+                          wal_frame_offset(wal, frames[i]) + WAL_FRAME_HEADER_SIZE) != (ssize_t) wal->page_size)
+                rc = CHIDB_EIO;
+            else
+            {
+                if (wal->compress)
+                    image = chidb_Compress_page(npage, buf, wal->page_size, zbuf, &len);
+                rc = wal_pwrite(wal->db_fd, image, len, (off_t)(npage - 1) * wal->page_size);
+            }
+        }
+        return rc;
+    }
+
+    for (int write = 0; rc == CHIDB_OK && write <= 1; write++)
+    {
+        for (uint32_t i = 0; i < n; i++)
+        {
+            npage_t npage = wal->frame_pages[frames[i] - 1];
+
+            iov[i].iov_base = buf + (size_t) i * wal->page_size;
+            iov[i].iov_len = wal->page_size;
+            if (write && wal->compress)
+            {
+                iov[i].iov_base = chidb_Compress_page(npage, iov[i].iov_base, wal->page_size,
+                                                      zbuf + (size_t) i * wal->page_size, &len);
+                iov[i].iov_len = len;
+            }
+            ops[i] = (UringOp) {.write = write, .iov = &iov[i], .iovcnt = 1};
+            ops[i].fd = write ? wal->db_fd : wal->fd;
+            ops[i].offset = write ? (off_t)(npage - 1) * wal->page_size
+                                  : wal_frame_offset(wal, frames[i]) + WAL_FRAME_HEADER_SIZE;
+        }
+        rc = chidb_Uring_run(wal->ring, ops, n);
+    }
+
+    return rc;
+}
+
+/* Checkpoint the WAL
+ *
+ * Copies the newest version of every page in the WAL into the database
+ * file (in page number order), syncs the database file, and resets the
+ * WAL. The caller must hold the write lock, or otherwise guarantee that
+ * no commits happen during the checkpoint.
+ *
+ * Parameters
+ * - wal: A Wal.
+ *
+ * Return
+ * - CHIDB_OK: Operation successful
+ * - CHIDB_ENOMEM: Could not allocate memory
+ * - CHIDB_EIO: An I/O error has occurred when accessing the files
+ */
+int chidb_Wal_checkpoint(Wal *wal)
+{
+    uint32_t *frames = NULL, nframes = 0;
+    uint8_t *pages = NULL;
+    int rc = CHIDB_OK;
+
+    pthread_mutex_lock(&wal->mutex);
+
+    if (wal->max_frame == 0)
+    {
+        pthread_mutex_unlock(&wal->mutex);
+        return CHIDB_OK;
+    }
+
+    /* Newest frame of each page, sorted by page number */
+    /* The database file may have been opened with O_DIRECT */
+    if ((frames = malloc(wal->slots_used * sizeof(uint32_t))) == NULL ||
+        posix_memalign((void **) &pages, IO_BUFFER_ALIGN,
+                       (wal->compress ? 2 : 1) * WAL_CHECKPOINT_BATCH * wal->page_size) != 0)
+        rc = CHIDB_ENOMEM;
+    for (uint32_t i = 0; rc == CHIDB_OK && i <= wal->slots_mask; i++)
+        if (wal->slots[i] != 0)
+            frames[nframes++] = wal->slots[i];
+    if (rc == CHIDB_OK)
+        qsort_r(frames, nframes, sizeof(uint32_t), wal_cmp_frame, wal);
+
+    for (uint32_t i = 0; rc == CHIDB_OK && i < nframes; i += WAL_CHECKPOINT_BATCH)
+    {
+        uint32_t n = nframes - i < WAL_CHECKPOINT_BATCH ? nframes - i : WAL_CHECKPOINT_BATCH;
+        rc = wal_copy_frames(wal, frames + i, n, pages, pages + WAL_CHECKPOINT_BATCH * wal->page_size);
+    }
+
+    /* The database may have shrunk since it was last checkpointed (or, if
+     * it is compressed, the image of its last page may be cut short) */
+    struct stat buf;
+    off_t db_bytes = (off_t) wal->db_size * wal->page_size;
+    if (rc == CHIDB_OK && wal->db_size > 0 && fstat(wal->db_fd, &buf) == 0 &&
+        buf.st_size != db_bytes && ftruncate(wal->db_fd, db_bytes) != 0)
+        rc = CHIDB_EIO;
+
+    if (rc == CHIDB_OK && fsync(wal->db_fd) != 0)
+        rc = CHIDB_EIO;
+
+    /* Every frame is now in the database file, so the WAL can start over.
+     * A new salt invalidates the frames left in the file. */
+    if (rc == CHIDB_OK)
+    {
+        chilog(DEBUG, "Checkpointed %i frames (%i pages) from %s", wal->max_frame, nframes, wal->filename);
+        wal->checkpoint_seq++;
+        wal->salt[0]++;
+        wal->salt[1] = wal->salt[1] * 2654435761u + 1;
+        if ((rc = wal_write_header(wal)) == CHIDB_OK && ftruncate(wal->fd, WAL_HEADER_SIZE) != 0)
+            rc = CHIDB_EIO;
+        if (rc == CHIDB_OK)
+            rc = wal_datasync(wal->fd);
+
+        wal->max_frame = 0;
+        wal->generation++;
+        memset(wal->slots, 0, (wal->slots_mask + 1) * sizeof(uint32_t));
+        wal->slots_used = 0;
+        wal->synced = wal->appended;
+        pthread_cond_broadcast(&wal->sync_cond);
+    }
+
+    pthread_mutex_unlock(&wal->mutex);
+
+    free(frames);
+    free(pages);
+    return rc;
+}
+
+
+/* Tells the WAL whether the pages of the database are stored compressed
+ * (see compress.c), so that checkpoints store them in the same way
+ *
+ * Parameters
+ * - wal: A Wal.
+ * - compress: Whether pages are compressed
+ */
+void chidb_Wal_setCompression(Wal *wal, bool compress)
+{
+    pthread_mutex_lock(&wal->mutex);
+    wal->compress = compress;
+    pthread_mutex_unlock(&wal->mutex);
+}
+
+
+/* Returns the current state of the WAL
+ *
+ * Pagers use this to find out whether other Pagers have committed
+ * since they last looked at the WAL (in which case their cached
+ * copies of the modified pages are stale).
+ *
+ * Parameters
+ * - wal: A Wal.
+ * - generation: Out parameter. Incremented every time the WAL is reset.
+ * - max_frame: Out parameter. Last committed frame.
+ * - db_size: Out parameter. Size of the database (in pages) as of the
+ *            last commit, or 0 if nothing has been committed to the WAL.
+ */
+void chidb_Wal_getState(Wal *wal, uint32_t *generation, uint32_t *max_frame, npage_t *db_size)
+{
+    pthread_mutex_lock(&wal->mutex);
+    *generation = wal->generation;
+    *max_frame = wal->max_frame;
+    *db_size = wal->db_size;
+    pthread_mutex_unlock(&wal->mutex);
+}
+
+
+/* Returns the page number stored in a frame, or 0 if the WAL has been
+ * reset since generation (or the frame has not been committed) */
+npage_t chidb_Wal_framePage(Wal *wal, uint32_t generation, uint32_t frame)
+{
+    npage_t npage = 0;
+
+    pthread_mutex_lock(&wal->mutex);
+    if (wal->generation == generation && frame >= 1 && frame <= wal->max_frame)
+        npage = wal->frame_pages[frame - 1];
+    pthread_mutex_unlock(&wal->mutex);
+
+    return npage;
+}
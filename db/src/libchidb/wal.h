@@ -0,0 +1,117 @@
+/*
+ *  chidb - a didactic relational database management system
+ *
+ *  Write-ahead log header. See wal.c for more details.
+ *
+ */
+
+/*
+ *  Copyright (c) 2009-2015, The University of Chicago
+ *  All rights reserved.
+ *
+ *  Redistribution and use in source and binary forms, with or withsend
+ *  modification, are permitted provided that the following conditions are met:
+ *
+ *  - Redistributions of source code must retain the above copyright notice,
+ *    this list of conditions and the following disclaimer.
+ *
+ *  - Redistributions in binary form must reproduce the above copyright notice,
+ *    this list of conditions and the following disclaimer in the documentation
+ *    and/or other materials provided with the distribution.
+ *
+ *  - Neither the name of The University of Chicago nor the names of its
+ *    contributors may be used to endorse or promote products derived from this
+ *    software withsend specific prior written permission.
+ *
+ *  THIS SOFTWARE IS PROVIDED BY THE COPYRIGHT HOLDERS AND CONTRIBUTORS "AS IS"
+ *  AND ANY EXPRESS OR IMPLIED WARRANTIES, INCLUDING, BUT NOT LIMITED TO, THE
+ *  IMPLIED WARRANTIES OF MERCHANTABILITY AND FITNESS FOR A PARTICULAR PURPOSE
+ *  ARE DISCLAIMED. IN NO EVENT SHALL THE COPYRIGHT HOLDER OR CONTRIBUTORS BE
+ *  LIABLE FOR ANY DIRECT, INDIRECT, INCIDENTAL, SPECIAL, EXEMPLARY, OR
+ *  CONSEQUENTIAL DAMAGES (INCLUDING, BUT NOT LIMITED TO, PROCUREMENT OF
+ *  SUBSTITUTE GOODS OR SERVICES; LOSS OF USE, DATA, OR PROFITS; OR BUSINESS
+ *  INTERRUPTION) HOWEVER CAUSED AND ON ANY THEORY OF LIABILITY, WHETHER IN
+ *  CONTRACT, STRICT LIABILITY, OR TORT (INCLUDING NEGLIGENCE OR OTHERWISE)
+ *  ARISING IN ANY WAY send OF THE USE OF THIS SOFTWARE, EVEN IF ADVISED OF THE
+ *  POSSIBILITY OF SUCH DAMAGE.
+ *
+ */
+
+#ifndef WAL_H_
+#define WAL_H_
+
+#include <pthread.h>
+#include <sys/types.h>
+#include "chidbInt.h"
+#include "uring.h"
+
+/* Sizes of the WAL file header and of the header of each frame */
+#define WAL_HEADER_SIZE (32)
+#define WAL_FRAME_HEADER_SIZE (24)
+
+#define WAL_MAGIC (0x43574c01)
+#define WAL_VERSION (1)
+
+/* Number of frames after which a commit checkpoints the WAL */
+#define WAL_AUTOCHECKPOINT (1000)
+
+/* Number of pages copied at a time by a checkpoint */
+#define WAL_CHECKPOINT_BATCH (URING_ENTRIES)
+
+/* A Wal is shared by every Pager in the process that has the same
+ * database file open in WAL mode. */
+struct Wal
+{
+    char *filename;             /* Name of the -wal file */
+    int fd;                     /* The -wal file */
+    int db_fd;                  /* The database file (for checkpoints) */
+    bool compress;              /* Pages are compressed in the database file */
+    Uring *ring;                /* io_uring used by checkpoints, or NULL */
+    dev_t dev;                  /* Identity of the database file */
+    ino_t ino;
+    uint32_t refcount;          /* Number of Pagers using this Wal */
+    struct Wal *next;           /* Next Wal in the process-wide registry */
+
+    /* WAL file header */
+    uint32_t page_size;         /* 0 until the first frame is written */
+    uint32_t checkpoint_seq;
+    uint32_t salt[2];
+    uint32_t cksum[2];          /* Checksum of the last valid frame */
+
+    /* WAL index. Frames are numbered from 1. */
+    uint32_t max_frame;         /* Last frame of the last commit */
+    uint32_t generation;        /* Incremented every time the WAL is reset */
+    npage_t db_size;            /* Size of the database as of the last commit */
+    npage_t *frame_pages;       /* Frame -> page number */
+    uint32_t frames_alloc;
+    uint32_t *slots;            /* Page number -> newest frame (open addressing) */
+    uint32_t slots_mask;
+    uint32_t slots_used;
+
+    /* Group commit. Frames are counted from the moment the Wal was opened,
+     * so that these counters keep increasing across checkpoints. */
+    uint64_t appended;          /* Frames written to the WAL file */
+    uint64_t synced;            /* Frames known to be durable */
+    bool syncing;               /* A committer is running fdatasync */
+    uint64_t n_syncs;           /* Number of fdatasync calls on the WAL */
+    pthread_cond_t sync_cond;
+
+    pthread_mutex_t mutex;      /* Protects everything above */
+    pthread_mutex_t write_lock; /* Held by the (single) writing Pager */
+};
+typedef struct Wal Wal;
+
+int chidb_Wal_open(Wal **wal, const char *dbfilename, int dbfd, int flags);
+int chidb_Wal_close(Wal *wal);
+int chidb_Wal_readPage(Wal *wal, npage_t npage, uint8_t *data, uint32_t len, bool *found);
+int chidb_Wal_beginWrite(Wal *wal);
+int chidb_Wal_endWrite(Wal *wal);
+int chidb_Wal_append(Wal *wal, uint32_t page_size, npage_t *npages, uint8_t **data, uint32_t n,
+                     npage_t db_size, uint64_t *lsn);
+int chidb_Wal_sync(Wal *wal, uint64_t lsn);
+int chidb_Wal_checkpoint(Wal *wal);
+void chidb_Wal_setCompression(Wal *wal, bool compress);
+void chidb_Wal_getState(Wal *wal, uint32_t *generation, uint32_t *max_frame, npage_t *db_size);
+npage_t chidb_Wal_framePage(Wal *wal, uint32_t generation, uint32_t frame);
+
+#endif /*WAL_H_*/
@@ -53,6 +53,8 @@ chisql_statement_t *__stmt;
 %token COUNT SUM AVG MIN MAX INTERSECT EXCEPT DISTINCT
 %token CONCAT TRUE FALSE CASE WHEN DECLARE BIT GROUP
 %token INDEX EXPLAIN
+%token TOKEN_BEGIN COMMIT ROLLBACK TRANSACTION
+%token VACUUM PRAGMA INCREMENTAL_VACUUM
 %token <strval> IDENTIFIER
 %token <strval> STRING_LITERAL
 %token <dval> DOUBLE_LITERAL
@@ -60,6 +62,7 @@ chisql_statement_t *__stmt;
 
 %type <ival> column_type bool_op comp_op select_combo
 %type <ival> function_name opt_distinct join opt_unique
+%type <ival> opt_vacuum_pages
 %type <strval> column_name table_name opt_alias 
 %type <strval> index_name column_name_or_star
 %type <slist> column_names_list opt_column_names
@@ -100,9 +103,26 @@ sql_line
 	| select 		{ __stmt->stmt.select = $1; __stmt->type = STMT_SELECT; }
 	| insert_into 	{ __stmt->stmt.insert = $1; __stmt->type = STMT_INSERT; }
 	| delete_from 	{ __stmt->stmt.delete = $1; __stmt->type = STMT_DELETE; }
+	| TOKEN_BEGIN opt_transaction	{ __stmt->type = STMT_BEGIN; }
+	| COMMIT opt_transaction		{ __stmt->type = STMT_COMMIT; }
+	| ROLLBACK opt_transaction	{ __stmt->type = STMT_ROLLBACK; }
+	| VACUUM					{ __stmt->type = STMT_VACUUM; }
+	| PRAGMA INCREMENTAL_VACUUM opt_vacuum_pages
+		{ __stmt->stmt.vacuum_pages = $3; __stmt->type = STMT_INCREMENTAL_VACUUM; }
 	| /* empty */
 	;
 
+opt_transaction
+	: TRANSACTION
+	| /* empty */
+	;
+
+opt_vacuum_pages
+	: '(' INT_LITERAL ')'	{ $$ = $2; }
+	| '=' INT_LITERAL		{ $$ = $2; }
+	| /* empty */			{ $$ = 0; }
+	;
+
 create
 	: create_table { $$ = Create_fromTable($1); }
 	| create_index { $$ = Create_fromIndex($1); }
@@ -289,8 +309,8 @@ bool_term
    		$$ = ($2 == '=') ? Eq($1, $3) :
    			  ($2 == '>') ? Gt($1, $3) :
    			  ($2 == '<') ? Lt($1, $3) :
-   			  ($2 == GEQ) ? Leq($1, $3) :
-   			  ($2 == LEQ) ? Geq($1, $3) :
+   			  ($2 == GEQ) ? Geq($1, $3) :
+   			  ($2 == LEQ) ? Leq($1, $3) :
    			  Not(Eq($1, $3));
    	}
    | expression in_statement { $$ = In($1, $2); }
@@ -506,6 +526,21 @@ int chisql_stmt_print(chisql_statement_t *stmt)
     case STMT_DELETE:
         Delete_print(stmt->stmt.delete);
         break;
+    case STMT_BEGIN:
+        printf("BEGIN\n");
+        break;
+    case STMT_COMMIT:
+        printf("COMMIT\n");
+        break;
+    case STMT_ROLLBACK:
+        printf("ROLLBACK\n");
+        break;
+    case STMT_VACUUM:
+        printf("VACUUM\n");
+        break;
+    case STMT_INCREMENTAL_VACUUM:
+        printf("PRAGMA INCREMENTAL_VACUUM(%i)\n", stmt->stmt.vacuum_pages);
+        break;
     }
 
     return 0;
@@ -20,6 +20,7 @@ struct handler_entry handlers[] =
     		                  "                     column  Left-aligned columns\n"
     		                  "                     list    Values delimited by | (default)"),
     HANDLER_ENTRY (explain,   ".explain on|off    Turn output mode suitable for EXPLAIN on or off."),
+    HANDLER_ENTRY (stats,     ".stats on|off      Show I/O statistics after each SQL statement"),
     HANDLER_ENTRY (help,      ".help              Show this message"),
 
     NULL_ENTRY
@@ -85,10 +86,51 @@ int chidb_shell_handle_cmd(chidb_shell_ctx_t *ctx, const char *cmd)
     return 0;
 }
 
+/* Prints a latency histogram, skipping the empty buckets */
+static void print_latency(const char *name, const uint64_t *before, const uint64_t *after)
+{
+    printf("%-18s", name);
+    for(int i = 0; i < CHIDB_STATS_BUCKETS; i++)
+    {
+        uint64_t n = after[i] - before[i];
+
+        if(n == 0)
+            continue;
+        if(i == CHIDB_STATS_BUCKETS - 1)
+            printf(" >=%llu:%llu", 1ULL << (i - 1), (unsigned long long) n);
+        else
+            printf(" <%llu:%llu", 1ULL << i, (unsigned long long) n);
+    }
+    printf("\n");
+}
+
+/* Prints the I/O done by a statement: the difference between the
+ * statistics taken before and after running it */
+static void print_stats(const chidb_stats_t *before, const chidb_stats_t *after)
+{
+    printf("Page reads:       %llu (%llu cache hits, %llu misses)\n",
+           (unsigned long long) (after->page_reads - before->page_reads),
+           (unsigned long long) (after->cache_hits - before->cache_hits),
+           (unsigned long long) (after->cache_misses - before->cache_misses));
+    printf("Page writes:      %llu\n", (unsigned long long) (after->page_writes - before->page_writes));
+    printf("Bytes read:       %llu\n", (unsigned long long) (after->bytes_read - before->bytes_read));
+    printf("Bytes written:    %llu\n", (unsigned long long) (after->bytes_written - before->bytes_written));
+    printf("Pages allocated:  %llu\n", (unsigned long long) (after->pages_allocated - before->pages_allocated));
+    printf("Node splits:      %llu\n", (unsigned long long) (after->node_splits - before->node_splits));
+    printf("Node merges:      %llu\n", (unsigned long long) (after->node_merges - before->node_merges));
+    printf("Overflow reads:   %llu\n", (unsigned long long) (after->overflow_reads - before->overflow_reads));
+    print_latency("Read times (us):", before->read_latency, after->read_latency);
+    print_latency("Write times (us):", before->write_latency, after->write_latency);
+}
+
 int chidb_shell_handle_sql(chidb_shell_ctx_t *ctx, const char *sql)
 {
     int rc;
     chidb_stmt *stmt;
+    chidb_stats_t before, after;
+
+    if(ctx->stats)
+        chidb_stats(ctx->db, &before, false);
 
     rc = chidb_prepare(ctx->db, sql, &stmt);
 
@@ -200,6 +242,12 @@ int chidb_shell_handle_sql(chidb_shell_ctx_t *ctx, const char *sql)
         rc = chidb_finalize(stmt);
         if(rc == CHIDB_EMISUSE)
             printf("API used incorrectly.\n");
+
+        if(ctx->stats)
+        {
+            chidb_stats(ctx->db, &after, false);
+            print_stats(&before, &after);
+        }
     }
     else if (rc == CHIDB_EINVALIDSQL)
         printf("SQL syntax error.\n");
@@ -396,6 +444,27 @@ int chidb_shell_handle_cmd_headers(chidb_shell_ctx_t *ctx, struct handler_entry
     return CHIDB_OK;
 }
 
+int chidb_shell_handle_cmd_stats(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
+{
+    if(ntokens != 2)
+    {
+    	usage_error(e, "Invalid arguments");
+    	return 1;
+    }
+
+    if(strcmp(tokens[1],"on")==0)
+        ctx->stats = true;
+    else if(strcmp(tokens[1],"off")==0)
+        ctx->stats = false;
+    else
+    {
+    	usage_error(e, "Invalid argument");
+    	return 1;
+    }
+
+    return CHIDB_OK;
+}
+
 int chidb_shell_handle_cmd_mode(chidb_shell_ctx_t *ctx, struct handler_entry *e, const char **tokens, int ntokens)
 {
     if(ntokens != 2)
@@ -16,6 +16,7 @@ typedef struct chidb_shell_ctx
 
     bool header;
     shell_mode_t mode;
+    bool stats;
 
 } chidb_shell_ctx_t;
 
@@ -27,6 +27,19 @@ TCase* make_btree_5_tc(void);
 TCase* make_btree_6_tc(void);
 TCase* make_btree_7_tc(void);
 TCase* make_btree_8_tc(void);
+TCase* make_btree_9_tc(void);
+TCase* make_btree_10_tc(void);
+TCase* make_btree_11_tc(void);
+TCase* make_btree_12_tc(void);
+TCase* make_btree_13_tc(void);
+TCase* make_btree_14_tc(void);
+TCase* make_btree_15_tc(void);
+TCase* make_btree_16_tc(void);
+TCase* make_btree_17_tc(void);
+TCase* make_btree_18_tc(void);
+TCase* make_btree_19_tc(void);
+TCase* make_btree_20_tc(void);
+TCase* make_btree_21_tc(void);
 
 
 
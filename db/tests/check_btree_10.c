@@ -0,0 +1,110 @@
+#include <stdlib.h>
+#include <check.h>
+#include <chidb/log.h>
+#include "check_btree.h"
+
+/* Returns the depth of the B-Tree rooted at npage */
+static int btree_depth(BTree *bt, npage_t npage)
+{
+    BTreeNode *btn;
+    int depth = 1;
+
+    for (;;)
+    {
+        chidb_Btree_getNodeByPage(bt, npage, &btn);
+        npage = btn->right_page;
+        if (btn->type != PGTYPE_TABLE_INTERNAL && btn->type != PGTYPE_INDEX_INTERNAL)
+            break;
+        chidb_Btree_freeMemNode(bt, btn);
+        depth++;
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return depth;
+}
+
+
+START_TEST (test_10_1)
+{
+    chidb *db;
+    BTree *bt;
+    int rc;
+    uint32_t sizes[] = {256, 1000, 131072};
+
+    char *fname = create_tmp_file();
+    db = malloc(sizeof(chidb));
+    for(int i=0; i<3; i++)
+    {
+        rc = chidb_Btree_openWithPageSize(fname, db, &bt, CHIDB_OPEN_DEFAULT, sizes[i]);
+        ck_assert(rc == CHIDB_EMISUSE);
+    }
+
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_10_2)
+{
+    chidb *db;
+    int rc, depth[4];
+    uint32_t sizes[] = {1024, 4096, 16384, 65536};
+    npage_t npage;
+    BTreeNode *btn;
+
+    db = malloc(sizeof(chidb));
+    for(int i=0; i<4; i++)
+    {
+        char *fname = create_tmp_file();
+
+        rc = chidb_Btree_openWithPageSize(fname, db, &db->bt, CHIDB_OPEN_DEFAULT, sizes[i]);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert_int_eq(db->bt->pager->page_size, sizes[i]);
+
+        chidb_Btree_newNode(db->bt, &npage, PGTYPE_INDEX_LEAF);
+        chidb_Btree_getNodeByPage(db->bt, npage, &btn);
+        btnNew_sanity_check(db->bt, btn, PGTYPE_INDEX_LEAF);
+        chidb_Btree_freeMemNode(db->bt, btn);
+
+        for(int j=0; j<bigfile_nvalues; j++)
+            insert_bigfile(db, j);
+        test_bigfile(db);
+        ck_assert(db->bt->pager->stats.node_splits > 0);
+        bt_sanity_check(db->bt, 1);
+        depth[i] = btree_depth(db->bt, 1);
+        chidb_Btree_close(db->bt);
+
+        /* The page size of an existing file comes from its header */
+        rc = chidb_Btree_open(fname, db, &db->bt);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert_int_eq(db->bt->pager->page_size, sizes[i]);
+        test_bigfile(db);
+
+        chidb_Btree_getNodeByPage(db->bt, npage, &btn);
+        btnNew_sanity_check(db->bt, btn, PGTYPE_INDEX_LEAF);
+        chidb_Btree_freeMemNode(db->bt, btn);
+        chidb_Btree_close(db->bt);
+
+        delete_tmp_file(fname);
+    }
+
+    /* Larger pages make for shallower trees */
+    for(int i=1; i<4; i++)
+        ck_assert(depth[i] <= depth[i-1]);
+    ck_assert(depth[3] < depth[0]);
+
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_10_tc(void)
+{
+    chilog_setloglevel(ERROR);
+    TCase *tc = tcase_create ("Large pages");
+    tcase_add_test (tc, test_10_1);
+    tcase_add_test (tc, test_10_2);
+
+    return tc;
+}
@@ -0,0 +1,73 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <chidb/log.h>
+#include "check_btree.h"
+
+/* Returns a byte of a file, read without going through a pager */
+static int file_byte(const char *fname, off_t offset)
+{
+    uint8_t byte;
+    FILE *f = fopen(fname, "rb");
+    int rc = f != NULL && fseek(f, offset, SEEK_SET) == 0 && fread(&byte, 1, 1, f) == 1 ? byte : -1;
+    if (f != NULL)
+        fclose(f);
+    return rc;
+}
+
+
+START_TEST (test_11_1)
+{
+    chidb *db;
+    int rc;
+
+    db = malloc(sizeof(chidb));
+    for(int wal=0; wal<2; wal++)
+    {
+        char *fname = create_tmp_file();
+
+        rc = chidb_Btree_openWithPageSize(fname, db, &db->bt, CHIDB_OPEN_COMPRESS, 4096);
+        ck_assert(rc == CHIDB_OK);
+        for(int j=0; j<bigfile_nvalues; j++)
+            insert_bigfile(db, j);
+        test_bigfile(db);
+        chidb_Btree_close(db->bt);
+
+        /* The header says that the pages are compressed, so the file is
+         * read correctly even if it is opened without the flag */
+        ck_assert_int_eq(file_byte(fname, HEADER_READ_VERSION_OFFSET), FORMAT_VERSION_COMPRESSED);
+        ck_assert_int_eq(file_byte(fname, 4096), COMPRESS_MAGIC >> 8);
+        rc = chidb_Btree_openWithFlags(fname, db, &db->bt, wal ? CHIDB_OPEN_WAL : CHIDB_OPEN_DEFAULT);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(db->bt->pager->flags & CHIDB_OPEN_COMPRESS);
+        test_bigfile(db);
+        chidb_Btree_close(db->bt);
+
+        delete_tmp_file(fname);
+    }
+
+    /* An existing file that is not compressed stays that way */
+    char *fname = create_tmp_file();
+    rc = chidb_Btree_openWithFlags(fname, db, &db->bt, CHIDB_OPEN_DEFAULT);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Btree_close(db->bt);
+    rc = chidb_Btree_openWithFlags(fname, db, &db->bt, CHIDB_OPEN_COMPRESS);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(!(db->bt->pager->flags & CHIDB_OPEN_COMPRESS));
+    chidb_Btree_close(db->bt);
+    ck_assert_int_eq(file_byte(fname, HEADER_READ_VERSION_OFFSET), FORMAT_VERSION_LEGACY);
+    delete_tmp_file(fname);
+
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_11_tc(void)
+{
+    chilog_setloglevel(ERROR);
+    TCase *tc = tcase_create ("Compressed pages");
+    tcase_add_test (tc, test_11_1);
+
+    return tc;
+}
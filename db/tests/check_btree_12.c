@@ -0,0 +1,69 @@
+#include <stdlib.h>
+#include <unistd.h>
+#include <check.h>
+#include <chidb/log.h>
+#include "check_btree.h"
+
+
+START_TEST (test_12_1)
+{
+    chidb *db, *db2;
+    npage_t n_pages;
+    uint8_t *data;
+    uint32_t size;
+    int rc;
+
+    db = malloc(sizeof(chidb));
+    db2 = malloc(sizeof(chidb));
+
+    /* Flags that need a file are ignored */
+    rc = chidb_Btree_openWithFlags(":memory:", db, &db->bt, CHIDB_OPEN_MMAP | CHIDB_OPEN_WAL | CHIDB_OPEN_COMPRESS);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(db->bt->pager->in_memory);
+    ck_assert_int_eq(db->bt->pager->flags, 0);
+    ck_assert_int_eq(db->bt->pager->n_pages, 1);
+
+    for(int j=0; j<bigfile_nvalues; j++)
+        insert_bigfile(db, j);
+    test_bigfile(db);
+    n_pages = db->bt->pager->n_pages;
+    ck_assert_int_eq(db->bt->pager->arena_size, (size_t) n_pages * db->bt->pager->page_size);
+
+    /* Every in-memory database is a new one */
+    rc = chidb_Btree_open(":memory:", db2, &db2->bt);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(db2->bt->pager->n_pages, 1);
+    ck_assert(chidb_Btree_find(db2->bt, 1, bigfile_pkeys[0], &data, &size) == CHIDB_ENOTFOUND);
+    chidb_Btree_close(db2->bt);
+
+    /* Transactions are rolled back, and the database shrinks */
+    chidb_Btree_begin(db->bt);
+    chidb_Btree_insertInTable(db->bt, 1, 0, (uint8_t *) "foo", 4);
+    chidb_Btree_rollback(db->bt);
+    ck_assert(chidb_Btree_find(db->bt, 1, 0, &data, &size) == CHIDB_ENOTFOUND);
+    test_bigfile(db);
+
+    chidb_Pager_truncate(db->bt->pager, 1);
+    chidb_Btree_initEmptyNode(db->bt, 1, PGTYPE_TABLE_LEAF);
+    ck_assert_int_eq(db->bt->pager->n_pages, 1);
+    ck_assert_int_eq(db->bt->pager->arena_size, db->bt->pager->page_size);
+    ck_assert(chidb_Btree_find(db->bt, 1, bigfile_pkeys[0], &data, &size) == CHIDB_ENOTFOUND);
+    chidb_Btree_close(db->bt);
+
+    /* Nothing was written to disk */
+    ck_assert(access(":memory:", F_OK) != 0);
+
+    free(db);
+    free(db2);
+}
+END_TEST
+
+
+TCase* make_btree_12_tc(void)
+{
+    chilog_setloglevel(ERROR);
+    TCase *tc = tcase_create ("In-memory databases");
+    tcase_add_test (tc, test_12_1);
+
+    return tc;
+}
@@ -0,0 +1,196 @@
+#include <stdlib.h>
+#include <check.h>
+#include <chidb/log.h>
+#include "check_btree.h"
+#include "libchidb/dbm-cursor.h"
+
+#define NKEYS (20000)
+
+/* The i-th key inserted: the even numbers from 2 to 2*NKEYS, in an order
+ * that is neither ascending nor descending */
+static chidb_key_t nth_key(int i)
+{
+    return ((i * 7919) % NKEYS) * 2 + 2;
+}
+
+static chidb_key_t cursor_key(chidb_dbm_cursor_t *cursor)
+{
+    cell_cursor *curr = (cell_cursor *) cursor->path.tail->val;
+    return chidb_Btree_getCellKey(curr->btn, curr->index);
+}
+
+static int btree_depth(BTree *bt, npage_t npage)
+{
+    BTreeNode *btn;
+    int depth = 1;
+
+    chidb_Btree_getNodeByPage(bt, npage, &btn);
+    while (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL)
+    {
+        npage = btn->right_page;
+        chidb_Btree_freeMemNode(bt, btn);
+        chidb_Btree_getNodeByPage(bt, npage, &btn);
+        depth++;
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return depth;
+}
+
+/* Builds a B-Tree of the given type in page 1 */
+static chidb *create_btree(uint8_t type)
+{
+    chidb *db = malloc(sizeof(chidb));
+    uint8_t record[64] = {0};
+
+    ck_assert(chidb_Btree_open(":memory:", db, &db->bt) == CHIDB_OK);
+    chidb_Btree_initEmptyNode(db->bt, 1, type);
+
+    chidb_Btree_begin(db->bt);
+    for(int i=0; i<NKEYS; i++)
+    {
+        chidb_key_t key = nth_key(i);
+        if (type == PGTYPE_TABLE_LEAF)
+        {
+            memcpy(record, &key, sizeof(key));
+            ck_assert(chidb_Btree_insertInTable(db->bt, 1, key, record, sizeof(record)) == CHIDB_OK);
+        }
+        else
+            ck_assert(chidb_Btree_insertInIndex(db->bt, 1, key, key + 1) == CHIDB_OK);
+    }
+    chidb_Btree_commit(db->bt);
+
+    return db;
+}
+
+
+START_TEST (test_13_1)
+{
+    chidb *db = create_btree(PGTYPE_TABLE_LEAF);
+    uint8_t *data;
+    uint32_t size;
+
+    bt_sanity_check(db->bt, 1);
+    /* 64-byte records fill leaves with at least 6 cells, and 1024-byte
+     * internal nodes have dozens of children */
+    ck_assert(btree_depth(db->bt, 1) <= 4);
+
+    for(int i=0; i<NKEYS; i++)
+    {
+        chidb_key_t key = nth_key(i);
+        ck_assert(chidb_Btree_find(db->bt, 1, key, &data, &size) == CHIDB_OK);
+        ck_assert_int_eq(size, 64);
+        ck_assert(!memcmp(data, &key, sizeof(key)));
+        free(data);
+
+        ck_assert(chidb_Btree_find(db->bt, 1, key + 1, &data, &size) == CHIDB_ENOTFOUND);
+    }
+    ck_assert(chidb_Btree_find(db->bt, 1, 0, &data, &size) == CHIDB_ENOTFOUND);
+
+    /* Duplicates are found in full leaves too */
+    for(int i=0; i<NKEYS; i+=97)
+        ck_assert(chidb_Btree_insertInTable(db->bt, 1, nth_key(i), (uint8_t *) "foo", 4) == CHIDB_EDUPLICATE);
+    bt_sanity_check(db->bt, 1);
+
+    chidb_Btree_close(db->bt);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_13_2)
+{
+    chidb *db = create_btree(PGTYPE_INDEX_LEAF);
+    chidb_key_t pkey;
+
+    bt_sanity_check(db->bt, 1);
+    ck_assert(btree_depth(db->bt, 1) <= 4);
+
+    for(int i=0; i<NKEYS; i++)
+    {
+        chidb_key_t key = nth_key(i);
+        ck_assert(chidb_Btree_findInIndex(db->bt, 1, key, &pkey) == CHIDB_OK);
+        ck_assert_int_eq(pkey, key + 1);
+    }
+    for(int i=0; i<NKEYS; i+=97)
+        ck_assert(chidb_Btree_insertInIndex(db->bt, 1, nth_key(i), 0) == CHIDB_EDUPLICATE);
+
+    chidb_Btree_close(db->bt);
+    free(db);
+}
+END_TEST
+
+
+/* Cursors visit every entry in order, including the ones in the internal
+ * nodes of index B-Trees, and seek to entries by key */
+static void test_cursor(uint8_t type)
+{
+    chidb *db = create_btree(type);
+    chidb_dbm_cursor_t cursor;
+    int n = 0;
+
+    chidb_dbm_init_cursor(&cursor, db, 1);
+    ck_assert(chidb_dbm_rewind(&cursor));
+    do
+    {
+        n++;
+        ck_assert_int_eq(cursor_key(&cursor), 2 * n);
+    } while (chidb_dbm_next(&cursor));
+    ck_assert_int_eq(n, NKEYS);
+    ck_assert(!chidb_dbm_next(&cursor));
+
+    for(int i=0; i<NKEYS; i+=13)
+    {
+        chidb_key_t key = nth_key(i);
+
+        ck_assert(chidb_dbm_seek(&cursor, key));
+        ck_assert_int_eq(cursor_key(&cursor), key);
+        ck_assert(!chidb_dbm_seek(&cursor, key - 1));
+
+        ck_assert(chidb_dbm_seekGe(&cursor, key - 1));
+        ck_assert_int_eq(cursor_key(&cursor), key);
+        ck_assert(chidb_dbm_seekGe(&cursor, key));
+        ck_assert_int_eq(cursor_key(&cursor), key);
+
+        if (key == 2 * NKEYS)
+        {
+            ck_assert(!chidb_dbm_seekGt(&cursor, key));
+            continue;
+        }
+        ck_assert(chidb_dbm_seekGt(&cursor, key));
+        ck_assert_int_eq(cursor_key(&cursor), key + 2);
+        ck_assert(chidb_dbm_next(&cursor) == (key + 4 <= 2 * NKEYS));
+    }
+    ck_assert(!chidb_dbm_seekGe(&cursor, 2 * NKEYS + 1));
+    ck_assert(!chidb_dbm_seekGt(&cursor, 2 * NKEYS));
+
+    chidb_dbm_free_cursor(&cursor);
+    chidb_Btree_close(db->bt);
+    free(db);
+}
+
+START_TEST (test_13_3)
+{
+    test_cursor(PGTYPE_TABLE_LEAF);
+}
+END_TEST
+
+
+START_TEST (test_13_4)
+{
+    test_cursor(PGTYPE_INDEX_LEAF);
+}
+END_TEST
+
+
+TCase* make_btree_13_tc(void)
+{
+    chilog_setloglevel(ERROR);
+    TCase *tc = tcase_create ("Searching large B-Trees");
+    tcase_add_test (tc, test_13_1);
+    tcase_add_test (tc, test_13_2);
+    tcase_add_test (tc, test_13_3);
+    tcase_add_test (tc, test_13_4);
+
+    return tc;
+}
@@ -0,0 +1,120 @@
+#include <stdlib.h>
+#include <check.h>
+#include <chidb/log.h>
+#include "check_btree.h"
+#include "libchidb/keysearch.h"
+
+#define NKEYS (5000)
+
+
+/* Every kernel finds the same position as a plain binary search */
+START_TEST (test_14_1)
+{
+    int kernels[] = {KEYSEARCH_SCALAR, KEYSEARCH_SSE2, KEYSEARCH_AVX2};
+    int default_kernel = chidb_KeySearch_getKernel();
+    uint32_t values[300];
+    int32_t *keys;
+
+    ck_assert(posix_memalign((void **) &keys, KEYSEARCH_ALIGN, chidb_KeySearch_padded(300) * sizeof(int32_t)) == 0);
+    srand(14);
+    for(uint32_t n=0; n<300; n+=n<40 ? 1 : 37)
+    {
+        /* Keys on both sides of 2^31, where signed and unsigned order differ */
+        for(uint32_t i=0; i<n; i++)
+            values[i] = (i == 0 ? 0x7FFFFF00u : values[i-1]) + 1 + rand() % 8;
+        for(size_t i=0; i<chidb_KeySearch_padded(n); i++)
+            keys[i] = chidb_KeySearch_key(i < n ? values[i] : UINT32_MAX);
+
+        for(int k=0; k<3; k++)
+        {
+            if (chidb_KeySearch_setKernel(kernels[k]) != CHIDB_OK)
+                continue;
+            ck_assert_int_eq(chidb_KeySearch_lowerBound(keys, n, 0), 0);
+            ck_assert_int_eq(chidb_KeySearch_lowerBound(keys, n, UINT32_MAX), n);
+            for(uint32_t i=0; i<n; i++)
+            {
+                ck_assert_int_eq(chidb_KeySearch_lowerBound(keys, n, values[i]), i);
+                ck_assert_int_eq(chidb_KeySearch_lowerBound(keys, n, values[i] - 1),
+                                 i > 0 && values[i-1] == values[i] - 1 ? i - 1 : i);
+                ck_assert_int_eq(chidb_KeySearch_lowerBound(keys, n, values[i] + 1), i + 1);
+            }
+        }
+    }
+
+    ck_assert(chidb_KeySearch_setKernel(default_kernel) == CHIDB_OK);
+    free(keys);
+}
+END_TEST
+
+
+static void test_keys(chidb *db, chidb_key_t first, chidb_key_t last, bool present)
+{
+    uint8_t *data;
+    uint32_t size;
+
+    for(chidb_key_t key=first; key<=last; key++)
+    {
+        int rc = chidb_Btree_find(db->bt, 1, key, &data, &size);
+        ck_assert(rc == (present ? CHIDB_OK : CHIDB_ENOTFOUND));
+        if (rc == CHIDB_OK)
+            free(data);
+    }
+}
+
+/* Decoded nodes are dropped when they are modified, and when the
+ * changes are rolled back */
+START_TEST (test_14_2)
+{
+    char *fname = create_tmp_file();
+    uint8_t record[64] = {0};
+    BTreeNode *btn;
+    chidb *db = malloc(sizeof(chidb));
+
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    chidb_Btree_initEmptyNode(db->bt, 1, PGTYPE_TABLE_LEAF);
+    chidb_Btree_begin(db->bt);
+    for(chidb_key_t key=1; key<=NKEYS; key++)
+        chidb_Btree_insertInTable(db->bt, 1, key * 2, record, sizeof(record));
+    chidb_Btree_commit(db->bt);
+
+    test_keys(db, 1, 1, false);
+    chidb_Btree_getNodeByPage(db->bt, 1, &btn);
+    ck_assert(btn->type == PGTYPE_TABLE_INTERNAL);
+    ck_assert(btn->page->decoded != NULL);
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    /* Fill in the gaps, splitting nodes that have been decoded */
+    for(chidb_key_t key=1; key<=NKEYS; key++)
+    {
+        ck_assert(chidb_Btree_insertInTable(db->bt, 1, key * 2 - 1, record, sizeof(record)) == CHIDB_OK);
+        if (key % 500 == 0)
+            test_keys(db, 1, 2 * key, true);
+    }
+    bt_sanity_check(db->bt, 1);
+
+    chidb_Btree_begin(db->bt);
+    for(chidb_key_t key=2*NKEYS+1; key<=3*NKEYS; key++)
+        chidb_Btree_insertInTable(db->bt, 1, key, record, sizeof(record));
+    test_keys(db, 1, 3 * NKEYS, true);
+    chidb_Btree_rollback(db->bt);
+
+    test_keys(db, 1, 2 * NKEYS, true);
+    test_keys(db, 2 * NKEYS + 1, 3 * NKEYS, false);
+    bt_sanity_check(db->bt, 1);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_14_tc(void)
+{
+    chilog_setloglevel(ERROR);
+    TCase *tc = tcase_create ("Decoded node keys");
+    tcase_add_test (tc, test_14_1);
+    tcase_add_test (tc, test_14_2);
+
+    return tc;
+}
@@ -0,0 +1,289 @@
+#include <stdlib.h>
+#include <check.h>
+#include <chidb/log.h>
+#include "check_btree.h"
+#include "libchidb/record.h"
+
+#define NKEYS (20000)
+
+/* Entries returned to chidb_Btree_bulkLoad: keys first, first + step, ...
+ * (n of them, going back by back steps halfway through), with a 64-byte
+ * record that starts with the key in table B-Trees, and key + 1 as the
+ * primary key in index B-Trees */
+typedef struct entries
+{
+    uint8_t type;
+    chidb_key_t first;
+    chidb_key_t step;
+    int n;
+    int next;
+    int back;
+    uint8_t record[64];
+} entries;
+
+static int next_entry(void *arg, BTreeCell *cell)
+{
+    entries *e = arg;
+    int i = e->next++;
+
+    if (i == e->n)
+        return CHIDB_DONE;
+    if (i >= e->n / 2)
+        i -= e->back;
+    cell->key = e->first + i * e->step;
+    if (e->type == PGTYPE_TABLE_LEAF)
+    {
+        memcpy(e->record, &cell->key, sizeof(cell->key));
+        cell->fields.tableLeaf.data = e->record;
+        cell->fields.tableLeaf.data_size = sizeof(e->record);
+    }
+    else
+        cell->fields.indexLeaf.keyPk = cell->key + 1;
+    return CHIDB_OK;
+}
+
+static int btree_depth(BTree *bt, npage_t npage)
+{
+    BTreeNode *btn;
+    int depth = 1;
+
+    chidb_Btree_getNodeByPage(bt, npage, &btn);
+    while (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL)
+    {
+        npage = btn->right_page;
+        chidb_Btree_freeMemNode(bt, btn);
+        chidb_Btree_getNodeByPage(bt, npage, &btn);
+        depth++;
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return depth;
+}
+
+static void test_entries(BTree *bt, npage_t nroot, uint8_t type, entries *e)
+{
+    uint8_t *data;
+    uint32_t size;
+    chidb_key_t pkey;
+
+    for(int i=0; i<e->n; i++)
+    {
+        chidb_key_t key = e->first + i * e->step;
+        if (type == PGTYPE_TABLE_LEAF)
+        {
+            ck_assert(chidb_Btree_find(bt, nroot, key, &data, &size) == CHIDB_OK);
+            ck_assert_int_eq(size, 64);
+            ck_assert(!memcmp(data, &key, sizeof(key)));
+            free(data);
+        }
+        else
+        {
+            ck_assert(chidb_Btree_findInIndex(bt, nroot, key, &pkey) == CHIDB_OK);
+            ck_assert_int_eq(pkey, key + 1);
+        }
+    }
+    bt_sanity_check(bt, nroot);
+}
+
+
+/* Bulk-loaded B-Trees have every entry, in fewer pages (and no more
+ * levels) than B-Trees built by inserting the same entries, and can be
+ * inserted into afterwards */
+static void test_bulk_load(uint8_t type)
+{
+    uint8_t fills[] = {100, BULKLOAD_INDEX_FILL, 50, 1};
+    int sizes[] = {0, 1, 2, 100, NKEYS};
+    chidb *db = malloc(sizeof(chidb));
+    uint8_t record[64] = {0};
+    npage_t nroot, n_pages;
+    int depth;
+
+    /* The B-Tree that insertions in no particular order build */
+    ck_assert(chidb_Btree_open(":memory:", db, &db->bt) == CHIDB_OK);
+    chidb_Btree_newNode(db->bt, &nroot, type);
+    n_pages = db->bt->pager->n_pages;
+    chidb_Btree_begin(db->bt);
+    for(int i=0; i<NKEYS; i++)
+    {
+        chidb_key_t key = (i * 7919) % NKEYS * 2 + 2;
+        if (type == PGTYPE_TABLE_LEAF)
+            chidb_Btree_insertInTable(db->bt, nroot, key, record, sizeof(record));
+        else
+            chidb_Btree_insertInIndex(db->bt, nroot, key, key + 1);
+    }
+    chidb_Btree_commit(db->bt);
+    n_pages = db->bt->pager->n_pages - n_pages;
+    depth = btree_depth(db->bt, nroot);
+    chidb_Btree_close(db->bt);
+
+    for(int f=0; f<4; f++)
+        for(int s=0; s<5; s++)
+        {
+            entries e = {.type = type, .first = 2, .step = 2, .n = sizes[s]};
+
+            /* In page 1 (after the file header) and in a page of its own */
+            for(int r=0; r<2; r++)
+            {
+                npage_t root = 1;
+                ck_assert(chidb_Btree_open(":memory:", db, &db->bt) == CHIDB_OK);
+                chidb_Btree_initEmptyNode(db->bt, 1, type);
+                if (r == 1)
+                    chidb_Btree_newNode(db->bt, &root, type);
+                ck_assert(chidb_Btree_bulkLoad(db->bt, root, fills[f], next_entry, &e) == CHIDB_OK);
+                test_entries(db->bt, root, type, &e);
+
+                if (sizes[s] == NKEYS && fills[f] >= 90)
+                {
+                    ck_assert(db->bt->pager->n_pages < n_pages);
+                    ck_assert(btree_depth(db->bt, root) <= depth);
+                }
+
+                /* Fill in the gaps */
+                for(int i=0; i<=sizes[s]; i+=7)
+                {
+                    if (type == PGTYPE_TABLE_LEAF)
+                        ck_assert(chidb_Btree_insertInTable(db->bt, root, 2 * i + 1, e.record, 64) == CHIDB_OK);
+                    else
+                        ck_assert(chidb_Btree_insertInIndex(db->bt, root, 2 * i + 1, 2 * i + 2) == CHIDB_OK);
+                }
+                test_entries(db->bt, root, type, &e);
+                e.next = 0;
+
+                chidb_Btree_close(db->bt);
+            }
+        }
+
+    free(db);
+}
+
+START_TEST (test_15_1)
+{
+    test_bulk_load(PGTYPE_TABLE_LEAF);
+}
+END_TEST
+
+
+START_TEST (test_15_2)
+{
+    test_bulk_load(PGTYPE_INDEX_LEAF);
+}
+END_TEST
+
+
+/* Loads that fail leave the B-Tree empty and the file as it was */
+START_TEST (test_15_3)
+{
+    char *fname = create_tmp_file();
+    chidb *db = malloc(sizeof(chidb));
+    entries e = {.type = PGTYPE_INDEX_LEAF, .first = 1, .step = 1, .n = NKEYS};
+    npage_t nroot, n_pages;
+
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    chidb_Btree_initEmptyNode(db->bt, 1, PGTYPE_INDEX_LEAF);
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+    n_pages = db->bt->pager->n_pages;
+
+    ck_assert(chidb_Btree_bulkLoad(db->bt, nroot, 0, next_entry, &e) == CHIDB_EMISUSE);
+    ck_assert(chidb_Btree_bulkLoad(db->bt, nroot, 101, next_entry, &e) == CHIDB_EMISUSE);
+
+    /* Keys that repeat, and keys that go down, once several levels have
+     * been written */
+    e.back = 1;
+    ck_assert(chidb_Btree_bulkLoad(db->bt, nroot, 100, next_entry, &e) == CHIDB_EDUPLICATE);
+    ck_assert_int_eq(db->bt->pager->n_pages, n_pages);
+    e.back = 2;
+    e.next = 0;
+    ck_assert(chidb_Btree_bulkLoad(db->bt, nroot, 100, next_entry, &e) == CHIDB_EMISUSE);
+    ck_assert_int_eq(db->bt->pager->n_pages, n_pages);
+
+    /* Only empty B-Trees can be loaded */
+    e.back = 0;
+    e.next = 0;
+    ck_assert(chidb_Btree_bulkLoad(db->bt, nroot, 100, next_entry, &e) == CHIDB_OK);
+    e.next = 0;
+    ck_assert(chidb_Btree_bulkLoad(db->bt, nroot, 100, next_entry, &e) == CHIDB_EMISUSE);
+    ck_assert(chidb_Btree_bulkLoad(db->bt, 1, 100, next_entry, &e) == CHIDB_OK);
+    n_pages = db->bt->pager->n_pages;
+    e.next = 0;
+    ck_assert(chidb_Btree_bulkLoad(db->bt, 1, 100, next_entry, &e) == CHIDB_EMISUSE);
+    ck_assert_int_eq(db->bt->pager->n_pages, n_pages);
+
+    test_entries(db->bt, nroot, PGTYPE_INDEX_LEAF, &e);
+    test_entries(db->bt, 1, PGTYPE_INDEX_LEAF, &e);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Indexes built from a table have an entry for each row that has a value */
+START_TEST (test_15_4)
+{
+    chidb *db = malloc(sizeof(chidb));
+    npage_t ntable, nindex, ntext;
+    DBRecord *dbr;
+    uint8_t *record;
+    chidb_key_t pkey;
+
+    ck_assert(chidb_Btree_open(":memory:", db, &db->bt) == CHIDB_OK);
+    chidb_Btree_newNode(db->bt, &ntable, PGTYPE_TABLE_LEAF);
+    chidb_Btree_begin(db->bt);
+    for(chidb_key_t key=1; key<=NKEYS; key++)
+    {
+        /* Values in reverse order, of every integer size, and some NULL */
+        int32_t value = NKEYS - key;
+        if (key % 10 == 0)
+            chidb_DBRecord_create(&dbr, "|s|0|", "foo");
+        else if (value < 100)
+            chidb_DBRecord_create(&dbr, "|s|i1|", "foo", value);
+        else if (value < 10000)
+            chidb_DBRecord_create(&dbr, "|s|i2|", "foo", value);
+        else
+            chidb_DBRecord_create(&dbr, "|s|i4|", "foo", value);
+        chidb_DBRecord_pack(dbr, &record);
+        ck_assert(chidb_Btree_insertInTable(db->bt, ntable, key, record, dbr->packed_len) == CHIDB_OK);
+        chidb_DBRecord_destroy(dbr);
+        free(record);
+    }
+    chidb_Btree_commit(db->bt);
+
+    chidb_Btree_newNode(db->bt, &nindex, PGTYPE_INDEX_LEAF);
+    ck_assert(chidb_Btree_buildIndex(db->bt, ntable, 1, nindex) == CHIDB_OK);
+    bt_sanity_check(db->bt, nindex);
+    for(chidb_key_t key=1; key<=NKEYS; key++)
+    {
+        int rc = chidb_Btree_findInIndex(db->bt, nindex, NKEYS - key, &pkey);
+        if (key % 10 == 0)
+            ck_assert(rc == CHIDB_ENOTFOUND);
+        else
+        {
+            ck_assert(rc == CHIDB_OK);
+            ck_assert_int_eq(pkey, key);
+        }
+    }
+
+    /* Only integer columns can be indexed, and only into empty indexes */
+    chidb_Btree_newNode(db->bt, &ntext, PGTYPE_INDEX_LEAF);
+    ck_assert(chidb_Btree_buildIndex(db->bt, ntable, 0, ntext) == CHIDB_EMISMATCH);
+    ck_assert(chidb_Btree_buildIndex(db->bt, ntable, 1, nindex) == CHIDB_EMISUSE);
+    ck_assert(chidb_Btree_buildIndex(db->bt, ntable, 2, ntext) == CHIDB_EMISUSE);
+
+    chidb_Btree_close(db->bt);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_15_tc(void)
+{
+    chilog_setloglevel(ERROR);
+    TCase *tc = tcase_create ("Bulk loading");
+    tcase_add_test (tc, test_15_1);
+    tcase_add_test (tc, test_15_2);
+    tcase_add_test (tc, test_15_3);
+    tcase_add_test (tc, test_15_4);
+
+    return tc;
+}
@@ -0,0 +1,207 @@
+#include <stdlib.h>
+#include <check.h>
+#include <chidb/log.h>
+#include "check_btree.h"
+
+#define NKEYS (20000)
+
+/* Adds up the bytes used by the cells of the leaves of a B-Tree, and the
+ * bytes available to them */
+static void leaf_usage(BTree *bt, npage_t npage, size_t *used, size_t *total)
+{
+    BTreeNode *btn;
+
+    chidb_Btree_getNodeByPage(bt, npage, &btn);
+    if (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL)
+    {
+        for(ncell_t i=0; i<=btn->n_cells; i++)
+            leaf_usage(bt, chidb_Btree_getChildPage(btn, i), used, total);
+    }
+    else
+    {
+        *used += bt->usable_size - btn->cells_offset + 2 * btn->n_cells;
+        *total += bt->usable_size - LEAFPG_CELLSOFFSET_OFFSET;
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+}
+
+static void insert(chidb *db, npage_t nroot, uint8_t type, chidb_key_t key, int expected)
+{
+    uint8_t record[64] = {0};
+
+    memcpy(record, &key, sizeof(key));
+    if (type == PGTYPE_TABLE_LEAF)
+        ck_assert(chidb_Btree_insertInTable(db->bt, nroot, key, record, sizeof(record)) == expected);
+    else
+        ck_assert(chidb_Btree_insertInIndex(db->bt, nroot, key, key + 1) == expected);
+}
+
+static void test_keys(chidb *db, npage_t nroot, uint8_t type, chidb_key_t first, chidb_key_t last)
+{
+    uint8_t *data;
+    uint32_t size;
+    chidb_key_t pkey;
+
+    for(chidb_key_t key=first; key<=last; key++)
+    {
+        if (type == PGTYPE_TABLE_LEAF)
+        {
+            ck_assert(chidb_Btree_find(db->bt, nroot, key, &data, &size) == CHIDB_OK);
+            ck_assert(!memcmp(data, &key, sizeof(key)));
+            free(data);
+        }
+        else
+        {
+            ck_assert(chidb_Btree_findInIndex(db->bt, nroot, key, &pkey) == CHIDB_OK);
+            ck_assert_int_eq(pkey, key + 1);
+        }
+    }
+    bt_sanity_check(db->bt, nroot);
+}
+
+
+/* B-Trees built by appending keys have nearly full leaves, and the
+ * appends go straight into the rightmost leaf */
+static void test_appends(uint8_t type)
+{
+    chidb *db = malloc(sizeof(chidb));
+    size_t used = 0, total = 0;
+    uint64_t splits;
+    npage_t nroot;
+
+    ck_assert(chidb_Btree_open(":memory:", db, &db->bt) == CHIDB_OK);
+    chidb_Btree_newNode(db->bt, &nroot, type);
+    chidb_Btree_begin(db->bt);
+    for(chidb_key_t key=1; key<=NKEYS; key++)
+    {
+        insert(db, nroot, type, key, CHIDB_OK);
+        ck_assert_int_eq(db->bt->appends[nroot % BTREE_APPEND_SLOTS].nroot, nroot);
+        ck_assert_int_eq(db->bt->appends[nroot % BTREE_APPEND_SLOTS].max_key, key);
+    }
+    chidb_Btree_commit(db->bt);
+    test_keys(db, nroot, type, 1, NKEYS);
+
+    /* Half-full leaves would be about 50% used */
+    leaf_usage(db->bt, nroot, &used, &total);
+    ck_assert(used * 100 >= total * (BTREE_APPEND_SPLIT - 10));
+
+    /* Keys that are not larger than every other one are not appended */
+    insert(db, nroot, type, NKEYS, CHIDB_EDUPLICATE);
+    insert(db, nroot, type, 1, CHIDB_EDUPLICATE);
+    splits = db->bt->pager->stats.node_splits;
+    for(chidb_key_t key=NKEYS + 2; key<=2 * NKEYS; key+=2)
+        insert(db, nroot, type, key, CHIDB_OK);
+    for(chidb_key_t key=NKEYS + 1; key<=2 * NKEYS; key+=2)
+        insert(db, nroot, type, key, CHIDB_OK);
+    ck_assert(db->bt->pager->stats.node_splits > splits);
+    test_keys(db, nroot, type, 1, 2 * NKEYS);
+
+    chidb_Btree_close(db->bt);
+    free(db);
+}
+
+START_TEST (test_16_1)
+{
+    test_appends(PGTYPE_TABLE_LEAF);
+}
+END_TEST
+
+
+START_TEST (test_16_2)
+{
+    test_appends(PGTYPE_INDEX_LEAF);
+}
+END_TEST
+
+
+/* The rightmost leaf is not trusted once pages have changed behind its
+ * back: rollbacks, B-Trees that share a slot, or pages that are reused */
+START_TEST (test_16_3)
+{
+    chidb *db = malloc(sizeof(chidb));
+    npage_t nroot[3];
+
+    ck_assert(chidb_Btree_open(":memory:", db, &db->bt) == CHIDB_OK);
+    for(int i=0; i<3; i++)
+    {
+        chidb_Btree_newNode(db->bt, &nroot[i], PGTYPE_TABLE_LEAF);
+        if (i == 1) /* nroot[2] shares the slot of nroot[1] */
+            for(int j=0; j<BTREE_APPEND_SLOTS-1; j++)
+            {
+                npage_t npage;
+                chidb_Btree_newNode(db->bt, &npage, PGTYPE_TABLE_LEAF);
+            }
+    }
+    ck_assert_int_eq(nroot[1] % BTREE_APPEND_SLOTS, nroot[2] % BTREE_APPEND_SLOTS);
+
+    for(chidb_key_t key=1; key<=NKEYS; key++)
+        for(int i=0; i<3; i++)
+            insert(db, nroot[i], PGTYPE_TABLE_LEAF, key, CHIDB_OK);
+
+    chidb_Btree_begin(db->bt);
+    for(chidb_key_t key=NKEYS + 1; key<=2 * NKEYS; key++)
+        insert(db, nroot[0], PGTYPE_TABLE_LEAF, key, CHIDB_OK);
+    chidb_Btree_rollback(db->bt);
+    for(chidb_key_t key=2 * NKEYS + 1; key<=2 * NKEYS + 100; key++)
+        insert(db, nroot[0], PGTYPE_TABLE_LEAF, key, CHIDB_OK);
+    for(chidb_key_t key=NKEYS + 1; key<=NKEYS + 100; key++)
+        insert(db, nroot[0], PGTYPE_TABLE_LEAF, key, CHIDB_OK);
+    test_keys(db, nroot[0], PGTYPE_TABLE_LEAF, 1, NKEYS + 100);
+    test_keys(db, nroot[0], PGTYPE_TABLE_LEAF, 2 * NKEYS + 1, 2 * NKEYS + 100);
+
+    /* A B-Tree that is emptied and filled again */
+    chidb_Btree_initEmptyNode(db->bt, nroot[1], PGTYPE_TABLE_LEAF);
+    insert(db, nroot[1], PGTYPE_TABLE_LEAF, NKEYS + 1, CHIDB_OK);
+    insert(db, nroot[1], PGTYPE_TABLE_LEAF, NKEYS + 2, CHIDB_OK);
+    for(chidb_key_t key=1; key<=NKEYS; key++)
+        insert(db, nroot[1], PGTYPE_TABLE_LEAF, key, CHIDB_OK);
+    test_keys(db, nroot[1], PGTYPE_TABLE_LEAF, 1, NKEYS + 2);
+    test_keys(db, nroot[2], PGTYPE_TABLE_LEAF, 1, NKEYS);
+
+    chidb_Btree_close(db->bt);
+    free(db);
+}
+END_TEST
+
+
+/* Appends made by another connection are seen */
+START_TEST (test_16_4)
+{
+    char *fname = create_tmp_file();
+    chidb *db1 = malloc(sizeof(chidb)), *db2 = malloc(sizeof(chidb));
+
+    ck_assert(chidb_Btree_open(fname, db1, &db1->bt) == CHIDB_OK);
+    chidb_Btree_close(db1->bt);
+    ck_assert(chidb_Btree_openWithFlags(fname, db1, &db1->bt, CHIDB_OPEN_WAL) == CHIDB_OK);
+    ck_assert(chidb_Btree_openWithFlags(fname, db2, &db2->bt, CHIDB_OPEN_WAL) == CHIDB_OK);
+
+    for(chidb_key_t key=1; key<=NKEYS; key+=100)
+    {
+        for(chidb_key_t k=key; k<key + 50; k++)
+            insert(db1, 1, PGTYPE_TABLE_LEAF, k, CHIDB_OK);
+        for(chidb_key_t k=key + 50; k<key + 100; k++)
+            insert(db2, 1, PGTYPE_TABLE_LEAF, k, CHIDB_OK);
+    }
+    test_keys(db1, 1, PGTYPE_TABLE_LEAF, 1, NKEYS);
+    test_keys(db2, 1, PGTYPE_TABLE_LEAF, 1, NKEYS);
+
+    chidb_Btree_close(db2->bt);
+    chidb_Btree_close(db1->bt);
+    delete_tmp_file(fname);
+    free(db1);
+    free(db2);
+}
+END_TEST
+
+
+TCase* make_btree_16_tc(void)
+{
+    chilog_setloglevel(ERROR);
+    TCase *tc = tcase_create ("Appends");
+    tcase_add_test (tc, test_16_1);
+    tcase_add_test (tc, test_16_2);
+    tcase_add_test (tc, test_16_3);
+    tcase_add_test (tc, test_16_4);
+
+    return tc;
+}
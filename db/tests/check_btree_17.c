@@ -0,0 +1,289 @@
+#include <stdlib.h>
+#include <check.h>
+#include <chidb/log.h>
+#include "check_btree.h"
+#include "libchidb/dbm-cursor.h"
+#include "libchidb/record.h"
+
+#define NKEYS (20000)
+
+/* The i-th key inserted: the even numbers from 2 to 2*NKEYS, in an order
+ * that is neither ascending nor descending */
+static chidb_key_t nth_key(int i)
+{
+    return ((i * 7919) % NKEYS) * 2 + 2;
+}
+
+static chidb_key_t cursor_key(chidb_dbm_cursor_t *cursor)
+{
+    cell_cursor *curr = (cell_cursor *) cursor->path.tail->val;
+    return chidb_Btree_getCellKey(curr->btn, curr->index);
+}
+
+static void insert(BTree *bt, npage_t nroot, uint8_t type, chidb_key_t key)
+{
+    uint8_t record[64] = {0};
+
+    memcpy(record, &key, sizeof(key));
+    if (type == PGTYPE_TABLE_LEAF)
+        ck_assert(chidb_Btree_insertInTable(bt, nroot, key, record, sizeof(record)) == CHIDB_OK);
+    else
+        ck_assert(chidb_Btree_insertInIndex(bt, nroot, key, key + 1) == CHIDB_OK);
+}
+
+/* Collects the leaves of a table B-Tree in key order */
+static void table_leaves(BTree *bt, npage_t npage, npage_t *leaves, int *nleaves)
+{
+    BTreeNode *btn;
+
+    ck_assert(chidb_Btree_getNodeByPage(bt, npage, &btn) == CHIDB_OK);
+    if (btn->type == PGTYPE_TABLE_LEAF)
+        leaves[(*nleaves)++] = npage;
+    else
+        for(ncell_t i=0; i<=btn->n_cells; i++)
+            table_leaves(bt, chidb_Btree_getChildPage(btn, i), leaves, nleaves);
+    chidb_Btree_freeMemNode(bt, btn);
+}
+
+/* The leaves of a table B-Tree are linked in key order, and following
+ * the links visits nkeys keys in ascending order */
+static void check_links(BTree *bt, npage_t nroot, int nkeys)
+{
+    npage_t *leaves = malloc(NKEYS * sizeof(npage_t));
+    int nleaves = 0, n = 0;
+    chidb_key_t last = 0;
+    BTreeNode *btn;
+
+    bt_sanity_check(bt, nroot);
+    table_leaves(bt, nroot, leaves, &nleaves);
+    for(int i=0; i<nleaves; i++)
+    {
+        ck_assert(chidb_Btree_getNodeByPage(bt, leaves[i], &btn) == CHIDB_OK);
+        ck_assert_int_eq(btn->prev_leaf, i > 0 ? leaves[i-1] : 0);
+        ck_assert_int_eq(btn->next_leaf, i < nleaves - 1 ? leaves[i+1] : 0);
+        for(ncell_t j=0; j<btn->n_cells; j++, n++)
+        {
+            ck_assert(chidb_Btree_getCellKey(btn, j) > last);
+            last = chidb_Btree_getCellKey(btn, j);
+        }
+        chidb_Btree_freeMemNode(bt, btn);
+    }
+    ck_assert_int_eq(n, nkeys);
+    free(leaves);
+}
+
+/* Builds a B-Tree of the given type in a new page, and returns its root
+ * in nroot. Files without links have no reserved bytes in their header,
+ * like the files of older versions of chidb. */
+static chidb *create_btree(const char *fname, uint8_t type, bool linked, npage_t *nroot)
+{
+    chidb *db = malloc(sizeof(chidb));
+    MemPage *page;
+
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    ck_assert(db->bt->linked);
+    if (!linked)
+    {
+        chidb_Pager_readPage(db->bt->pager, 1, &page);
+        page->data[HEADER_RESERVED_OFFSET] = 0;
+        chidb_Pager_writePage(db->bt->pager, page);
+        chidb_Pager_releaseMemPage(db->bt->pager, page);
+        chidb_Btree_close(db->bt);
+        ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+        ck_assert(!db->bt->linked);
+        ck_assert_int_eq(db->bt->usable_size, db->bt->pager->page_size);
+    }
+    chidb_Btree_newNode(db->bt, nroot, type);
+
+    chidb_Btree_begin(db->bt);
+    for(int i=0; i<NKEYS; i++)
+        insert(db->bt, *nroot, type, nth_key(i));
+    chidb_Btree_commit(db->bt);
+
+    return db;
+}
+
+
+/* Cursors visit every entry backwards too, and seek to the entries with
+ * the largest key less than (or equal to) a given key */
+static void test_reverse(uint8_t type, bool linked)
+{
+    char *fname = create_tmp_file();
+    npage_t nroot;
+    chidb *db = create_btree(fname, type, linked, &nroot);
+    chidb_dbm_cursor_t cursor;
+    int n = 0;
+
+    if (type == PGTYPE_TABLE_LEAF && linked)
+        check_links(db->bt, nroot, NKEYS);
+
+    chidb_dbm_init_cursor(&cursor, db, nroot);
+    ck_assert(chidb_dbm_seekLe(&cursor, 2 * NKEYS + 5));
+    do
+    {
+        ck_assert_int_eq(cursor_key(&cursor), 2 * (NKEYS - n));
+        /* Cursors on linked leaves only keep the leaf */
+        if (type == PGTYPE_TABLE_LEAF)
+            ck_assert((cursor.path.head == cursor.path.tail) == linked);
+        n++;
+    } while (chidb_dbm_prev(&cursor));
+    ck_assert_int_eq(n, NKEYS);
+    ck_assert(!chidb_dbm_prev(&cursor));
+    ck_assert_int_eq(cursor_key(&cursor), 2);
+    ck_assert(chidb_dbm_next(&cursor));
+    ck_assert_int_eq(cursor_key(&cursor), 4);
+
+    /* Back from past the last row */
+    ck_assert(chidb_dbm_rewind(&cursor));
+    while (chidb_dbm_next(&cursor));
+    ck_assert(chidb_dbm_prev(&cursor));
+    ck_assert_int_eq(cursor_key(&cursor), 2 * NKEYS);
+
+    for(int i=0; i<NKEYS; i+=13)
+    {
+        chidb_key_t key = nth_key(i);
+
+        ck_assert(chidb_dbm_seekLe(&cursor, key));
+        ck_assert_int_eq(cursor_key(&cursor), key);
+        ck_assert(chidb_dbm_seekLe(&cursor, key + 1));
+        ck_assert_int_eq(cursor_key(&cursor), key);
+
+        /* Back and forth across leaf boundaries */
+        for(int j=0; j<20 && chidb_dbm_prev(&cursor); j++)
+            ck_assert_int_eq(cursor_key(&cursor), key - 2 * (j + 1));
+        ck_assert(chidb_dbm_seekGe(&cursor, key));
+        for(int j=0; j<20 && chidb_dbm_next(&cursor); j++)
+            ck_assert_int_eq(cursor_key(&cursor), key + 2 * (j + 1));
+
+        if (key == 2)
+        {
+            ck_assert(!chidb_dbm_seekLt(&cursor, key));
+            continue;
+        }
+        ck_assert(chidb_dbm_seekLt(&cursor, key));
+        ck_assert_int_eq(cursor_key(&cursor), key - 2);
+        ck_assert(chidb_dbm_prev(&cursor) == (key - 4 >= 2));
+    }
+    ck_assert(!chidb_dbm_seekLe(&cursor, 1));
+    ck_assert(!chidb_dbm_seekLt(&cursor, 2));
+    ck_assert(chidb_dbm_seekLt(&cursor, 2 * NKEYS + 1));
+    ck_assert_int_eq(cursor_key(&cursor), 2 * NKEYS);
+
+    chidb_dbm_free_cursor(&cursor);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+
+START_TEST (test_17_1)
+{
+    test_reverse(PGTYPE_TABLE_LEAF, true);
+}
+END_TEST
+
+
+START_TEST (test_17_2)
+{
+    test_reverse(PGTYPE_INDEX_LEAF, true);
+    test_reverse(PGTYPE_TABLE_LEAF, false);
+}
+END_TEST
+
+
+static int next_entry(void *arg, BTreeCell *cell)
+{
+    int *next = arg;
+    static uint8_t record[64];
+
+    if (*next == NKEYS)
+        return CHIDB_DONE;
+    cell->key = 2 * ++(*next);
+    memcpy(record, &cell->key, sizeof(cell->key));
+    cell->fields.tableLeaf.data = record;
+    cell->fields.tableLeaf.data_size = sizeof(record);
+    return CHIDB_OK;
+}
+
+static void add_table(BTree *bt, chidb_key_t key, npage_t nroot)
+{
+    DBRecord *dbr;
+    uint8_t *record;
+
+    chidb_DBRecord_create(&dbr, "|s|s|s|i4|s|", "table", "t", "t", nroot, "CREATE TABLE t(a)");
+    chidb_DBRecord_pack(dbr, &record);
+    ck_assert(chidb_Btree_insertInTable(bt, 1, key, record, dbr->packed_len) == CHIDB_OK);
+    chidb_DBRecord_destroy(dbr);
+    free(record);
+}
+
+static npage_t table_root(BTree *bt, chidb_key_t key)
+{
+    uint8_t *data;
+    uint32_t size;
+    DBRecord *dbr;
+    int32_t root;
+
+    ck_assert(chidb_Btree_find(bt, 1, key, &data, &size) == CHIDB_OK);
+    chidb_DBRecord_unpack(&dbr, data);
+    chidb_DBRecord_getInt32(dbr, 3, &root);
+    chidb_DBRecord_destroy(dbr);
+    free(data);
+
+    return root;
+}
+
+/* Leaves stay linked when they are bulk loaded, and when they are moved
+ * around by a vacuum */
+START_TEST (test_17_3)
+{
+    char *fname = create_tmp_file();
+    chidb *db = malloc(sizeof(chidb));
+    npage_t nroot[2], spacers[50];
+    int next = 0;
+
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    for(int i=0; i<50; i++)
+        chidb_Btree_newNode(db->bt, &spacers[i], PGTYPE_TABLE_LEAF);
+    for(int t=0; t<2; t++)
+    {
+        chidb_Btree_newNode(db->bt, &nroot[t], PGTYPE_TABLE_LEAF);
+        add_table(db->bt, t + 1, nroot[t]);
+    }
+    chidb_Btree_begin(db->bt);
+    for(int i=0; i<NKEYS; i++)
+        insert(db->bt, nroot[0], PGTYPE_TABLE_LEAF, nth_key(i));
+    chidb_Btree_commit(db->bt);
+    ck_assert(chidb_Btree_bulkLoad(db->bt, nroot[1], 90, next_entry, &next) == CHIDB_OK);
+    check_links(db->bt, nroot[0], NKEYS);
+    check_links(db->bt, nroot[1], NKEYS);
+
+    /* The pages at the end of the file are moved into the free ones */
+    for(int i=0; i<50; i++)
+        chidb_Btree_freePage(db->bt, spacers[i]);
+    ck_assert(chidb_Btree_incrementalVacuum(db->bt, 0) == CHIDB_OK);
+    for(int t=0; t<2; t++)
+        check_links(db->bt, table_root(db->bt, t + 1), NKEYS);
+
+    ck_assert(chidb_Btree_vacuum(db->bt) == CHIDB_OK);
+    chidb_Btree_close(db->bt);
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    for(int t=0; t<2; t++)
+        check_links(db->bt, table_root(db->bt, t + 1), NKEYS);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_17_tc(void)
+{
+    chilog_setloglevel(ERROR);
+    TCase *tc = tcase_create ("Linked leaves");
+    tcase_add_test (tc, test_17_1);
+    tcase_add_test (tc, test_17_2);
+    tcase_add_test (tc, test_17_3);
+
+    return tc;
+}
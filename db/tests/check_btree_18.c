@@ -0,0 +1,236 @@
+#include <stdlib.h>
+#include <check.h>
+#include <chidb/log.h>
+#include "check_btree.h"
+
+#define NKEYS (20000)
+
+/* The i-th key inserted (and deleted): the numbers from 1 to NKEYS, in an
+ * order that is neither ascending nor descending */
+static chidb_key_t nth_key(int i, int step)
+{
+    return (i * step) % NKEYS + 1;
+}
+
+static void insert(BTree *bt, npage_t nroot, uint8_t type, chidb_key_t key)
+{
+    uint8_t record[64] = {0};
+
+    memcpy(record, &key, sizeof(key));
+    if (type == PGTYPE_TABLE_LEAF)
+        ck_assert(chidb_Btree_insertInTable(bt, nroot, key, record, sizeof(record)) == CHIDB_OK);
+    else
+        ck_assert(chidb_Btree_insertInIndex(bt, nroot, key, key + 1) == CHIDB_OK);
+}
+
+static void test_key(BTree *bt, npage_t nroot, uint8_t type, chidb_key_t key, bool present)
+{
+    uint8_t *data;
+    uint32_t size;
+    chidb_key_t pkey;
+
+    if (type == PGTYPE_TABLE_LEAF)
+    {
+        int rc = chidb_Btree_find(bt, nroot, key, &data, &size);
+        ck_assert(rc == (present ? CHIDB_OK : CHIDB_ENOTFOUND));
+        if (rc == CHIDB_OK)
+        {
+            ck_assert(!memcmp(data, &key, sizeof(key)));
+            free(data);
+        }
+    }
+    else
+    {
+        int rc = chidb_Btree_findInIndex(bt, nroot, key, &pkey);
+        ck_assert(rc == (present ? CHIDB_OK : CHIDB_ENOTFOUND));
+        if (rc == CHIDB_OK)
+            ck_assert_int_eq(pkey, key + 1);
+    }
+}
+
+/* Adds up the bytes used by the cells of the leaves of a B-Tree, and the
+ * bytes available to them, and checks the links between table leaves */
+static void leaf_usage(BTree *bt, npage_t npage, size_t *used, size_t *total, npage_t *prev)
+{
+    BTreeNode *btn;
+
+    ck_assert(chidb_Btree_getNodeByPage(bt, npage, &btn) == CHIDB_OK);
+    if (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL)
+    {
+        for(ncell_t i=0; i<=btn->n_cells; i++)
+            leaf_usage(bt, chidb_Btree_getChildPage(btn, i), used, total, prev);
+    }
+    else
+    {
+        *used += bt->usable_size - btn->cells_offset + 2 * btn->n_cells;
+        *total += bt->usable_size - LEAFPG_CELLSOFFSET_OFFSET;
+        ck_assert_int_eq(btn->prev_leaf, *prev);
+        if (*prev != 0)
+        {
+            BTreeNode *prev_btn;
+            ck_assert(chidb_Btree_getNodeByPage(bt, *prev, &prev_btn) == CHIDB_OK);
+            ck_assert_int_eq(prev_btn->next_leaf, npage);
+            chidb_Btree_freeMemNode(bt, prev_btn);
+        }
+        if (btn->type == PGTYPE_TABLE_LEAF)
+            *prev = npage;
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+}
+
+/* The leaves are at least min_fill percent full on average */
+static void check_fill(BTree *bt, npage_t nroot, uint8_t min_fill)
+{
+    size_t used = 0, total = 0;
+    npage_t prev = 0;
+
+    bt_sanity_check(bt, nroot);
+    leaf_usage(bt, nroot, &used, &total, &prev);
+    ck_assert(used * 100 >= total * min_fill);
+}
+
+
+/* Entries are deleted in any order, and the rest are still found. The
+ * leaves are kept at least min_fill full on average, the pages that are
+ * emptied are freed, and reused by later insertions. */
+static void test_delete(uint8_t type)
+{
+    chidb *db = malloc(sizeof(chidb));
+    npage_t nroot, n_pages;
+    uint32_t nfree;
+
+    ck_assert(chidb_Btree_open(":memory:", db, &db->bt) == CHIDB_OK);
+    chidb_Btree_newNode(db->bt, &nroot, type);
+    chidb_Btree_begin(db->bt);
+    for(int i=0; i<NKEYS; i++)
+        insert(db->bt, nroot, type, nth_key(i, 7919));
+    chidb_Btree_commit(db->bt);
+    n_pages = db->bt->pager->n_pages;
+
+    /* Three quarters of them, checking the rest every so often */
+    for(int i=0; i<NKEYS * 3 / 4; i++)
+    {
+        ck_assert(chidb_Btree_delete(db->bt, nroot, nth_key(i, 4999)) == CHIDB_OK);
+        if (i % 5000 == 0)
+        {
+            for(int j=0; j<NKEYS; j++)
+                test_key(db->bt, nroot, type, nth_key(j, 4999), j > i);
+            check_fill(db->bt, nroot, BTREE_MIN_FILL);
+        }
+    }
+    ck_assert(db->bt->pager->stats.node_merges > 0);
+    check_fill(db->bt, nroot, BTREE_MIN_FILL);
+    ck_assert(chidb_Btree_getFreelistCount(db->bt, &nfree) == CHIDB_OK);
+    ck_assert(nfree > (n_pages - 2) / 2);
+
+    /* Deleted entries are not found, and can be inserted again */
+    ck_assert(chidb_Btree_delete(db->bt, nroot, nth_key(0, 4999)) == CHIDB_ENOTFOUND);
+    ck_assert(chidb_Btree_delete(db->bt, nroot, NKEYS + 1) == CHIDB_ENOTFOUND);
+    for(int i=0; i<NKEYS * 3 / 4; i+=2)
+        insert(db->bt, nroot, type, nth_key(i, 4999));
+    for(int i=0; i<NKEYS; i++)
+        test_key(db->bt, nroot, type, nth_key(i, 4999), i % 2 == 0 || i >= NKEYS * 3 / 4);
+    ck_assert_int_eq(db->bt->pager->n_pages, n_pages);
+    check_fill(db->bt, nroot, BTREE_MIN_FILL);
+
+    /* Deleting everything leaves an empty leaf, and frees every other page */
+    for(int i=0; i<NKEYS; i++)
+        if (i % 2 == 0 || i >= NKEYS * 3 / 4)
+            ck_assert(chidb_Btree_delete(db->bt, nroot, nth_key(i, 4999)) == CHIDB_OK);
+    ck_assert(chidb_Btree_getFreelistCount(db->bt, &nfree) == CHIDB_OK);
+    ck_assert_int_eq(nfree, n_pages - 2);
+    check_fill(db->bt, nroot, 0);
+    for(int i=0; i<NKEYS; i++)
+        test_key(db->bt, nroot, type, i + 1, false);
+
+    chidb_Btree_close(db->bt);
+    free(db);
+}
+
+START_TEST (test_18_1)
+{
+    test_delete(PGTYPE_TABLE_LEAF);
+}
+END_TEST
+
+
+START_TEST (test_18_2)
+{
+    test_delete(PGTYPE_INDEX_LEAF);
+}
+END_TEST
+
+
+/* Lower thresholds leave sparser B-Trees behind, and deletions that are
+ * rolled back leave the B-Tree as it was. Page 1 keeps the file header
+ * when its B-Tree gets shorter. */
+START_TEST (test_18_3)
+{
+    char *fname = create_tmp_file();
+    chidb *db = malloc(sizeof(chidb));
+    npage_t nroot[2];
+    uint32_t nfree[2], before;
+
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    ck_assert_int_eq(db->bt->min_fill, BTREE_MIN_FILL);
+    ck_assert(chidb_Btree_setMinFill(db->bt, 51) == CHIDB_EMISUSE);
+    ck_assert_int_eq(db->bt->min_fill, BTREE_MIN_FILL);
+    for(int t=0; t<2; t++)
+    {
+        chidb_Btree_newNode(db->bt, &nroot[t], PGTYPE_TABLE_LEAF);
+        chidb_Btree_begin(db->bt);
+        for(int i=0; i<NKEYS; i++)
+            insert(db->bt, nroot[t], PGTYPE_TABLE_LEAF, nth_key(i, 7919));
+        chidb_Btree_commit(db->bt);
+    }
+    for(int t=0; t<2; t++)
+    {
+        ck_assert(chidb_Btree_setMinFill(db->bt, t == 0 ? 0 : 50) == CHIDB_OK);
+        chidb_Btree_getFreelistCount(db->bt, &before);
+        for(int i=0; i<NKEYS; i++)
+            if (i % 4 != 0)
+                ck_assert(chidb_Btree_delete(db->bt, nroot[t], nth_key(i, 4999)) == CHIDB_OK);
+        check_fill(db->bt, nroot[t], t == 0 ? 0 : 45);
+        chidb_Btree_getFreelistCount(db->bt, &nfree[t]);
+        nfree[t] -= before;
+    }
+    ck_assert(nfree[1] > 2 * nfree[0]);
+
+    chidb_Btree_begin(db->bt);
+    for(int i=0; i<NKEYS; i+=4)
+        ck_assert(chidb_Btree_delete(db->bt, nroot[1], nth_key(i, 4999)) == CHIDB_OK);
+    chidb_Btree_rollback(db->bt);
+    for(int i=0; i<NKEYS; i++)
+        test_key(db->bt, nroot[1], PGTYPE_TABLE_LEAF, nth_key(i, 4999), i % 4 == 0);
+    check_fill(db->bt, nroot[1], 45);
+
+    /* The B-Tree in page 1 */
+    for(int i=0; i<NKEYS; i++)
+        insert(db->bt, 1, PGTYPE_TABLE_LEAF, nth_key(i, 7919));
+    for(int i=0; i<NKEYS; i++)
+        ck_assert(chidb_Btree_delete(db->bt, 1, nth_key(i, 4999)) == CHIDB_OK);
+    check_fill(db->bt, 1, 0);
+    chidb_Btree_close(db->bt);
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    for(int i=0; i<100; i++)
+        insert(db->bt, 1, PGTYPE_TABLE_LEAF, i + 1);
+    for(int i=0; i<100; i++)
+        test_key(db->bt, 1, PGTYPE_TABLE_LEAF, i + 1, true);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_18_tc(void)
+{
+    chilog_setloglevel(ERROR);
+    TCase *tc = tcase_create ("Deletion");
+    tcase_add_test (tc, test_18_1);
+    tcase_add_test (tc, test_18_2);
+    tcase_add_test (tc, test_18_3);
+
+    return tc;
+}
@@ -0,0 +1,228 @@
+#include <stdlib.h>
+#include <check.h>
+#include <chidb/log.h>
+#include "check_btree.h"
+
+#define NKEYS (20000)
+
+static void insert(BTree *bt, npage_t nroot, chidb_key_t key)
+{
+    uint8_t record[64] = {0};
+
+    memcpy(record, &key, sizeof(key));
+    ck_assert(chidb_Btree_insertInTable(bt, nroot, key, record, sizeof(record)) == CHIDB_OK);
+}
+
+/* Builds a table B-Tree with the keys from 1 to NKEYS, inserted in an
+ * order that is neither ascending nor descending */
+static void build(BTree *bt, npage_t nroot)
+{
+    chidb_Btree_begin(bt);
+    for(int i=0; i<NKEYS; i++)
+        insert(bt, nroot, (i * 7919) % NKEYS + 1);
+    chidb_Btree_commit(bt);
+}
+
+/* Counts the pages of a B-Tree and the entries in its leaves, and checks
+ * the links between the leaves */
+static void count_pages(BTree *bt, npage_t npage, uint32_t *npages, uint32_t *nkeys, npage_t *prev)
+{
+    BTreeNode *btn;
+
+    ck_assert(chidb_Btree_getNodeByPage(bt, npage, &btn) == CHIDB_OK);
+    (*npages)++;
+    if (btn->type == PGTYPE_TABLE_INTERNAL)
+    {
+        for(ncell_t i=0; i<=btn->n_cells; i++)
+            count_pages(bt, chidb_Btree_getChildPage(btn, i), npages, nkeys, prev);
+    }
+    else
+    {
+        *nkeys += btn->n_cells;
+        ck_assert_int_eq(btn->prev_leaf, *prev);
+        if (*prev != 0)
+        {
+            BTreeNode *prev_btn;
+            ck_assert(chidb_Btree_getNodeByPage(bt, *prev, &prev_btn) == CHIDB_OK);
+            ck_assert_int_eq(prev_btn->next_leaf, npage);
+            chidb_Btree_freeMemNode(bt, prev_btn);
+        }
+        *prev = npage;
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+}
+
+/* The keys that were not deleted are found, and the ones that were are
+ * not. Every page of the file other than page 1 is either in the B-Tree
+ * or in the freelist. */
+static void test_keys(BTree *bt, npage_t nroot, bool *present)
+{
+    uint32_t npages = 0, nkeys = 0, nfree, expected = 0;
+    npage_t prev = 0;
+    uint8_t *data;
+    uint32_t size;
+
+    for(chidb_key_t key=1; key<=NKEYS; key++)
+    {
+        int rc = chidb_Btree_find(bt, nroot, key, &data, &size);
+        ck_assert(rc == (present[key] ? CHIDB_OK : CHIDB_ENOTFOUND));
+        if (rc == CHIDB_OK)
+        {
+            ck_assert(!memcmp(data, &key, sizeof(key)));
+            free(data);
+            expected++;
+        }
+    }
+    bt_sanity_check(bt, nroot);
+    count_pages(bt, nroot, &npages, &nkeys, &prev);
+    ck_assert_int_eq(nkeys, expected);
+    ck_assert(chidb_Btree_getFreelistCount(bt, &nfree) == CHIDB_OK);
+    ck_assert_int_eq(npages + nfree + (nroot == 1 ? 0 : 1), bt->pager->n_pages);
+}
+
+
+/* Ranges of any size, anywhere in the B-Tree, are deleted */
+static void test_ranges(const char *fname, npage_t nroot)
+{
+    chidb_key_t ranges[][2] = {
+            {100, 100}, {150, 160}, {1000, 5000}, {0, 50}, {7000, 6000},
+            {NKEYS - 500, UINT32_MAX}, {6000, 6000 + NKEYS / 4}, {5001, 5999},
+            {0, UINT32_MAX}};
+    bool *present = malloc((NKEYS + 1) * sizeof(bool));
+    chidb *db = malloc(sizeof(chidb));
+    uint32_t nfree;
+
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    if (nroot != 1)
+        chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    build(db->bt, nroot);
+    for(chidb_key_t key=0; key<=NKEYS; key++)
+        present[key] = true;
+
+    for(int r=0; r<sizeof(ranges) / sizeof(ranges[0]); r++)
+    {
+        ck_assert(chidb_Btree_deleteRange(db->bt, nroot, ranges[r][0], ranges[r][1]) == CHIDB_OK);
+        for(chidb_key_t key=1; key<=NKEYS; key++)
+            if (key >= ranges[r][0] && key <= ranges[r][1])
+                present[key] = false;
+        test_keys(db->bt, nroot, present);
+
+        /* Keys in the range can be inserted again */
+        if (r == 2)
+        {
+            for(chidb_key_t key=1000; key<=5000; key+=2)
+            {
+                insert(db->bt, nroot, key);
+                present[key] = true;
+            }
+            test_keys(db->bt, nroot, present);
+        }
+    }
+
+    /* Everything was deleted: only the root is left */
+    ck_assert(chidb_Btree_getFreelistCount(db->bt, &nfree) == CHIDB_OK);
+    ck_assert_int_eq(nfree, db->bt->pager->n_pages - (nroot == 1 ? 1 : 2));
+    build(db->bt, nroot);
+    for(chidb_key_t key=1; key<=NKEYS; key++)
+        present[key] = true;
+    test_keys(db->bt, nroot, present);
+
+    chidb_Btree_close(db->bt);
+    free(present);
+    free(db);
+}
+
+START_TEST (test_19_1)
+{
+    test_ranges(":memory:", 0);
+}
+END_TEST
+
+
+/* The B-Tree in page 1 keeps the file header */
+START_TEST (test_19_2)
+{
+    char *fname = create_tmp_file();
+    chidb *db = malloc(sizeof(chidb));
+
+    test_ranges(fname, 1);
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    for(chidb_key_t key=1; key<=NKEYS; key++)
+    {
+        uint8_t *data;
+        uint32_t size;
+        ck_assert(chidb_Btree_find(db->bt, 1, key, &data, &size) == CHIDB_OK);
+        free(data);
+    }
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Deleting most of a table reads and writes a small fraction of the pages
+ * that deleting its entries one by one does, and the deletion can be
+ * rolled back */
+START_TEST (test_19_3)
+{
+    chidb *db[2];
+    bool *present = malloc((NKEYS + 1) * sizeof(bool));
+    npage_t nroot[2], nindex;
+    uint64_t reads[2], writes[2];
+
+    for(chidb_key_t key=0; key<=NKEYS; key++)
+        present[key] = key > NKEYS * 9 / 10;
+    for(int t=0; t<2; t++)
+    {
+        db[t] = malloc(sizeof(chidb));
+        ck_assert(chidb_Btree_open(":memory:", db[t], &db[t]->bt) == CHIDB_OK);
+        chidb_Btree_newNode(db[t]->bt, &nroot[t], PGTYPE_TABLE_LEAF);
+        build(db[t]->bt, nroot[t]);
+
+        reads[t] = db[t]->bt->pager->stats.page_reads;
+        writes[t] = db[t]->bt->pager->stats.page_writes;
+        chidb_Btree_begin(db[t]->bt);
+        if (t == 0)
+            ck_assert(chidb_Btree_deleteRange(db[t]->bt, nroot[t], 1, NKEYS * 9 / 10) == CHIDB_OK);
+        else
+            for(chidb_key_t key=1; key<=NKEYS * 9 / 10; key++)
+                ck_assert(chidb_Btree_delete(db[t]->bt, nroot[t], key) == CHIDB_OK);
+        chidb_Btree_commit(db[t]->bt);
+        reads[t] = db[t]->bt->pager->stats.page_reads - reads[t];
+        writes[t] = db[t]->bt->pager->stats.page_writes - writes[t];
+        test_keys(db[t]->bt, nroot[t], present);
+    }
+    ck_assert(reads[0] * 100 < reads[1]);
+    ck_assert(writes[0] * 50 < writes[1]);
+
+    chidb_Btree_begin(db[0]->bt);
+    ck_assert(chidb_Btree_deleteRange(db[0]->bt, nroot[0], 0, UINT32_MAX) == CHIDB_OK);
+    chidb_Btree_rollback(db[0]->bt);
+    test_keys(db[0]->bt, nroot[0], present);
+
+    /* Only table B-Trees */
+    chidb_Btree_newNode(db[0]->bt, &nindex, PGTYPE_INDEX_LEAF);
+    ck_assert(chidb_Btree_deleteRange(db[0]->bt, nindex, 0, UINT32_MAX) == CHIDB_EMISUSE);
+
+    for(int t=0; t<2; t++)
+    {
+        chidb_Btree_close(db[t]->bt);
+        free(db[t]);
+    }
+    free(present);
+}
+END_TEST
+
+
+TCase* make_btree_19_tc(void)
+{
+    chilog_setloglevel(ERROR);
+    TCase *tc = tcase_create ("Range deletion");
+    tcase_add_test (tc, test_19_1);
+    tcase_add_test (tc, test_19_2);
+    tcase_add_test (tc, test_19_3);
+
+    return tc;
+}
@@ -0,0 +1,468 @@
+#include <stdlib.h>
+#include <check.h>
+#include <chidb/log.h>
+#include "check_btree.h"
+#include "libchidb/record.h"
+#include "libchidb/dbm.h"
+
+#define NKEYS (2000)
+
+/* The record of a key: between 8 and 4007 bytes, starting with the key */
+static uint16_t make_record(chidb_key_t key, uint8_t *record)
+{
+    uint16_t size = (key * 397) % 4000 + 8;
+
+    for(int i=0; i<size; i++)
+        record[i] = (key + i) % 251;
+    memcpy(record, &key, sizeof(key));
+    return size;
+}
+
+static void insert(BTree *bt, npage_t nroot, chidb_key_t key)
+{
+    uint8_t record[4008];
+    uint16_t size = make_record(key, record);
+
+    ck_assert(chidb_Btree_insertInTable(bt, nroot, key, record, size) == CHIDB_OK);
+}
+
+/* Number of overflow pages of the record of a key */
+static uint32_t overflow_pages(BTree *bt, chidb_key_t key)
+{
+    uint8_t record[4008];
+    uint16_t size = make_record(key, record);
+    uint32_t local = chidb_Btree_localSize(bt, size);
+    uint32_t per_page = bt->usable_size - OVERFLOW_DATA_OFFSET;
+
+    return (size - local + per_page - 1) / per_page;
+}
+
+static uint32_t count_pages(BTree *bt, npage_t npage)
+{
+    BTreeNode *btn;
+    uint32_t npages = 1;
+
+    ck_assert(chidb_Btree_getNodeByPage(bt, npage, &btn) == CHIDB_OK);
+    if (btn->type == PGTYPE_TABLE_INTERNAL)
+        for(ncell_t i=0; i<=btn->n_cells; i++)
+            npages += count_pages(bt, chidb_Btree_getChildPage(btn, i));
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return npages;
+}
+
+/* The keys that were not deleted are found, with their whole record, and
+ * the ones that were are not. Returns the number of pages of the B-Tree,
+ * including the overflow pages of its records. */
+static uint32_t test_keys(BTree *bt, npage_t nroot, bool *present)
+{
+    uint32_t npages = 0;
+    uint8_t record[4008];
+    uint8_t *data;
+    uint32_t size;
+
+    for(chidb_key_t key=1; key<=NKEYS; key++)
+    {
+        int rc = chidb_Btree_find(bt, nroot, key, &data, &size);
+        ck_assert(rc == (present[key] ? CHIDB_OK : CHIDB_ENOTFOUND));
+        if (rc == CHIDB_OK)
+        {
+            ck_assert_int_eq(size, make_record(key, record));
+            ck_assert(!memcmp(data, record, size));
+            free(data);
+            npages += overflow_pages(bt, key);
+        }
+    }
+    bt_sanity_check(bt, nroot);
+
+    return npages + count_pages(bt, nroot);
+}
+
+/* Every page of the file other than page 1 is either in the B-Tree, an
+ * overflow page of one of its records, or in the freelist */
+static void test_table(BTree *bt, npage_t nroot, bool *present)
+{
+    uint32_t npages = test_keys(bt, nroot, present), nfree;
+
+    ck_assert(chidb_Btree_getFreelistCount(bt, &nfree) == CHIDB_OK);
+    ck_assert_int_eq(npages + nfree + 1, bt->pager->n_pages);
+}
+
+/* Large records are inserted and found, and their overflow pages are
+ * freed when they are deleted, one by one or in ranges */
+START_TEST (test_20_1)
+{
+    bool *present = malloc((NKEYS + 1) * sizeof(bool));
+    chidb *db = malloc(sizeof(chidb));
+    npage_t nroot;
+    uint32_t nfree;
+
+    ck_assert(chidb_Btree_open(":memory:", db, &db->bt) == CHIDB_OK);
+    ck_assert(db->bt->max_local > 0 && db->bt->max_local < db->bt->usable_size / 4);
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+
+    chidb_Btree_begin(db->bt);
+    for(int i=0; i<NKEYS; i++)
+        insert(db->bt, nroot, (i * 1297) % NKEYS + 1);
+    chidb_Btree_commit(db->bt);
+    for(chidb_key_t key=0; key<=NKEYS; key++)
+        present[key] = true;
+    test_table(db->bt, nroot, present);
+
+    /* A duplicate key does not leave its overflow pages behind */
+    uint8_t record[4008];
+    ck_assert(chidb_Btree_insertInTable(db->bt, nroot, 10, record, 4000) == CHIDB_EDUPLICATE);
+    test_table(db->bt, nroot, present);
+
+    for(chidb_key_t key=1; key<=NKEYS; key+=2)
+    {
+        ck_assert(chidb_Btree_delete(db->bt, nroot, key) == CHIDB_OK);
+        present[key] = false;
+    }
+    test_table(db->bt, nroot, present);
+
+    ck_assert(chidb_Btree_deleteRange(db->bt, nroot, NKEYS / 4, NKEYS * 3 / 4) == CHIDB_OK);
+    for(chidb_key_t key=NKEYS / 4; key<=NKEYS * 3 / 4; key++)
+        present[key] = false;
+    test_table(db->bt, nroot, present);
+
+    /* Everything was deleted: only the root is left */
+    ck_assert(chidb_Btree_deleteRange(db->bt, nroot, 0, UINT32_MAX) == CHIDB_OK);
+    ck_assert(chidb_Btree_getFreelistCount(db->bt, &nfree) == CHIDB_OK);
+    ck_assert_int_eq(nfree, db->bt->pager->n_pages - 2);
+
+    /* Range deletions stop reading leaves once no row spills */
+    ck_assert(db->bt->spilled);
+    ck_assert(chidb_Btree_incrementalVacuum(db->bt, 0) == CHIDB_OK);
+    ck_assert(!db->bt->spilled);
+
+    chidb_Btree_close(db->bt);
+    free(present);
+    free(db);
+}
+END_TEST
+
+
+/* Only the overflow pages up to the last byte that is read are read */
+START_TEST (test_20_2)
+{
+    chidb *db = malloc(sizeof(chidb));
+    uint8_t record[20000], buf[20000];
+    uint32_t per_page;
+    BTreeNode *btn;
+    BTreeCell btc;
+    npage_t nroot;
+    uint64_t reads;
+
+    ck_assert(chidb_Btree_open(":memory:", db, &db->bt) == CHIDB_OK);
+    per_page = db->bt->usable_size - OVERFLOW_DATA_OFFSET;
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(int i=0; i<sizeof(record); i++)
+        record[i] = i % 253;
+    ck_assert(chidb_Btree_insertInTable(db->bt, nroot, 1, record, sizeof(record)) == CHIDB_OK);
+
+    ck_assert(chidb_Btree_getNodeByPage(db->bt, nroot, &btn) == CHIDB_OK);
+    ck_assert(chidb_Btree_getCell(btn, 0, &btc) == CHIDB_OK);
+    uint32_t local = btc.fields.tableLeaf.local_size;
+    ck_assert_int_eq(btc.fields.tableLeaf.data_size, sizeof(record));
+    ck_assert_int_eq(local, chidb_Btree_localSize(db->bt, sizeof(record)));
+    ck_assert(btc.fields.tableLeaf.overflow != 0);
+
+    reads = db->bt->pager->stats.overflow_reads;
+    ck_assert(chidb_Btree_readPayload(db->bt, &btc, 0, local, buf) == CHIDB_OK);
+    ck_assert(!memcmp(buf, record, local));
+    ck_assert_int_eq(db->bt->pager->stats.overflow_reads, reads);
+
+    ck_assert(chidb_Btree_readPayload(db->bt, &btc, local + per_page + 10, 100, buf) == CHIDB_OK);
+    ck_assert(!memcmp(buf, record + local + per_page + 10, 100));
+    ck_assert_int_eq(db->bt->pager->stats.overflow_reads, reads + 2);
+
+    ck_assert(chidb_Btree_readPayload(db->bt, &btc, 0, sizeof(record), buf) == CHIDB_OK);
+    ck_assert(!memcmp(buf, record, sizeof(record)));
+    ck_assert_int_eq(db->bt->pager->stats.overflow_reads,
+                     reads + 2 + (sizeof(record) - local + per_page - 1) / per_page);
+
+    ck_assert(chidb_Btree_readPayload(db->bt, &btc, sizeof(record) - 1, 2, buf) == CHIDB_EMISUSE);
+
+    chidb_Btree_freeMemNode(db->bt, btn);
+    chidb_Btree_close(db->bt);
+    free(db);
+}
+END_TEST
+
+
+static int next_entry(void *arg, BTreeCell *cell)
+{
+    int *next = arg;
+    static uint8_t record[4008];
+
+    if (*next == NKEYS)
+        return CHIDB_DONE;
+    cell->key = ++(*next);
+    cell->fields.tableLeaf.data = record;
+    cell->fields.tableLeaf.data_size = make_record(cell->key, record);
+    return CHIDB_OK;
+}
+
+static void add_table(BTree *bt, chidb_key_t key, char *name, npage_t nroot)
+{
+    DBRecord *dbr;
+    uint8_t *record;
+
+    chidb_DBRecord_create(&dbr, "|s|s|s|i4|s|", "table", name, name, nroot, "CREATE TABLE t(a)");
+    chidb_DBRecord_pack(dbr, &record);
+    ck_assert(chidb_Btree_insertInTable(bt, 1, key, record, dbr->packed_len) == CHIDB_OK);
+    chidb_DBRecord_destroy(dbr);
+    free(record);
+}
+
+static npage_t table_root(BTree *bt, chidb_key_t key)
+{
+    uint8_t *data;
+    uint32_t size;
+    DBRecord *dbr;
+    int32_t root;
+
+    ck_assert(chidb_Btree_find(bt, 1, key, &data, &size) == CHIDB_OK);
+    chidb_DBRecord_unpack(&dbr, data);
+    chidb_DBRecord_getInt32(dbr, 3, &root);
+    chidb_DBRecord_destroy(dbr);
+    free(data);
+
+    return root;
+}
+
+/* Large records can be bulk loaded, and their overflow pages are moved
+ * along with their B-Tree by a vacuum. A schema record whose rootpage
+ * field is in an overflow page keeps its root where it is. */
+START_TEST (test_20_3)
+{
+    char *fname = create_tmp_file();
+    chidb *db = malloc(sizeof(chidb));
+    bool *present = malloc((NKEYS + 1) * sizeof(bool));
+    bool *present2 = malloc((NKEYS + 1) * sizeof(bool));
+    char long_name[400];
+    npage_t nroot[2], spacers[20];
+    uint32_t nfree;
+    int next = 0;
+
+    memset(long_name, 'x', sizeof(long_name) - 1);
+    long_name[sizeof(long_name) - 1] = '\0';
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    for(int i=0; i<20; i++)
+        chidb_Btree_newNode(db->bt, &spacers[i], PGTYPE_TABLE_LEAF);
+    chidb_Btree_newNode(db->bt, &nroot[0], PGTYPE_TABLE_LEAF);
+    chidb_Btree_newNode(db->bt, &nroot[1], PGTYPE_TABLE_LEAF);
+    add_table(db->bt, 1, "t", nroot[0]);
+    add_table(db->bt, 2, long_name, nroot[1]);
+
+    ck_assert(chidb_Btree_bulkLoad(db->bt, nroot[0], 90, next_entry, &next) == CHIDB_OK);
+    for(chidb_key_t key=0; key<=NKEYS; key++)
+    {
+        present[key] = true;
+        present2[key] = key % 4 == 1;
+    }
+    chidb_Btree_begin(db->bt);
+    for(chidb_key_t key=1; key<=NKEYS; key+=4)
+        insert(db->bt, nroot[1], key);
+    chidb_Btree_commit(db->bt);
+    ck_assert(chidb_Btree_deleteRange(db->bt, nroot[0], 1, NKEYS / 2) == CHIDB_OK);
+    for(chidb_key_t key=1; key<=NKEYS / 2; key++)
+        present[key] = false;
+    for(int i=0; i<20; i++)
+        chidb_Btree_freePage(db->bt, spacers[i]);
+
+    ck_assert(chidb_Btree_vacuum(db->bt) == CHIDB_OK);
+    chidb_Btree_close(db->bt);
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    ck_assert(chidb_Btree_getFreelistCount(db->bt, &nfree) == CHIDB_OK);
+    ck_assert_int_eq(nfree, 0);
+    ck_assert_int_eq(table_root(db->bt, 2), nroot[1]);
+    ck_assert(table_root(db->bt, 1) < nroot[0]);
+
+    /* The file only holds the schema (one of its records spills to an
+     * overflow page) and the two tables */
+    uint8_t *data;
+    uint32_t size;
+    ck_assert(chidb_Btree_find(db->bt, 1, 2, &data, &size) == CHIDB_OK);
+    ck_assert(chidb_Btree_localSize(db->bt, size) < size);
+    free(data);
+    ck_assert_int_eq(count_pages(db->bt, 1) + 1 +
+                     test_keys(db->bt, table_root(db->bt, 1), present) +
+                     test_keys(db->bt, nroot[1], present2), db->bt->pager->n_pages);
+
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+    free(present);
+    free(present2);
+    free(db);
+}
+END_TEST
+
+
+/* Files created without overflow pages never spill records */
+START_TEST (test_20_4)
+{
+    char *fname = create_copy(TESTFILE_STRINGS1, "btree-legacy.dat");
+    chidb *db = malloc(sizeof(chidb));
+    uint8_t record[600] = {0}, *data;
+    uint32_t size;
+
+    ck_assert(chidb_Btree_open(fname, db, &db->bt) == CHIDB_OK);
+    ck_assert_int_eq(db->bt->max_local, 0);
+    ck_assert_int_eq(chidb_Btree_localSize(db->bt, sizeof(record)), sizeof(record));
+    ck_assert(chidb_Btree_insertInTable(db->bt, 1, 123456, record, sizeof(record)) == CHIDB_OK);
+    ck_assert(chidb_Btree_find(db->bt, 1, 123456, &data, &size) == CHIDB_OK);
+    ck_assert_int_eq(size, sizeof(record));
+    free(data);
+    bt_sanity_check(db->bt, 1);
+
+    chidb_Btree_close(db->bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
+/* Runs a program that reads column col of the row with the given key into
+ * register 1, and returns the number of overflow pages it read */
+static uint64_t read_column(chidb *db, npage_t nroot, chidb_key_t key, int32_t col, chidb_stmt *stmt)
+{
+    uint64_t reads = db->bt->pager->stats.overflow_reads;
+    chidb_dbm_op_t ops[] = {
+            {Op_Integer, key, 0, 0, NULL},
+            {Op_OpenRead, 0, nroot, 4, NULL},
+            {Op_Seek, 0, 5, 0, NULL},
+            {Op_Column, 0, col, 1, NULL},
+            {Op_Close, 0, 0, 0, NULL},
+            {Op_Halt, 0, 0, 0, NULL},
+    };
+
+    ck_assert(chidb_stmt_init(stmt, db) == CHIDB_OK);
+    for(int i=0; i<sizeof(ops) / sizeof(chidb_dbm_op_t); i++)
+        chidb_stmt_set_op(stmt, &ops[i], i);
+    ck_assert_int_eq(chidb_stmt_exec(stmt), CHIDB_DONE);
+
+    return db->bt->pager->stats.overflow_reads - reads;
+}
+
+/* The Column instruction only reads the overflow pages of a row to get
+ * at columns past its local prefix, and reads columns stored on both
+ * sides of a spilled TEXT field (longer than 64 KiB) */
+START_TEST (test_20_5)
+{
+    chidb *db = malloc(sizeof(chidb));
+    static char text[70000];
+    DBRecord *dbr;
+    uint8_t *record;
+    chidb_stmt stmt;
+    npage_t nroot;
+
+    memset(text, 'x', sizeof(text) - 1);
+    text[sizeof(text) - 1] = '\0';
+    ck_assert(chidb_Btree_open(":memory:", db, &db->bt) == CHIDB_OK);
+    db->in_transaction = false;
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+    for(chidb_key_t key=1; key<=2; key++)
+    {
+        chidb_DBRecord_create(&dbr, "|i4|s|i2|", 1000 + key, key == 1 ? text : "short", -7);
+        chidb_DBRecord_pack(dbr, &record);
+        ck_assert(chidb_Btree_insertInTable(db->bt, nroot, key, record, dbr->packed_len) == CHIDB_OK);
+        ck_assert((chidb_Btree_localSize(db->bt, dbr->packed_len) < dbr->packed_len) == (key == 1));
+        chidb_DBRecord_destroy(dbr);
+        free(record);
+    }
+
+    /* The column before the spilled field is in the local prefix */
+    ck_assert_int_eq(read_column(db, nroot, 1, 0, &stmt), 0);
+    ck_assert_int_eq(stmt.reg[1].type, REG_INT32);
+    ck_assert_int_eq(stmt.reg[1].value.i, 1001);
+    chidb_stmt_free(&stmt);
+
+    ck_assert(read_column(db, nroot, 1, 1, &stmt) > 0);
+    ck_assert_int_eq(stmt.reg[1].type, REG_STRING);
+    ck_assert_str_eq(stmt.reg[1].value.s, text);
+    free(stmt.reg[1].value.s);
+    chidb_stmt_free(&stmt);
+
+    /* The column after it is in the last overflow page */
+    ck_assert(read_column(db, nroot, 1, 2, &stmt) > 0);
+    ck_assert_int_eq(stmt.reg[1].type, REG_INT32);
+    ck_assert_int_eq(stmt.reg[1].value.i, -7);
+    chidb_stmt_free(&stmt);
+
+    /* Columns past the end of the record are NULL */
+    ck_assert_int_eq(read_column(db, nroot, 1, 3, &stmt), 0);
+    ck_assert_int_eq(stmt.reg[1].type, REG_NULL);
+    chidb_stmt_free(&stmt);
+
+    /* Rows that do not spill never read overflow pages */
+    for(int32_t col=0; col<3; col++)
+    {
+        ck_assert_int_eq(read_column(db, nroot, 2, col, &stmt), 0);
+        if (col == 1)
+        {
+            ck_assert_str_eq(stmt.reg[1].value.s, "short");
+            free(stmt.reg[1].value.s);
+        }
+        else
+            ck_assert_int_eq(stmt.reg[1].value.i, col == 0 ? 1002 : -7);
+        chidb_stmt_free(&stmt);
+    }
+
+    chidb_Btree_close(db->bt);
+    free(db);
+}
+END_TEST
+
+
+/* Rows are not limited to 64 KiB, not even with 64 KiB pages */
+START_TEST (test_20_6)
+{
+    uint32_t page_sizes[] = {1024, 65536};
+    uint32_t sizes[] = {65535, 65536, 200003};
+    uint8_t *record = malloc(200003), *data;
+    uint32_t size;
+
+    for(int i=0; i<200003; i++)
+        record[i] = (i * 7) % 251;
+    for(int p=0; p<2; p++)
+    {
+        chidb *db = malloc(sizeof(chidb));
+        npage_t nroot;
+
+        ck_assert(chidb_Btree_openWithPageSize(":memory:", db, &db->bt, CHIDB_OPEN_DEFAULT, page_sizes[p]) == CHIDB_OK);
+        chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF);
+        for(int i=0; i<3; i++)
+            ck_assert(chidb_Btree_insertInTable(db->bt, nroot, i + 1, record, sizes[i]) == CHIDB_OK);
+
+        for(int i=0; i<3; i++)
+        {
+            ck_assert(chidb_Btree_find(db->bt, nroot, i + 1, &data, &size) == CHIDB_OK);
+            ck_assert_int_eq(size, sizes[i]);
+            ck_assert(!memcmp(data, record, size));
+            free(data);
+        }
+        bt_sanity_check(db->bt, nroot);
+
+        chidb_Btree_close(db->bt);
+        free(db);
+    }
+    free(record);
+}
+END_TEST
+
+
+TCase* make_btree_20_tc(void)
+{
+    chilog_setloglevel(ERROR);
+    TCase *tc = tcase_create ("Overflow pages");
+    tcase_add_test (tc, test_20_1);
+    tcase_add_test (tc, test_20_2);
+    tcase_add_test (tc, test_20_3);
+    tcase_add_test (tc, test_20_4);
+    tcase_add_test (tc, test_20_5);
+    tcase_add_test (tc, test_20_6);
+
+    return tc;
+}
@@ -0,0 +1,355 @@
+#include <stdlib.h>
+#include <stdio.h>
+#include <check.h>
+#include <chidb/log.h>
+#include "check_btree.h"
+
+#define NKEYS (20000)
+
+/* Strides between keys: keys that share long prefixes, and keys spread
+ * over the whole range of keys */
+#define DENSE (1)
+#define SPARSE (214013)
+
+/* The i-th key inserted (and deleted): the keys from 1 to NKEYS (times
+ * stride), in an order that is neither ascending nor descending */
+static chidb_key_t nth_key(int i, int step, chidb_key_t stride)
+{
+    return ((i * step) % NKEYS) * stride + 1;
+}
+
+/* Returns a byte of a file, read without going through a pager */
+static int file_byte(const char *fname, off_t offset)
+{
+    uint8_t byte;
+    FILE *f = fopen(fname, "rb");
+    int rc = f != NULL && fseek(f, offset, SEEK_SET) == 0 && fread(&byte, 1, 1, f) == 1 ? byte : -1;
+    if (f != NULL)
+        fclose(f);
+    return rc;
+}
+
+static uint32_t count_pages(BTree *bt, npage_t npage)
+{
+    BTreeNode *btn;
+    uint32_t npages = 1;
+
+    ck_assert(chidb_Btree_getNodeByPage(bt, npage, &btn) == CHIDB_OK);
+    ck_assert(btn->packed == bt->packed_index);
+    ck_assert(btn->prefix_len <= INDEX_MAX_PREFIX);
+    if (btn->type == PGTYPE_INDEX_INTERNAL)
+        for(ncell_t i=0; i<=btn->n_cells; i++)
+            npages += count_pages(bt, chidb_Btree_getChildPage(btn, i));
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return npages;
+}
+
+static int btree_depth(BTree *bt, npage_t npage)
+{
+    BTreeNode *btn;
+    int depth = 1;
+
+    chidb_Btree_getNodeByPage(bt, npage, &btn);
+    while (btn->type == PGTYPE_INDEX_INTERNAL)
+    {
+        npage = btn->right_page;
+        chidb_Btree_freeMemNode(bt, btn);
+        chidb_Btree_getNodeByPage(bt, npage, &btn);
+        depth++;
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+
+    return depth;
+}
+
+/* The keys that are present (from 1 to NKEYS, times stride) are found,
+ * with key + 1 as their primary key, and the others are not. Every page
+ * of the file other than page 1 is in the index, or in the freelist. */
+static void test_keys(BTree *bt, npage_t nroot, chidb_key_t stride, bool *present)
+{
+    chidb_key_t pkey;
+    uint32_t nfree;
+
+    for(int i=0; i<NKEYS; i++)
+    {
+        chidb_key_t key = i * stride + 1;
+        int rc = chidb_Btree_findInIndex(bt, nroot, key, &pkey);
+        ck_assert(rc == (present[i] ? CHIDB_OK : CHIDB_ENOTFOUND));
+        if (rc == CHIDB_OK)
+            ck_assert_int_eq(pkey, key + 1);
+    }
+    bt_sanity_check(bt, nroot);
+
+    ck_assert(chidb_Btree_getFreelistCount(bt, &nfree) == CHIDB_OK);
+    ck_assert_int_eq(count_pages(bt, nroot) + nfree + 1, bt->pager->n_pages);
+}
+
+static npage_t build_index(BTree *bt, chidb_key_t stride)
+{
+    npage_t nroot;
+
+    chidb_Btree_newNode(bt, &nroot, PGTYPE_INDEX_LEAF);
+    chidb_Btree_begin(bt);
+    for(int i=0; i<NKEYS; i++)
+    {
+        chidb_key_t key = nth_key(i, 7919, stride);
+        ck_assert(chidb_Btree_insertInIndex(bt, nroot, key, key + 1) == CHIDB_OK);
+    }
+    chidb_Btree_commit(bt);
+
+    return nroot;
+}
+
+
+/* Packed indexes have every entry, in fewer pages (and no more levels)
+ * than the same indexes in files that are not packed */
+START_TEST (test_21_1)
+{
+    chidb_key_t strides[] = {DENSE, SPARSE};
+    bool *present = malloc(NKEYS * sizeof(bool));
+    chidb *db = malloc(sizeof(chidb));
+    chidb *packed_db = malloc(sizeof(chidb));
+
+    for(int i=0; i<NKEYS; i++)
+        present[i] = true;
+    for(int s=0; s<2; s++)
+    {
+        ck_assert(chidb_Btree_open(":memory:", db, &db->bt) == CHIDB_OK);
+        ck_assert(chidb_Btree_openWithFlags(":memory:", packed_db, &packed_db->bt, CHIDB_OPEN_PACKED) == CHIDB_OK);
+        ck_assert(!db->bt->packed_index);
+        ck_assert(packed_db->bt->packed_index);
+
+        npage_t nroot = build_index(db->bt, strides[s]);
+        npage_t packed_nroot = build_index(packed_db->bt, strides[s]);
+        test_keys(db->bt, nroot, strides[s], present);
+        test_keys(packed_db->bt, packed_nroot, strides[s], present);
+
+        uint32_t npages = count_pages(db->bt, nroot);
+        uint32_t packed_npages = count_pages(packed_db->bt, packed_nroot);
+        ck_assert(packed_npages * 4 < npages * 3);
+        ck_assert(btree_depth(packed_db->bt, packed_nroot) <= btree_depth(db->bt, nroot));
+
+        ck_assert(chidb_Btree_insertInIndex(packed_db->bt, packed_nroot, strides[s] + 1, 0) == CHIDB_EDUPLICATE);
+
+        chidb_Btree_close(db->bt);
+        chidb_Btree_close(packed_db->bt);
+    }
+
+    free(db);
+    free(packed_db);
+    free(present);
+}
+END_TEST
+
+
+/* Whether indexes are packed is recorded in the file header, so it
+ * does not depend on the flags the file is opened with afterwards */
+START_TEST (test_21_2)
+{
+    bool *present = malloc(NKEYS * sizeof(bool));
+    chidb *db = malloc(sizeof(chidb));
+    char *fname = create_tmp_file();
+    npage_t nroot;
+
+    for(int i=0; i<NKEYS; i++)
+        present[i] = true;
+    ck_assert(chidb_Btree_openWithFlags(fname, db, &db->bt, CHIDB_OPEN_PACKED) == CHIDB_OK);
+    nroot = build_index(db->bt, SPARSE);
+    chidb_Btree_close(db->bt);
+    ck_assert(file_byte(fname, HEADER_FEATURES_OFFSET) & FEATURE_PACKED_INDEX);
+
+    ck_assert(chidb_Btree_openWithFlags(fname, db, &db->bt, CHIDB_OPEN_DEFAULT) == CHIDB_OK);
+    ck_assert(db->bt->packed_index);
+    test_keys(db->bt, nroot, SPARSE, present);
+    chidb_Btree_close(db->bt);
+    delete_tmp_file(fname);
+
+    fname = create_tmp_file();
+    ck_assert(chidb_Btree_openWithFlags(fname, db, &db->bt, CHIDB_OPEN_DEFAULT) == CHIDB_OK);
+    chidb_Btree_close(db->bt);
+    ck_assert(chidb_Btree_openWithFlags(fname, db, &db->bt, CHIDB_OPEN_PACKED) == CHIDB_OK);
+    ck_assert(!db->bt->packed_index);
+    nroot = build_index(db->bt, DENSE);
+    test_keys(db->bt, nroot, DENSE, present);
+    chidb_Btree_close(db->bt);
+    ck_assert(!(file_byte(fname, HEADER_FEATURES_OFFSET) & FEATURE_PACKED_INDEX));
+    delete_tmp_file(fname);
+
+    free(db);
+    free(present);
+}
+END_TEST
+
+
+/* A full leaf is split where its keys differ earliest (near the median),
+ * so that both halves keep the longest prefix */
+START_TEST (test_21_3)
+{
+    chidb *db = malloc(sizeof(chidb));
+    BTreeNode *btn, *child;
+    BTreeCell cell;
+    npage_t nroot;
+
+    ck_assert(chidb_Btree_openWithFlags(":memory:", db, &db->bt, CHIDB_OPEN_PACKED) == CHIDB_OK);
+    chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+
+    /* Keys 256 and up start with 0x00 0x00 0x01, and the ones below 256
+     * with 0x00 0x00 0x00. They are inserted in descending order, so that
+     * the split is not an append */
+    for(chidb_key_t key=330; ; key--)
+    {
+        ck_assert(key > 0);
+        ck_assert(chidb_Btree_insertInIndex(db->bt, nroot, key, key + 1) == CHIDB_OK);
+        ck_assert(chidb_Btree_getNodeByPage(db->bt, nroot, &btn) == CHIDB_OK);
+        if (btn->type == PGTYPE_INDEX_INTERNAL)
+            break;
+        ck_assert_int_eq(btn->prefix_len, key >= 256 ? INDEX_MAX_PREFIX : 2);
+        chidb_Btree_freeMemNode(db->bt, btn);
+    }
+    bt_sanity_check(db->bt, nroot);
+
+    ck_assert_int_eq(btn->n_cells, 1);
+    chidb_Btree_getCell(btn, 0, &cell);
+    ck_assert(cell.key == 255 || cell.key == 256);
+    for(ncell_t i=0; i<=1; i++)
+    {
+        ck_assert(chidb_Btree_getNodeByPage(db->bt, chidb_Btree_getChildPage(btn, i), &child) == CHIDB_OK);
+        ck_assert_int_eq(child->type, PGTYPE_INDEX_LEAF);
+        ck_assert_int_eq(child->prefix_len, INDEX_MAX_PREFIX);
+        chidb_Btree_freeMemNode(db->bt, child);
+    }
+    chidb_Btree_freeMemNode(db->bt, btn);
+
+    chidb_Btree_close(db->bt);
+    free(db);
+}
+END_TEST
+
+
+/* Entries are deleted from packed indexes in any order (including the
+ * entries of internal nodes, which are replaced with the ones of their
+ * leaves), and the rest are still found */
+START_TEST (test_21_4)
+{
+    chidb_key_t strides[] = {DENSE, SPARSE};
+    bool *present = malloc(NKEYS * sizeof(bool));
+    chidb *db = malloc(sizeof(chidb));
+
+    for(int s=0; s<2; s++)
+    {
+        ck_assert(chidb_Btree_openWithFlags(":memory:", db, &db->bt, CHIDB_OPEN_PACKED) == CHIDB_OK);
+        npage_t nroot = build_index(db->bt, strides[s]);
+        for(int i=0; i<NKEYS; i++)
+            present[i] = true;
+
+        for(int i=0; i<NKEYS * 3 / 4; i++)
+        {
+            chidb_key_t key = nth_key(i, 4999, strides[s]);
+            ck_assert(chidb_Btree_delete(db->bt, nroot, key) == CHIDB_OK);
+            present[(key - 1) / strides[s]] = false;
+            if (i % 5000 == 0)
+                test_keys(db->bt, nroot, strides[s], present);
+        }
+        test_keys(db->bt, nroot, strides[s], present);
+
+        /* And inserted again */
+        for(int i=0; i<NKEYS / 4; i++)
+        {
+            chidb_key_t key = nth_key(i, 4999, strides[s]);
+            ck_assert(chidb_Btree_insertInIndex(db->bt, nroot, key, key + 1) == CHIDB_OK);
+            present[(key - 1) / strides[s]] = true;
+        }
+        test_keys(db->bt, nroot, strides[s], present);
+
+        chidb_Btree_close(db->bt);
+    }
+
+    free(db);
+    free(present);
+}
+END_TEST
+
+
+/* Entries returned to chidb_Btree_bulkLoad: every other key, in order */
+typedef struct entries
+{
+    chidb_key_t stride;
+    int next;
+} entries;
+
+static int next_entry(void *arg, BTreeCell *cell)
+{
+    entries *e = arg;
+    int i = e->next;
+
+    if (i >= NKEYS)
+        return CHIDB_DONE;
+    e->next += 2;
+    cell->key = i * e->stride + 1;
+    cell->fields.indexLeaf.keyPk = cell->key + 1;
+    return CHIDB_OK;
+}
+
+/* Packed indexes are bulk loaded into fewer pages than the ones that are
+ * not packed, and can be inserted into and deleted from afterwards */
+START_TEST (test_21_5)
+{
+    chidb_key_t strides[] = {DENSE, SPARSE};
+    bool *present = malloc(NKEYS * sizeof(bool));
+    chidb *db = malloc(sizeof(chidb));
+    uint32_t npages[2];
+
+    for(int s=0; s<2; s++)
+    {
+        for(int packed=0; packed<2; packed++)
+        {
+            entries e = {.stride = strides[s]};
+            npage_t nroot;
+
+            ck_assert(chidb_Btree_openWithFlags(":memory:", db, &db->bt,
+                                                packed ? CHIDB_OPEN_PACKED : CHIDB_OPEN_DEFAULT) == CHIDB_OK);
+            chidb_Btree_newNode(db->bt, &nroot, PGTYPE_INDEX_LEAF);
+            ck_assert(chidb_Btree_bulkLoad(db->bt, nroot, BULKLOAD_INDEX_FILL, next_entry, &e) == CHIDB_OK);
+            for(int i=0; i<NKEYS; i++)
+                present[i] = i % 2 == 0;
+            test_keys(db->bt, nroot, strides[s], present);
+            npages[packed] = count_pages(db->bt, nroot);
+
+            for(int i=1; i<NKEYS; i+=2)
+            {
+                chidb_key_t key = i * strides[s] + 1;
+                ck_assert(chidb_Btree_insertInIndex(db->bt, nroot, key, key + 1) == CHIDB_OK);
+                present[i] = true;
+            }
+            test_keys(db->bt, nroot, strides[s], present);
+            for(int i=0; i<NKEYS; i+=3)
+            {
+                ck_assert(chidb_Btree_delete(db->bt, nroot, i * strides[s] + 1) == CHIDB_OK);
+                present[i] = false;
+            }
+            test_keys(db->bt, nroot, strides[s], present);
+
+            chidb_Btree_close(db->bt);
+        }
+        ck_assert(npages[1] * 4 < npages[0] * 3);
+    }
+
+    free(db);
+    free(present);
+}
+END_TEST
+
+
+TCase* make_btree_21_tc(void)
+{
+    chilog_setloglevel(ERROR);
+    TCase *tc = tcase_create ("Packed index pages");
+    tcase_add_test (tc, test_21_1);
+    tcase_add_test (tc, test_21_2);
+    tcase_add_test (tc, test_21_3);
+    tcase_add_test (tc, test_21_4);
+    tcase_add_test (tc, test_21_5);
+
+    return tc;
+}
@@ -20,7 +20,7 @@ END_TEST
 START_TEST (test_5_2)
 {
     chidb *db;
-    uint16_t size;
+    uint32_t size;
     uint8_t *data;
     chidb_key_t nokeys[] = {0,4,6,8,9,11,18,27,36,40,100,650,1500,2500,3500,4500,5500};
     int rc;
@@ -0,0 +1,225 @@
+#include <stdlib.h>
+#include <sys/stat.h>
+#include <check.h>
+#include <chidb/log.h>
+#include "check_btree.h"
+#include "libchidb/record.h"
+
+#define TESTFILE_LARGEBTREE ("1table-largebtree.cdb")
+#define MAXKEYS (4096)
+
+static off_t file_size(const char *fname)
+{
+    struct stat st;
+    return stat(fname, &st) == 0 ? st.st_size : -1;
+}
+
+/* Returns the rootpage field of the schema record with the given key */
+static npage_t schema_root(BTree *bt, chidb_key_t key)
+{
+    uint8_t *data;
+    uint32_t size;
+    DBRecord *dbr;
+    int32_t root;
+
+    ck_assert(chidb_Btree_find(bt, 1, key, &data, &size) == CHIDB_OK);
+    chidb_DBRecord_unpack(&dbr, data);
+    chidb_DBRecord_getInt32(dbr, 3, &root);
+    chidb_DBRecord_destroy(dbr);
+    free(data);
+
+    return root;
+}
+
+/* Collects the keys of a table B-Tree, and the pages of its leaves, in key order */
+static void scan_table(BTree *bt, npage_t npage, chidb_key_t *keys, int *nkeys, npage_t *leaves, int *nleaves)
+{
+    BTreeNode *btn;
+    BTreeCell btc;
+
+    ck_assert(chidb_Btree_getNodeByPage(bt, npage, &btn) == CHIDB_OK);
+    if (btn->type == PGTYPE_TABLE_LEAF)
+    {
+        leaves[(*nleaves)++] = npage;
+        for(int i=0; i<btn->n_cells; i++)
+        {
+            chidb_Btree_getCell(btn, i, &btc);
+            keys[(*nkeys)++] = btc.key;
+        }
+    }
+    else
+    {
+        ck_assert(btn->type == PGTYPE_TABLE_INTERNAL);
+        for(int i=0; i<btn->n_cells; i++)
+        {
+            chidb_Btree_getCell(btn, i, &btc);
+            scan_table(bt, btc.fields.tableInternal.child_page, keys, nkeys, leaves, nleaves);
+        }
+        scan_table(bt, btn->right_page, keys, nkeys, leaves, nleaves);
+    }
+    chidb_Btree_freeMemNode(bt, btn);
+}
+
+
+START_TEST (test_9_1)
+{
+    BTree *bt;
+    chidb *db;
+    npage_t npage, n_pages, pages[300];
+    uint32_t nfree;
+    int rc;
+
+    char *fname = create_copy(TESTFILE_LARGEBTREE, "btree-freelist.dat");
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &bt);
+    ck_assert(rc == CHIDB_OK);
+    n_pages = bt->pager->n_pages;
+    chidb_Btree_getFreelistCount(bt, &nfree);
+    ck_assert_int_eq(nfree, 0);
+
+    ck_assert(chidb_Btree_freePage(bt, 1) == CHIDB_EPAGENO);
+    ck_assert(chidb_Btree_freePage(bt, n_pages + 1) == CHIDB_EPAGENO);
+
+    /* Enough free pages to need more than one trunk page */
+    for(int i=0; i<300; i++)
+    {
+        chidb_Btree_newNode(bt, &pages[i], PGTYPE_TABLE_LEAF);
+        ck_assert_int_eq(pages[i], n_pages + i + 1);
+    }
+    for(int i=0; i<300; i++)
+        ck_assert(chidb_Btree_freePage(bt, pages[i]) == CHIDB_OK);
+    chidb_Btree_getFreelistCount(bt, &nfree);
+    ck_assert_int_eq(nfree, 300);
+
+    /* Free pages are reused before the file grows */
+    for(int i=0; i<300; i++)
+    {
+        rc = chidb_Btree_newNode(bt, &npage, PGTYPE_INDEX_LEAF);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert(npage > n_pages && npage <= n_pages + 300);
+        pages[npage - n_pages - 1] = 0;
+    }
+    for(int i=0; i<300; i++)
+        ck_assert_int_eq(pages[i], 0);
+    ck_assert_int_eq(bt->pager->n_pages, n_pages + 300);
+    chidb_Btree_getFreelistCount(bt, &nfree);
+    ck_assert_int_eq(nfree, 0);
+
+    chidb_Btree_newNode(bt, &npage, PGTYPE_INDEX_LEAF);
+    ck_assert_int_eq(npage, n_pages + 301);
+
+    chidb_Btree_close(bt);
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
+START_TEST (test_9_2)
+{
+    BTree *bt;
+    chidb *db;
+    DBRecord *dbr;
+    uint8_t *record;
+    npage_t npage, nroot, n_pages, leaves[MAXKEYS];
+    chidb_key_t keys[MAXKEYS], keys2[MAXKEYS];
+    int nkeys = 0, nleaves = 0, nkeys2 = 0, nleaves2 = 0;
+    uint32_t nfree;
+    int rc;
+
+    char *fname = create_copy(TESTFILE_LARGEBTREE, "btree-vacuum.dat");
+    db = malloc(sizeof(chidb));
+    rc = chidb_Btree_open(fname, db, &bt);
+    ck_assert(rc == CHIDB_OK);
+    n_pages = bt->pager->n_pages;
+
+    BTreeNode *schema;
+    BTreeCell btc;
+    chidb_Btree_getNodeByPage(bt, 1, &schema);
+    chidb_Btree_getCell(schema, 0, &btc);
+    chidb_Btree_freeMemNode(bt, schema);
+    nroot = schema_root(bt, btc.key);
+    scan_table(bt, nroot, keys, &nkeys, leaves, &nleaves);
+
+    /* Free pages at the end of the file are dropped */
+    for(int i=0; i<10; i++)
+        chidb_Btree_newNode(bt, &npage, PGTYPE_TABLE_LEAF);
+    for(int i=0; i<10; i++)
+        chidb_Btree_freePage(bt, n_pages + i + 1);
+    rc = chidb_Btree_incrementalVacuum(bt, 3);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(bt->pager->n_pages, n_pages + 7);
+    chidb_Btree_getFreelistCount(bt, &nfree);
+    ck_assert_int_eq(nfree, 7);
+    rc = chidb_Btree_incrementalVacuum(bt, 0);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(bt->pager->n_pages, n_pages);
+    chidb_Btree_getFreelistCount(bt, &nfree);
+    ck_assert_int_eq(nfree, 0);
+
+    /* A B-Tree at the end of the file is moved to a free page */
+    npage_t nfree_page, nroot2;
+    chidb_Btree_newNode(bt, &nfree_page, PGTYPE_TABLE_LEAF);
+    chidb_Btree_newNode(bt, &nroot2, PGTYPE_TABLE_LEAF);
+    chidb_Btree_freePage(bt, nfree_page);
+    chidb_Btree_insertInTable(bt, nroot2, 1, (uint8_t *) "foo1", 5);
+    chidb_Btree_insertInTable(bt, nroot2, 2, (uint8_t *) "foo2", 5);
+    chidb_DBRecord_create(&dbr, "|s|s|s|i4|s|", "table", "t2", "t2", nroot2, "CREATE TABLE t2(a)");
+    chidb_DBRecord_pack(dbr, &record);
+    rc = chidb_Btree_insertInTable(bt, 1, 1000, record, dbr->packed_len);
+    ck_assert(rc == CHIDB_OK);
+    chidb_DBRecord_destroy(dbr);
+    free(record);
+
+    rc = chidb_Btree_incrementalVacuum(bt, 0);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(bt->pager->n_pages, n_pages + 1);
+    ck_assert_int_eq(schema_root(bt, 1000), nfree_page);
+    uint8_t *data;
+    uint32_t size;
+    rc = chidb_Btree_find(bt, nfree_page, 2, &data, &size);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(!strcmp((char *) data, "foo2"));
+    free(data);
+
+    /* A full vacuum lays out the leaves in key order, in contiguous pages */
+    rc = chidb_Btree_vacuum(bt);
+    ck_assert(rc == CHIDB_OK);
+    nroot = schema_root(bt, btc.key);
+    scan_table(bt, nroot, keys2, &nkeys2, leaves, &nleaves2);
+    ck_assert_int_eq(nkeys2, nkeys);
+    ck_assert(!memcmp(keys, keys2, nkeys * sizeof(chidb_key_t)));
+    ck_assert_int_eq(nleaves2, nleaves);
+    for(int i=1; i<nleaves; i++)
+        ck_assert_int_eq(leaves[i], leaves[i-1] + 1);
+    ck_assert(schema_root(bt, 1000) == bt->pager->n_pages);
+    chidb_Btree_getFreelistCount(bt, &nfree);
+    ck_assert_int_eq(nfree, 0);
+    n_pages = bt->pager->n_pages;
+    uint32_t page_size = bt->pager->page_size;
+
+    chidb_Btree_close(bt);
+    ck_assert_int_eq(file_size(fname), n_pages * page_size);
+
+    rc = chidb_Btree_open(fname, db, &bt);
+    ck_assert(rc == CHIDB_OK);
+    nkeys2 = nleaves2 = 0;
+    scan_table(bt, schema_root(bt, btc.key), keys2, &nkeys2, leaves, &nleaves2);
+    ck_assert(!memcmp(keys, keys2, nkeys * sizeof(chidb_key_t)));
+    chidb_Btree_close(bt);
+
+    delete_copy(fname);
+    free(db);
+}
+END_TEST
+
+
+TCase* make_btree_9_tc(void)
+{
+    chilog_setloglevel(ERROR);
+    TCase *tc = tcase_create ("Freelist and VACUUM");
+    tcase_add_test (tc, test_9_1);
+    tcase_add_test (tc, test_9_2);
+
+    return tc;
+}
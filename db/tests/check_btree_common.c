@@ -26,13 +26,13 @@ void btn_sanity_check(BTree *bt, BTreeNode *btn, bool empty)
     }
 
     ck_assert(btn->cells_offset >= btn->free_offset);
-    ck_assert(btn->cells_offset <= bt->pager->page_size);
+    ck_assert(btn->cells_offset <= bt->usable_size);
 
     for(int i=0; i<btn->n_cells; i++)
     {
         uint16_t cell_offset = get2byte(&btn->celloffset_array[i*2]);
         ck_assert(cell_offset >= btn->cells_offset);
-        ck_assert(cell_offset <= bt->pager->page_size);
+        ck_assert(cell_offset < bt->usable_size);
     }
 
     if (!empty && (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL))
@@ -50,14 +50,54 @@ void btnNew_sanity_check(BTree *bt, BTreeNode *btn, uint8_t type)
     ck_assert(btn->type == type);
     ck_assert(btn->n_cells == 0);
     ck_assert(btn->free_offset == (leaf? LEAFPG_CELLSOFFSET_OFFSET : INTPG_CELLSOFFSET_OFFSET));
-    ck_assert(btn->cells_offset == bt->pager->page_size);
+    ck_assert(btn->cells_offset == bt->usable_size);
     ck_assert(btn->celloffset_array == (uint8_t*) (btn->page->data + (leaf? LEAFPG_CELLSOFFSET_OFFSET : INTPG_CELLSOFFSET_OFFSET)));
 }
 
 
+/* Checks the nodes of the subtree rooted at npage, and that its keys are
+ * sorted and greater than lo and less than or equal to hi. Returns the
+ * depth of its leaves, which must all be the same. */
+static int subtree_sanity_check(BTree *bt, npage_t npage, int64_t lo, int64_t hi)
+{
+    BTreeNode *btn;
+    int depth = -1;
+
+    ck_assert(chidb_Btree_getNodeByPage(bt, npage, &btn) == CHIDB_OK);
+    btn_sanity_check(bt, btn, false);
+
+    for(int i=0; i<btn->n_cells; i++)
+    {
+        chidb_key_t key = chidb_Btree_getCellKey(btn, i);
+        ck_assert(key > lo && key <= hi);
+
+        if (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL)
+        {
+            /* Index entries are not repeated in the leaves */
+            int64_t child_hi = btn->type == PGTYPE_TABLE_INTERNAL ? key : (int64_t) key - 1;
+            int child_depth = subtree_sanity_check(bt, chidb_Btree_getChildPage(btn, i), lo, child_hi);
+            ck_assert(depth == -1 || child_depth == depth);
+            depth = child_depth;
+        }
+        lo = key;
+    }
+
+    if (btn->type == PGTYPE_TABLE_INTERNAL || btn->type == PGTYPE_INDEX_INTERNAL)
+    {
+        int child_depth = subtree_sanity_check(bt, btn->right_page, lo, hi);
+        ck_assert(depth == -1 || child_depth == depth);
+        depth = child_depth + 1;
+    }
+    else
+        depth = 1;
+
+    chidb_Btree_freeMemNode(bt, btn);
+    return depth;
+}
+
 void bt_sanity_check(BTree *bt, npage_t nroot)
 {
-    return;
+    subtree_sanity_check(bt, nroot, -1, UINT32_MAX);
 }
 
 void test_init_empty(BTree *bt, uint8_t type)
@@ -86,7 +126,7 @@ void test_new_node(BTree *bt, uint8_t type)
 
 void test_values(BTree *bt, chidb_key_t *keys, char **values, chidb_key_t nkeys)
 {
-    uint16_t size;
+    uint32_t size;
     uint8_t *data;
     int rc;
 
@@ -121,7 +161,7 @@ void test_bigfile(chidb *db)
     for(int i=0; i<bigfile_nvalues; i++)
     {
         uint8_t* buf;
-        uint16_t size;
+        uint32_t size;
         uint8_t data[192];
         int datalen = ((bigfile_pkeys[i] % 3) + 1) * 64;
 
@@ -151,13 +191,17 @@ int chidb_Btree_findInIndex(BTree *bt, npage_t nroot, chidb_key_t ikey, chidb_ke
             if(btc.key == ikey)
             {
                 *pkey = btc.fields.indexLeaf.keyPk;
+                chidb_Btree_freeMemNode(bt, btn);
                 return CHIDB_OK;
             }
         }
+        chidb_Btree_freeMemNode(bt, btn);
         return CHIDB_ENOTFOUND;
     }
     else if (btn->type == PGTYPE_INDEX_INTERNAL)
     {
+        npage_t child = btn->right_page;
+
         for(int i = 0; i<btn->n_cells; i++)
         {
             BTreeCell btc;
@@ -167,13 +211,18 @@ int chidb_Btree_findInIndex(BTree *bt, npage_t nroot, chidb_key_t ikey, chidb_ke
             if(btc.key == ikey)
             {
                 *pkey = btc.fields.indexInternal.keyPk;
+                chidb_Btree_freeMemNode(bt, btn);
                 return CHIDB_OK;
             }
 
             if(ikey <= btc.key)
-                return chidb_Btree_findInIndex(bt, btc.fields.indexInternal.child_page, ikey, pkey);
+            {
+                child = btc.fields.indexInternal.child_page;
+                break;
+            }
         }
-        return chidb_Btree_findInIndex(bt, btn->right_page, ikey, pkey);
+        chidb_Btree_freeMemNode(bt, btn);
+        return chidb_Btree_findInIndex(bt, child, ikey, pkey);
     }
 
     chidb_Btree_freeMemNode(bt, btn);
@@ -188,7 +237,7 @@ void test_index_bigfile(chidb *db, npage_t index_nroot)
     for(int i=0; i<bigfile_nvalues; i++)
     {
         uint8_t* buf;
-        uint16_t size;
+        uint32_t size;
         uint8_t data[192];
         chidb_key_t pkey;
 
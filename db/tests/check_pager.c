@@ -1,5 +1,9 @@
 #include <stdlib.h>
 #include <check.h>
+#include <pthread.h>
+#include <fcntl.h>
+#include <sys/stat.h>
+#include <unistd.h>
 #include "check_common.h"
 #include "libchidb/pager.h"
 
@@ -146,6 +150,1110 @@ START_TEST (test_readwrite)
 END_TEST
 
 
+START_TEST (test_cache)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page, *page2;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    chidb_Pager_setCacheSize(pg, 2);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        page->data[pagepos[j]] = values[j];
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    /* A cached page is shared by all its readers */
+    chidb_Pager_readPage(pg, 1, &page);
+    chidb_Pager_readPage(pg, 1, &page2);
+    ck_assert(page == page2);
+    ck_assert_int_eq(page->pin_count, 2);
+    chidb_Pager_releaseMemPage(pg, page2);
+
+    /* Pinned pages survive eviction, others are read back from the file */
+    for(int j=2; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page2);
+        ck_assert(page2->data[pagepos[j]] == values[j]);
+        chidb_Pager_releaseMemPage(pg, page2);
+    }
+    ck_assert(page->npage == 1);
+    ck_assert(page->data[pagepos[1]] == values[1]);
+    chidb_Pager_releaseMemPage(pg, page);
+    ck_assert(pg->n_frames <= 2);
+
+    chidb_Pager_close(pg);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_vectored)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page, *pages[MAXPAGES];
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    /* Write the pages in reverse order in a single call */
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        page = malloc(sizeof(MemPage));
+        *page = chidb_Pager_initMemPage(npage, PAGE_SIZE);
+        page->data[pagepos[j]] = values[j];
+        pages[MAXPAGES - j] = page;
+    }
+    rc = chidb_Pager_writePages(pg, pages, MAXPAGES);
+    ck_assert(rc == CHIDB_OK);
+    for(int j=0; j<MAXPAGES; j++)
+        chidb_Pager_releaseMemPage(pg, pages[j]);
+    chidb_Pager_close(pg);
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    /* Page 2 is cached, so the others are read in two runs */
+    chidb_Pager_readPage(pg, 2, &page);
+    rc = chidb_Pager_readPages(pg, 1, MAXPAGES, pages);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pages[1] == page);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        ck_assert(pages[j-1]->npage == j);
+        ck_assert(pages[j-1]->data[pagepos[j]] == values[j]);
+        chidb_Pager_releaseMemPage(pg, pages[j-1]);
+    }
+    chidb_Pager_releaseMemPage(pg, page);
+
+    rc = chidb_Pager_readPages(pg, 2, MAXPAGES, pages);
+    ck_assert(rc == CHIDB_EPAGENO);
+
+    chidb_Pager_close(pg);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_readahead)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    PagerReadAhead ra;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=200; j++)
+        chidb_Pager_allocatePage(pg, &npage);
+
+    /* Sequential scan: the first window is prefetched on the third page,
+     * and the next one once the scan is halfway through it */
+    chidb_Pager_initReadAhead(&ra);
+    chidb_Pager_readAhead(pg, &ra, 1);
+    chidb_Pager_readAhead(pg, &ra, 2);
+    ck_assert_int_eq(ra.window_end, 2);
+    chidb_Pager_readAhead(pg, &ra, 3);
+    ck_assert_int_eq(ra.window_end, 3 + PAGER_READAHEAD_PAGES);
+    for(int j=4; j<3 + PAGER_READAHEAD_PAGES / 2; j++)
+    {
+        chidb_Pager_readAhead(pg, &ra, j);
+        ck_assert_int_eq(ra.window_end, 3 + PAGER_READAHEAD_PAGES);
+    }
+    chidb_Pager_readAhead(pg, &ra, 3 + PAGER_READAHEAD_PAGES / 2);
+    ck_assert_int_eq(ra.window_end, 3 + PAGER_READAHEAD_PAGES / 2 + PAGER_READAHEAD_PAGES);
+
+    /* A jump resets the detection */
+    chidb_Pager_readAhead(pg, &ra, 150);
+    ck_assert_int_eq(ra.hits, 1);
+    ck_assert_int_eq(ra.window_end, 150);
+
+    /* Backwards strided scan, clipped at the first page */
+    chidb_Pager_readAhead(pg, &ra, 146);
+    chidb_Pager_readAhead(pg, &ra, 142);
+    ck_assert_int_eq(ra.window_end, 142 - 4 * PAGER_READAHEAD_PAGES);
+    chidb_Pager_readAhead(pg, &ra, 138);
+    ck_assert_int_eq(ra.window_end, 142 - 4 * PAGER_READAHEAD_PAGES);
+    chidb_Pager_readAhead(pg, &ra, 120);
+    chidb_Pager_readAhead(pg, &ra, 100);
+    chidb_Pager_readAhead(pg, &ra, 80);
+    ck_assert_int_eq(ra.window_end, 1);
+
+    /* Forward scan, clipped at the last page */
+    chidb_Pager_initReadAhead(&ra);
+    for(int j=190; j<=192; j++)
+        chidb_Pager_readAhead(pg, &ra, j);
+    ck_assert_int_eq(ra.window_end, 200);
+
+    rc = chidb_Pager_readAhead(pg, &ra, 201);
+    ck_assert(rc == CHIDB_EPAGENO);
+
+    chidb_Pager_close(pg);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_mmap)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+
+    for(int i=0; i<NMULT; i++)
+    {
+        char *fname = create_tmp_file();
+
+        rc = chidb_Pager_openWithFlags(&pg, fname, CHIDB_OPEN_MMAP);
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_setPageSize(pg, PAGE_SIZE * pagemult[i]);
+
+        for(int j=1; j<=MAXPAGES; j++)
+        {
+            chidb_Pager_allocatePage(pg, &npage);
+            ck_assert(npage == j);
+
+            chidb_Pager_readPage(pg, j, &page);
+            ck_assert(page->mapped);
+            for(int k=0; k<NVALUES; k++)
+                page->data[pagepos[k]*(i+1)] = values[(k + j) % NVALUES];
+            chidb_Pager_writePage(pg, page);
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+        chidb_Pager_close(pg);
+
+        /* The changes must have reached the file */
+        rc = chidb_Pager_open(&pg, fname);
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_setPageSize(pg, PAGE_SIZE * pagemult[i]);
+        ck_assert_int_eq(pg->n_pages, MAXPAGES);
+        for(int j=1; j<=MAXPAGES; j++)
+        {
+            chidb_Pager_readPage(pg, j, &page);
+            for(int k=0; k<NVALUES; k++)
+                ck_assert(page->data[pagepos[k]*(i+1)] == values[(k + j) % NVALUES]);
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+        chidb_Pager_close(pg);
+
+        delete_tmp_file(fname);
+    }
+}
+END_TEST
+
+
+static off_t file_size(const char *fname)
+{
+    struct stat buf;
+    return stat(fname, &buf) == 0 ? buf.st_size : -1;
+}
+
+/* Returns a byte of a file, read without going through a pager */
+static int file_byte(const char *fname, off_t offset)
+{
+    uint8_t byte;
+    FILE *f = fopen(fname, "rb");
+    int rc = f != NULL && fseek(f, offset, SEEK_SET) == 0 && fread(&byte, 1, 1, f) == 1 ? byte : -1;
+    if (f != NULL)
+        fclose(f);
+    return rc;
+}
+
+START_TEST (test_transaction)
+{
+    int rc, flags[] = {CHIDB_OPEN_DEFAULT, CHIDB_OPEN_MMAP};
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+
+    for(int i=0; i<2; i++)
+    {
+        char *fname = create_tmp_file();
+
+        rc = chidb_Pager_openWithFlags(&pg, fname, flags[i]);
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+        rc = chidb_Pager_commit(pg);
+        ck_assert(rc == CHIDB_EMISUSE);
+        rc = chidb_Pager_rollback(pg);
+        ck_assert(rc == CHIDB_EMISUSE);
+
+        /* Nothing reaches the file until the transaction is committed */
+        chidb_Pager_begin(pg);
+        for(int j=1; j<=MAXPAGES; j++)
+        {
+            chidb_Pager_allocatePage(pg, &npage);
+            chidb_Pager_readPage(pg, npage, &page);
+            page->data[pagepos[j]] = values[j];
+            chidb_Pager_writePage(pg, page);
+            chidb_Pager_releaseMemPage(pg, page);
+
+            /* Nested transactions are part of the outer one */
+            chidb_Pager_begin(pg);
+            chidb_Pager_readPage(pg, npage, &page);
+            ck_assert(page->data[pagepos[j]] == values[j]);
+            page->data[pagepos[j] + 1] = values[j];
+            chidb_Pager_writePage(pg, page);
+            chidb_Pager_releaseMemPage(pg, page);
+            rc = chidb_Pager_commit(pg);
+            ck_assert(rc == CHIDB_OK);
+        }
+        for(int j=1; j<=MAXPAGES; j++)
+            ck_assert(file_byte(fname, (j-1) * PAGE_SIZE + pagepos[j]) != values[j]);
+        rc = chidb_Pager_commit(pg);
+        ck_assert(rc == CHIDB_OK);
+        for(int j=1; j<=MAXPAGES; j++)
+        {
+            ck_assert(file_byte(fname, (j-1) * PAGE_SIZE + pagepos[j]) == values[j]);
+            ck_assert(file_byte(fname, (j-1) * PAGE_SIZE + pagepos[j] + 1) == values[j]);
+        }
+
+        /* A rollback discards the changes, including the allocated pages */
+        chidb_Pager_begin(pg);
+        chidb_Pager_readPage(pg, 1, &page);
+        page->data[pagepos[1]] = values[0];
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+        chidb_Pager_allocatePage(pg, &npage);
+        ck_assert_int_eq(npage, MAXPAGES + 1);
+        rc = chidb_Pager_rollback(pg);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert_int_eq(pg->n_pages, MAXPAGES);
+        ck_assert_int_eq(file_size(fname), MAXPAGES * PAGE_SIZE);
+        chidb_Pager_readPage(pg, 1, &page);
+        ck_assert(page->data[pagepos[1]] == values[1]);
+        chidb_Pager_releaseMemPage(pg, page);
+
+        /* Closing the pager rolls back an open transaction */
+        chidb_Pager_begin(pg);
+        chidb_Pager_readPage(pg, 2, &page);
+        page->data[pagepos[2]] = values[0];
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+        chidb_Pager_close(pg);
+        ck_assert(file_byte(fname, PAGE_SIZE + pagepos[2]) == values[2]);
+
+        delete_tmp_file(fname);
+    }
+}
+END_TEST
+
+
+START_TEST (test_truncate)
+{
+    int rc, flags[] = {CHIDB_OPEN_DEFAULT, CHIDB_OPEN_MMAP, CHIDB_OPEN_WAL};
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+
+    for(int i=0; i<3; i++)
+    {
+        char *fname = create_tmp_file();
+
+        rc = chidb_Pager_openWithFlags(&pg, fname, flags[i]);
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_setPageSize(pg, PAGE_SIZE);
+        for(int j=1; j<=MAXPAGES; j++)
+        {
+            chidb_Pager_allocatePage(pg, &npage);
+            chidb_Pager_readPage(pg, npage, &page);
+            page->data[pagepos[j]] = values[j];
+            chidb_Pager_writePage(pg, page);
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+
+        rc = chidb_Pager_truncate(pg, MAXPAGES + 1);
+        ck_assert(rc == CHIDB_EPAGENO);
+
+        /* Truncating within a transaction is undone by a rollback */
+        chidb_Pager_begin(pg);
+        rc = chidb_Pager_truncate(pg, MAXPAGES / 2);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert_int_eq(pg->n_pages, MAXPAGES / 2);
+        chidb_Pager_rollback(pg);
+        ck_assert_int_eq(pg->n_pages, MAXPAGES);
+        chidb_Pager_readPage(pg, MAXPAGES, &page);
+        ck_assert(page->data[pagepos[MAXPAGES]] == values[MAXPAGES]);
+        chidb_Pager_releaseMemPage(pg, page);
+
+        /* Pages modified and then truncated away are not written */
+        chidb_Pager_begin(pg);
+        chidb_Pager_readPage(pg, MAXPAGES, &page);
+        page->data[pagepos[MAXPAGES]] = values[0];
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+        rc = chidb_Pager_truncate(pg, MAXPAGES / 2);
+        ck_assert(rc == CHIDB_OK);
+        rc = chidb_Pager_commit(pg);
+        ck_assert(rc == CHIDB_OK);
+        ck_assert_int_eq(pg->n_pages, MAXPAGES / 2);
+
+        /* Pages allocated after the truncation start out empty */
+        chidb_Pager_allocatePage(pg, &npage);
+        ck_assert_int_eq(npage, MAXPAGES / 2 + 1);
+        chidb_Pager_readPage(pg, npage, &page);
+        ck_assert(page->data[pagepos[npage]] == 0);
+        chidb_Pager_releaseMemPage(pg, page);
+        chidb_Pager_truncate(pg, MAXPAGES / 2);
+        chidb_Pager_close(pg);
+        ck_assert_int_eq(file_size(fname), MAXPAGES / 2 * PAGE_SIZE);
+
+        rc = chidb_Pager_openWithFlags(&pg, fname, flags[i]);
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_setPageSize(pg, PAGE_SIZE);
+        ck_assert_int_eq(pg->n_pages, MAXPAGES / 2);
+        chidb_Pager_readPage(pg, MAXPAGES / 2, &page);
+        ck_assert(page->data[pagepos[MAXPAGES / 2]] == values[MAXPAGES / 2]);
+        chidb_Pager_releaseMemPage(pg, page);
+        chidb_Pager_close(pg);
+
+        delete_tmp_file(fname);
+    }
+}
+END_TEST
+
+
+START_TEST (test_uring)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page, *pages[4 * MAXPAGES];
+
+    for(int wal=0; wal<2; wal++)
+    {
+        char *fname = create_tmp_file();
+
+        rc = chidb_Pager_openWithFlags(&pg, fname, CHIDB_OPEN_URING | (wal ? CHIDB_OPEN_WAL : 0));
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+        /* Every other page is written in a single transaction, so that the
+         * commit (or the checkpoint, in WAL mode) has many runs to write */
+        chidb_Pager_begin(pg);
+        for(int j=1; j<=4 * MAXPAGES; j++)
+        {
+            chidb_Pager_allocatePage(pg, &npage);
+            chidb_Pager_readPage(pg, npage, &page);
+            page->data[pagepos[j]] = j % 2 ? values[j] : 0;
+            chidb_Pager_writePage(pg, page);
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+        rc = chidb_Pager_commit(pg);
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_close(pg);
+        ck_assert_int_eq(file_size(fname), 4 * MAXPAGES * PAGE_SIZE);
+
+        /* Read back in several runs, around cached pages */
+        rc = chidb_Pager_openWithFlags(&pg, fname, CHIDB_OPEN_URING);
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_setPageSize(pg, PAGE_SIZE);
+        for(int j=3; j<=4 * MAXPAGES; j+=7)
+        {
+            chidb_Pager_readPage(pg, j, &page);
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+        rc = chidb_Pager_readPages(pg, 1, 4 * MAXPAGES, pages);
+        ck_assert(rc == CHIDB_OK);
+        for(int j=1; j<=4 * MAXPAGES; j++)
+        {
+            ck_assert(pages[j-1]->npage == j);
+            ck_assert(pages[j-1]->data[pagepos[j]] == (j % 2 ? values[j] : 0));
+            chidb_Pager_releaseMemPage(pg, pages[j-1]);
+        }
+        chidb_Pager_close(pg);
+
+        delete_tmp_file(fname);
+    }
+}
+END_TEST
+
+
+START_TEST (test_wal)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg, *pg2;
+    MemPage *page;
+    char *wal, *fname2, *wal2;
+
+    char *fname = create_tmp_file();
+    asprintf(&wal, "%s-wal", fname);
+
+    rc = chidb_Pager_openWithFlags(&pg, fname, CHIDB_OPEN_WAL);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    chidb_Pager_begin(pg);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        page->data[pagepos[j]] = values[j];
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    rc = chidb_Pager_commit(pg);
+    ck_assert(rc == CHIDB_OK);
+
+    /* The commit went to the WAL, not to the database file */
+    ck_assert_int_eq(file_size(fname), 0);
+    ck_assert_int_eq(file_size(wal), WAL_HEADER_SIZE + MAXPAGES * (WAL_FRAME_HEADER_SIZE + PAGE_SIZE));
+
+    /* Another pager finds the pages through the WAL index */
+    rc = chidb_Pager_openWithFlags(&pg2, fname, CHIDB_OPEN_WAL);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg2, PAGE_SIZE);
+    ck_assert_int_eq(pg2->n_pages, MAXPAGES);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg2, j, &page);
+        ck_assert(page->data[pagepos[j]] == values[j]);
+        chidb_Pager_releaseMemPage(pg2, page);
+    }
+
+    /* ...and sees later commits, even if it has the page cached */
+    chidb_Pager_readPage(pg, 1, &page);
+    page->data[pagepos[1]] = values[0];
+    rc = chidb_Pager_writePage(pg, page);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_releaseMemPage(pg, page);
+    chidb_Pager_readPage(pg2, 1, &page);
+    ck_assert(page->data[pagepos[1]] == values[0]);
+    chidb_Pager_releaseMemPage(pg2, page);
+
+    /* Simulate a crash by copying the files while the WAL is in use */
+    fname2 = create_tmp_file();
+    asprintf(&wal2, "%s-wal", fname2);
+    copy(fname, fname2);
+    copy(wal, wal2);
+
+    /* Closing the last pager checkpoints the WAL and removes it */
+    chidb_Pager_close(pg);
+    ck_assert(file_size(wal) > 0);
+    chidb_Pager_close(pg2);
+    ck_assert_int_eq(file_size(wal), -1);
+    ck_assert_int_eq(file_size(fname), MAXPAGES * PAGE_SIZE);
+
+    /* The commits are recovered from the copy of the WAL */
+    rc = chidb_Pager_openWithFlags(&pg, fname2, CHIDB_OPEN_WAL);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert_int_eq(pg->n_pages, MAXPAGES);
+    chidb_Pager_close(pg);
+    ck_assert_int_eq(file_size(wal2), -1);
+
+    for(int f=0; f<2; f++)
+    {
+        rc = chidb_Pager_open(&pg, f == 0 ? fname : fname2);
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_setPageSize(pg, PAGE_SIZE);
+        ck_assert_int_eq(pg->n_pages, MAXPAGES);
+        for(int j=1; j<=MAXPAGES; j++)
+        {
+            chidb_Pager_readPage(pg, j, &page);
+            ck_assert(page->data[pagepos[j]] == (j == 1 ? values[0] : values[j]));
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+        chidb_Pager_close(pg);
+    }
+
+    free(wal);
+    free(wal2);
+    delete_tmp_file(fname);
+    delete_tmp_file(fname2);
+}
+END_TEST
+
+
+START_TEST (test_compress)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page, *pages[MAXPAGES];
+    uint8_t src[4 * PAGE_SIZE], dst[5 * PAGE_SIZE], out[4 * PAGE_SIZE];
+    size_t len;
+
+    /* The codec compresses repetitive data, and detects corrupt data */
+    for(int i=0; i<4 * PAGE_SIZE; i++)
+        src[i] = "chidb compresses its pages "[i % 27];
+    len = chidb_Compress_lz(src, sizeof(src), dst, sizeof(dst));
+    ck_assert(len > 0 && len < sizeof(src) / 8);
+    ck_assert(chidb_Compress_unlz(dst, len, out, sizeof(out)) == CHIDB_OK);
+    ck_assert(!memcmp(src, out, sizeof(src)));
+    ck_assert(chidb_Compress_unlz(dst, len / 2, out, sizeof(out)) == CHIDB_ECORRUPT);
+    ck_assert(chidb_Compress_unlz(dst, len, out, sizeof(out) - 1) == CHIDB_ECORRUPT);
+
+    /* ...and random data round-trips, even if it does not compress */
+    srand(1);
+    for(int i=0; i<4 * PAGE_SIZE; i++)
+        src[i] = rand();
+    src[0] = 0;
+    ck_assert(chidb_Compress_lz(src, sizeof(src), dst, sizeof(src) - 1) == 0);
+    len = chidb_Compress_lz(src, sizeof(src), dst, sizeof(dst));
+    ck_assert(len > 0);
+    ck_assert(chidb_Compress_unlz(dst, len, out, sizeof(out)) == CHIDB_OK);
+    ck_assert(!memcmp(src, out, sizeof(src)));
+
+    for(int wal=0; wal<2; wal++)
+    {
+        char *fname = create_tmp_file();
+
+        rc = chidb_Pager_openWithFlags(&pg, fname, CHIDB_OPEN_COMPRESS | (wal ? CHIDB_OPEN_WAL : 0));
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_setPageSize(pg, 4 * PAGE_SIZE);
+
+        /* Page 2 does not compress */
+        chidb_Pager_begin(pg);
+        for(int j=1; j<=MAXPAGES; j++)
+        {
+            chidb_Pager_allocatePage(pg, &npage);
+            chidb_Pager_readPage(pg, npage, &page);
+            if (j == 2)
+                memcpy(page->data, src, 4 * PAGE_SIZE);
+            else
+                page->data[pagepos[j]] = values[j];
+            chidb_Pager_writePage(pg, page);
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+        rc = chidb_Pager_commit(pg);
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_close(pg);
+
+        /* Page 1 and page 2 are stored as they are, the others compressed,
+         * and the file is still a whole number of pages long */
+        ck_assert_int_eq(file_size(fname), MAXPAGES * 4 * PAGE_SIZE);
+        ck_assert_int_eq(file_byte(fname, pagepos[1]), values[1]);
+        ck_assert_int_eq(file_byte(fname, 4 * PAGE_SIZE + 17), src[17]);
+        for(int j=3; j<=MAXPAGES; j++)
+            ck_assert_int_eq(file_byte(fname, (j-1) * 4 * PAGE_SIZE), COMPRESS_MAGIC >> 8);
+
+        /* Pages read back the same, whether the page map knows their
+         * size (the second time around) or not */
+        rc = chidb_Pager_openWithFlags(&pg, fname, CHIDB_OPEN_COMPRESS);
+        ck_assert(rc == CHIDB_OK);
+        chidb_Pager_setPageSize(pg, 4 * PAGE_SIZE);
+        chidb_Pager_setCacheSize(pg, 1);
+        for(int k=0; k<2; k++)
+        {
+            rc = chidb_Pager_readPages(pg, 1, MAXPAGES, pages);
+            ck_assert(rc == CHIDB_OK);
+            ck_assert(!memcmp(pages[1]->data, src, 4 * PAGE_SIZE));
+            for(int j=1; j<=MAXPAGES; j++)
+            {
+                if (j != 2)
+                    ck_assert(pages[j-1]->data[pagepos[j]] == values[j]);
+                chidb_Pager_releaseMemPage(pg, pages[j-1]);
+            }
+            chidb_Pager_setCacheSize(pg, 1);
+        }
+        chidb_Pager_close(pg);
+
+        delete_tmp_file(fname);
+    }
+}
+END_TEST
+
+
+#define NTHREADS (4)
+#define NCOMMITS (50)
+
+static void *wal_committer(void *arg)
+{
+    char *fname = ((char **) arg)[0];
+    npage_t npage = (npage_t)(uintptr_t) ((char **) arg)[1];
+    Pager *pg;
+    MemPage *page;
+
+    chidb_Pager_openWithFlags(&pg, fname, CHIDB_OPEN_WAL);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int c=0; c<NCOMMITS; c++)
+    {
+        chidb_Pager_begin(pg);
+        chidb_Pager_readPage(pg, npage, &page);
+        page->data[pagepos[c]] = values[c];
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+        if (chidb_Pager_commit(pg) != CHIDB_OK)
+            return (void *) 1;
+    }
+    chidb_Pager_close(pg);
+    return NULL;
+}
+
+START_TEST (test_wal_group_commit)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+    pthread_t threads[NTHREADS];
+    char *args[NTHREADS][2];
+    void *ret;
+
+    char *fname = create_tmp_file();
+
+    /* Keep the WAL open so that it is not checkpointed between threads */
+    rc = chidb_Pager_openWithFlags(&pg, fname, CHIDB_OPEN_WAL);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    chidb_Pager_begin(pg);
+    for(int t=0; t<NTHREADS; t++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_commit(pg);
+
+    for(int t=0; t<NTHREADS; t++)
+    {
+        args[t][0] = fname;
+        args[t][1] = (char *)(uintptr_t) (t + 1);
+        pthread_create(&threads[t], NULL, wal_committer, args[t]);
+    }
+    for(int t=0; t<NTHREADS; t++)
+    {
+        pthread_join(threads[t], &ret);
+        ck_assert(ret == NULL);
+    }
+
+    /* Concurrent commits may share an fdatasync, but never need more than one each */
+    ck_assert(pg->wal->n_syncs <= 1 + NTHREADS * NCOMMITS);
+
+    for(int t=0; t<NTHREADS; t++)
+    {
+        chidb_Pager_readPage(pg, t + 1, &page);
+        for(int c=0; c<NCOMMITS; c++)
+            ck_assert(page->data[pagepos[c]] == values[c]);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_memory)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page, *pages[MAXPAGES];
+
+    rc = chidb_Pager_openWithFlags(&pg, ":memory:", CHIDB_OPEN_MMAP | CHIDB_OPEN_URING);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pg->in_memory);
+    ck_assert_int_eq(pg->flags, 0);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert_int_eq(pg->n_pages, 0);
+
+    /* Pages are kept across the end of an arena chunk */
+    npage_t n = 2 * PAGER_ARENA_CHUNK / PAGE_SIZE + MAXPAGES;
+    chidb_Pager_begin(pg);
+    for(npage_t j=1; j<=n; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        page->data[pagepos[j % NVALUES]] = values[j % NVALUES];
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    rc = chidb_Pager_commit(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(pg->arena_size, (size_t) n * PAGE_SIZE);
+    chidb_Pager_getRealDBSize(pg, &npage);
+    ck_assert_int_eq(npage, n);
+
+    chidb_Pager_setCacheSize(pg, MAXPAGES);
+    for(npage_t j=1; j<=n; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        ck_assert(page->data[pagepos[j % NVALUES]] == values[j % NVALUES]);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    rc = chidb_Pager_readPages(pg, PAGER_ARENA_CHUNK / PAGE_SIZE - 3, MAXPAGES, pages);
+    ck_assert(rc == CHIDB_OK);
+    for(int j=0; j<MAXPAGES; j++)
+    {
+        npage = PAGER_ARENA_CHUNK / PAGE_SIZE - 3 + j;
+        ck_assert(pages[j]->data[pagepos[npage % NVALUES]] == values[npage % NVALUES]);
+        chidb_Pager_releaseMemPage(pg, pages[j]);
+    }
+
+    /* Truncated pages read as zeroes when they are allocated again */
+    rc = chidb_Pager_truncate(pg, 3);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(pg->arena_size, 3 * PAGE_SIZE);
+    chidb_Pager_allocatePage(pg, &npage);
+    chidb_Pager_readPage(pg, npage, &page);
+    for(int i=0; i<PAGE_SIZE; i++)
+        ck_assert(page->data[i] == 0);
+    chidb_Pager_releaseMemPage(pg, page);
+
+    chidb_Pager_close(pg);
+    ck_assert(access(":memory:", F_OK) != 0);
+}
+END_TEST
+
+
+START_TEST (test_direct)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page, *pages[MAXPAGES];
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_openWithFlags(&pg, fname, CHIDB_OPEN_DIRECT | CHIDB_OPEN_MMAP);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(!(pg->flags & CHIDB_OPEN_MMAP));
+
+    /* The file system may not support O_DIRECT */
+    if (pg->flags & CHIDB_OPEN_DIRECT)
+    {
+        ck_assert(fcntl(pg->fd, F_GETFL) & O_DIRECT);
+        ck_assert(pg->block_size > 0 && PAGE_SIZE % pg->block_size == 0);
+        ck_assert_int_eq(pg->max_frames, DEFAULT_DIRECT_CACHE_FRAMES);
+    }
+    else
+        ck_assert(!(fcntl(pg->fd, F_GETFL) & O_DIRECT));
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        ck_assert(((uintptr_t) page->data) % IO_BUFFER_ALIGN == 0);
+        page->data[pagepos[j]] = values[j];
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+
+    rc = chidb_Pager_openWithFlags(&pg, fname, CHIDB_OPEN_DIRECT);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    rc = chidb_Pager_readPages(pg, 1, MAXPAGES, pages);
+    ck_assert(rc == CHIDB_OK);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        ck_assert(pages[j-1]->data[pagepos[j]] == values[j]);
+        chidb_Pager_releaseMemPage(pg, pages[j-1]);
+    }
+
+    /* Compressed pages are not a whole number of blocks long */
+    chidb_Pager_setCompression(pg, true);
+    ck_assert(!(pg->flags & CHIDB_OPEN_DIRECT));
+    ck_assert(!(fcntl(pg->fd, F_GETFL) & O_DIRECT));
+    chidb_Pager_close(pg);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_prealloc)
+{
+    int rc;
+    npage_t npage, npages;
+    Pager *pg;
+    MemPage *page;
+    struct stat buf;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pg->prealloc_chunk == DEFAULT_PREALLOC_CHUNK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    chidb_Pager_setPreallocation(pg, 16 * PAGE_SIZE + 1);
+
+    chidb_Pager_allocatePage(pg, &npage);
+
+    /* The file system may not support preallocation */
+    if (pg->prealloc_chunk != 0)
+    {
+        /* Rounded up to whole pages */
+        ck_assert(pg->prealloc_end == 17 * PAGE_SIZE);
+        ck_assert(fstat(pg->fd, &buf) == 0);
+        ck_assert(buf.st_size == 0);
+        ck_assert((off_t) buf.st_blocks * 512 >= 17 * PAGE_SIZE);
+    }
+
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        if (j > 1)
+            chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        page->data[pagepos[j]] = values[j];
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    /* The size of the file is still the number of pages */
+    ck_assert(file_size(fname) == MAXPAGES * PAGE_SIZE);
+    chidb_Pager_getRealDBSize(pg, &npages);
+    ck_assert_int_eq(npages, MAXPAGES);
+    if (pg->prealloc_chunk != 0)
+        ck_assert(pg->prealloc_end >= (MAXPAGES + 1) * PAGE_SIZE);
+
+    /* Shrinking the file frees what was preallocated past its end */
+    chidb_Pager_truncate(pg, MAXPAGES - 1);
+    ck_assert(pg->prealloc_end == (MAXPAGES - 1) * PAGE_SIZE);
+    chidb_Pager_allocatePage(pg, &npage);
+    ck_assert_int_eq(npage, MAXPAGES);
+    chidb_Pager_close(pg);
+
+    /* ... and so does closing it */
+    ck_assert(stat(fname, &buf) == 0);
+    ck_assert((off_t) buf.st_blocks * 512 <= ((MAXPAGES - 1) * PAGE_SIZE + 4095) / 4096 * 4096);
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    ck_assert_int_eq(pg->n_pages, MAXPAGES - 1);
+    for(int j=1; j<MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        ck_assert(page->data[pagepos[j]] == values[j]);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+
+    /* Turned off, nothing is preallocated */
+    chidb_Pager_setPreallocation(pg, 0);
+    chidb_Pager_allocatePage(pg, &npage);
+    ck_assert(pg->prealloc_end == 0);
+    chidb_Pager_close(pg);
+
+    /* In-memory databases have nothing to preallocate */
+    chidb_Pager_open(&pg, ":memory:");
+    ck_assert(pg->prealloc_chunk == 0);
+    chidb_Pager_close(pg);
+
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+START_TEST (test_prewarm)
+{
+    int rc;
+    npage_t npage, *hot;
+    uint32_t nhot;
+    Pager *pg;
+    Prewarm *pw;
+    int fd;
+    MemPage *page, mpage;
+    uint8_t buf[PAGE_SIZE];
+
+    char *fname = create_tmp_file();
+    char *hotname = malloc(strlen(fname) + 5);
+    sprintf(hotname, "%s-hot", fname);
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        page->data[pagepos[j]] = values[j];
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    chidb_Pager_close(pg);
+    ck_assert(access(hotname, F_OK) != 0);
+
+    /* The pages in the buffer pool are saved when the pager is closed */
+    rc = chidb_Pager_openWithFlags(&pg, fname, CHIDB_OPEN_PREWARM);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    rc = chidb_Pager_prewarm(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pg->prewarm == NULL);
+    for(int j=6; j>=2; j--)
+        if (j != 4)
+        {
+            chidb_Pager_readPage(pg, j, &page);
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+    chidb_Pager_close(pg);
+
+    rc = chidb_Prewarm_load(hotname, PAGE_SIZE, MAXPAGES, MAXPAGES, &hot, &nhot);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(nhot, 4);
+    ck_assert(hot[0] == 2 && hot[1] == 3 && hot[2] == 5 && hot[3] == 6);
+    free(hot);
+
+    /* Pages past the end of the file, past the maximum, or saved with
+     * another page size are not loaded */
+    rc = chidb_Prewarm_load(hotname, PAGE_SIZE, 5, 2, &hot, &nhot);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(nhot, 2);
+    free(hot);
+    rc = chidb_Prewarm_load(hotname, PAGE_SIZE, 5, MAXPAGES, &hot, &nhot);
+    ck_assert_int_eq(nhot, 3);
+    free(hot);
+    rc = chidb_Prewarm_load(hotname, 2 * PAGE_SIZE, MAXPAGES, MAXPAGES, &hot, &nhot);
+    ck_assert(rc == CHIDB_ENOTFOUND);
+
+    /* Loaded pages can be taken only once */
+    rc = chidb_Prewarm_load(hotname, PAGE_SIZE, MAXPAGES, MAXPAGES, &hot, &nhot);
+    ck_assert(rc == CHIDB_OK);
+    fd = open(fname, O_RDONLY);
+    rc = chidb_Prewarm_start(&pw, fd, PAGE_SIZE, hot, nhot);
+    ck_assert(rc == CHIDB_OK);
+    while (!chidb_Prewarm_done(pw))
+        usleep(1000);
+    ck_assert(pw->bytes_read == 4 * PAGE_SIZE);
+    ck_assert(chidb_Prewarm_read(pw, 5, buf));
+    ck_assert(buf[pagepos[5]] == values[5]);
+    ck_assert(!chidb_Prewarm_read(pw, 5, buf));
+    ck_assert(!chidb_Prewarm_read(pw, 4, buf));
+    chidb_Prewarm_forget(pw, 6);
+    ck_assert(!chidb_Prewarm_read(pw, 6, buf));
+    chidb_Prewarm_stop(pw);
+    close(fd);
+
+    /* The hot pages are loaded in the background when the pager is opened,
+     * and go into the buffer pool, unless they have been written since */
+    rc = chidb_Pager_openWithFlags(&pg, fname, CHIDB_OPEN_PREWARM);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    rc = chidb_Pager_prewarm(pg);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert(pg->prewarm != NULL);
+
+    mpage = chidb_Pager_initMemPage(3, PAGE_SIZE);
+    mpage.data[pagepos[3]] = values[3] + 1;
+    chidb_Pager_writePage(pg, &mpage);
+    free(mpage.data);
+
+    while (!chidb_Prewarm_done(pg->prewarm))
+        usleep(1000);
+    memset(&pg->stats, 0, sizeof(chidb_stats_t));
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_readPage(pg, j, &page);
+        ck_assert(page->data[pagepos[j]] == (j == 3 ? values[j] + 1 : values[j]));
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    ck_assert(pg->prewarm == NULL);
+    ck_assert_int_eq(pg->stats.cache_hits, 3);
+    ck_assert_int_eq(pg->stats.cache_misses, MAXPAGES - 3);
+    ck_assert(pg->stats.bytes_read == (4 + MAXPAGES - 3) * PAGE_SIZE);
+    chidb_Pager_close(pg);
+
+    /* Every page was cached this time */
+    rc = chidb_Prewarm_load(hotname, PAGE_SIZE, MAXPAGES, MAXPAGES, &hot, &nhot);
+    ck_assert(rc == CHIDB_OK);
+    ck_assert_int_eq(nhot, MAXPAGES);
+    free(hot);
+
+    /* In-memory databases have nothing to save */
+    chidb_Pager_openWithFlags(&pg, ":memory:", CHIDB_OPEN_PREWARM);
+    ck_assert(pg->hot_filename == NULL);
+    chidb_Pager_close(pg);
+
+    unlink(hotname);
+    free(hotname);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+static uint64_t hist_count(const uint64_t *hist)
+{
+    uint64_t n = 0;
+    for(int i=0; i<CHIDB_STATS_BUCKETS; i++)
+        n += hist[i];
+    return n;
+}
+
+START_TEST (test_stats)
+{
+    int rc;
+    npage_t npage;
+    Pager *pg;
+    MemPage *page;
+
+    char *fname = create_tmp_file();
+
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+
+    /* New pages are not read from the file, and are written right away */
+    for(int j=1; j<=MAXPAGES; j++)
+    {
+        chidb_Pager_allocatePage(pg, &npage);
+        chidb_Pager_readPage(pg, npage, &page);
+        page->data[pagepos[j]] = values[j];
+        chidb_Pager_writePage(pg, page);
+        chidb_Pager_releaseMemPage(pg, page);
+    }
+    ck_assert_int_eq(pg->stats.pages_allocated, MAXPAGES);
+    ck_assert_int_eq(pg->stats.page_reads, MAXPAGES);
+    ck_assert_int_eq(pg->stats.cache_misses, MAXPAGES);
+    ck_assert_int_eq(pg->stats.bytes_read, 0);
+    ck_assert_int_eq(hist_count(pg->stats.read_latency), 0);
+    ck_assert_int_eq(pg->stats.page_writes, MAXPAGES);
+    ck_assert(pg->stats.bytes_written >= MAXPAGES * PAGE_SIZE);
+    ck_assert_int_eq(hist_count(pg->stats.write_latency), MAXPAGES);
+    chidb_Pager_close(pg);
+
+    /* Only the first read of a page misses the cache */
+    rc = chidb_Pager_open(&pg, fname);
+    ck_assert(rc == CHIDB_OK);
+    chidb_Pager_setPageSize(pg, PAGE_SIZE);
+    for(int i=0; i<2; i++)
+        for(int j=1; j<=MAXPAGES; j++)
+        {
+            chidb_Pager_readPage(pg, j, &page);
+            ck_assert(page->data[pagepos[j]] == values[j]);
+            chidb_Pager_releaseMemPage(pg, page);
+        }
+    ck_assert_int_eq(pg->stats.page_reads, 2 * MAXPAGES);
+    ck_assert_int_eq(pg->stats.cache_hits, MAXPAGES);
+    ck_assert_int_eq(pg->stats.cache_misses, MAXPAGES);
+    ck_assert_int_eq(pg->stats.bytes_read, MAXPAGES * PAGE_SIZE);
+    ck_assert_int_eq(hist_count(pg->stats.read_latency), MAXPAGES);
+    ck_assert_int_eq(pg->stats.page_writes, 0);
+    ck_assert_int_eq(pg->stats.pages_allocated, 0);
+
+    chidb_Pager_close(pg);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
 Suite* make_pager_suite (void)
 {
     Suite *s = suite_create ("Pager");
@@ -162,6 +1270,60 @@ Suite* make_pager_suite (void)
     tcase_add_test (tc_readwrite, test_readwrite);
     suite_add_tcase (s, tc_readwrite);
 
+    TCase *tc_cache = tcase_create ("Caching pages in the buffer pool");
+    tcase_add_test (tc_cache, test_cache);
+    suite_add_tcase (s, tc_cache);
+
+    TCase *tc_vectored = tcase_create ("Reading/writing runs of pages");
+    tcase_add_test (tc_vectored, test_vectored);
+    suite_add_tcase (s, tc_vectored);
+
+    TCase *tc_uring = tcase_create ("Reading/writing through io_uring");
+    tcase_add_test (tc_uring, test_uring);
+    suite_add_tcase (s, tc_uring);
+
+    TCase *tc_readahead = tcase_create ("Reading ahead of a scan");
+    tcase_add_test (tc_readahead, test_readahead);
+    suite_add_tcase (s, tc_readahead);
+
+    TCase *tc_txn = tcase_create ("Deferring writes until a transaction commits");
+    tcase_add_test (tc_txn, test_transaction);
+    tcase_add_test (tc_txn, test_truncate);
+    suite_add_tcase (s, tc_txn);
+
+    TCase *tc_wal = tcase_create ("Reading/writing through a write-ahead log");
+    tcase_add_test (tc_wal, test_wal);
+    tcase_add_test (tc_wal, test_wal_group_commit);
+    suite_add_tcase (s, tc_wal);
+
+    TCase *tc_compress = tcase_create ("Reading/writing compressed pages");
+    tcase_add_test (tc_compress, test_compress);
+    suite_add_tcase (s, tc_compress);
+
+    TCase *tc_prealloc = tcase_create ("Preallocating space for new pages");
+    tcase_add_test (tc_prealloc, test_prealloc);
+    suite_add_tcase (s, tc_prealloc);
+
+    TCase *tc_prewarm = tcase_create ("Prewarming the buffer pool");
+    tcase_add_test (tc_prewarm, test_prewarm);
+    suite_add_tcase (s, tc_prewarm);
+
+    TCase *tc_memory = tcase_create ("Keeping pages in memory");
+    tcase_add_test (tc_memory, test_memory);
+    suite_add_tcase (s, tc_memory);
+
+    TCase *tc_direct = tcase_create ("Bypassing the page cache");
+    tcase_add_test (tc_direct, test_direct);
+    suite_add_tcase (s, tc_direct);
+
+    TCase *tc_stats = tcase_create ("Counting I/O operations");
+    tcase_add_test (tc_stats, test_stats);
+    suite_add_tcase (s, tc_stats);
+
+    TCase *tc_mmap = tcase_create ("Reading/writing a memory-mapped file");
+    tcase_add_test (tc_mmap, test_mmap);
+    suite_add_tcase (s, tc_mmap);
+
     return s;
 }
 
@@ -0,0 +1,332 @@
+#include <stdlib.h>
+#include <check.h>
+#include <chidb/chidb.h>
+#include <chidb/log.h>
+#include "check_common.h"
+#include "libchidb/btree.h"
+#include "libchidb/dbm-cursor.h"
+#include "libchidb/record.h"
+
+#define NROWS (20)
+
+/* Creates a database with a table t(id INTEGER PRIMARY KEY, v INTEGER)
+ * holding the rows 1 to NROWS, and returns the root of the table */
+static npage_t create_table(chidb *db)
+{
+    DBRecord *dbr;
+    uint8_t *record;
+    npage_t nroot;
+
+    ck_assert(chidb_Btree_newNode(db->bt, &nroot, PGTYPE_TABLE_LEAF) == CHIDB_OK);
+    chidb_DBRecord_create(&dbr, "|s|s|s|i4|s|", "table", "t", "t", nroot,
+                          "CREATE TABLE t(id INTEGER PRIMARY KEY, v INTEGER)");
+    chidb_DBRecord_pack(dbr, &record);
+    ck_assert(chidb_Btree_insertInTable(db->bt, 1, 1, record, dbr->packed_len) == CHIDB_OK);
+    chidb_DBRecord_destroy(dbr);
+    free(record);
+
+    for(int id=1; id<=NROWS; id++)
+    {
+        chidb_DBRecord_create(&dbr, "|0|i4|", id * 10);
+        chidb_DBRecord_pack(dbr, &record);
+        ck_assert(chidb_Btree_insertInTable(db->bt, nroot, id, record, dbr->packed_len) == CHIDB_OK);
+        chidb_DBRecord_destroy(dbr);
+        free(record);
+    }
+
+    return nroot;
+}
+
+/* Adds the schema record of an index on column v of table tname, whose
+ * rows start at ntable, and builds the index */
+static npage_t create_index(chidb *db, chidb_key_t key, const char *tname, npage_t ntable)
+{
+    DBRecord *dbr;
+    uint8_t *record;
+    char sql[64];
+    npage_t nindex;
+
+    ck_assert(chidb_Btree_newNode(db->bt, &nindex, PGTYPE_INDEX_LEAF) == CHIDB_OK);
+    snprintf(sql, sizeof(sql), "CREATE INDEX idx_%s ON %s(v)", tname, tname);
+    chidb_DBRecord_create(&dbr, "|s|s|s|i4|s|", "index", sql + 13, tname, nindex, sql);
+    chidb_DBRecord_pack(dbr, &record);
+    ck_assert(chidb_Btree_insertInTable(db->bt, 1, key, record, dbr->packed_len) == CHIDB_OK);
+    chidb_DBRecord_destroy(dbr);
+    free(record);
+
+    ck_assert(chidb_Btree_buildIndex(db->bt, ntable, 1, nindex) == CHIDB_OK);
+    return nindex;
+}
+
+/* Checks that every entry of an index points to a row of its table, and
+ * returns the number of entries */
+static int check_index(chidb *db, npage_t nindex, npage_t ntable)
+{
+    chidb_dbm_cursor_t cursor;
+    uint8_t *data;
+    uint32_t size;
+    int n = 0;
+
+    chidb_dbm_init_cursor(&cursor, db, nindex);
+    if (chidb_dbm_rewind(&cursor))
+        do
+        {
+            cell_cursor *curr = (cell_cursor *) cursor.path.tail->val;
+            BTreeCell cell;
+
+            ck_assert(chidb_Btree_getCell(curr->btn, curr->index, &cell) == CHIDB_OK);
+            chidb_key_t pk = cell.type == PGTYPE_INDEX_LEAF ? cell.fields.indexLeaf.keyPk :
+                                                              cell.fields.indexInternal.keyPk;
+            ck_assert_int_eq(cell.key, pk * 10);
+            ck_assert_msg(chidb_Btree_find(db->bt, ntable, pk, &data, &size) == CHIDB_OK,
+                          "Index entry %u points to deleted row %u", cell.key, pk);
+            free(data);
+            n++;
+        } while (chidb_dbm_next(&cursor));
+    chidb_dbm_free_cursor(&cursor);
+
+    return n;
+}
+
+/* Runs a statement that produces no rows, and returns what chidb_step
+ * returned */
+static int run(chidb *db, const char *sql)
+{
+    chidb_stmt *stmt;
+    int rc;
+
+    ck_assert_msg(chidb_prepare(db, sql, &stmt) == CHIDB_OK, "Could not prepare %s", sql);
+    rc = chidb_step(stmt);
+    chidb_finalize(stmt);
+
+    return rc;
+}
+
+/* Checks that table t only has the rows outside [lo, hi] */
+static void check_rows(chidb *db, npage_t nroot, const char *sql, int lo, int hi)
+{
+    uint8_t *data;
+    uint32_t size;
+
+    for(int id=1; id<=NROWS; id++)
+    {
+        int rc = chidb_Btree_find(db->bt, nroot, id, &data, &size);
+        bool deleted = id >= lo && id <= hi;
+
+        ck_assert_msg(rc == (deleted ? CHIDB_ENOTFOUND : CHIDB_OK),
+                      "After %s, row %i should %s", sql, id, deleted ? "be deleted" : "remain");
+        if (rc == CHIDB_OK)
+            free(data);
+    }
+}
+
+
+/* Primary key conditions, in both orders and combined with AND, and the
+ * keys that they select */
+struct key_range
+{
+    const char *where;
+    int lo, hi;
+} key_ranges[] = {
+    {"id = 5", 5, 5},
+    {"5 = id", 5, 5},
+    {"id < 5", 1, 4},
+    {"5 > id", 1, 4},
+    {"id > 15", 16, NROWS},
+    {"15 < id", 16, NROWS},
+    {"id <= 5", 1, 5},
+    {"5 >= id", 1, 5},
+    {"id >= 15", 15, NROWS},
+    {"15 <= id", 15, NROWS},
+    {"id <= 15 AND id > 10", 11, 15},
+    {"10 < id AND 15 >= id", 11, 15},
+    {"id >= 5 AND 8 > id", 5, 7},
+    {"id > 0 AND id <= 3 AND id <> 2", 0, -1},
+    {"id > 10 AND id < 5", 0, -1},
+    {"id >= 21", 0, -1},
+};
+#define NKEY_RANGES (sizeof(key_ranges) / sizeof(struct key_range))
+
+START_TEST (test_delete_range)
+{
+    char *fname = create_tmp_file();
+    char sql[128];
+    chidb *db;
+    npage_t nroot;
+
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    nroot = create_table(db);
+
+    snprintf(sql, sizeof(sql), "DELETE FROM t WHERE %s", key_ranges[_i].where);
+    ck_assert_int_eq(run(db, sql), CHIDB_DONE);
+    check_rows(db, nroot, sql, key_ranges[_i].lo, key_ranges[_i].hi);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* Ranges are not deleted from tables with indexes by detaching them from
+ * the table B-Tree, which would leave index entries for the deleted rows.
+ * Indexes on other tables do not matter. */
+START_TEST (test_delete_range_indexed)
+{
+    char *fname = create_tmp_file();
+    chidb *db;
+    npage_t nroot, nindex, nother;
+    int nentries;
+
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    nroot = create_table(db);
+    nindex = create_index(db, 2, "t", nroot);
+    ck_assert_int_eq(check_index(db, nindex, nroot), NROWS);
+
+    ck_assert_int_eq(run(db, "DELETE FROM t WHERE id <= 5"), CHIDB_DONE);
+    nentries = check_index(db, nindex, nroot);
+    for(int id=1; id<=NROWS; id++)
+    {
+        uint8_t *data;
+        uint32_t size;
+
+        if (chidb_Btree_find(db->bt, nroot, id, &data, &size) == CHIDB_OK)
+        {
+            nentries--;
+            free(data);
+        }
+    }
+    ck_assert_int_eq(nentries, 0);
+
+    ck_assert(chidb_Btree_newNode(db->bt, &nother, PGTYPE_TABLE_LEAF) == CHIDB_OK);
+    create_index(db, 3, "u", nother);
+    ck_assert(chidb_Btree_delete(db->bt, 1, 2) == CHIDB_OK);
+    ck_assert_int_eq(run(db, "DELETE FROM t WHERE id > 15"), CHIDB_DONE);
+    check_rows(db, nroot, "DELETE FROM t WHERE id > 15", 16, NROWS);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* Changes are only kept if the transaction that made them commits */
+START_TEST (test_transaction)
+{
+    char *fname = create_tmp_file();
+    chidb *db;
+    npage_t nroot;
+
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    nroot = create_table(db);
+
+    ck_assert_int_eq(run(db, "COMMIT"), CHIDB_EMISUSE);
+    ck_assert_int_eq(run(db, "ROLLBACK"), CHIDB_EMISUSE);
+
+    ck_assert_int_eq(run(db, "BEGIN"), CHIDB_DONE);
+    ck_assert_int_eq(run(db, "DELETE FROM t WHERE id <= 5"), CHIDB_DONE);
+    check_rows(db, nroot, "DELETE FROM t WHERE id <= 5", 1, 5);
+    ck_assert_int_eq(run(db, "ROLLBACK"), CHIDB_DONE);
+    check_rows(db, nroot, "ROLLBACK", 0, -1);
+
+    ck_assert_int_eq(run(db, "BEGIN TRANSACTION"), CHIDB_DONE);
+    ck_assert_int_eq(run(db, "DELETE FROM t WHERE id >= 16"), CHIDB_DONE);
+    ck_assert_int_eq(run(db, "COMMIT"), CHIDB_DONE);
+    chidb_close(db);
+
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    check_rows(db, nroot, "COMMIT", 16, NROWS);
+
+    /* A transaction that changes nothing has nothing to write */
+    ck_assert_int_eq(run(db, "BEGIN"), CHIDB_DONE);
+    ck_assert_int_eq(run(db, "COMMIT"), CHIDB_DONE);
+    check_rows(db, nroot, "COMMIT", 16, NROWS);
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* Transactions do not nest, and the database cannot be vacuumed within
+ * one. Neither error ends the transaction. */
+START_TEST (test_transaction_misuse)
+{
+    char *fname = create_tmp_file();
+    chidb *db;
+    npage_t nroot;
+
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    nroot = create_table(db);
+
+    ck_assert_int_eq(run(db, "BEGIN"), CHIDB_DONE);
+    ck_assert_int_eq(run(db, "DELETE FROM t WHERE id < 3"), CHIDB_DONE);
+    ck_assert_int_eq(run(db, "BEGIN"), CHIDB_EMISUSE);
+    ck_assert_int_eq(run(db, "VACUUM"), CHIDB_EMISUSE);
+    check_rows(db, nroot, "DELETE FROM t WHERE id < 3", 1, 2);
+    ck_assert_int_eq(run(db, "ROLLBACK"), CHIDB_DONE);
+    check_rows(db, nroot, "ROLLBACK", 0, -1);
+
+    ck_assert_int_eq(run(db, "VACUUM"), CHIDB_DONE);
+    check_rows(db, nroot, "VACUUM", 0, -1);
+
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+/* Closing the database rolls back the transaction left open */
+START_TEST (test_transaction_close)
+{
+    char *fname = create_tmp_file();
+    chidb *db;
+    npage_t nroot;
+
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    nroot = create_table(db);
+
+    ck_assert_int_eq(run(db, "BEGIN"), CHIDB_DONE);
+    ck_assert_int_eq(run(db, "DELETE FROM t WHERE id > 10"), CHIDB_DONE);
+    check_rows(db, nroot, "DELETE FROM t WHERE id > 10", 11, NROWS);
+    chidb_close(db);
+
+    ck_assert(chidb_open(fname, &db) == CHIDB_OK);
+    check_rows(db, nroot, "chidb_close", 0, -1);
+    ck_assert_int_eq(run(db, "COMMIT"), CHIDB_EMISUSE);
+    chidb_close(db);
+    delete_tmp_file(fname);
+}
+END_TEST
+
+
+Suite* make_sql_suite (void)
+{
+    chilog_setloglevel(ERROR);
+    Suite *s = suite_create ("SQL");
+
+    TCase *tc_delete = tcase_create ("Deleting ranges of primary keys");
+    tcase_add_loop_test (tc_delete, test_delete_range, 0, NKEY_RANGES);
+    tcase_add_test (tc_delete, test_delete_range_indexed);
+    suite_add_tcase (s, tc_delete);
+
+    TCase *tc_txn = tcase_create ("Running statements in transactions");
+    tcase_add_test (tc_txn, test_transaction);
+    tcase_add_test (tc_txn, test_transaction_misuse);
+    tcase_add_test (tc_txn, test_transaction_close);
+    suite_add_tcase (s, tc_txn);
+
+    return s;
+}
+
+int main (void)
+{
+    SRunner *sr;
+    int number_failed;
+
+    sr = srunner_create (make_sql_suite ());
+
+    srunner_run_all (sr, CK_NORMAL);
+    number_failed = srunner_ntests_failed (sr);
+    srunner_free (sr);
+
+    return (number_failed == 0) ? EXIT_SUCCESS : EXIT_FAILURE;
+}